@@ -0,0 +1,225 @@
+# benchmarks/CPBenchmark.cmake
+#
+# Baseline/optimized benchmark pairs. For each benchmark <name>:
+#
+#   <name>.ll      IR of the whole program (-O0 -g, see CP_BENCH_IR_FLAGS)
+#   <name>.orig    baseline binary
+#   <name>.cgann   cg_annotate output of <name>.orig on the benchmark's
+#                  runme_small.sh (or runme_large.sh) input
+#   <name>.opt.ll  <name>.ll after CP_BENCH_PASSES, guided by <name>.cgann
+#   <name>.opt     optimized binary, linked with cp_runtime
+#
+# all in CMAKE_CURRENT_BINARY_DIR, built by target mibench-<name>. The runme
+# scripts run in scratch copies of the benchmark directory (cp_bench.sh), so
+# the source tree is never written to.
+#
+# Expects CP_BENCH_SUITE_DIR (the directory benchmark DIRs are relative to)
+# and the tools found by benchmarks/CMakeLists.txt.
+
+set(CP_BENCH_SCRIPT ${CMAKE_CURRENT_LIST_DIR}/cp_bench.sh)
+
+# Compiler driver for package builds: keeps every object as bitcode and has
+# lld save the merged program module (<output>.0.0.preopt.bc) next to each
+# linked executable, which still gets built so build-time tools can run.
+set(CP_LTO_CC
+    "${CP_CLANG} -g -flto -fuse-ld=lld -Wl,--save-temps -Qunused-arguments")
+
+# Archives of bitcode need an LLVM symbol index: package builds find
+# llvm-ar/llvm-ranlib first as ar/ranlib, whatever their makefiles hardcode.
+set(CP_PKG_BIN ${CMAKE_CURRENT_BINARY_DIR}/pkg/bin)
+file(MAKE_DIRECTORY ${CP_PKG_BIN})
+file(CREATE_LINK ${CP_LLVM_AR} ${CP_PKG_BIN}/ar SYMBOLIC)
+file(CREATE_LINK ${CP_LLVM_RANLIB} ${CP_PKG_BIN}/ranlib SYMBOLIC)
+
+# cp_add_package(<pkg> DIR <dir> [CONFIGURE] [CONFIGURE_ARGS <arg>...]
+#                [MAKE_ARGS <arg>...] TARGETS <target>... PROGRAMS <path>...)
+#
+# Build a package with its own build system in a copy of <dir> (relative to
+# CP_BENCH_SUITE_DIR), optionally running ./configure first. PROGRAMS are the
+# linked executables (relative to <dir>) whose bitcode benchmarks use.
+function(cp_add_package pkg)
+  cmake_parse_arguments(ARG "CONFIGURE" "DIR"
+                        "CONFIGURE_ARGS;MAKE_ARGS;TARGETS;PROGRAMS" ${ARGN})
+  set(src ${CP_BENCH_SUITE_DIR}/${ARG_DIR})
+  set(dst ${CMAKE_CURRENT_BINARY_DIR}/pkg/${pkg})
+
+  set(env ${CMAKE_COMMAND} -E env "PATH=${CP_PKG_BIN}:$ENV{PATH}")
+  set(configure_cmd)
+  if(ARG_CONFIGURE)
+    set(configure_cmd
+        COMMAND ${CMAKE_COMMAND} -E chdir ${dst}
+                ${env} "CC=${CP_LTO_CC}" sh ./configure ${ARG_CONFIGURE_ARGS})
+  endif()
+
+  set(outputs)
+  foreach(prog ${ARG_PROGRAMS})
+    list(APPEND outputs ${dst}/${prog}.0.0.preopt.bc)
+  endforeach()
+
+  add_custom_command(
+    OUTPUT ${outputs}
+    COMMAND ${CMAKE_COMMAND} -E remove_directory ${dst}
+    COMMAND ${CMAKE_COMMAND} -E copy_directory ${src} ${dst}
+    ${configure_cmd}
+    COMMAND ${CMAKE_COMMAND} -E chdir ${dst}
+            ${env} ${CP_MAKE} "CC=${CP_LTO_CC}" ${ARG_MAKE_ARGS} ${ARG_TARGETS}
+    COMMENT "Building ${pkg} as bitcode"
+    VERBATIM)
+  add_custom_target(mibench-pkg-${pkg} DEPENDS ${outputs})
+endfunction()
+
+# cp_add_benchmark(<name> DIR <dir> RUN_AS <path>...
+#                  (SOURCES <src>... | PACKAGE <pkg> PROGRAM <path>)
+#                  [DEFINES <def>...] [INCLUDES <dir>...] [LIBS <lib>...]
+#                  [INPUT small|large])
+#
+# <dir> is the benchmark directory holding runme_small.sh/runme_large.sh,
+# relative to CP_BENCH_SUITE_DIR; RUN_AS the path(s) the scripts invoke the
+# program by, relative to <dir>. SOURCES and INCLUDES are relative to <dir>.
+# The profile comes from the INPUT script (default small).
+function(cp_add_benchmark name)
+  cmake_parse_arguments(ARG "" "DIR;PACKAGE;PROGRAM;INPUT"
+                        "RUN_AS;SOURCES;DEFINES;INCLUDES;LIBS" ${ARGN})
+  if(NOT ARG_INPUT)
+    set(ARG_INPUT small)
+  endif()
+  set(dir ${CP_BENCH_SUITE_DIR}/${ARG_DIR})
+  set(out ${CMAKE_CURRENT_BINARY_DIR}/${name})
+
+  set(cflags)
+  foreach(def ${ARG_DEFINES})
+    list(APPEND cflags -D${def})
+  endforeach()
+  foreach(inc ${ARG_INCLUDES})
+    list(APPEND cflags -I${dir}/${inc})
+  endforeach()
+  set(libs)
+  foreach(lib ${ARG_LIBS})
+    list(APPEND libs -l${lib})
+  endforeach()
+
+  # 1. Whole-program IR
+  if(ARG_PACKAGE)
+    set(pkg_bc
+        ${CMAKE_CURRENT_BINARY_DIR}/pkg/${ARG_PACKAGE}/${ARG_PROGRAM}.0.0.preopt.bc)
+    add_custom_command(
+      OUTPUT ${out}.ll
+      COMMAND ${CP_LLVM_DIS} ${pkg_bc} -o ${out}.ll
+      DEPENDS ${pkg_bc}
+      VERBATIM)
+  else()
+    set(bcs)
+    foreach(src ${ARG_SOURCES})
+      string(MAKE_C_IDENTIFIER ${src} obj)
+      set(bc ${out}.bc.d/${obj}.bc)
+      add_custom_command(
+        OUTPUT ${bc}
+        COMMAND ${CMAKE_COMMAND} -E make_directory ${out}.bc.d
+        COMMAND ${CP_CLANG} ${CP_BENCH_IR_FLAGS} -g -emit-llvm -c ${cflags}
+                ${dir}/${src} -o ${bc}
+        DEPENDS ${dir}/${src}
+        VERBATIM)
+      list(APPEND bcs ${bc})
+    endforeach()
+    add_custom_command(
+      OUTPUT ${out}.ll
+      COMMAND ${CP_LLVM_LINK} -S ${bcs} -o ${out}.ll
+      DEPENDS ${bcs}
+      VERBATIM)
+  endif()
+
+  # 2. Baseline binary and its profile
+  add_custom_command(
+    OUTPUT ${out}.orig
+    COMMAND ${CP_CLANG} ${CP_BENCH_OPT_LEVEL} -g ${out}.ll -o ${out}.orig ${libs}
+    DEPENDS ${out}.ll
+    VERBATIM)
+  add_custom_command(
+    OUTPUT ${out}.cgann
+    COMMAND ${CP_BENCH_SCRIPT} profile ${CP_BENCH_SUITE_DIR} ${ARG_DIR}
+            ${ARG_INPUT} ${CMAKE_CURRENT_BINARY_DIR}/work/profile-${name}
+            ${out}.cgann ${out}.orig ${ARG_RUN_AS}
+    DEPENDS ${out}.orig ${CP_BENCH_SCRIPT}
+    COMMENT "Profiling ${name} (runme_${ARG_INPUT}.sh) with Cachegrind"
+    VERBATIM)
+
+  # 3. Optimized binary
+  add_custom_command(
+    OUTPUT ${out}.opt.ll
+    COMMAND ${CP_OPT} -load $<TARGET_FILE:ParseCachegrindPass>
+            -load-pass-plugin $<TARGET_FILE:ParseCachegrindPass>
+            -passes=${CP_BENCH_PASSES} -cache-cg-file=${out}.cgann
+            ${CP_BENCH_OPT_FLAGS} ${out}.ll -S -o ${out}.opt.ll
+    DEPENDS ${out}.ll ${out}.cgann ParseCachegrindPass
+    VERBATIM)
+  # Pool nodes may be freed by the prebuilt libraries too (see cp_pool.c)
+  set(wrap_flags)
+  if(CP_BENCH_PASSES MATCHES "pool-alloc")
+    set(wrap_flags -Wl,--wrap=free,--wrap=realloc)
+  endif()
+  add_custom_command(
+    OUTPUT ${out}.opt
+    COMMAND ${CP_CLANG} ${CP_BENCH_OPT_LEVEL} -g ${out}.opt.ll
+            $<TARGET_FILE:cp_runtime> ${wrap_flags} -o ${out}.opt ${libs}
+    DEPENDS ${out}.opt.ll cp_runtime
+    VERBATIM)
+
+  add_custom_target(mibench-${name} ALL DEPENDS ${out}.orig ${out}.opt)
+  if(ARG_PACKAGE)
+    add_dependencies(mibench-${name} mibench-pkg-${ARG_PACKAGE})
+  endif()
+  set_target_properties(mibench-${name} PROPERTIES
+    CP_RUN_AS "${ARG_RUN_AS}"
+    CP_OUTPUT "${out}")
+endfunction()
+
+# cp_add_benchmark_test(<dir> <name>... [TOLERANCE <rel_tol>])
+#
+# Add ctest tests mibench-<dir name>-small/-large (for whichever runme
+# scripts <dir> has), labelled with <dir>'s category and the input size,
+# that run the script with the baseline binaries of the listed benchmarks
+# and with the optimized ones and compare the outputs (see verify.sh).
+# TOLERANCE lets numbers in text output differ by that relative amount.
+# Also adds targets mibench-measure-<dir name>-small/-large, which print
+# the I-side and branch totals of both runs (cp_bench.sh measure).
+function(cp_add_benchmark_test dir)
+  cmake_parse_arguments(ARG "" "TOLERANCE" "" ${ARGN})
+  get_filename_component(category ${dir} DIRECTORY)
+  get_filename_component(bench ${dir} NAME)
+
+  set(tolerance)
+  if(ARG_TOLERANCE)
+    set(tolerance -r ${ARG_TOLERANCE})
+  endif()
+
+  set(specs)
+  foreach(name ${ARG_UNPARSED_ARGUMENTS})
+    get_target_property(run_as mibench-${name} CP_RUN_AS)
+    get_target_property(out mibench-${name} CP_OUTPUT)
+    string(REPLACE ";" "," run_as "${run_as}")
+    list(APPEND specs "${out}.orig:${out}.opt:${run_as}")
+  endforeach()
+
+  foreach(size small large)
+    if(NOT EXISTS ${CP_BENCH_SUITE_DIR}/${dir}/runme_${size}.sh)
+      continue()
+    endif()
+    add_test(NAME mibench-${bench}-${size}
+             COMMAND ${CP_BENCH_SCRIPT} check ${tolerance} ${CP_BENCH_SUITE_DIR} ${dir}
+                     ${size} ${CMAKE_CURRENT_BINARY_DIR}/work/test-${bench}-${size}
+                     ${specs})
+    set_tests_properties(mibench-${bench}-${size} PROPERTIES
+      LABELS "mibench;${category};${size}"
+      SKIP_RETURN_CODE 77)
+
+    add_custom_target(mibench-measure-${bench}-${size}
+      COMMAND ${CP_BENCH_SCRIPT} measure ${CP_BENCH_SUITE_DIR} ${dir} ${size}
+              ${CMAKE_CURRENT_BINARY_DIR}/work/measure-${bench}-${size}
+              ${specs}
+      USES_TERMINAL
+      VERBATIM)
+    foreach(name ${ARG_UNPARSED_ARGUMENTS})
+      add_dependencies(mibench-measure-${bench}-${size} mibench-${name})
+    endforeach()
+  endforeach()
+endfunction()
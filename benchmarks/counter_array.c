@@ -0,0 +1,54 @@
+// counter_array.c
+// Per-thread event counters in one array: thread t only ever touches
+// counters[t], but the counters are 16 bytes, so four threads' counters
+// share each 64-byte line and every increment takes the line from the
+// others (false sharing). The sharing profile (./run.sh -m) reports it;
+// false-sharing-pad (./run.sh -m -P) pads each counter to a line.
+//
+//   ./counter_array [threads] [iterations per thread]
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_THREADS 16
+
+static struct counter {
+    long events;
+    long bytes;
+} counters[MAX_THREADS];
+
+static long iterations = 10000000;
+
+static void *count(void *arg) {
+    long t = (long)arg;
+    for (long i = 0; i < iterations; i++) {
+        counters[t].events++;
+        counters[t].bytes += (i & 63) + 1;
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    if (argc > 2)
+        iterations = atol(argv[2]);
+    if (threads < 1 || threads > MAX_THREADS) {
+        fprintf(stderr, "threads must be between 1 and %d\n", MAX_THREADS);
+        return 1;
+    }
+
+    pthread_t tids[MAX_THREADS];
+    for (long t = 0; t < threads; t++)
+        pthread_create(&tids[t], NULL, count, (void *)t);
+    for (int t = 0; t < threads; t++)
+        pthread_join(tids[t], NULL);
+
+    long events = 0, bytes = 0;
+    for (int t = 0; t < threads; t++) {
+        events += counters[t].events;
+        bytes += counters[t].bytes;
+    }
+    printf("Counted %ld events, %ld bytes in %d threads\n", events, bytes,
+           threads);
+    return 0;
+}
@@ -0,0 +1,268 @@
+#!/usr/bin/env bash
+# Helper for the MiBench targets in benchmarks/CPBenchmark.cmake: runs a
+# benchmark's runme_small.sh/runme_large.sh in a scratch copy of its directory.
+#
+# Usage:
+#   cp_bench.sh profile <suite_dir> <bench> <size> <work_dir> <out.cgann> \
+#                       <binary> <run_as>...
+#   cp_bench.sh check   [-r rel_tol] <suite_dir> <bench> <size> <work_dir> \
+#                       <orig>:<opt>:<run_as>[,<run_as>...]...
+#   cp_bench.sh measure <suite_dir> <bench> <size> <work_dir> \
+#                       <orig>:<opt>:<run_as>[,<run_as>...]...
+#
+# check compares the two runs with ../verify.sh (-r allows that much relative
+# difference in numbers) and exits 77 (skipped) when the baseline run itself
+# fails.
+#
+# measure runs the script under Cachegrind (with --branch-sim=yes) with the
+# baseline binaries and with the optimized ones, and prints the I-side and
+# branch totals of each: Ir, I1mr, ILmr, Bc, Bcm, and taken branches from
+# `perf stat` (br_inst_retired.near_taken) when perf can count them.
+#
+# <bench> is the benchmark directory relative to <suite_dir> (e.g.
+# automotive/susan). <run_as> is the path the runme script invokes the
+# program by, relative to <bench> (e.g. basicmath_small, jpeg-6a/cjpeg,
+# ../tiff-v3.5.4/tools/tiff2bw).
+
+set -e
+
+VERIFY="$(dirname "$(realpath "$0")")/../verify.sh"
+
+# Copy <bench> into <work>, and link the rest of its category next to it
+# so inputs like ../tiff-data resolve. Outputs land in the copy only.
+setup_work() {
+  local suite="$1" bench="$2" work="$3"
+  local category
+  category=$(dirname "$bench")
+
+  rm -rf "$work"
+  mkdir -p "$work/$category"
+  for entry in "$suite/$category"/*; do
+    [ "$entry" = "$suite/$bench" ] && continue
+    ln -s "$(realpath "$entry")" "$work/$category/$(basename "$entry")"
+  done
+  cp -a "$suite/$bench" "$work/$bench"
+}
+
+# Replace a linked directory by a real one holding links to its entries, so
+# files can be placed in it without touching the source tree.
+materialize() {
+  local dir="$1" target
+  target=$(readlink -f "$dir")
+  rm "$dir"
+  mkdir "$dir"
+  for entry in "$target"/* "$target"/.[!.]*; do
+    [ -e "$entry" ] && ln -s "$entry" "$dir/$(basename "$entry")"
+  done
+  return 0
+}
+
+# Put <binary> where the runme script expects it (<run_as> relative to
+# <work>/<bench>), materializing linked directories on the way.
+install_bin() {
+  local work="$1" bench="$2" run_as="$3" binary="$4"
+  local dest rel prefix part
+
+  dest=$(realpath -ms "$work/$bench/$run_as")
+  rel=${dest#"$(realpath -s "$work")"/}
+  prefix=$(realpath -s "$work")
+  IFS=/ read -ra parts <<< "$(dirname "$rel")"
+  for part in "${parts[@]}"; do
+    prefix="$prefix/$part"
+    if [ -L "$prefix" ]; then
+      materialize "$prefix"
+    fi
+    mkdir -p "$prefix"
+  done
+
+  rm -f "$dest"
+  cp "$binary" "$dest"
+  chmod +x "$dest"
+}
+
+# Run the runme script, keeping stdout/stderr and the exit status in
+# runme.log next to the program's own outputs.
+run_script() {
+  local dir="$1/$2" size="$3" status=0
+  # The scripts call programs by bare name
+  (cd "$dir" && PATH=".:$PATH" sh "./runme_$size.sh") \
+    > "$dir/runme.log" 2>&1 || status=$?
+  echo "exit $status" >> "$dir/runme.log"
+}
+
+# Install <binary> for every <run_as> of the specs, as the given variant
+install_specs() {
+  local work="$1" bench="$2" variant="$3" wrap="$4" spec orig opt path
+  shift 4
+  local n=0
+  for spec in "$@"; do
+    IFS=: read -r orig opt run_as_list <<< "$spec"
+    n=$((n + 1))
+    cp "$([ "$variant" = opt ] && echo "$opt" || echo "$orig")" "$work/.cp/prog$n"
+    sed "s|@PROG@|$work/.cp/prog$n|" "$wrap" > "$work/.cp/wrapper$n"
+    IFS=, read -ra run_as <<< "$run_as_list"
+    for path in "${run_as[@]}"; do
+      install_bin "$work" "$bench" "$path" "$work/.cp/wrapper$n"
+    done
+  done
+}
+
+# Ir I1mr ILmr Bc Bcm of a cachegrind.out file
+cg_totals() {
+  awk '
+    /^events:/ { for (i = 2; i <= NF; ++i) col[$i] = i - 1 }
+    /^summary:/ {
+      split("Ir I1mr ILmr Bc Bcm", want, " ")
+      for (i = 1; i <= 5; ++i)
+        printf "%s%s", (i > 1 ? " " : ""), (want[i] in col ? $(col[want[i]] + 1) : "-")
+      print ""
+    }' "$1"
+}
+
+cmd="$1"
+shift
+
+case "$cmd" in
+  profile)
+    SUITE="$1" BENCH="$2" SIZE="$3" WORK="$4" OUT="$5" BINARY="$6"
+    shift 6
+    WORK=$(realpath -m "$WORK")
+    setup_work "$SUITE" "$BENCH" "$WORK"
+
+    # Every invocation of the program runs under Cachegrind
+    mkdir -p "$WORK/.cp"
+    cp "$BINARY" "$WORK/.cp/prog"
+    cat > "$WORK/.cp/wrapper" << EOF
+#!/bin/sh
+exec valgrind --tool=cachegrind --cache-sim=yes --branch-sim=no \\
+  --cachegrind-out-file="$WORK/.cp/%p.cg" "$WORK/.cp/prog" "\$@"
+EOF
+    for run_as in "$@"; do
+      install_bin "$WORK" "$BENCH" "$run_as" "$WORK/.cp/wrapper"
+    done
+    run_script "$WORK" "$BENCH" "$SIZE"
+
+    shopt -s nullglob
+    CG_FILES=("$WORK"/.cp/*.cg)
+    shopt -u nullglob
+    if [ ${#CG_FILES[@]} -eq 0 ]; then
+      echo "cp_bench: $BENCH/runme_$SIZE.sh never ran $*" >&2
+      cat "$WORK/$BENCH/runme.log" >&2
+      exit 1
+    fi
+    if [ ${#CG_FILES[@]} -gt 1 ]; then
+      cg_merge -o "$WORK/.cp/merged.cg" "${CG_FILES[@]}"
+    else
+      cp "${CG_FILES[0]}" "$WORK/.cp/merged.cg"
+    fi
+    cg_annotate --auto=yes --show-percs=no "$WORK/.cp/merged.cg" > "$OUT"
+    ;;
+
+  check)
+    TOLERANCE=()
+    if [ "$1" = -r ]; then
+      TOLERANCE=(-r "$2")
+      shift 2
+    fi
+    SUITE="$1" BENCH="$2" SIZE="$3" WORK="$4"
+    shift 4
+    WORK=$(realpath -m "$WORK")
+    EXCLUDE=()
+    for variant in orig opt; do
+      setup_work "$SUITE" "$BENCH" "$WORK/$variant"
+      for spec in "$@"; do
+        IFS=: read -r orig opt run_as_list <<< "$spec"
+        binary=$orig
+        [ "$variant" = opt ] && binary=$opt
+        IFS=, read -ra run_as <<< "$run_as_list"
+        for path in "${run_as[@]}"; do
+          install_bin "$WORK/$variant" "$BENCH" "$path" "$binary"
+          EXCLUDE+=(-x "$(basename "$path")")
+        done
+      done
+      run_script "$WORK/$variant" "$BENCH" "$SIZE"
+    done
+
+    # Nothing to compare against if the baseline itself fails (e.g. an
+    # input file missing from this copy of MiBench): report a skip
+    if [ "$(tail -n 1 "$WORK/orig/$BENCH/runme.log")" != "exit 0" ]; then
+      echo "cp_bench: $BENCH ($SIZE) baseline run failed, skipping:" >&2
+      cat "$WORK/orig/$BENCH/runme.log" >&2
+      exit 77
+    fi
+
+    # Output files, stdout/stderr and exit status must match the baseline
+    if ! "$VERIFY" compare "${TOLERANCE[@]}" "${EXCLUDE[@]}" \
+         "$WORK/orig/$BENCH" "$WORK/opt/$BENCH"; then
+      echo "cp_bench: $BENCH ($SIZE) output differs from the baseline" >&2
+      exit 1
+    fi
+    echo "cp_bench: $BENCH ($SIZE) matches the baseline"
+    ;;
+
+  measure)
+    SUITE="$1" BENCH="$2" SIZE="$3" WORK="$4"
+    shift 4
+    WORK=$(realpath -m "$WORK")
+    # Without them every run script fails and reports no binaries ran
+    for tool in valgrind cg_merge; do
+      if ! command -v "$tool" > /dev/null; then
+        echo "cp_bench: measure needs $tool, which is not installed" >&2
+        exit 1
+      fi
+    done
+    PERF=$(command -v perf || true)
+    printf "%-24s %-5s %14s %10s %10s %12s %10s %12s\n" \
+      benchmark binary Ir I1mr ILmr Bc Bcm taken
+    for variant in orig opt; do
+      dir="$WORK/$variant"
+
+      setup_work "$SUITE" "$BENCH" "$dir"
+      mkdir -p "$dir/.cp"
+      cat > "$dir/.cp/cg.in" << EOF
+#!/bin/sh
+exec valgrind --tool=cachegrind --cache-sim=yes --branch-sim=yes \\
+  --cachegrind-out-file="$dir/.cp/%p.cg" "@PROG@" "\$@"
+EOF
+      install_specs "$dir" "$BENCH" "$variant" "$dir/.cp/cg.in" "$@"
+      run_script "$dir" "$BENCH" "$SIZE"
+      shopt -s nullglob
+      CG_FILES=("$dir"/.cp/*.cg)
+      shopt -u nullglob
+      if [ ${#CG_FILES[@]} -eq 0 ]; then
+        echo "cp_bench: $BENCH/runme_$SIZE.sh never ran the $variant binaries" >&2
+        cat "$dir/$BENCH/runme.log" >&2
+        exit 1
+      fi
+      cg_merge -o "$dir/.cp/merged.cg" "${CG_FILES[@]}"
+      read -r ir i1mr ilmr bc bcm < <(cg_totals "$dir/.cp/merged.cg")
+
+      # Taken branches need the hardware counters, in a run of their own
+      taken=-
+      if [ -n "$PERF" ]; then
+        setup_work "$SUITE" "$BENCH" "$dir"
+        mkdir -p "$dir/.cp"
+        cat > "$dir/.cp/perf.in" << EOF
+#!/bin/sh
+exec "$PERF" stat -x, -e br_inst_retired.near_taken:u --append \\
+  -o "$dir/.cp/perf.csv" "@PROG@" "\$@"
+EOF
+        install_specs "$dir" "$BENCH" "$variant" "$dir/.cp/perf.in" "$@"
+        run_script "$dir" "$BENCH" "$SIZE"
+        taken=$(awk -F, '
+          $3 ~ /^br_inst_retired.near_taken/ {
+            if ($1 !~ /^[0-9]+$/) bad = 1
+            sum += $1; n++
+          }
+          END { print (n && !bad) ? sum : "-" }' "$dir/.cp/perf.csv" 2> /dev/null || echo -)
+      fi
+      printf "%-24s %-5s %14s %10s %10s %12s %10s %12s\n" \
+        "$BENCH" "$variant" "$ir" "$i1mr" "$ilmr" "$bc" "$bcm" "$taken"
+    done
+    ;;
+
+  *)
+    echo "Usage: $0 profile|check|measure ..." >&2
+    exit 1
+    ;;
+esac
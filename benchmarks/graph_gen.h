@@ -0,0 +1,155 @@
+// graph_gen.h
+// Deterministic graph inputs for the irregular benchmarks (spmv_csr.c, bfs.c,
+// pagerank.c). Every benchmark takes the same optional arguments:
+//
+//   <prog> [rmat|uniform] [scale] [edge_factor]
+//
+// for a graph of 2^scale vertices and edge_factor * 2^scale edges (default
+// rmat 16 16, 4.5 MiB of CSR, 8.5 MiB stored in both directions). Scale 12
+// stays in L2, scale 20 is several times a typical LLC.
+#ifndef GRAPH_GEN_H
+#define GRAPH_GEN_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int rmat;           // R-MAT (skewed degrees) or uniform random edges
+    int scale;
+    int edge_factor;
+} GraphSpec;
+
+// Compressed sparse rows: the neighbours of v are col[row[v] .. row[v + 1])
+typedef struct {
+    uint32_t n;
+    uint64_t m;
+    uint64_t *row;
+    uint32_t *col;
+} CSRGraph;
+
+static uint64_t gg_rng_state = 88172645463325252ull;
+
+static inline uint64_t gg_rng(void) {
+    gg_rng_state ^= gg_rng_state << 13;
+    gg_rng_state ^= gg_rng_state >> 7;
+    gg_rng_state ^= gg_rng_state << 17;
+    return gg_rng_state;
+}
+
+static inline GraphSpec gg_parse_args(int argc, char **argv) {
+    GraphSpec spec = {1, 16, 16};
+    if (argc > 1)
+        spec.rmat = strcmp(argv[1], "uniform") != 0;
+    if (argc > 2)
+        spec.scale = atoi(argv[2]);
+    if (argc > 3)
+        spec.edge_factor = atoi(argv[3]);
+    if (spec.scale < 1 || spec.scale > 30 || spec.edge_factor < 1) {
+        fprintf(stderr, "usage: %s [rmat|uniform] [scale 1-30] [edge_factor]\n",
+                argv[0]);
+        exit(2);
+    }
+    return spec;
+}
+
+// One R-MAT edge: descend the adjacency matrix one bit at a time, picking
+// quadrants with the Graph500 probabilities a = .57, b = c = .19, d = .05
+// (16 random bits per level, 65536 * .57 = 37355 and so on)
+static inline void gg_rmat_edge(int scale, uint32_t *src, uint32_t *dst) {
+    uint32_t u = 0, v = 0;
+    uint64_t bits = 0;
+    for (int bit = 0; bit < scale; bit++) {
+        if (bit % 4 == 0)
+            bits = gg_rng();
+        uint32_t r = (uint32_t)(bits & 0xffff);
+        bits >>= 16;
+        u <<= 1;
+        v <<= 1;
+        if (r < 37355) {
+        } else if (r < 49807) {
+            v |= 1;
+        } else if (r < 62259) {
+            u |= 1;
+        } else {
+            u |= 1;
+            v |= 1;
+        }
+    }
+    *src = u;
+    *dst = v;
+}
+
+// Generate the graph of spec; with symmetric set, every edge is stored in
+// both directions (for traversals of an undirected graph).
+static inline CSRGraph gg_generate(GraphSpec spec, int symmetric) {
+    CSRGraph g;
+    uint64_t edges = (uint64_t)spec.edge_factor << spec.scale;
+    g.n = 1u << spec.scale;
+    g.m = symmetric ? 2 * edges : edges;
+
+    uint32_t *src = malloc(edges * sizeof(uint32_t));
+    uint32_t *dst = malloc(edges * sizeof(uint32_t));
+    uint32_t *perm = malloc(g.n * sizeof(uint32_t));
+    g.row = calloc((size_t)g.n + 1, sizeof(uint64_t));
+    g.col = malloc(g.m * sizeof(uint32_t));
+    if (!src || !dst || !perm || !g.row || !g.col) {
+        fprintf(stderr, "graph_gen: out of memory\n");
+        exit(1);
+    }
+
+    for (uint64_t e = 0; e < edges; e++) {
+        if (spec.rmat) {
+            gg_rmat_edge(spec.scale, &src[e], &dst[e]);
+        } else {
+            src[e] = (uint32_t)(gg_rng() % g.n);
+            dst[e] = (uint32_t)(gg_rng() % g.n);
+        }
+    }
+
+    // Relabel vertices so R-MAT's high-degree vertices are not all at low ids
+    for (uint32_t v = 0; v < g.n; v++)
+        perm[v] = v;
+    for (uint32_t v = g.n - 1; v > 0; v--) {
+        uint32_t j = (uint32_t)(gg_rng() % (v + 1));
+        uint32_t t = perm[v];
+        perm[v] = perm[j];
+        perm[j] = t;
+    }
+
+    // Counting sort of the edges by source into CSR
+    for (uint64_t e = 0; e < edges; e++) {
+        src[e] = perm[src[e]];
+        dst[e] = perm[dst[e]];
+        g.row[src[e] + 1]++;
+        if (symmetric)
+            g.row[dst[e] + 1]++;
+    }
+    for (uint32_t v = 0; v < g.n; v++)
+        g.row[v + 1] += g.row[v];
+    uint64_t *fill = malloc((size_t)g.n * sizeof(uint64_t));
+    if (!fill) {
+        fprintf(stderr, "graph_gen: out of memory\n");
+        exit(1);
+    }
+    memcpy(fill, g.row, (size_t)g.n * sizeof(uint64_t));
+    for (uint64_t e = 0; e < edges; e++) {
+        g.col[fill[src[e]]++] = dst[e];
+        if (symmetric)
+            g.col[fill[dst[e]]++] = src[e];
+    }
+
+    free(fill);
+    free(perm);
+    free(src);
+    free(dst);
+    return g;
+}
+
+static inline void gg_free(CSRGraph *g) {
+    free(g->row);
+    free(g->col);
+}
+
+#endif
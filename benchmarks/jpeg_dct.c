@@ -0,0 +1,154 @@
+// jpeg_dct.c
+// MiBench jpeg's integer forward and inverse DCTs (jfdctint.c, jidctint.c)
+// over every 8x8 block of a generated grayscale image: each block reads 8
+// rows a full image width apart.
+//
+//   jpeg_dct [width] [height] [iters]     (default 2048 2048 4)
+//
+// Prints checksums of the coefficients and the reconstructed image;
+// per-kernel times go to CP_KERNEL_TIMES (see kernel_times.h).
+#include <stddef.h>
+
+#include "kernel_times.h"
+
+// The kernels, straight from libjpeg
+#include "mibench_benchmarks/consumer/jpeg/jpeg-6a/jfdctint.c"
+#include "mibench_benchmarks/consumer/jpeg/jpeg-6a/jidctint.c"
+
+// Standard JPEG luminance quantization table (quality 50), natural order
+static const unsigned short std_luminance_quant[DCTSIZE2] = {
+    16, 11, 10, 16, 24,  40,  51,  61,
+    12, 12, 14, 19, 26,  58,  60,  55,
+    14, 13, 16, 24, 40,  57,  69,  56,
+    14, 17, 22, 29, 51,  87,  80,  62,
+    18, 22, 37, 56, 68,  109, 103, 77,
+    24, 35, 55, 64, 81,  104, 113, 92,
+    49, 64, 78, 87, 103, 121, 120, 101,
+    72, 92, 95, 98, 112, 100, 103, 99,
+};
+
+// The sample range-limiting table jpeg_idct_islow expects, as built by
+// prepare_range_limit_table() in jdmaster.c
+static JSAMPLE *make_range_limit(void) {
+    JSAMPLE *table = malloc((5 * (MAXJSAMPLE + 1) + CENTERJSAMPLE) * sizeof(JSAMPLE));
+    if (!table) exit(1);
+    table += MAXJSAMPLE + 1;
+    JSAMPLE *limit = table;
+    memset(table - (MAXJSAMPLE + 1), 0, (MAXJSAMPLE + 1) * sizeof(JSAMPLE));
+    for (int i = 0; i <= MAXJSAMPLE; i++)
+        table[i] = (JSAMPLE)i;
+    table += CENTERJSAMPLE;
+    for (int i = CENTERJSAMPLE; i < 2 * (MAXJSAMPLE + 1); i++)
+        table[i] = MAXJSAMPLE;
+    memset(table + 2 * (MAXJSAMPLE + 1), 0,
+           (2 * (MAXJSAMPLE + 1) - CENTERJSAMPLE) * sizeof(JSAMPLE));
+    memcpy(table + 4 * (MAXJSAMPLE + 1) - CENTERJSAMPLE, limit,
+           CENTERJSAMPLE * sizeof(JSAMPLE));
+    return limit;
+}
+
+// Forward DCT and quantization of every block, as in jcdctmgr.c's
+// forward_DCT(): coefs holds the blocks in raster order
+static void fdct_image(JSAMPARRAY rows, int width, int height, JCOEF *coefs) {
+    DCTELEM workspace[DCTSIZE2];
+    for (int by = 0; by < height; by += DCTSIZE) {
+        for (int bx = 0; bx < width; bx += DCTSIZE) {
+            for (int r = 0; r < DCTSIZE; r++)
+                for (int c = 0; c < DCTSIZE; c++)
+                    workspace[r * DCTSIZE + c] =
+                        GETJSAMPLE(rows[by + r][bx + c]) - CENTERJSAMPLE;
+            jpeg_fdct_islow(workspace);
+            for (int i = 0; i < DCTSIZE2; i++) {
+                // The fdct output is scaled up by 8, as are the divisors
+                DCTELEM q = (DCTELEM)std_luminance_quant[i] << 3;
+                DCTELEM t = workspace[i];
+                if (t < 0)
+                    t = -((q / 2 - t) / q);
+                else
+                    t = (t + q / 2) / q;
+                *coefs++ = (JCOEF)t;
+            }
+        }
+    }
+}
+
+static void idct_image(j_decompress_ptr cinfo, jpeg_component_info *comp,
+                       JCOEF *coefs, JSAMPARRAY rows, int width, int height) {
+    for (int by = 0; by < height; by += DCTSIZE) {
+        for (int bx = 0; bx < width; bx += DCTSIZE) {
+            jpeg_idct_islow(cinfo, comp, coefs, rows + by, (JDIMENSION)bx);
+            coefs += DCTSIZE2;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int width = argc > 1 ? atoi(argv[1]) : 2048;
+    int height = argc > 2 ? atoi(argv[2]) : 2048;
+    int iters = argc > 3 ? atoi(argv[3]) : 4;
+    if (width < DCTSIZE || height < DCTSIZE || width % DCTSIZE ||
+        height % DCTSIZE || iters < 1) {
+        fprintf(stderr, "usage: %s [width] [height] (multiples of 8) [iters]\n",
+                argv[0]);
+        return 2;
+    }
+    size_t pixels = (size_t)width * height;
+
+    JSAMPLE *image = malloc(pixels * sizeof(JSAMPLE));
+    JSAMPLE *output = malloc(pixels * sizeof(JSAMPLE));
+    JSAMPARRAY in_rows = malloc(height * sizeof(JSAMPROW));
+    JSAMPARRAY out_rows = malloc(height * sizeof(JSAMPROW));
+    JCOEF *coefs = malloc(pixels * sizeof(JCOEF));
+    if (!image || !output || !in_rows || !out_rows || !coefs) return 1;
+    for (int y = 0; y < height; y++) {
+        in_rows[y] = image + (size_t)y * width;
+        out_rows[y] = output + (size_t)y * width;
+    }
+
+    // Smooth shading plus hard-edged stripes: blocks with both low- and
+    // high-frequency content
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            in_rows[y][x] = (JSAMPLE)(((x + 2 * y) & 255) / 2 +
+                                      (((x / 13) ^ (y / 7)) & 1) * 100);
+
+    struct jpeg_decompress_struct cinfo;
+    jpeg_component_info comp;
+    ISLOW_MULT_TYPE dct_table[DCTSIZE2];
+    for (int i = 0; i < DCTSIZE2; i++)
+        dct_table[i] = (ISLOW_MULT_TYPE)std_luminance_quant[i];
+    memset(&cinfo, 0, sizeof(cinfo));
+    memset(&comp, 0, sizeof(comp));
+    cinfo.sample_range_limit = make_range_limit();
+    comp.dct_table = dct_table;
+
+    double t_fdct = 0, t_idct = 0, t0;
+    for (int it = 0; it < iters; it++) {
+        t0 = kt_now();
+        fdct_image(in_rows, width, height, coefs);
+        t_fdct += kt_now() - t0;
+
+        t0 = kt_now();
+        idct_image(&cinfo, &comp, coefs, out_rows, width, height);
+        t_idct += kt_now() - t0;
+    }
+
+    unsigned long long coef_sum = 0, sample_sum = 0, error_sum = 0;
+    for (size_t i = 0; i < pixels; i++) {
+        coef_sum += (unsigned long long)(coefs[i] < 0 ? -coefs[i] : coefs[i]);
+        sample_sum += output[i];
+        error_sum += (unsigned long long)abs((int)output[i] - (int)image[i]);
+    }
+    printf("jpeg dct %dx%d, %d iters: |coef| sum %llu, sample sum %llu, "
+           "abs error sum %llu\n",
+           width, height, iters, coef_sum, sample_sum, error_sum);
+    kt_report("jpeg_fdct_islow", t_fdct, iters);
+    kt_report("jpeg_idct_islow", t_idct, iters);
+
+    free(image);
+    free(output);
+    free(in_rows);
+    free(out_rows);
+    free(coefs);
+    return 0;
+}
@@ -0,0 +1,32 @@
+// kernel_times.h
+// Per-kernel wall-clock time for the image drivers (susan_stencil.c,
+// jpeg_dct.c). Times vary from run to run, so they are kept out of the
+// program's output (which verify.sh compares) and written to the file named
+// by CP_KERNEL_TIMES, e.g. CP_KERNEL_TIMES=/dev/stderr.
+#ifndef KERNEL_TIMES_H
+#define KERNEL_TIMES_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static inline double kt_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// One line per kernel: name, total seconds, iterations, seconds/iteration
+static inline void kt_report(const char *kernel, double seconds, int iters) {
+    const char *path = getenv("CP_KERNEL_TIMES");
+    if (!path)
+        return;
+    FILE *f = fopen(path, "a");
+    if (!f)
+        return;
+    fprintf(f, "%-16s %10.6f s  %d iters  %10.6f s/iter\n", kernel, seconds,
+            iters, seconds / iters);
+    fclose(f);
+}
+
+#endif
@@ -0,0 +1,94 @@
+// susan_stencil.c
+// MiBench susan's smoothing, edge and corner kernels (2D sliding windows of
+// up to 37 pixels) on a generated image large enough to stress the LLC.
+//
+//   susan_stencil [width] [height] [iters]     (default 2048 2048 1)
+//
+// Prints checksums of each kernel's output; per-kernel times go to
+// CP_KERNEL_TIMES (see kernel_times.h).
+#include <stddef.h>
+
+#include "kernel_times.h"
+
+// The kernels, without susan's own main()
+#define main susan_main
+#include "mibench_benchmarks/automotive/susan/susan.c"
+#undef main
+
+// Corner list big enough for any image: susan_corners exits when it fills up
+static CORNER_LIST corner_list;
+
+// Checkerboard of flat cells with slow gradients and +-3 noise (below the
+// brightness threshold), so edges and corners come from the cell borders only
+static void generate_image(uchar *img, int x_size, int y_size) {
+    int cell = x_size / 32 > 16 ? x_size / 32 : 16;
+    unsigned seed = 12345;
+    for (int y = 0; y < y_size; y++) {
+        for (int x = 0; x < x_size; x++) {
+            int v = ((x / cell + y / cell) & 1) ? 180 : 60;
+            v += (x % cell + y % cell) / 8;
+            seed = seed * 1103515245u + 12345u;
+            v += (int)((seed >> 16) % 7) - 3;
+            img[(size_t)y * x_size + x] = (uchar)v;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int x_size = argc > 1 ? atoi(argv[1]) : 2048;
+    int y_size = argc > 2 ? atoi(argv[2]) : 2048;
+    int iters = argc > 3 ? atoi(argv[3]) : 1;
+    if (x_size < 64 || y_size < 64 || iters < 1) {
+        fprintf(stderr, "usage: %s [width >= 64] [height >= 64] [iters]\n", argv[0]);
+        return 2;
+    }
+    size_t pixels = (size_t)x_size * y_size;
+
+    uchar *image = malloc(pixels);
+    uchar *in = malloc(pixels);
+    uchar *mid = malloc(pixels);
+    int *r = malloc(pixels * sizeof(int));
+    if (!image || !in || !mid || !r) return 1;
+    generate_image(image, x_size, y_size);
+
+    uchar *bp_smooth, *bp_features;
+    setup_brightness_lut(&bp_smooth, 20, 2);
+    setup_brightness_lut(&bp_features, 20, 6);
+
+    double t_smooth = 0, t_edges = 0, t_corners = 0, t0;
+    unsigned long long smooth_sum = 0, edge_count = 0, corner_count = 0;
+    for (int it = 0; it < iters; it++) {
+        // Smoothing works in place: start each iteration from the original
+        memcpy(in, image, pixels);
+        t0 = kt_now();
+        susan_smoothing(0, in, 4.0, x_size, y_size, bp_smooth);
+        t_smooth += kt_now() - t0;
+        for (size_t i = 0; i < pixels; i++)
+            smooth_sum += in[i];
+
+        memset(mid, 100, pixels);
+        t0 = kt_now();
+        susan_edges(image, r, mid, bp_features, 2650, x_size, y_size);
+        t_edges += kt_now() - t0;
+        for (size_t i = 0; i < pixels; i++)
+            edge_count += mid[i] != 100;
+
+        t0 = kt_now();
+        susan_corners(image, r, bp_features, 1850, corner_list, x_size, y_size);
+        t_corners += kt_now() - t0;
+        for (int n = 0; corner_list[n].info != 7; n++)
+            corner_count++;
+    }
+
+    printf("susan %dx%d, %d iters: smoothing sum %llu, edge pixels %llu, corners %llu\n",
+           x_size, y_size, iters, smooth_sum, edge_count, corner_count);
+    kt_report("susan_smoothing", t_smooth, iters);
+    kt_report("susan_edges", t_edges, iters);
+    kt_report("susan_corners", t_corners, iters);
+
+    free(image);
+    free(in);
+    free(mid);
+    free(r);
+    return 0;
+}
@@ -0,0 +1,452 @@
+#!/usr/bin/env bash
+# Synthetic memory-access kernels from parameterized specs
+# Usage:
+#   gen_kernel.sh gen [--d1 size,assoc,line] [--ll size,assoc,line] \
+#                 -o <out_dir> <name> <key>=<value>...
+#   gen_kernel.sh expand <specs.txt>
+#   gen_kernel.sh check <name.expected> <cg_annotate output>
+
+set -e
+
+D1="32768,8,64"      # same format as valgrind --D1/--LL
+LL="8388608,16,64"
+ACCESS_TARGET=$((1 << 22))   # accesses per run when reps is not given
+
+show_help() {
+  cat << EOF
+Usage:
+  $0 gen [--d1 size,assoc,line] [--ll size,assoc,line] \\
+      -o <out_dir> <name> <key>=<value>...
+  $0 expand <specs.txt>
+  $0 check <name.expected> <cg_annotate output>
+
+gen writes <out_dir>/<name>.c, a program whose kernel() function runs the
+access pattern below, and <out_dir>/<name>.expected, the D1mr/D1mw/DLmr/DLmw
+that kernel() should take in total under Cachegrind with the given cache
+geometry (default --D1=${D1} --LL=${LL}). The model covers capacity and
+set-conflict misses; setup code runs outside kernel() and warms the caches.
+
+Keys (sizes take K/M/G suffixes):
+  pattern=stride|nest|indirect|chase    required
+  elem=N       element (chase: node) size in bytes; 1,2,4,8 (chase: 16+,
+               a multiple of 8). Default 8, chase 16
+  ws=SIZE      working set: the data array (chase: all nodes). Default 8M
+  stride=N     stride: distance between accesses in elements. Default 1
+  dims=AxB[xC] nest: array dims, the loop nest depth is their number
+  order=row|col  nest: row walks the last dim innermost, col the first
+  depth=N      indirect: a[idx_N[...idx_1[i]]], idx_* random permutations
+  locality=P   chase: percent of steps to the next node in memory (the
+               rest jump to a random node). Default 0
+  writes=P     percent of data accesses that store instead of load
+  reps=N       kernel() calls. Default: about ${ACCESS_TARGET} accesses
+
+expand reads a spec file (lines "<name> <key>=<value>...", # comments) and
+prints one spec per line, expanding comma-separated values into every
+combination; each listed key is appended to the name (ws=16K,4M under
+"stream" gives stream_ws16K and stream_ws4M).
+
+check prints the expected kernel() misses next to the measured ones.
+EOF
+}
+
+die() {
+  echo "gen_kernel: $*" >&2
+  exit 1
+}
+
+# 16K -> 16384
+bytes() {
+  local v="$1" n
+  n=${v%[KkMmGg]}
+  [[ "$n" =~ ^[0-9]+$ ]] || die "bad size '$v'"
+  case "$v" in
+    *[Kk]) echo $((n << 10)) ;;
+    *[Mm]) echo $((n << 20)) ;;
+    *[Gg]) echo $((n << 30)) ;;
+    *) echo "$n" ;;
+  esac
+}
+
+###############################################
+# expand
+###############################################
+expand() {
+  local line name rest
+  while read -r line; do
+    line="${line%%#*}"
+    read -r name rest <<< "$line"
+    [ -n "$name" ] || continue
+    expand_one "$name" "" $rest
+  done < "$1"
+}
+
+# expand_one <name> <done k=v...> <k=v...>: recursive cartesian product
+expand_one() {
+  local name="$1" done="$2"
+  shift 2
+  if [ $# -eq 0 ]; then
+    echo "$name$done"
+    return
+  fi
+  local kv="$1" key values value
+  shift
+  key="${kv%%=*}"
+  IFS=, read -ra values <<< "${kv#*=}"
+  if [ ${#values[@]} -eq 1 ]; then
+    expand_one "$name" "$done $kv" "$@"
+    return
+  fi
+  for value in "${values[@]}"; do
+    expand_one "${name}_${key}${value//[^A-Za-z0-9]/_}" "$done $key=$value" "$@"
+  done
+}
+
+###############################################
+# check
+###############################################
+check() {
+  local expected="$1" cgann="$2"
+  # Column names come from "Events shown:", the counts from the line
+  # ending in kernel (file:function)
+  awk '
+    FNR == NR { exp_v[$1] = $2; names[++n] = $1; next }
+    /^Events shown:/ { for (i = 3; i <= NF; ++i) ev[i - 2] = $i; next }
+    !found && ($NF ~ /(^|:)kernel$/) {
+      sub(/^> */, "")
+      for (i = 1; i in ev; ++i) { v = $i; gsub(",", "", v); got[ev[i]] = v }
+      found = 1
+    }
+    END {
+      if (!found) { print "gen_kernel: no kernel() line in " FILENAME > "/dev/stderr"; exit 1 }
+      printf "%-6s %14s %14s %8s\n", "event", "expected", "measured", "ratio"
+      for (i = 1; i <= n; ++i) {
+        e = names[i]; m = (e in got) ? got[e] : "-"
+        r = (m != "-" && exp_v[e] > 0) ? sprintf("%.2f", m / exp_v[e]) : "-"
+        printf "%-6s %14d %14s %8s\n", e, exp_v[e], m, r
+      }
+    }' "$expected" "$cgann"
+}
+
+###############################################
+# gen
+###############################################
+
+# Expected kernel() misses for one cache level: prints "<reads> <writes>"
+model() {
+  local size assoc line
+  IFS=, read -r size assoc line <<< "$1"
+  awk -v C="$size" -v A="$assoc" -v L="$line" -v pat="$PATTERN" \
+      -v e="$ELEM" -v n="$N" -v stride="$STRIDE" -v dims="$DIMS" \
+      -v order="$ORDER" -v depth="$DEPTH" -v loc="$LOCALITY" \
+      -v w="$WRITES" -v reps="$REPS" '
+    function gcd(a, b,   t) { while (b) { t = a % b; a = b; b = t } return a }
+    function min(a, b) { return a < b ? a : b }
+    # Misses per rep of a sweep over nlines lines, step bytes apart: none
+    # if they all stay cached (capacity, and the sets that step reaches)
+    function sweep(nlines, step,   cap, sets) {
+      cap = C / L
+      if (step >= L && step % L == 0) {
+        sets = C / (L * A)
+        cap = min(cap, sets / gcd(step / L, sets) * A)
+      }
+      return nlines > cap ? nlines : 0
+    }
+    BEGIN {
+      w /= 100
+      if (pat == "stride") {
+        acc = int((n + stride - 1) / stride)
+        step = stride * e
+        m = sweep(step >= L ? acc : n * e / L, step)
+        rd = m * (1 - w); wr = m * w
+      } else if (pat == "nest") {
+        nd = split(dims, d, "x")
+        step = e
+        for (i = 2; i <= nd; ++i) step *= d[i]
+        if (order == "col" && step >= L && sweep(d[1], step) > 0)
+          m = n                   # every access a new line
+        else
+          m = sweep(n * e / L, e) # lines reused before eviction
+        rd = m * (1 - w); wr = m * w
+      } else if (pat == "indirect") {
+        F = n * e + depth * n * 4
+        q = F > C ? 1 - C / F : 0
+        rd = sweep(F / L, 4) > 0 ? n * 4 / L : 0  # idx_1, streamed
+        rd += (depth - 1) * n * q                 # idx_2..idx_depth
+        rd += n * q * (1 - w); wr = n * q * w     # a[]
+      } else {
+        F = n * e
+        q = F > C ? 1 - C / F : 0
+        seq = F > C ? min(1, e / L) : 0
+        # the load of p->next always comes first, so stores hit
+        rd = n * ((1 - loc / 100) * q + loc / 100 * seq); wr = 0
+      }
+      printf "%d %d\n", rd * reps + 0.5, wr * reps + 0.5
+    }'
+}
+
+emit_access() {
+  local x="$1" v="$2"
+  if [ "$WRITES" -eq 0 ]; then
+    echo "sum += $x;"
+  elif [ "$WRITES" -eq 100 ]; then
+    echo "$x = (T)$v;"
+  else
+    echo "if (k++ % 100 < WRITES) $x = (T)$v; else sum += $x;"
+  fi
+}
+
+gen() {
+  local out=""
+  while [ $# -gt 0 ]; do
+    case "$1" in
+      --d1) D1="$2"; shift 2 ;;
+      --ll) LL="$2"; shift 2 ;;
+      -o) out="$2"; shift 2 ;;
+      *) break ;;
+    esac
+  done
+  [ -n "$out" ] && [ $# -ge 2 ] || { show_help; exit 2; }
+  local name="$1"
+  shift
+  SPEC="$*"
+
+  PATTERN="" ELEM="" WS=8M STRIDE=1 DIMS="" ORDER=row DEPTH=1
+  LOCALITY=0 WRITES=0 REPS=""
+  local kv
+  for kv in "$@"; do
+    case "${kv%%=*}" in
+      pattern) PATTERN="${kv#*=}" ;;
+      elem) ELEM="${kv#*=}" ;;
+      ws) WS="${kv#*=}" ;;
+      stride) STRIDE="${kv#*=}" ;;
+      dims) DIMS="${kv#*=}" ;;
+      order) ORDER="${kv#*=}" ;;
+      depth) DEPTH="${kv#*=}" ;;
+      locality) LOCALITY="${kv#*=}" ;;
+      writes) WRITES="${kv#*=}" ;;
+      reps) REPS="${kv#*=}" ;;
+      *) die "$name: unknown key '${kv%%=*}'" ;;
+    esac
+  done
+
+  case "$PATTERN" in
+    stride|nest|indirect) ELEM=${ELEM:-8}
+      case "$ELEM" in 1|2|4|8) ;; *) die "$name: elem must be 1, 2, 4 or 8" ;; esac ;;
+    chase) ELEM=${ELEM:-16}
+      [ "$ELEM" -ge 16 ] && [ $((ELEM % 8)) -eq 0 ] ||
+        die "$name: chase nodes (elem) are a multiple of 8, at least 16" ;;
+    *) die "$name: pattern must be stride, nest, indirect or chase" ;;
+  esac
+  [ "$WRITES" -ge 0 ] && [ "$WRITES" -le 100 ] || die "$name: writes is a percentage"
+  [ "$LOCALITY" -ge 0 ] && [ "$LOCALITY" -le 100 ] || die "$name: locality is a percentage"
+  [ "$STRIDE" -ge 1 ] && [ "$DEPTH" -ge 1 ] || die "$name: stride and depth are at least 1"
+
+  # N: data elements (chase: nodes), ACC: accesses per kernel() call
+  local d ACC
+  if [ "$PATTERN" = nest ]; then
+    [[ "$DIMS" =~ ^[0-9]+x[0-9]+(x[0-9]+)?$ ]] || die "$name: nest needs dims=AxB[xC]"
+    [ "$ORDER" = row ] || [ "$ORDER" = col ] || die "$name: order is row or col"
+    N=1
+    IFS=x read -ra d <<< "$DIMS"
+    for x in "${d[@]}"; do N=$((N * x)); done
+  else
+    N=$(( $(bytes "$WS") / ELEM ))
+    [ "$N" -ge 1 ] || die "$name: ws is smaller than one element"
+  fi
+  ACC=$N
+  [ "$PATTERN" = stride ] && ACC=$(( (N + STRIDE - 1) / STRIDE ))
+  REPS=${REPS:-$(( ACC >= ACCESS_TARGET ? 1 : ACCESS_TARGET / ACC ))}
+
+  local d1 ll
+  read -ra d1 <<< "$(model "$D1")"
+  read -ra ll <<< "$(model "$LL")"
+  # An LL miss is a D1 miss too
+  [ "${ll[0]}" -le "${d1[0]}" ] || ll[0]=${d1[0]}
+  [ "${ll[1]}" -le "${d1[1]}" ] || ll[1]=${d1[1]}
+
+  mkdir -p "$out"
+  printf "D1mr %s\nD1mw %s\nDLmr %s\nDLmw %s\n" \
+    "${d1[0]}" "${d1[1]}" "${ll[0]}" "${ll[1]}" > "$out/$name.expected"
+  emit_c "$name" "${d1[@]}" "${ll[@]}" > "$out/$name.c"
+}
+
+emit_c() {
+  local name="$1" d1mr="$2" d1mw="$3" dlmr="$4" dlmw="$5"
+  local mix="" kernel_body init data
+  [ "$WRITES" -gt 0 ] && [ "$WRITES" -lt 100 ] && mix="    unsigned k = 0;
+"
+
+  case "$PATTERN" in
+    stride)
+      data="static T *a;"
+      init="    a = malloc(N * sizeof(T));
+    if (!a) return 1;
+    for (size_t i = 0; i < N; i++)
+        a[i] = (T)i;"
+      kernel_body="    for (size_t i = 0; i < N; i += STRIDE)
+        $(emit_access "a[i]" i)"
+      ;;
+    nest)
+      local ix=(i0 i1 i2) nd idx="" loops="" indent="    " j
+      IFS=x read -ra d <<< "$DIMS"
+      nd=${#d[@]}
+      data="static T (*a)$(for ((j = 1; j < nd; ++j)); do printf '[D%d]' "$j"; done);"
+      for ((j = 0; j < nd; ++j)); do idx+="[${ix[$j]}]"; done
+      local seq
+      if [ "$ORDER" = row ]; then seq=$(seq 0 $((nd - 1))); else seq=$(seq $((nd - 1)) -1 0); fi
+      for j in $seq; do
+        loops+="${indent}for (size_t ${ix[$j]} = 0; ${ix[$j]} < D$j; ${ix[$j]}++)
+"
+        indent+="    "
+      done
+      init="    a = malloc(N * sizeof(T));
+    if (!a) return 1;
+    for (size_t i = 0; i < N; i++)
+        ((T *)a)[i] = (T)i;"
+      kernel_body="${loops}${indent}$(emit_access "a$idx" i0)"
+      ;;
+    indirect)
+      local expr="i" j
+      data="static T *a;
+static uint32_t *idx[DEPTH];"
+      for ((j = 0; j < DEPTH; ++j)); do expr="idx[$j][$expr]"; done
+      init="    a = malloc(N * sizeof(T));
+    if (!a) return 1;
+    for (size_t i = 0; i < N; i++)
+        a[i] = (T)i;
+    for (int d = 0; d < DEPTH; d++) {
+        idx[d] = malloc(N * sizeof(uint32_t));
+        if (!idx[d]) return 1;
+        for (size_t i = 0; i < N; i++)
+            idx[d][i] = (uint32_t)i;
+        shuffle(idx[d], N);
+    }"
+      kernel_body="    for (size_t i = 0; i < N; i++)
+        $(emit_access "a[$expr]" i)"
+      ;;
+    chase)
+      # With no locality every node starts a run; the comparison would be
+      # always true (-Wtype-limits), so leave it out
+      local cut="i == 0 || rng() % 100 >= LOCALITY"
+      if [ "$LOCALITY" -eq 0 ]; then cut="1"; fi
+      data="typedef struct Node {
+    struct Node *next;
+    uint64_t val;$(if [ "$ELEM" -gt 16 ]; then printf '\n    char pad[ELEM - 16];'; fi)
+} Node;
+static Node *nodes, *cur;"
+      init="    nodes = malloc(N * sizeof(Node));
+    uint32_t *runs = malloc((N + 1) * sizeof(uint32_t));
+    uint32_t *visit = malloc(N * sizeof(uint32_t));
+    if (!nodes || !runs || !visit) return 1;
+    for (size_t i = 0; i < N; i++)
+        nodes[i].val = i;
+
+    // Cut 0..N-1 into runs of consecutive nodes, with a cut before each
+    // node with probability 1 - LOCALITY%, and link the runs in random order
+    size_t nruns = 0;
+    for (size_t i = 0; i < N; i++)
+        if ($cut)
+            runs[nruns++] = (uint32_t)i;
+    runs[nruns] = (uint32_t)N;
+    for (size_t r = 0; r < nruns; r++)
+        visit[r] = (uint32_t)r;
+    shuffle(visit, nruns);
+    Node *last = NULL;
+    for (size_t r = 0; r < nruns; r++) {
+        for (uint32_t i = runs[visit[r]]; i < runs[visit[r] + 1]; i++) {
+            if (last)
+                last->next = &nodes[i];
+            else
+                cur = &nodes[i];
+            last = &nodes[i];
+        }
+    }
+    last->next = cur;
+    free(runs);
+    free(visit);"
+      kernel_body="    for (size_t i = 0; i < N; i++) {
+        cur = cur->next;
+        $(emit_access "cur->val" i)
+    }"
+      ;;
+  esac
+
+  cat << EOF
+// $name.c -- generated by benchmarks/synthetic/gen_kernel.sh, do not edit
+// spec: $SPEC
+//
+// Expected Cachegrind misses in kernel(), all $REPS calls together
+// (--D1=$D1 --LL=$LL):
+//   D1mr $d1mr  D1mw $d1mw  DLmr $dlmr  DLmw $dlmw
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef uint$((ELEM > 8 ? 64 : ELEM * 8))_t T;
+
+#define N ((size_t)$N)
+#define REPS $REPS
+#define STRIDE $STRIDE
+#define DEPTH $DEPTH
+#define WRITES $WRITES
+#define LOCALITY $LOCALITY
+#define ELEM $ELEM
+$(if [ "$PATTERN" = nest ]; then j=0; for x in "${d[@]}"; do echo "#define D$j $x"; j=$((j + 1)); done; fi)
+
+$data$(if [ "$PATTERN" = indirect ] || [ "$PATTERN" = chase ]; then cat << 'EOC'
+
+
+static uint64_t rng_state = 88172645463325252ull;
+
+static uint64_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static void shuffle(uint32_t *v, size_t n) {
+    for (size_t i = n; i > 1; i--) {
+        size_t j = rng() % i;
+        uint32_t t = v[i - 1];
+        v[i - 1] = v[j];
+        v[j] = t;
+    }
+}
+EOC
+fi)
+
+__attribute__((noinline)) static uint64_t kernel(void) {
+    uint64_t sum = 0;
+$mix$kernel_body
+    return sum;
+}
+
+int main(void) {
+$init
+
+    uint64_t sum = 0;
+    for (int r = 0; r < REPS; r++)
+        sum += kernel();
+    printf("%llu\n", (unsigned long long)sum);
+    return 0;
+}
+EOF
+}
+
+cmd="$1"
+shift || true
+case "$cmd" in
+  gen) gen "$@" ;;
+  expand)
+    [ $# -eq 1 ] || { show_help; exit 2; }
+    expand "$1"
+    ;;
+  check)
+    [ $# -eq 2 ] || { show_help; exit 2; }
+    check "$1" "$2"
+    ;;
+  -h|--help) show_help ;;
+  *) show_help; exit 2 ;;
+esac
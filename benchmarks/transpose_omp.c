@@ -0,0 +1,48 @@
+// transpose_omp.c
+// transpose.c with the row loop split across OpenMP threads. Each thread
+// reads its own rows of A but writes a column strip of B, so neighbouring
+// threads write different bytes of the same lines of B wherever their
+// strips meet: with schedule(static, CHUNK) and a small CHUNK that is every
+// line (false sharing).
+//
+//   OMP_NUM_THREADS=4 ./transpose_omp
+//
+// Build with -fopenmp (./run.sh -m); without it the pragma is ignored and
+// the program runs serially with the same result.
+#include <stddef.h>
+#include <stdio.h>
+
+#define N 2048
+#ifndef CHUNK
+#define CHUNK 1 // rows per scheduling chunk: 8 doubles share a line of B
+#endif
+
+double A[N][N], B[N][N];
+
+int main(void) {
+    // Initialize A
+    for (size_t i = 0; i < N; i++) {
+        for (size_t j = 0; j < N; j++) {
+            A[i][j] = (double)(i * N + j);
+        }
+    }
+
+    // Naive transpose: the inner loop walks down a column of B
+    #pragma omp parallel for schedule(static, CHUNK)
+    for (size_t i = 0; i < N; i++) {
+        for (size_t j = 0; j < N; j++) {
+            B[j][i] = A[i][j];
+        }
+    }
+
+    // Consume B serially
+    double sum = 0.0;
+    for (size_t i = 0; i < N; i++) {
+        for (size_t j = 0; j < N; j++) {
+            sum += B[i][j] * (double)(j + 1);
+        }
+    }
+
+    printf("transpose_omp %d: weighted sum %.6e\n", N, sum);
+    return 0;
+}
@@ -0,0 +1,97 @@
+// tree_lookup.c
+// Binary search tree lookups: a batch of independent queries, each walking
+// from the root to its key through nodes scattered over the heap.
+//
+//   tree_lookup [keys_log2] [query_factor]
+//
+// 2^keys_log2 nodes inserted in random order (default 20, about 32 MiB) and
+// query_factor times as many lookups (default 2), half of which hit.
+#include <stddef.h>
+
+#include "graph_gen.h"
+
+typedef struct Node {
+    uint64_t key;
+    uint64_t value;
+    struct Node *left;
+    struct Node *right;
+} Node;
+
+Node *tree_find(Node *t, uint64_t key) {
+    while (t && t->key != key)
+        t = key < t->key ? t->left : t->right;
+    return t;
+}
+
+// Sum of the values of the keys found
+uint64_t lookup_all(Node *root, const uint64_t *q, uint64_t nq,
+                    uint64_t *hits) {
+    uint64_t sum = 0, found = 0;
+    for (uint64_t j = 0; j < nq; j++) {
+        Node *t = tree_find(root, q[j]);
+        if (t) {
+            sum += t->value;
+            found++;
+        }
+    }
+    *hits = found;
+    return sum;
+}
+
+static Node *insert(Node *root, Node *n) {
+    Node **p = &root;
+    while (*p)
+        p = n->key < (*p)->key ? &(*p)->left : &(*p)->right;
+    *p = n;
+    return root;
+}
+
+int main(int argc, char **argv) {
+    int keys_log2 = argc > 1 ? atoi(argv[1]) : 20;
+    int query_factor = argc > 2 ? atoi(argv[2]) : 2;
+    if (keys_log2 < 1 || keys_log2 > 28 || query_factor < 1) {
+        fprintf(stderr, "usage: %s [keys_log2 1-28] [query_factor]\n", argv[0]);
+        return 2;
+    }
+
+    uint64_t n = 1ull << keys_log2;
+    uint64_t nq = (uint64_t)query_factor * n;
+
+    // One allocation per node, shuffled so neighbours in the tree are not
+    // neighbours in memory
+    Node **nodes = malloc(n * sizeof(Node *));
+    uint64_t *q = malloc(nq * sizeof(uint64_t));
+    if (!nodes || !q) return 1;
+    for (uint64_t i = 0; i < n; i++) {
+        nodes[i] = malloc(sizeof(Node));
+        if (!nodes[i]) return 1;
+    }
+    for (uint64_t i = n - 1; i > 0; i--) {
+        uint64_t k = gg_rng() % (i + 1);
+        Node *tmp = nodes[i];
+        nodes[i] = nodes[k];
+        nodes[k] = tmp;
+    }
+
+    // Odd keys are in the tree, even keys never match
+    Node *root = NULL;
+    for (uint64_t i = 0; i < n; i++) {
+        nodes[i]->key = 2 * (gg_rng() >> 2) + 1;
+        nodes[i]->value = i;
+        nodes[i]->left = nodes[i]->right = NULL;
+        root = insert(root, nodes[i]);
+    }
+    for (uint64_t j = 0; j < nq; j++)
+        q[j] = (gg_rng() & 1) ? nodes[gg_rng() % n]->key : 2 * (gg_rng() >> 2);
+
+    uint64_t hits;
+    uint64_t sum = lookup_all(root, q, nq, &hits);
+    printf("tree lookup hits %llu, value sum %llu\n", (unsigned long long)hits,
+           (unsigned long long)sum);
+
+    for (uint64_t i = 0; i < n; i++)
+        free(nodes[i]);
+    free(nodes);
+    free(q);
+    return 0;
+}
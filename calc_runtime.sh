@@ -55,12 +55,16 @@ measure_avg_time() {
   shift
 
   local sum="0.0"
+  local out
+  out=$(mktemp)
   for ((i=1; i<=runs; ++i)); do
-    # %e = real time in seconds (float)
+    # %e = real time in seconds (float), kept apart from the program's stderr
     local t
-    t=$(/usr/bin/time -f "%e" "$bin" "$@" 2>&1 >/dev/null)
+    /usr/bin/time -o "$out" -f "%e" "$bin" "$@" >/dev/null 2>&1
+    t=$(tail -n 1 "$out")
     sum=$(echo "$sum + $t" | bc -l)
   done
+  rm -f "$out"
 
   echo "scale=6; $sum / $runs" | bc -l
 }
@@ -145,7 +149,7 @@ clang -O0 -g -emit-llvm -S "$SRC_FILE" -o "$IR_ORIG"
 # STEP 2: Build baseline binary
 ###############################################
 echo "[2] Building baseline binary…"
-clang -O0 -g "$SRC_FILE" -o "$BIN_ORIG"
+clang -O0 -g "$SRC_FILE" -o "$BIN_ORIG" -lm
 
 ###############################################
 # STEP 2.5: Time baseline (real wall-clock)
@@ -183,7 +187,7 @@ opt \
 # STEP 6: Build new binary (default threshold)
 ###############################################
 echo "[6] Building new binary…"
-clang -O0 -g "$IR_OPT" -o "$BIN_OPT"
+clang -O0 -g "$IR_OPT" -o "$BIN_OPT" -lm
 
 ###############################################
 # STEP 6.5: Time optimized (default threshold)
@@ -227,7 +231,7 @@ for TH in "${THRESHOLDS[@]}"; do
     "$IR_ORIG" -o "$IR_OPT_TH"
 
   # Build binary for this threshold
-  clang -O0 -g "$IR_OPT_TH" -o "$BIN_OPT_TH"
+  clang -O0 -g "$IR_OPT_TH" -o "$BIN_OPT_TH" -lm
 
   # Time it NUM_RUNS times and average
   AVG_TH=$(measure_avg_time "$NUM_RUNS" "$BIN_OPT_TH" "${PROG_ARGS[@]}")
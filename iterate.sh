@@ -0,0 +1,177 @@
+#!/usr/bin/env bash
+# Closed-loop prefetch tuning: profile, optimize, re-profile, retune
+# Usage:
+#   ./iterate.sh [-n max_iters] <sourcefile.c> [program args...]
+
+set -e
+set -o pipefail
+
+###############################################
+# CONFIG
+###############################################
+
+PASS="./build/profiler/ParseCachegrindPass.so"
+MAX_ITERS=6    # optimize/re-profile rounds before giving up on convergence
+
+show_help() {
+  cat << EOF
+Usage: $0 [-n max_iters] <source_file.c> [program args...]
+
+Tunes prefetch sites against Cachegrind instead of trusting one profile:
+  1. Profile the baseline binary (once)
+  2. Insert prefetches for hot lines at the distance the cache target
+     suggests (see -cache-target)
+  3. Build and profile the result
+  4. Per site, compare its line against the baseline (misses saved vs
+     extra Ir): keep doubling the distance while that improves, fall back
+     to the best distance once it stops, prune sites that never paid off
+  5. Repeat 3-4 until no site is still tuning or max_iters is reached
+
+The final per-site decisions are written to build/<name>.decisions (and
+as a plan to build/<name>.plan.json) and can be replayed without Valgrind:
+  opt -load-pass-plugin $PASS -passes=parse-cachegrind \\
+      -cache-apply-plan=build/<name>.plan.json in.ll -o out.ll
+
+Options:
+  -n N    At most N optimize/re-profile rounds (default ${MAX_ITERS})
+  -h      Show help
+EOF
+}
+
+while getopts ":n:h" opt; do
+    case $opt in
+        n) MAX_ITERS="$OPTARG" ;;
+        h) show_help; exit 0 ;;
+        \?)
+            echo "Invalid option: -$OPTARG" >&2
+            show_help
+            exit 1
+            ;;
+    esac
+done
+
+shift $((OPTIND -1))
+
+if [ $# -lt 1 ] || [ ! -f "$1" ]; then
+    echo "Error: Missing or nonexistent <source_file.c>"
+    show_help
+    exit 1
+fi
+
+SRC_FILE=$1
+shift
+PROG_ARGS=("$@")
+
+if [ ! -f "$PASS" ]; then
+    echo "ERROR: Could not find LLVM pass at: $PASS"
+    exit 1
+fi
+
+echo "[0] Compiling LLVM Pass…"
+cmake --build ./build/ -j
+
+BASENAME=$(basename "$SRC_FILE")
+NAME="./build/${BASENAME%.*}"
+IR_ORIG="$NAME.ll"
+IR_OPT="$NAME.iter.ll"
+BIN_ORIG="$NAME.orig"
+BIN_OPT="$NAME.iter"
+CG_ANN="$NAME.cgann"
+CG_ANN_OPT="$NAME.iter.cgann"
+DECISIONS="$NAME.decisions"
+NEXT_DECISIONS="$NAME.decisions.next"
+OPT_LOG="$NAME.opt.log"
+
+profile() {
+  local bin="$1" out="$2"
+  valgrind --tool=cachegrind \
+    --cache-sim=yes --branch-sim=no \
+    --cachegrind-out-file="$out.raw" \
+    "$bin" "${PROG_ARGS[@]}" > /dev/null
+  cg_annotate --auto=yes --show-percs=no "$out.raw" > "$out"
+  rm -f "$out.raw"
+}
+
+# Run parse-cachegrind with the given options, showing the lines of its
+# output that match $1 (none if it is empty). Stops the script, with all of opt's output, if opt
+# fails.
+run_pass() {
+  local filter="$1"
+  shift
+  if ! opt -load-pass-plugin "$PASS" -passes="parse-cachegrind" "$@" \
+      2> "$OPT_LOG"; then
+    cat "$OPT_LOG" >&2
+    echo "ERROR: opt failed" >&2
+    exit 1
+  fi
+  [ -z "$filter" ] || grep -E "$filter" "$OPT_LOG" || true
+}
+
+data_misses() {
+  grep "PROGRAM TOTALS" "$1" | awk '{
+    for (i = 1; i <= 9; ++i) gsub(",", "", $i);
+    print $5 + $6 + $8 + $9 }'
+}
+
+###############################################
+# STEP 1: Baseline profile
+###############################################
+echo "[1] Profiling baseline…"
+clang -O0 -g -emit-llvm -S "$SRC_FILE" -o "$IR_ORIG"
+clang -O0 -g "$SRC_FILE" -o "$BIN_ORIG" -lm
+profile "$BIN_ORIG" "$CG_ANN"
+echo "  baseline data misses: $(data_misses "$CG_ANN")"
+
+###############################################
+# STEPS 2-5: Optimize, re-profile, retune
+###############################################
+rm -f "$DECISIONS"
+for ((iter=1; iter<=MAX_ITERS; ++iter)); do
+  echo "[2] Round $iter: optimizing…"
+  RETUNE_ARGS=()
+  if [ -f "$DECISIONS" ]; then
+    RETUNE_ARGS=(-cache-prefetch-decisions="$DECISIONS"
+                 -cache-retune-profile="$CG_ANN_OPT")
+  fi
+  run_pass "^(Retune|parse-cachegrind)" \
+    -cache-cg-file="$CG_ANN" \
+    "${RETUNE_ARGS[@]}" \
+    -cache-prefetch-decisions-out="$NEXT_DECISIONS" \
+    "$IR_ORIG" -o "$IR_OPT"
+  mv "$NEXT_DECISIONS" "$DECISIONS"
+
+  if ! grep -q " tune$" "$DECISIONS"; then
+    echo "  converged after $iter rounds"
+    break
+  fi
+
+  echo "[3] Round $iter: profiling…"
+  clang -O0 -g "$IR_OPT" -o "$BIN_OPT" -lm
+  profile "$BIN_OPT" "$CG_ANN_OPT"
+  echo "  data misses: $(data_misses "$CG_ANN_OPT")"
+done
+
+# Out of budget: settle sites still tuning on their best measured distance
+if grep -q " tune$" "$DECISIONS"; then
+  echo "  budget of $MAX_ITERS rounds used up, settling remaining sites"
+  run_pass "^Retune" \
+    -cache-cg-file="$CG_ANN" \
+    -cache-prefetch-decisions="$DECISIONS" \
+    -cache-retune-profile="$CG_ANN_OPT" \
+    -cache-retune-max-distance=0 \
+    -cache-prefetch-decisions-out="$NEXT_DECISIONS" \
+    "$IR_ORIG" -o /dev/null
+  mv "$NEXT_DECISIONS" "$DECISIONS"
+fi
+
+# The same decisions as a plan, for -cache-apply-plan
+run_pass "" \
+  -cache-prefetch-decisions="$DECISIONS" \
+  -cache-emit-plan="$NAME.plan.json" \
+  "$IR_ORIG" -o /dev/null
+
+echo
+echo "Final decisions ($DECISIONS, plan in $NAME.plan.json):"
+column -t "$DECISIONS" | sed 's/^/  /'
+
+rm -f "$IR_OPT" "$BIN_OPT" "$CG_ANN_OPT" "$OPT_LOG"
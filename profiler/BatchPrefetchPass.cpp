@@ -0,0 +1,827 @@
+#include "ParseCachegrindPass.h"
+
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallVector.h"
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<unsigned> BatchSize(
+    "batch-size",
+    cl::desc("Iterations per batch whose addresses are prefetched together "
+             "(rounded up to a power of two)"),
+    cl::init(16));
+
+static cl::opt<unsigned> BatchMaxStages(
+    "batch-max-stages",
+    cl::desc("Most dependent levels of loads prefetched per batch (group "
+             "prefetching stages)"),
+    cl::init(3));
+
+static cl::opt<unsigned> CoroWidth(
+    "coro-width",
+    cl::desc("Lookups interleaved per batch by cachegrind-coro (rounded up "
+             "to a power of two)"),
+    cl::init(8));
+
+/**
+ * Batched (group) prefetching of hot indirect loads, after Chen et al.'s
+ * group prefetching for hash joins (ICDE'04) and in the spirit of AMAC.
+ *
+ * In `for (j...) for (i = head[hash(s[j])]; i != NIL; i = next[i]) ...`
+ * each iteration of the outer loop waits for its own bucket: one miss is
+ * outstanding at a time, though the lookups of different iterations are
+ * independent. The loop is strip-mined into batches of B (-batch-size)
+ * iterations, and each batch starts with address-generation sub-loops:
+ *
+ *   for (j...) {
+ *     if (k % B == 0)                          ; k: iterations so far
+ *       for (s = 0; s < stages; s++)           ; one sub-loop per stage
+ *         for (t = 0; t < min(B, n - k); t++)
+ *           prefetch(level-s addresses of iteration j + t)
+ *     ...original body...                      ; the work sub-loop
+ *   }
+ *
+ * so up to B misses per level are in flight together. The work sub-loop is
+ * the original body, left in place.
+ *
+ * Targets are hot loads (-cache-miss-threshold) whose address is not
+ * affine in the loop (affine ones are the prefetch pass's job): loads in the
+ * loop's own blocks, and the first iteration of loads in a directly nested
+ * loop whose address depends only on that loop's header phi (the first node
+ * of a bucket chain). A target's level is the number of targets its address
+ * depends on: level 0 is prefetched first, and a later stage loads the
+ * (now cached) values of earlier levels to compute its addresses, as group
+ * prefetching's stages do. Up to -batch-max-stages levels are prefetched.
+ *
+ * The address slice is recomputed for iteration j + t from the loop's
+ * induction variable. It may contain arithmetic, GEPs, casts, loads and
+ * calls to functions that only touch their own stack frame (a hash
+ * function). Loads and calls must execute in every iteration (dominate the
+ * latch), and no store or call in the loop may alias the loads. The
+ * slice then computes exactly what iteration j + t will, and loads nothing
+ * that iteration doesn't. The target itself is only prefetched. The loop
+ * needs an integer induction variable with a constant step, a computable
+ * trip count and a single exit at its header or latch.
+ *
+ * -O0 IR keeps induction variables in allocas, so as for software
+ * pipelining a hot function is promoted to SSA (mem2reg) only if a promoted
+ * copy of it has a candidate loop.
+ *
+ * cachegrind-coro batches calls instead of loads. Its target is a call to a
+ * lookup that createLookupCoroutine() (CoroInterleave.cpp) can make into a
+ * coroutine, and that is marked cp_interleave or has a hot line itself. A
+ * batch of -coro-width iterations starts with one sub-loop that computes the
+ * call's arguments for each iteration and starts its lookup, which runs to
+ * its first prefetch. The scheduler then runs the lookups round-robin to
+ * completion, and the body reads its iteration's result from a buffer:
+ *
+ *   if (k % W == 0) {
+ *     for (t = 0; t < min(W, n - k); t++)
+ *       h[t] = lookup.coro(args of iteration j + t, &r[t])
+ *     cp.co.run(h, min(W, n - k))
+ *   }
+ *   x = r[k % W]                              ; was x = lookup(args)
+ *
+ * The call must run in every iteration, with arguments sliced as above, and
+ * its own line or some line of the loop must be hot: a hot lookup called
+ * from a setup loop that runs a handful of times isn't worth a batch.
+ * Running a batch's lookups first moves them ahead of the loop's other work,
+ * so the loop may write no memory, or the lookup must be marked: the mark
+ * promises that its data isn't changed by the loop.
+ */
+struct BatchPrefetchImpl {
+  Module &M;
+  const CachegrindProfile &Profile;
+  const std::map<FileLinePair, CacheMetrics> &lineMetrics;
+  /// Batch calls to lookups as coroutines (cachegrind-coro)
+  bool Interleave;
+  const char *Prefix;
+
+  /// Coroutine of each lookup callee, or null if it can't have one
+  std::map<Function *, Function *> Coroutines;
+
+  /// Functions that read and write only their own allocas, by callee
+  std::map<const Function *, bool> PureCallees;
+  /// Level of each instruction of the slice being built
+  DenseMap<Instruction *, unsigned> SliceLevels;
+  const DenseMap<LoadInst *, unsigned> NoLevels;
+  const std::vector<Instruction *> NoWrites;
+
+  /// One hot load to prefetch, and the level of loads it depends on
+  struct Target {
+    LoadInst *Load;
+    /// Header phi of the nested loop whose first iteration is prefetched,
+    /// or null for a load in the batched loop itself
+    PHINode *Inner;
+    unsigned Level;
+  };
+
+  struct Candidate {
+    Loop *L = nullptr;
+    PHINode *IV = nullptr;
+    int64_t Step = 0;
+    const SCEV *BTC = nullptr;
+    BasicBlock *BodyEntry = nullptr;
+    std::vector<Target> Targets;
+    /// The lookup call, and its coroutine, for cachegrind-coro
+    CallInst *Call = nullptr;
+    Function *Coro = nullptr;
+  };
+
+  BatchPrefetchImpl(Module &M, const CachegrindProfile &Profile,
+                    bool Interleave)
+      : M(M), Profile(Profile), lineMetrics(Profile.LineMetrics),
+        Interleave(Interleave), Prefix(Interleave ? "coro" : "batch") {}
+
+  bool isHotLine(const Instruction &I) {
+    FileLinePair fl;
+    if (!Profile.getFileLine(I, fl))
+      return false;
+    auto it = lineMetrics.find(fl);
+    return it != lineMetrics.end() &&
+           it->second.totalMisses() >= MissThreshold;
+  }
+
+  bool hasHotLine(Function &F) {
+    for (Instruction &I : instructions(F))
+      if (isa<LoadInst>(I) && isHotLine(I))
+        return true;
+    return false;
+  }
+
+  /// Whether some line of L has missed, so that a lookup called from it is
+  /// worth batching.
+  bool isHotLoop(Loop *L) {
+    for (BasicBlock *BB : L->blocks())
+      for (Instruction &I : *BB)
+        if (isHotLine(I))
+          return true;
+    return false;
+  }
+
+  /// The coroutine for calls to Callee, made on first use if Callee is
+  /// marked or has a hot line.
+  Function *getCoroutine(Function *Callee) {
+    if (!Callee || Callee->isDeclaration())
+      return nullptr;
+    auto It = Coroutines.find(Callee);
+    if (It != Coroutines.end())
+      return It->second;
+    Function *Coro = nullptr;
+    unsigned Suspends = 0;
+    if (isInterleaveMarked(*Callee) || hasHotLine(*Callee))
+      Coro = createLookupCoroutine(*Callee, Suspends);
+    if (Coro)
+      errs() << "coro: " << Callee->getName() << " suspends after "
+             << Suspends << " next-node load(s)\n";
+    return Coroutines[Callee] = Coro;
+  }
+
+  bool callsLookup(Function &F) {
+    for (Instruction &I : instructions(F))
+      if (auto *CI = dyn_cast<CallInst>(&I))
+        if (getCoroutine(CI->getCalledFunction()))
+          return true;
+    return false;
+  }
+
+  /// Does F read and write only its own allocas (and call only such
+  /// functions)? -O0 hash functions spill their arguments, so readnone
+  /// isn't inferred for them.
+  bool isPureCallee(const Function *F, unsigned Depth = 0) {
+    if (!F || F->isDeclaration() || F->isVarArg() || Depth > 4)
+      return false;
+    auto It = PureCallees.find(F);
+    if (It != PureCallees.end())
+      return It->second;
+    PureCallees[F] = false; // recursion isn't pure enough
+    bool Pure = true;
+    for (const Instruction &I : instructions(F)) {
+      if (isa<DbgInfoIntrinsic>(I))
+        continue;
+      if (auto *CB = dyn_cast<CallBase>(&I)) {
+        if (!CB->doesNotAccessMemory() &&
+            !isPureCallee(CB->getCalledFunction(), Depth + 1))
+          Pure = false;
+      } else if (I.mayReadOrWriteMemory()) {
+        const Value *Ptr = getLoadStorePointerOperand(&I);
+        if (!Ptr || !isa<AllocaInst>(getUnderlyingObject(Ptr)) ||
+            I.isVolatile())
+          Pure = false;
+      }
+      if (!Pure)
+        break;
+    }
+    return PureCallees[F] = Pure;
+  }
+
+  /**
+   * Collects the instructions computing V in one iteration of L, defs
+   * before uses, with Subst's values standing for the keys. Returns false
+   * if V depends on anything but loop invariants, Subst's keys, and the
+   * instructions allowed in a slice (see above). Level is the most targets
+   * (Levels' keys) on one path to V.
+   */
+  bool slice(Value *V, Loop *L, LoopInfo &LI, DominatorTree &DT,
+             const DenseMap<Value *, Value *> &Subst,
+             const DenseMap<LoadInst *, unsigned> &Levels,
+             const std::vector<Instruction *> &Writes, AAResults &AA,
+             SetVector<Instruction *> &Out, unsigned &Level) {
+    auto *I = dyn_cast<Instruction>(V);
+    if (!I || !L->contains(I) || Subst.count(I))
+      return true;
+    if (Out.count(I)) {
+      Level = std::max(Level, SliceLevels.lookup(I));
+      return true;
+    }
+    if (isa<PHINode>(I))
+      return false; // another recurrence
+
+    bool MustDominate = false;
+    if (auto *LD = dyn_cast<LoadInst>(I)) {
+      if (!LD->isSimple())
+        return false;
+      MemoryLocation Loc = MemoryLocation::get(LD);
+      for (Instruction *W : Writes) {
+        auto *SI = dyn_cast<StoreInst>(W);
+        if (!SI || !AA.isNoAlias(Loc, MemoryLocation::get(SI)))
+          return false;
+      }
+      MustDominate = true;
+    } else if (auto *CI = dyn_cast<CallInst>(I)) {
+      if (!isPureCallee(CI->getCalledFunction()))
+        return false;
+      MustDominate = true;
+    } else if (!isSafeToSpeculativelyExecute(I)) {
+      return false;
+    }
+    if (MustDominate && (LI.getLoopFor(I->getParent()) != L ||
+                         !DT.dominates(I->getParent(), L->getLoopLatch())))
+      return false;
+
+    unsigned OpLevel = 0;
+    for (Value *Op : I->operands())
+      if (!slice(Op, L, LI, DT, Subst, Levels, Writes, AA, Out, OpLevel))
+        return false;
+    if (auto *LD = dyn_cast<LoadInst>(I))
+      if (Levels.count(LD))
+        OpLevel = std::max(OpLevel, Levels.lookup(LD) + 1);
+    Level = std::max(Level, OpLevel);
+    SliceLevels[I] = OpLevel;
+    Out.insert(I);
+    return true;
+  }
+
+  /// The integer induction variable of L with a constant step, if any.
+  static PHINode *findIV(Loop *L, ScalarEvolution &SE, int64_t &Step) {
+    for (PHINode &P : L->getHeader()->phis()) {
+      if (!P.getType()->isIntegerTy() || !SE.isSCEVable(P.getType()))
+        continue;
+      auto *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(&P));
+      if (!AR || AR->getLoop() != L || !AR->isAffine())
+        continue;
+      auto *C = dyn_cast<SCEVConstant>(AR->getStepRecurrence(SE));
+      if (!C || C->getAPInt().getMinSignedBits() > 64)
+        continue;
+      Step = C->getAPInt().getSExtValue();
+      return &P;
+    }
+    return nullptr;
+  }
+
+  bool findCandidate(Loop *L, ScalarEvolution &SE, DominatorTree &DT,
+                     LoopInfo &LI, AAResults &AA, Candidate &C) {
+    BasicBlock *Header = L->getHeader();
+    BasicBlock *Latch = L->getLoopLatch();
+    BasicBlock *Exiting = L->getExitingBlock();
+    if (!L->getLoopPreheader() || !Latch || !Exiting ||
+        (Exiting != Header && Exiting != Latch))
+      return false;
+
+    // The body starts where an iteration that won't exit begins
+    BasicBlock *BodyEntry = Header;
+    if (Exiting == Header && Exiting != Latch) {
+      auto *Br = dyn_cast<BranchInst>(Header->getTerminator());
+      if (!Br || !Br->isConditional())
+        return false;
+      BodyEntry = Br->getSuccessor(L->contains(Br->getSuccessor(0)) ? 0 : 1);
+      if (BodyEntry->getSinglePredecessor() != Header)
+        return false;
+    }
+
+    const SCEV *BTC = SE.getBackedgeTakenCount(L);
+    if (isa<SCEVCouldNotCompute>(BTC) || !isSafeToExpand(BTC, SE))
+      return false;
+    int64_t Step = 0;
+    PHINode *IV = findIV(L, SE, Step);
+    if (!IV)
+      return false;
+
+    std::vector<Instruction *> Writes;
+    for (BasicBlock *BB : L->blocks())
+      for (Instruction &I : *BB)
+        if (I.mayWriteToMemory() && !isHarmlessCall(I) &&
+            !(isa<CallInst>(I) && cast<CallInst>(I).getCalledFunction() &&
+              writesOnlyStack(*cast<CallInst>(I).getCalledFunction())))
+          Writes.push_back(&I);
+
+    C.L = L;
+    C.IV = IV;
+    C.Step = Step;
+    C.BTC = BTC;
+    C.BodyEntry = BodyEntry;
+    if (Interleave)
+      return findLookupCall(C, Writes, LI, DT, AA);
+
+    // Hot loads with a non-affine address: in L, or the first iteration of
+    // a directly nested loop
+    std::vector<Target> Hot;
+    for (BasicBlock *BB : L->blocks()) {
+      Loop *Owner = LI.getLoopFor(BB);
+      if (Owner != L && Owner->getParentLoop() != L)
+        continue;
+      for (Instruction &I : *BB) {
+        auto *LD = dyn_cast<LoadInst>(&I);
+        if (!LD || !LD->isSimple() || !isHotLine(*LD))
+          continue;
+        auto *AR = dyn_cast<SCEVAddRecExpr>(
+            SE.getSCEV(LD->getPointerOperand()));
+        if (AR && AR->getLoop() == L)
+          continue;
+        PHINode *Inner = nullptr;
+        if (Owner != L) {
+          if (!Owner->getLoopPreheader() || !L->contains(
+                                                Owner->getLoopPreheader()))
+            continue;
+          for (PHINode &P : Owner->getHeader()->phis()) {
+            SetVector<Instruction *> Probe;
+            DenseMap<Value *, Value *> Subst{{&P, nullptr}};
+            unsigned Unused = 0;
+            // Only arithmetic on the first node: it may be the null end
+            if (slice(LD->getPointerOperand(), Owner, LI, DT, Subst, NoLevels,
+                      Writes, AA, Probe, Unused) &&
+                llvm::none_of(Probe, [](Instruction *I) {
+                  return isa<LoadInst>(I) || isa<CallInst>(I);
+                })) {
+              Inner = &P;
+              break;
+            }
+          }
+          if (!Inner)
+            continue;
+        }
+        Hot.push_back({LD, Inner, 0});
+      }
+    }
+    if (Hot.empty())
+      return false;
+
+    // Levels in dependence order: a target's slice can only contain
+    // targets that come before it in the body
+    DenseMap<LoadInst *, unsigned> Levels;
+    DenseMap<Value *, Value *> Subst{{IV, nullptr}};
+    for (Target &T : Hot) {
+      SetVector<Instruction *> Slice;
+      unsigned Level = 0;
+      Value *Addr = T.Load->getPointerOperand();
+      bool OK = true;
+      if (T.Inner) {
+        // Inside the nested loop, the header phi is its first value
+        SetVector<Instruction *> InnerSlice;
+        DenseMap<Value *, Value *> InnerSubst{{T.Inner, nullptr}};
+        unsigned Unused = 0;
+        Loop *Owner = LI.getLoopFor(T.Load->getParent());
+        slice(Addr, Owner, LI, DT, InnerSubst, NoLevels, NoWrites, AA,
+              InnerSlice, Unused);
+        Addr = T.Inner->getIncomingValueForBlock(Owner->getLoopPreheader());
+        for (Instruction *I : InnerSlice)
+          for (Value *Op : I->operands())
+            if (auto *OpI = dyn_cast<Instruction>(Op))
+              if (!Owner->contains(OpI) && L->contains(OpI))
+                OK &= slice(OpI, L, LI, DT, Subst, Levels, Writes, AA, Slice,
+                            Level);
+      }
+      OK &= slice(Addr, L, LI, DT, Subst, Levels, Writes, AA, Slice, Level);
+      if (!OK || Level >= BatchMaxStages)
+        continue;
+      T.Level = Level;
+      Levels[T.Load] = Level;
+      C.Targets.push_back(T);
+    }
+    return !C.Targets.empty();
+  }
+
+  /// The first call in C's loop body to a lookup with a coroutine whose
+  /// arguments can be computed ahead, if the call or the loop is hot.
+  bool findLookupCall(Candidate &C, const std::vector<Instruction *> &Writes,
+                      LoopInfo &LI, DominatorTree &DT, AAResults &AA) {
+    Loop *L = C.L;
+    bool HotLoop = isHotLoop(L);
+    DenseMap<Value *, Value *> Subst{{C.IV, nullptr}};
+    for (BasicBlock *BB : L->blocks()) {
+      if (LI.getLoopFor(BB) != L || !DT.dominates(C.BodyEntry, BB) ||
+          !DT.dominates(BB, L->getLoopLatch()))
+        continue;
+      for (Instruction &I : *BB) {
+        auto *CI = dyn_cast<CallInst>(&I);
+        if (!CI || CI->isMustTailCall() || !(HotLoop || isHotLine(*CI)))
+          continue;
+        Function *Coro = getCoroutine(CI->getCalledFunction());
+        if (!Coro)
+          continue;
+        if (!Writes.empty() && !isInterleaveMarked(*CI->getCalledFunction()))
+          continue;
+        SetVector<Instruction *> Slice;
+        unsigned Level = 0;
+        bool OK = true;
+        for (Value *Arg : CI->args())
+          OK &= slice(Arg, L, LI, DT, Subst, NoLevels, Writes, AA, Slice,
+                      Level);
+        if (!OK)
+          continue;
+        C.Call = CI;
+        C.Coro = Coro;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// Clone I with Map's operands. The address of the first node may be
+  /// computed from the end-of-chain value, so no poison flags.
+  static Instruction *cloneInto(Instruction *I,
+                                const DenseMap<Value *, Value *> &Map,
+                                IRBuilder<> &Builder) {
+    Instruction *New = I->clone();
+    for (Use &U : New->operands())
+      if (Value *R = Map.lookup(U.get()))
+        U.set(R);
+    New->dropPoisonGeneratingFlags();
+    Builder.Insert(New, I->getName() + ".batch");
+    return New;
+  }
+
+  /// Clone V's slice in C's loop into Builder, for the iteration whose
+  /// induction variable Map gives.
+  Value *cloneValue(const Candidate &C, Value *V,
+                    DenseMap<Value *, Value *> &Map, LoopInfo &LI,
+                    DominatorTree &DT, AAResults &AA, IRBuilder<> &Builder) {
+    SetVector<Instruction *> Slice;
+    DenseMap<Value *, Value *> Subst{{C.IV, nullptr}};
+    unsigned Unused = 0;
+    slice(V, C.L, LI, DT, Subst, NoLevels, NoWrites, AA, Slice, Unused);
+    for (Instruction *I : Slice)
+      if (!Map.count(I))
+        Map[I] = cloneInto(I, Map, Builder);
+    Value *R = Map.lookup(V);
+    return R ? R : V;
+  }
+
+  /// Clone the address of T into Builder, for the iteration whose
+  /// induction variable Map gives. Map collects the clones, so targets of
+  /// one stage share their common slice.
+  Value *cloneAddress(const Candidate &C, const Target &T,
+                      DenseMap<Value *, Value *> &Map, LoopInfo &LI,
+                      DominatorTree &DT, AAResults &AA,
+                      IRBuilder<> &Builder) {
+    Loop *L = C.L;
+    auto CloneSlice = [&](Value *V, Loop *In, PHINode *Phi) {
+      SetVector<Instruction *> Slice;
+      DenseMap<Value *, Value *> Subst{{In == L ? C.IV : Phi, nullptr}};
+      unsigned Unused = 0;
+      slice(V, In, LI, DT, Subst, NoLevels, NoWrites, AA, Slice, Unused);
+      for (Instruction *I : Slice) {
+        if (Map.count(I))
+          continue;
+        Map[I] = cloneInto(I, Map, Builder);
+      }
+      Value *R = Map.lookup(V);
+      return R ? R : V;
+    };
+
+    if (!T.Inner)
+      return CloneSlice(T.Load->getPointerOperand(), L, nullptr);
+    Loop *Owner = LI.getLoopFor(T.Load->getParent());
+    Value *First = CloneSlice(
+        T.Inner->getIncomingValueForBlock(Owner->getLoopPreheader()), L,
+        nullptr);
+    Map[T.Inner] = First;
+    // The nested loop's address computation only uses First and values
+    // defined outside it
+    SetVector<Instruction *> Slice;
+    DenseMap<Value *, Value *> Subst{{T.Inner, nullptr}};
+    unsigned Unused = 0;
+    slice(T.Load->getPointerOperand(), Owner, LI, DT, Subst, NoLevels,
+          NoWrites, AA, Slice, Unused);
+    for (Instruction *I : Slice)
+      for (Value *Op : I->operands())
+        if (auto *OpI = dyn_cast<Instruction>(Op))
+          if (!Owner->contains(OpI) && L->contains(OpI))
+            CloneSlice(OpI, L, nullptr);
+    for (Instruction *I : Slice)
+      Map[I] = cloneInto(I, Map, Builder);
+    return Map.lookup(T.Load->getPointerOperand());
+  }
+
+  void batchLoop(Candidate &C, ScalarEvolution &SE, LoopInfo &LI,
+                 DominatorTree &DT, AAResults &AA) {
+    Loop *L = C.L;
+    BasicBlock *Preheader = L->getLoopPreheader();
+    BasicBlock *Header = L->getHeader();
+    BasicBlock *Latch = L->getLoopLatch();
+    LLVMContext &Ctx = M.getContext();
+    Type *I8PtrTy = Type::getInt8PtrTy(Ctx);
+    Type *CountTy = C.BTC->getType();
+    Function *Prefetch =
+        Intrinsic::getDeclaration(&M, Intrinsic::prefetch, {I8PtrTy});
+
+    unsigned B = 1;
+    while (B < std::max(2u, (unsigned)(Interleave ? CoroWidth : BatchSize)))
+      B <<= 1;
+    unsigned Stages = Interleave ? 1 : 0;
+    for (const Target &T : C.Targets)
+      Stages = std::max(Stages, T.Level + 1);
+    DebugLoc DL = Interleave ? C.Call->getDebugLoc()
+                             : C.Targets.front().Load->getDebugLoc();
+
+    // Iterations in all: BTC, or BTC + 1 if the exit test is at the latch
+    SCEVExpander Expander(SE, M.getDataLayout(), "batch");
+    const SCEV *NumS = C.BTC;
+    if (L->getExitingBlock() == Latch)
+      NumS = SE.getAddExpr(C.BTC, SE.getOne(CountTy));
+    Value *Num = Expander.expandCodeFor(NumS, CountTy,
+                                        Preheader->getTerminator());
+
+    // Iteration counter k: 0, 1, 2, ...
+    IRBuilder<> Builder(&Header->front());
+    PHINode *Iter = Builder.CreatePHI(CountTy, 2, "batch.iter");
+    Builder.SetInsertPoint(Latch->getTerminator());
+    Value *IterNext = Builder.CreateAdd(Iter, ConstantInt::get(CountTy, 1),
+                                        "batch.iter.next");
+    Iter->addIncoming(ConstantInt::get(CountTy, 0), Preheader);
+    Iter->addIncoming(IterNext, Latch);
+
+    // Every B iterations: stage sub-loops over min(B, Num - k) iterations
+    BasicBlock *Entry = C.BodyEntry;
+    BasicBlock *Rest =
+        SplitBlock(Entry, &*Entry->getFirstInsertionPt(), &DT, &LI);
+    Rest->setName(Entry->getName() + ".work");
+    Entry->getTerminator()->eraseFromParent();
+    Builder.SetInsertPoint(Entry);
+    Builder.SetCurrentDebugLocation(DL);
+    Value *Left = Builder.CreateSub(Num, Iter, "batch.left");
+    Value *Count = Builder.CreateSelect(
+        Builder.CreateICmpULT(Left, ConstantInt::get(CountTy, B)), Left,
+        ConstantInt::get(CountTy, B), "batch.count");
+    Value *Start = Builder.CreateICmpEQ(
+        Builder.CreateAnd(Iter, ConstantInt::get(CountTy, B - 1)),
+        ConstantInt::get(CountTy, 0), "batch.start");
+
+    Function *F = Header->getParent();
+    std::vector<BasicBlock *> StageBBs;
+    for (unsigned s = 0; s < Stages; ++s)
+      StageBBs.push_back(BasicBlock::Create(
+          Ctx, "batch.stage" + std::to_string(s), F, Rest));
+    Builder.CreateCondBr(Start, StageBBs[0], Rest);
+
+    // Handles and results of a batch of lookups
+    Type *RetTy = Interleave ? C.Call->getType() : nullptr;
+    ArrayType *HandlesTy = ArrayType::get(I8PtrTy, B);
+    ArrayType *ResultsTy = Interleave ? ArrayType::get(RetTy, B) : nullptr;
+    Value *Handles = nullptr, *Results = nullptr;
+    BasicBlock *RunBB = nullptr;
+    if (Interleave) {
+      IRBuilder<> EntryBuilder(&*F->getEntryBlock().getFirstInsertionPt());
+      Handles = EntryBuilder.CreateAlloca(HandlesTy, nullptr, "coro.handles");
+      if (!RetTy->isVoidTy())
+        Results = EntryBuilder.CreateAlloca(ResultsTy, nullptr,
+                                            "coro.results");
+      RunBB = BasicBlock::Create(Ctx, "coro.run", F, Rest);
+    }
+
+    Type *IVTy = C.IV->getType();
+    for (unsigned s = 0; s < Stages; ++s) {
+      BasicBlock *BB = StageBBs[s];
+      BasicBlock *Next =
+          s + 1 < Stages ? StageBBs[s + 1] : Interleave ? RunBB : Rest;
+      Builder.SetInsertPoint(BB);
+      PHINode *T = Builder.CreatePHI(CountTy, 2, "batch.t");
+      T->addIncoming(ConstantInt::get(CountTy, 0),
+                     s ? StageBBs[s - 1] : Entry);
+      Value *Offset = Builder.CreateZExtOrTrunc(T, IVTy);
+      if (C.Step != 1)
+        Offset =
+            Builder.CreateMul(Offset, ConstantInt::get(IVTy, C.Step, true));
+      Value *IVj = Builder.CreateAdd(C.IV, Offset, "batch.iv");
+
+      DenseMap<Value *, Value *> Map{{C.IV, IVj}};
+      if (Interleave) {
+        // h[t] = lookup.coro(args of iteration j + t, &r[t])
+        SmallVector<Value *, 8> Args;
+        for (Value *Arg : C.Call->args())
+          Args.push_back(cloneValue(C, Arg, Map, LI, DT, AA, Builder));
+        if (Results)
+          Args.push_back(Builder.CreateInBoundsGEP(
+              ResultsTy, Results,
+              {Builder.getInt64(0), Builder.CreateZExtOrTrunc(
+                                        T, Builder.getInt64Ty())}));
+        Value *H = Builder.CreateCall(C.Coro, Args, "coro.h");
+        Builder.CreateStore(
+            H, Builder.CreateInBoundsGEP(
+                   HandlesTy, Handles,
+                   {Builder.getInt64(0),
+                    Builder.CreateZExtOrTrunc(T, Builder.getInt64Ty())}));
+      }
+      std::vector<Value *> Issued;
+      for (const Target &Tg : C.Targets) {
+        if (Tg.Level != s)
+          continue;
+        Value *Addr = cloneAddress(C, Tg, Map, LI, DT, AA, Builder);
+        if (std::find(Issued.begin(), Issued.end(), Addr) != Issued.end())
+          continue;
+        Issued.push_back(Addr);
+        Builder.CreateCall(Prefetch,
+                           {Builder.CreatePointerCast(Addr, I8PtrTy),
+                            Builder.getInt32(0), Builder.getInt32(3),
+                            Builder.getInt32(1)});
+      }
+
+      Value *TNext =
+          Builder.CreateAdd(T, ConstantInt::get(CountTy, 1), "batch.t.next");
+      T->addIncoming(TNext, BB);
+      Builder.CreateCondBr(Builder.CreateICmpULT(TNext, Count), BB, Next);
+    }
+
+    if (!Interleave) {
+      FileLinePair fl;
+      Profile.getFileLine(*C.Targets.front().Load, fl);
+      errs() << "batch: loop with hot load at " << fl.first << ":"
+             << fl.second << " in batches of " << B << ", "
+             << C.Targets.size() << " load(s) in " << Stages
+             << " stage(s)\n";
+      return;
+    }
+
+    // Run the batch, then read each iteration's result from r[k % W]
+    Builder.SetInsertPoint(RunBB);
+    Builder.CreateCall(
+        getCoroScheduler(M),
+        {Builder.CreateConstInBoundsGEP2_64(
+             HandlesTy, Handles, 0, 0),
+         Builder.CreateZExtOrTrunc(Count, Builder.getInt64Ty())});
+    Builder.CreateBr(Rest);
+
+    CallInst *Call = C.Call;
+    Builder.SetInsertPoint(Call);
+    if (Results) {
+      Value *Slot = Builder.CreateZExtOrTrunc(
+          Builder.CreateAnd(Iter, ConstantInt::get(CountTy, B - 1)),
+          Builder.getInt64Ty(), "coro.slot");
+      Value *Result = Builder.CreateLoad(
+          RetTy,
+          Builder.CreateInBoundsGEP(ResultsTy,
+                                    Results, {Builder.getInt64(0), Slot}),
+          Call->getName() + ".result");
+      Call->replaceAllUsesWith(Result);
+    }
+    FileLinePair fl;
+    Profile.getFileLine(*Call, fl);
+    errs() << "coro: call to " << Call->getCalledFunction()->getName()
+           << " at " << fl.first << ":" << fl.second << " interleaved " << B
+           << " wide\n";
+    Call->eraseFromParent();
+  }
+
+  /// Whether some loop of F can be batched.
+  bool hasCandidateLoop(Function &F, FunctionAnalysisManager &FAM) {
+    LoopInfo &LI = FAM.getResult<LoopAnalysis>(F);
+    ScalarEvolution &SE = FAM.getResult<ScalarEvolutionAnalysis>(F);
+    DominatorTree &DT = FAM.getResult<DominatorTreeAnalysis>(F);
+    AAResults &AA = FAM.getResult<AAManager>(F);
+    for (Loop *L : LI.getLoopsInPreorder()) {
+      Candidate C;
+      if (findCandidate(L, SE, DT, LI, AA, C))
+        return true;
+    }
+    return false;
+  }
+
+  bool run(ModuleAnalysisManager &MAM) {
+    auto &FAM =
+        MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+    unsigned NumLoops = 0;
+    bool Changed = false;
+
+    // Coroutines made on the way are added to M
+    std::vector<Function *> Funcs;
+    for (Function &F : M)
+      Funcs.push_back(&F);
+    for (Function *FP : Funcs) {
+      Function &F = *FP;
+      if (F.isDeclaration() ||
+          !(Interleave ? callsLookup(F) : hasHotLine(F)))
+        continue;
+
+      if (promoteAllocasIfUseful(F, FAM, [&](Function &Copy) {
+            return hasCandidateLoop(Copy, FAM);
+          }))
+        Changed = true;
+
+      LoopInfo &LI = FAM.getResult<LoopAnalysis>(F);
+      ScalarEvolution &SE = FAM.getResult<ScalarEvolutionAnalysis>(F);
+      DominatorTree &DT = FAM.getResult<DominatorTreeAnalysis>(F);
+      AAResults &AA = FAM.getResult<AAManager>(F);
+
+      // One loop per nest: the outermost that qualifies
+      std::vector<Candidate> Cands;
+      for (Loop *L : LI.getLoopsInPreorder()) {
+        bool Nested = false;
+        for (const Candidate &C : Cands)
+          Nested |= C.L->contains(L);
+        Candidate C;
+        if (!Nested && findCandidate(L, SE, DT, LI, AA, C))
+          Cands.push_back(C);
+      }
+      // The nests are disjoint, so one's blocks don't change another's
+      for (Candidate &C : Cands) {
+        batchLoop(C, SE, LI, DT, AA);
+        ++NumLoops;
+      }
+      if (!Cands.empty()) {
+        FAM.invalidate(F, PreservedAnalyses::none());
+        Changed = true;
+      }
+    }
+
+    if (!Interleave) {
+      errs() << "batch: batched " << NumLoops << " loops\n";
+      return Changed;
+    }
+    unsigned NumCoroutines = 0;
+    for (auto &Entry : Coroutines) {
+      if (!Entry.second)
+        continue;
+      if (Entry.second->use_empty()) {
+        Entry.second->eraseFromParent();
+      } else {
+        ++NumCoroutines;
+        Changed = true;
+      }
+    }
+    errs() << "coro: interleaved " << NumLoops << " call sites of "
+           << NumCoroutines << " lookups\n";
+    return Changed;
+  }
+};
+
+PreservedAnalyses BatchPrefetchPass::run(Module &M,
+                                         ModuleAnalysisManager &MAM) {
+  if (CacheCGFile.empty()) {
+    errs() << "No file provided via -cache-cg-file\n";
+    return PreservedAnalyses::all();
+  }
+
+  const auto &Profile = MAM.getResult<CachegrindProfileAnalysis>(M);
+  if (!Profile.Loaded) {
+    errs() << "Failed to parse file: " << CacheCGFile << "\n";
+    return PreservedAnalyses::all();
+  }
+
+  BatchPrefetchImpl Impl(M, Profile, /*Interleave=*/false);
+  return Impl.run(MAM) ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
+
+PreservedAnalyses CoroInterleavePass::run(Module &M,
+                                          ModuleAnalysisManager &MAM) {
+  if (CacheCGFile.empty()) {
+    errs() << "No file provided via -cache-cg-file\n";
+    return PreservedAnalyses::all();
+  }
+
+  const auto &Profile = MAM.getResult<CachegrindProfileAnalysis>(M);
+  if (!Profile.Loaded) {
+    errs() << "Failed to parse file: " << CacheCGFile << "\n";
+    return PreservedAnalyses::all();
+  }
+
+  BatchPrefetchImpl Impl(M, Profile, /*Interleave=*/true);
+  return Impl.run(MAM) ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
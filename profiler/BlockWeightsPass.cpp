@@ -0,0 +1,252 @@
+#include "ParseCachegrindPass.h"
+
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/ProfileSummary.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <set>
+#include <vector>
+
+using namespace llvm;
+
+/**
+ * Turns Cachegrind's per-line Ir counts into profile metadata, so that when
+ * no PGO profile exists the standard heuristics (MachineBlockPlacement,
+ * the inliner, hot/cold splitting) still see real execution frequencies.
+ *
+ * Ir counts instructions, not executions. We approximate a line's execution
+ * count as Ir(line) / #IR instructions on that line in the function, and a
+ * block's count as the maximum over its lines (a line such as a `for`
+ * header spans blocks of different frequency; the hottest one dominates its
+ * Ir, as in AutoFDO). From block counts we attach:
+ *  - !prof branch_weights on conditional branches and switches, one weight
+ *    per successor's count;
+ *  - function entry counts from the entry block;
+ *  - a module ProfileSummary so PSI treats the counts as a real profile.
+ *
+ * The metadata only matters when the result is compiled with optimization
+ * (clang -O0 marks functions optnone), see run.sh -b.
+ */
+struct BlockWeightsImpl {
+  Module &M;
+  const CachegrindProfile &Profile;
+  const std::map<FileLinePair, CacheMetrics> &lineMetrics;
+
+  /// Files that appear in the annotation
+  std::set<std::string> ProfiledFiles;
+
+  /// Estimated execution counts of the current function's blocks
+  DenseMap<const BasicBlock *, uint64_t> BlockCount;
+
+  /// All counts we attached, for the profile summary
+  std::vector<uint64_t> AllCounts;
+  uint64_t MaxFunctionCount = 0;
+  uint64_t MaxInternalCount = 0;
+  uint32_t NumFunctions = 0;
+
+  BlockWeightsImpl(Module &M, const CachegrindProfile &Profile)
+      : M(M), Profile(Profile), lineMetrics(Profile.LineMetrics) {}
+
+  /// Estimate block counts for F. Returns false if F has no profiled lines.
+  bool estimateBlockCounts(Function &F) {
+    BlockCount.clear();
+
+    std::map<FileLinePair, unsigned> InstsPerLine;
+    for (Instruction &I : instructions(F)) {
+      FileLinePair fl;
+      if (!isa<DbgInfoIntrinsic>(I) && Profile.getFileLine(I, fl) &&
+          fl.second > 0)
+        ++InstsPerLine[fl];
+    }
+
+    bool AnyProfiled = false;
+    for (BasicBlock &BB : F) {
+      bool Known = false;
+      uint64_t Count = 0;
+      for (Instruction &I : BB) {
+        FileLinePair fl;
+        if (isa<DbgInfoIntrinsic>(I) || !Profile.getFileLine(I, fl) ||
+            !ProfiledFiles.count(fl.first))
+          continue;
+        // Lines of a profiled file that cg_annotate didn't list never ran
+        Known = true;
+        auto it = lineMetrics.find(fl);
+        if (it != lineMetrics.end())
+          Count = std::max(Count, it->second.Ir / InstsPerLine[fl]);
+      }
+      if (Known) {
+        BlockCount[&BB] = Count;
+        AnyProfiled = true;
+      }
+    }
+    return AnyProfiled;
+  }
+
+  /// Count for BB, looking through line-less single-successor blocks.
+  bool getCount(const BasicBlock *BB, uint64_t &Count) {
+    for (int Depth = 0; BB && Depth < 4; ++Depth) {
+      auto it = BlockCount.find(BB);
+      if (it != BlockCount.end()) {
+        Count = it->second;
+        return true;
+      }
+      BB = BB->getSingleSuccessor();
+    }
+    return false;
+  }
+
+  bool setWeights(Instruction *Term, uint64_t SrcCount) {
+    unsigned NumSucc = Term->getNumSuccessors();
+    SmallVector<uint64_t, 4> Weights(NumSucc, 0);
+    SmallVector<unsigned, 4> Unknown;
+    uint64_t KnownSum = 0;
+    for (unsigned i = 0; i != NumSucc; ++i) {
+      uint64_t Count;
+      if (!getCount(Term->getSuccessor(i), Count)) {
+        Unknown.push_back(i);
+        continue;
+      }
+      // An edge can't run more often than its source block
+      Weights[i] = std::min(Count, SrcCount);
+      KnownSum += Weights[i];
+    }
+    if (Unknown.size() == NumSucc)
+      return false;
+
+    // Successors without lines (e.g. a bare `ret` block) share whatever
+    // flow the known ones don't account for.
+    uint64_t Rest = SrcCount > KnownSum ? SrcCount - KnownSum : 0;
+    for (unsigned i : Unknown)
+      Weights[i] = Rest / Unknown.size();
+
+    uint64_t MaxWeight = 0;
+    for (uint64_t W : Weights)
+      MaxWeight = std::max(MaxWeight, W);
+    if (MaxWeight == 0)
+      return false;
+
+    // branch_weights are 32-bit
+    uint64_t Scale = MaxWeight / std::numeric_limits<uint32_t>::max() + 1;
+    SmallVector<uint32_t, 4> Scaled;
+    for (uint64_t W : Weights)
+      Scaled.push_back(std::max<uint64_t>(W / Scale, 1));
+
+    MDBuilder MDB(M.getContext());
+    Term->setMetadata(LLVMContext::MD_prof, MDB.createBranchWeights(Scaled));
+    return true;
+  }
+
+  unsigned annotateFunction(Function &F) {
+    if (!estimateBlockCounts(F))
+      return 0;
+
+    uint64_t EntryCount = 0;
+    getCount(&F.getEntryBlock(), EntryCount);
+    F.setEntryCount(EntryCount);
+    ++NumFunctions;
+    MaxFunctionCount = std::max(MaxFunctionCount, EntryCount);
+
+    unsigned NumBranches = 0;
+    for (BasicBlock &BB : F) {
+      auto it = BlockCount.find(&BB);
+      if (it == BlockCount.end())
+        continue;
+      AllCounts.push_back(it->second);
+      if (&BB != &F.getEntryBlock())
+        MaxInternalCount = std::max(MaxInternalCount, it->second);
+
+      Instruction *Term = BB.getTerminator();
+      bool IsCondBr = isa<BranchInst>(Term) &&
+                      cast<BranchInst>(Term)->isConditional();
+      if ((IsCondBr || isa<SwitchInst>(Term)) && setWeights(Term, it->second))
+        ++NumBranches;
+    }
+    return NumBranches;
+  }
+
+  /// Build an instrumentation-style profile summary from all block counts,
+  /// using the same percentile cutoffs as LLVM's ProfileSummaryBuilder.
+  void setProfileSummary() {
+    static const uint32_t Cutoffs[] = {
+        10000,  100000, 200000, 300000, 400000, 500000, 600000, 700000,
+        800000, 900000, 950000, 990000, 999000, 999900, 999990, 999999};
+
+    std::sort(AllCounts.begin(), AllCounts.end(), std::greater<uint64_t>());
+    uint64_t Total = 0;
+    for (uint64_t C : AllCounts)
+      Total += C;
+
+    SummaryEntryVector Detailed;
+    uint64_t Cumulative = 0;
+    size_t Idx = 0;
+    for (uint32_t Cutoff : Cutoffs) {
+      uint64_t Desired =
+          (uint64_t)((double)Total * Cutoff / ProfileSummary::Scale);
+      while (Idx < AllCounts.size() && Cumulative < Desired)
+        Cumulative += AllCounts[Idx++];
+      uint64_t MinCount = Idx ? AllCounts[Idx - 1] : 0;
+      Detailed.emplace_back(Cutoff, MinCount, Idx);
+    }
+
+    ProfileSummary PS(ProfileSummary::PSK_Instr, Detailed, Total,
+                      AllCounts.empty() ? 0 : AllCounts.front(),
+                      MaxInternalCount, MaxFunctionCount, AllCounts.size(),
+                      NumFunctions);
+    M.setProfileSummary(PS.getMD(M.getContext()), ProfileSummary::PSK_Instr);
+  }
+
+  bool run() {
+    if (M.getProfileSummary(/*IsCS=*/false)) {
+      errs() << "cachegrind-block-weights: module already has a profile, "
+                "leaving it alone\n";
+      return false;
+    }
+
+    for (const auto &entry : lineMetrics)
+      ProfiledFiles.insert(entry.first.first);
+
+    unsigned NumBranches = 0;
+    for (Function &F : M) {
+      if (F.isDeclaration())
+        continue;
+      NumBranches += annotateFunction(F);
+    }
+
+    if (NumFunctions == 0) {
+      errs() << "cachegrind-block-weights: no functions matched the profile\n";
+      return false;
+    }
+
+    setProfileSummary();
+    errs() << "cachegrind-block-weights: annotated " << NumBranches
+           << " branches in " << NumFunctions << " functions\n";
+    return true;
+  }
+};
+
+PreservedAnalyses BlockWeightsPass::run(Module &M,
+                                        ModuleAnalysisManager &MAM) {
+  if (CacheCGFile.empty()) {
+    errs() << "No file provided via -cache-cg-file\n";
+    return PreservedAnalyses::all();
+  }
+
+  const auto &Profile = MAM.getResult<CachegrindProfileAnalysis>(M);
+  if (!Profile.Loaded) {
+    errs() << "Failed to parse file: " << CacheCGFile << "\n";
+    return PreservedAnalyses::all();
+  }
+
+  BlockWeightsImpl Impl(M, Profile);
+  return Impl.run() ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
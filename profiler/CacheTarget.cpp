@@ -0,0 +1,213 @@
+#include "ParseCachegrindPass.h"
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <fstream>
+#include <regex>
+
+using namespace llvm;
+
+static cl::opt<std::string> CacheTargetName(
+    "cache-target",
+    cl::desc("Cache hierarchy to optimize for: a preset (x86-64, skylake-sp, "
+             "icelake-sp, zen3, zen4, neoverse-n1, neoverse-v1, a64fx) or a "
+             "JSON file. Default: the geometry in the profile's header"),
+    cl::init(""));
+
+/**
+ * Cache targets: what the prefetch decisions assume about the machine.
+ *
+ * Cachegrind simulates two levels, so a target is the I1/D1/LL geometry plus
+ * two costs: a D1 miss that hits LL and an LL miss. By default the geometry
+ * is the one the profile was simulated with (the "I1 cache:" ... lines that
+ * cg_annotate copies from the cachegrind.out "desc:" header), with the
+ * x86-64 latencies. -cache-target names the machine the binary will run on
+ * instead, as a preset or a JSON file:
+ *
+ *   {"name": "my-server", "base": "icelake-sp",
+ *    "d1": {"size": 49152, "line": 64, "assoc": 12},
+ *    "ll": {"size": 62914560, "line": 64, "assoc": 12},
+ *    "l1_miss_latency": 45, "ll_miss_latency": 270}
+ *
+ * Every field is optional; missing ones come from "base" (default x86-64).
+ *
+ * The presets are approximate per-socket figures from vendor documentation;
+ * "LL" is the last level shared cache and the latencies are in core cycles.
+ */
+
+static const CacheTarget Presets[] = {
+    // Cachegrind's own default geometry
+    {"x86-64", {32768, 64, 8}, {32768, 64, 8}, {8388608, 64, 16}, 14, 200},
+    {"skylake-sp", {32768, 64, 8}, {32768, 64, 8}, {40370176, 64, 11}, 40,
+     250},
+    {"icelake-sp", {32768, 64, 8}, {49152, 64, 12}, {62914560, 64, 12}, 45,
+     270},
+    {"zen3", {32768, 64, 8}, {32768, 64, 8}, {33554432, 64, 16}, 46, 300},
+    {"zen4", {32768, 64, 8}, {32768, 64, 8}, {33554432, 64, 16}, 50, 300},
+    {"neoverse-n1", {65536, 64, 4}, {65536, 64, 4}, {33554432, 64, 16}, 35,
+     250},
+    {"neoverse-v1", {65536, 64, 4}, {65536, 64, 4}, {33554432, 64, 16}, 40,
+     280},
+    // 256-byte lines throughout
+    {"a64fx", {65536, 256, 4}, {65536, 256, 4}, {8388608, 256, 16}, 40, 260},
+};
+
+static const CacheTarget *findPreset(StringRef Name) {
+  for (const CacheTarget &T : Presets)
+    if (Name == T.Name)
+      return &T;
+  return nullptr;
+}
+
+unsigned CacheTarget::missLatency(const CacheMetrics &CM) const {
+  uint64_t Misses = CM.D1mr ? CM.D1mr : 1;
+  uint64_t LLMisses = std::min(CM.DLmr, Misses);
+  return (unsigned)(((Misses - LLMisses) * L1MissLatency +
+                     LLMisses * LLMissLatency) /
+                    Misses);
+}
+
+unsigned CacheTarget::distanceFor(const CacheMetrics &CM, unsigned IterCost,
+                                  int64_t Stride, unsigned MaxDistance) const {
+  IterCost = std::max(IterCost, 1u);
+  unsigned D = (missLatency(CM) + IterCost - 1) / IterCost;
+  if (Stride) {
+    uint64_t Abs = Stride < 0 ? -Stride : Stride;
+    D = std::max(D, (unsigned)((lineSize() + Abs - 1) / Abs));
+  }
+  return std::max(1u, std::min(D, MaxDistance));
+}
+
+unsigned CacheTarget::localityFor(uint64_t Footprint) const {
+  if (!Footprint || Footprint <= D1.Size)
+    return 3;
+  return Footprint <= LL.Size ? 2 : 0;
+}
+
+std::string describeCacheTarget(const CacheTarget &T) {
+  auto Level = [](const CacheLevel &L) {
+    return formatv("{0} KiB/{1} B/{2}-way", L.Size / 1024, L.LineSize,
+                   L.Assoc)
+        .str();
+  };
+  return formatv("{0}: D1 {1}, LL {2}, {3}/{4} cycles per D1/LL miss",
+                 T.Name, Level(T.D1), Level(T.LL), T.L1MissLatency,
+                 T.LLMissLatency)
+      .str();
+}
+
+static bool fromJSON(const json::Value &V, CacheLevel &L, json::Path P) {
+  json::ObjectMapper O(V, P);
+  int64_t Size = L.Size, Line = L.LineSize, Assoc = L.Assoc;
+  if (!O || !O.mapOptional("size", Size) || !O.mapOptional("line", Line) ||
+      !O.mapOptional("assoc", Assoc))
+    return false;
+  if (Size <= 0 || Line <= 0 || Assoc <= 0) {
+    P.report("size, line and assoc must be positive");
+    return false;
+  }
+  L.Size = (uint64_t)Size;
+  L.LineSize = (unsigned)Line;
+  L.Assoc = (unsigned)Assoc;
+  return true;
+}
+
+static bool readTargetFile(const std::string &Path, CacheTarget &T) {
+  auto Buf = MemoryBuffer::getFile(Path);
+  if (!Buf) {
+    errs() << "cache target: no preset or file named " << Path << "\n";
+    return false;
+  }
+  Expected<json::Value> V = json::parse((*Buf)->getBuffer());
+  if (!V) {
+    errs() << "cache target: " << toString(V.takeError()) << "\n";
+    return false;
+  }
+
+  std::string Base = "x86-64";
+  if (const json::Object *Obj = V->getAsObject())
+    if (Optional<StringRef> B = Obj->getString("base"))
+      Base = B->str();
+  const CacheTarget *Preset = findPreset(Base);
+  if (!Preset) {
+    errs() << "cache target: unknown base " << Base << "\n";
+    return false;
+  }
+  T = *Preset;
+  T.Name = Path;
+
+  json::Path::Root Root("target");
+  json::ObjectMapper O(*V, Root);
+  int64_t L1Latency = T.L1MissLatency, LLLatency = T.LLMissLatency;
+  if (!O || !O.mapOptional("name", T.Name) || !O.mapOptional("i1", T.I1) ||
+      !O.mapOptional("d1", T.D1) || !O.mapOptional("ll", T.LL) ||
+      !O.mapOptional("l1_miss_latency", L1Latency) ||
+      !O.mapOptional("ll_miss_latency", LLLatency)) {
+    errs() << "cache target: " << toString(Root.getError()) << "\n";
+    return false;
+  }
+  T.L1MissLatency = (unsigned)L1Latency;
+  T.LLMissLatency = (unsigned)LLLatency;
+  return true;
+}
+
+/// Read the "I1 cache: 32768 B, 64 B, 8-way associative" lines (with a
+/// "desc: " prefix in cachegrind.out files) before the first annotated
+/// source. Returns true if any was found.
+static bool readProfileGeometry(const std::string &Path, CacheTarget &T) {
+  std::ifstream ifs(Path);
+  static const std::regex Desc(
+      "^(desc: *)?(I1|D1|LL) cache: *([0-9]+) B, ([0-9]+) B, "
+      "(([0-9]+)-way|direct-mapped|fully)");
+  std::string line;
+  bool Found = false;
+  while (std::getline(ifs, line)) {
+    if (line.rfind("-- Auto-annotated source:", 0) == 0)
+      break;
+    std::smatch Match;
+    if (!std::regex_search(line, Match, Desc))
+      continue;
+
+    CacheLevel L;
+    L.Size = std::stoull(Match[3]);
+    L.LineSize = (unsigned)std::stoul(Match[4]);
+    if (Match[6].matched)
+      L.Assoc = (unsigned)std::stoul(Match[6]);
+    else if (Match[5] == "direct-mapped")
+      L.Assoc = 1;
+    else
+      L.Assoc = (unsigned)(L.Size / L.LineSize);
+    if (Match[2] == "I1")
+      T.I1 = L;
+    else if (Match[2] == "D1")
+      T.D1 = L;
+    else
+      T.LL = L;
+    Found = true;
+  }
+  return Found;
+}
+
+bool loadCacheTarget(const std::string &ProfilePath, CacheTarget &T) {
+  if (!CacheTargetName.empty()) {
+    if (const CacheTarget *Preset = findPreset(CacheTargetName)) {
+      T = *Preset;
+      return true;
+    }
+    if (readTargetFile(CacheTargetName, T))
+      return true;
+    T = CacheTarget();
+    errs() << "cache target: cannot load " << CacheTargetName
+           << ", using default " << T.Name << "\n";
+    return false;
+  }
+
+  if (!ProfilePath.empty() && readProfileGeometry(ProfilePath, T))
+    T.Name = "profile";
+  return true;
+}
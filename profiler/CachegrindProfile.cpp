@@ -0,0 +1,239 @@
+#include "ParseCachegrindPass.h"
+
+#include "llvm/IR/DebugInfo.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm> // for std::remove
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <regex>
+#include <sstream>
+
+using namespace llvm;
+
+// Constants
+const std::string AutoAnnotatedPrefix = "-- Auto-annotated source:";
+const std::string EndAnnotatedBlock =
+    "--------------------------------------------------------------------------"
+    "------";
+
+std::string normalizeFileName(const std::string &Path) {
+  std::string S = Path;
+  // Strip directory components: keep only the basename
+  auto pos = S.find_last_of("/\\");
+  if (pos != std::string::npos)
+    S = S.substr(pos + 1);
+  return S;
+}
+
+bool getFileLine(const Instruction &I, FileLinePair &FL) {
+  // Need debug info to map back to source line
+  const DebugLoc &DL = I.getDebugLoc();
+  if (!DL)
+    return false;
+
+  auto *Scope = dyn_cast<DIScope>(DL.getScope());
+  if (!Scope)
+    return false;
+
+  FL = FileLinePair(normalizeFileName(Scope->getFilename().str()),
+                    DL.getLine());
+  return true;
+}
+
+std::string CachegrindProfile::fileName(const DIFile *File) const {
+  auto It = FileNames.find(File);
+  if (It != FileNames.end())
+    return It->second;
+  return normalizeFileName(File ? File->getFilename().str() : "");
+}
+
+bool CachegrindProfile::getFileLine(const Instruction &I,
+                                    FileLinePair &FL) const {
+  const DebugLoc &DL = I.getDebugLoc();
+  if (!DL)
+    return false;
+
+  auto *Scope = dyn_cast<DIScope>(DL.getScope());
+  if (!Scope)
+    return false;
+
+  FL.first = fileName(Scope->getFile());
+  FL.second = DL.getLine();
+  return true;
+}
+
+bool CachegrindProfile::isColdFunction(const Function &F) const {
+  const DISubprogram *SP = F.getSubprogram();
+  if (!SP)
+    return true;
+  auto It = Files.find(fileName(SP->getFile()));
+  if (It == Files.end() || It->second.HotLines.empty())
+    return true;
+
+  // F spans [Start, End]: up to the line before the next function
+  const FileSummary &FS = It->second;
+  int Start = SP->getLine();
+  auto Next = std::upper_bound(FS.FunctionStarts.begin(),
+                               FS.FunctionStarts.end(), Start);
+  int End = Next == FS.FunctionStarts.end() ? INT_MAX : *Next - 1;
+  auto Hot = std::lower_bound(FS.HotLines.begin(), FS.HotLines.end(), Start);
+  return Hot == FS.HotLines.end() || *Hot > End;
+}
+
+AnalysisKey CachegrindProfileAnalysis::Key;
+
+CachegrindProfile CachegrindProfileAnalysis::run(Module &M,
+                                                 ModuleAnalysisManager &) {
+  CachegrindProfile Profile;
+  loadCacheTarget(CacheCGFile, Profile.Target);
+  if (CacheCGFile.empty())
+    return Profile;
+
+  Profile.Loaded = parseCachegrindFile(CacheCGFile, Profile.LineMetrics);
+
+  // LineMetrics is sorted by file, then line
+  for (const auto &Entry : Profile.LineMetrics) {
+    auto Inserted = Profile.Files.insert({Entry.first.first, {}});
+    CachegrindProfile::FileSummary &FS = Inserted.first->second;
+    if (Inserted.second)
+      FS.MinLine = Entry.first.second;
+    FS.MaxLine = Entry.first.second;
+    FS.Misses += Entry.second.totalMisses();
+    if (Entry.second.totalMisses() >= MissThreshold)
+      FS.HotLines.push_back(Entry.first.second);
+  }
+
+  // Name every DIFile now: passes share the result and only read it
+  DebugInfoFinder Finder;
+  Finder.processModule(M);
+  auto NameFile = [&](const DIFile *File) {
+    if (!Profile.FileNames.count(File))
+      Profile.FileNames[File] = Profile.fileName(File);
+  };
+  for (const DISubprogram *SP : Finder.subprograms())
+    NameFile(SP->getFile());
+  for (const DIScope *S : Finder.scopes())
+    NameFile(S->getFile());
+
+  for (Function &F : M) {
+    const DISubprogram *SP = F.getSubprogram();
+    if (!SP)
+      continue;
+    auto It = Profile.Files.find(Profile.fileName(SP->getFile()));
+    if (It != Profile.Files.end())
+      It->second.FunctionStarts.push_back(SP->getLine());
+  }
+  for (auto &Entry : Profile.Files)
+    std::sort(Entry.second.FunctionStarts.begin(),
+              Entry.second.FunctionStarts.end());
+  return Profile;
+}
+
+bool parseCachegrindFile(const std::string &path,
+                         std::map<FileLinePair, CacheMetrics> &lineMetrics) {
+  std::ifstream ifs(path);
+  if (!ifs) {
+    errs() << "Failed to open cachegrind file: " << path << "\n";
+    return false;
+  }
+
+  std::string line;
+  std::string currentFile;
+  int lineNumber = 0;
+
+  while (std::getline(ifs, line)) {
+    // Start of an annotated block: "-- Auto-annotated source:  filename"
+    if (line.rfind(AutoAnnotatedPrefix, 0) == 0) {
+      auto filename = line.substr(AutoAnnotatedPrefix.size());
+      std::string trimmed =
+          std::regex_replace(filename, std::regex("^ +| +$|( ) +"), "$1");
+
+      currentFile = normalizeFileName(trimmed);
+      lineNumber = 0;
+      std::getline(ifs, line); // skip first dashed block
+      continue;
+    }
+
+    // End of an annotated block (but skip the first dashed line after filename)
+    if (!currentFile.empty() &&
+        line.rfind(EndAnnotatedBlock, 0) == 0 &&
+        lineNumber != 0) {
+      currentFile.clear();
+      continue;
+    }
+
+    // Not in an annotated block? Skip.
+    if (currentFile.empty())
+      continue;
+
+    // Skip header row: "Ir I1mr ILmr ..."
+    if (line.rfind("Ir", 0) == 0)
+      continue;
+
+    // Blank line: don't advance lineNumber
+    if (line.empty())
+      continue;
+
+    // Left trim spaces
+    auto trimmedLine = std::regex_replace(line, std::regex("^ +"), "$1");
+
+    // Handle line skips: "-- line 39 -----------"
+    if (trimmedLine.rfind("-- line", 0) == 0) {
+      std::stringstream ss(trimmedLine.substr(std::strlen("-- line")));
+      int ln = 0;
+      ss >> ln;
+      lineNumber = ln - 1;
+      continue;
+    }
+
+    ++lineNumber;
+
+    // Sanity check: first token should start with a digit
+    if (trimmedLine.empty() ||
+        !std::isdigit(static_cast<unsigned char>(trimmedLine[0]))) {
+      continue;
+    }
+
+    std::stringstream ss(trimmedLine);
+    uint64_t fields[9];
+    std::string temp;
+
+    // Read Ir, I1mr, ILmr, Dr, D1mr, DLmr, Dw, D1mw, DLmw
+    for (int i = 0; i < 9; ++i) {
+      if (!(ss >> temp)) {
+        fields[i] = 0;
+        continue;
+      }
+
+      // Strip commas from numbers like "7,004"
+      temp.erase(std::remove(temp.begin(), temp.end(), ','), temp.end());
+
+      if (temp.empty() ||
+          !std::isdigit(static_cast<unsigned char>(temp[0]))) {
+        fields[i] = 0;
+        continue;
+      }
+
+      fields[i] = static_cast<uint64_t>(std::stoull(temp));
+    }
+
+    CacheMetrics &cm = lineMetrics[{currentFile, lineNumber}];
+    cm.Ir   += fields[0];
+    cm.I1mr += fields[1];
+    cm.ILmr += fields[2];
+    cm.Dr   += fields[3];
+    cm.D1mr += fields[4];
+    cm.DLmr += fields[5];
+    cm.Dw   += fields[6];
+    cm.D1mw += fields[7];
+    cm.DLmw += fields[8];
+  }
+
+  errs() << "Parsed " << lineMetrics.size()
+         << " annotated lines from cachegrind\n";
+  return !lineMetrics.empty();
+}
@@ -0,0 +1,395 @@
+#include "ParseCachegrindPass.h"
+
+#include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/ADT/SmallVector.h"
+
+#include <vector>
+
+using namespace llvm;
+
+/**
+ * Lookups as coroutines, for interleaving independent pointer chases
+ * (Kocberber et al.'s AMAC, and Jonathan et al.'s "Exploiting coroutines to
+ * attack the killer nanoseconds", VLDB'18).
+ *
+ * A lookup like pat_search stalls once per node: the next node's address is
+ * in the node. Lookups for different keys are independent, so N of them can
+ * walk together, each prefetching its next node and giving way to the
+ * others until the line arrives. createLookupCoroutine() turns a copy of the
+ * lookup into an LLVM coroutine (switch lowering, see
+ * llvm/docs/Coroutines.rst) that does exactly that:
+ *
+ *   i8* F.coro(args..., T* out)     ; T F(args...)
+ *     frame = cp_co_alloc(size)     ; runtime/cp_coro.c
+ *     ...
+ *     loop:                         ; each pointer-chasing loop
+ *       t = <next node>
+ *       prefetch(t); suspend        ; resumed by the scheduler
+ *       ...
+ *     *out = result; final suspend
+ *
+ * The first call runs up to the first suspend and returns the handle. The
+ * scheduler (getCoroScheduler) resumes a batch of handles round-robin until
+ * every one is done, then destroys them, returning the frames to the
+ * runtime's pool. The cachegrind-coro pass (BatchPrefetchPass.cpp) decides
+ * which call sites get batched.
+ *
+ * The coroutine is only made if F writes no memory but its own stack, so
+ * lookups can run in any order relative to each other. A pointer-chasing
+ * loop is one whose header phi's next value is loaded through the phi
+ * (directly or through a select/phi of such loads, as in `t = bit ?
+ * t->right : t->left`). The coroutine suspends right after that value is
+ * computed, before the loop tests it.
+ */
+
+/// The pointer operand's base, through GEPs and casts.
+static const Value *pointerBase(const Value *V) {
+  return getUnderlyingObject(V, /*MaxLookup=*/0);
+}
+
+/// Is V, or every value a select/phi in L chooses from, loaded through P?
+static bool loadedThrough(Value *V, PHINode *P, Loop *L, unsigned Depth = 0) {
+  auto *I = dyn_cast<Instruction>(V);
+  if (!I || !L->contains(I) || Depth > 4)
+    return false;
+  if (auto *LD = dyn_cast<LoadInst>(I))
+    return pointerBase(LD->getPointerOperand()) == P;
+  if (auto *Sel = dyn_cast<SelectInst>(I))
+    return loadedThrough(Sel->getTrueValue(), P, L, Depth + 1) &&
+           loadedThrough(Sel->getFalseValue(), P, L, Depth + 1);
+  if (auto *Phi = dyn_cast<PHINode>(I)) {
+    if (Phi == P || L->getHeader() == Phi->getParent())
+      return false;
+    for (Value *In : Phi->incoming_values())
+      if (!loadedThrough(In, P, L, Depth + 1))
+        return false;
+    return true;
+  }
+  if (isa<CastInst>(I))
+    return loadedThrough(I->getOperand(0), P, L, Depth + 1);
+  return false;
+}
+
+bool isInterleaveMarked(const Function &F) {
+  const GlobalVariable *GA =
+      F.getParent()->getGlobalVariable("llvm.global.annotations");
+  if (!GA || !GA->hasInitializer())
+    return false;
+  auto *CA = dyn_cast<ConstantArray>(GA->getInitializer());
+  if (!CA)
+    return false;
+  for (const Use &U : CA->operands()) {
+    auto *CS = dyn_cast<ConstantStruct>(U.get());
+    if (!CS || CS->getNumOperands() < 2 ||
+        CS->getOperand(0)->stripPointerCasts() != &F)
+      continue;
+    auto *Str =
+        dyn_cast<GlobalVariable>(CS->getOperand(1)->stripPointerCasts());
+    if (!Str || !Str->hasInitializer())
+      continue;
+    auto *Data = dyn_cast<ConstantDataArray>(Str->getInitializer());
+    if (Data && Data->isCString() && Data->getAsCString() == "cp_interleave")
+      return true;
+  }
+  return false;
+}
+
+bool writesOnlyStack(const Function &F, unsigned Depth) {
+  if (F.isDeclaration() || Depth > 4)
+    return false;
+  for (const Instruction &I : instructions(F)) {
+    if (!I.mayWriteToMemory())
+      continue;
+    if (auto *II = dyn_cast<IntrinsicInst>(&I)) {
+      switch (II->getIntrinsicID()) {
+      case Intrinsic::prefetch:
+      case Intrinsic::lifetime_start:
+      case Intrinsic::lifetime_end:
+      case Intrinsic::assume:
+        continue;
+      default:
+        if (isa<DbgInfoIntrinsic>(II))
+          continue;
+        return false;
+      }
+    }
+    if (auto *CB = dyn_cast<CallBase>(&I)) {
+      const Function *Callee = CB->getCalledFunction();
+      if (CB->onlyReadsMemory() ||
+          (Callee && Callee != &F && writesOnlyStack(*Callee, Depth + 1)))
+        continue;
+      return false;
+    }
+    auto *SI = dyn_cast<StoreInst>(&I);
+    if (!SI || SI->isVolatile() ||
+        !isa<AllocaInst>(getUnderlyingObject(SI->getPointerOperand())))
+      return false;
+  }
+  return true;
+}
+
+Function *createLookupCoroutine(Function &F, unsigned &NumSuspends) {
+  NumSuspends = 0;
+  if (F.isDeclaration() || F.isVarArg() || !writesOnlyStack(F))
+    return nullptr;
+  Module &M = *F.getParent();
+  LLVMContext &Ctx = M.getContext();
+  Type *I8PtrTy = Type::getInt8PtrTy(Ctx);
+  Type *I64Ty = Type::getInt64Ty(Ctx);
+  Type *RetTy = F.getReturnType();
+  bool HasResult = !RetTy->isVoidTy();
+
+  // i8* F.coro(args..., RetTy* out)
+  std::vector<Type *> Params(F.getFunctionType()->param_begin(),
+                             F.getFunctionType()->param_end());
+  if (HasResult)
+    Params.push_back(RetTy->getPointerTo());
+  Function *NF = Function::Create(FunctionType::get(I8PtrTy, Params, false),
+                                  GlobalValue::InternalLinkage,
+                                  F.getName() + ".coro", M);
+  ValueToValueMapTy VMap;
+  for (auto Pair : zip(F.args(), NF->args())) {
+    std::get<1>(Pair).setName(std::get<0>(Pair).getName());
+    VMap[&std::get<0>(Pair)] = &std::get<1>(Pair);
+  }
+  SmallVector<ReturnInst *, 4> Returns;
+  CloneFunctionInto(NF, &F, VMap, CloneFunctionChangeType::LocalChangesOnly,
+                    Returns);
+  NF->setLinkage(GlobalValue::InternalLinkage); // cloned from F's
+  NF->setDSOLocal(true);
+  Argument *Out = HasResult ? NF->getArg(NF->arg_size() - 1) : nullptr;
+  if (Out)
+    Out->setName("out");
+
+  // Same parameters, but it returns a handle and writes its frame and *out
+  AttributeList Attrs = NF->getAttributes();
+  SmallVector<AttributeSet, 8> ParamAttrs;
+  for (unsigned i = 0; i < F.arg_size(); ++i)
+    ParamAttrs.push_back(Attrs.getParamAttrs(i));
+  AttrBuilder FnAttrs(Ctx, Attrs.getFnAttrs());
+  for (Attribute::AttrKind K :
+       {Attribute::ReadNone, Attribute::ReadOnly, Attribute::ArgMemOnly,
+        Attribute::InaccessibleMemOnly, Attribute::NoFree,
+        Attribute::WillReturn})
+    FnAttrs.removeAttribute(K);
+  NF->setAttributes(AttributeList::get(
+      Ctx, AttributeSet::get(Ctx, FnAttrs), AttributeSet(), ParamAttrs));
+  NF->addFnAttr("coroutine.presplit", "0");
+
+  // -O0 keeps the walk in allocas; they would all live in the frame
+  {
+    DominatorTree DT(*NF);
+    AssumptionCache AC(*NF);
+    promoteAllocas(*NF, DT, AC);
+  }
+
+  // The next node of each pointer-chasing loop
+  std::vector<Instruction *> Nexts;
+  {
+    DominatorTree DT(*NF);
+    LoopInfo LI(DT);
+    for (Loop *L : LI.getLoopsInPreorder()) {
+      BasicBlock *Latch = L->getLoopLatch();
+      if (!Latch)
+        continue;
+      for (PHINode &P : L->getHeader()->phis()) {
+        if (!P.getType()->isPointerTy())
+          continue;
+        auto *Next = dyn_cast<Instruction>(P.getIncomingValueForBlock(Latch));
+        if (Next && loadedThrough(Next, &P, L) &&
+            std::find(Nexts.begin(), Nexts.end(), Next) == Nexts.end())
+          Nexts.push_back(Next);
+      }
+    }
+  }
+  if (Nexts.empty()) {
+    NF->eraseFromParent();
+    return nullptr;
+  }
+
+  FunctionCallee Alloc = M.getOrInsertFunction("cp_co_alloc", I8PtrTy, I64Ty);
+  FunctionCallee Free =
+      M.getOrInsertFunction("cp_co_free", Type::getVoidTy(Ctx), I8PtrTy);
+  Function *Prefetch =
+      Intrinsic::getDeclaration(&M, Intrinsic::prefetch, {I8PtrTy});
+  Function *Suspend = Intrinsic::getDeclaration(&M, Intrinsic::coro_suspend);
+
+  // Frame from the runtime's pool, before anything else
+  BasicBlock &Entry = NF->getEntryBlock();
+  IRBuilder<> Builder(&Entry, Entry.getFirstInsertionPt());
+  Value *Null = ConstantPointerNull::get(cast<PointerType>(I8PtrTy));
+  Value *Id = Builder.CreateIntrinsic(Intrinsic::coro_id, {},
+                                      {Builder.getInt32(0), Null, Null, Null},
+                                      nullptr, "coro.id");
+  Value *Size =
+      Builder.CreateIntrinsic(Intrinsic::coro_size, {I64Ty}, {}, nullptr,
+                              "coro.size");
+  Value *Mem = Builder.CreateCall(Alloc, {Size}, "coro.mem");
+  Value *Handle = Builder.CreateIntrinsic(Intrinsic::coro_begin, {},
+                                          {Id, Mem}, nullptr, "coro.handle");
+
+  // Return the handle at every suspend; free the frame on destroy
+  BasicBlock *SuspendBB = BasicBlock::Create(Ctx, "coro.suspend", NF);
+  BasicBlock *CleanupBB = BasicBlock::Create(Ctx, "coro.cleanup", NF);
+  BasicBlock *FinalBB = BasicBlock::Create(Ctx, "coro.final", NF);
+  BasicBlock *TrapBB = BasicBlock::Create(Ctx, "coro.trap", NF);
+  Builder.SetInsertPoint(SuspendBB);
+  Builder.CreateIntrinsic(Intrinsic::coro_end, {},
+                          {Handle, Builder.getFalse()});
+  Builder.CreateRet(Handle);
+  Builder.SetInsertPoint(CleanupBB);
+  Value *FreeMem = Builder.CreateIntrinsic(Intrinsic::coro_free, {},
+                                           {Id, Handle}, nullptr, "coro.free");
+  Builder.CreateCall(Free, {FreeMem});
+  Builder.CreateBr(SuspendBB);
+  Builder.SetInsertPoint(FinalBB);
+  Value *Final = Builder.CreateCall(
+      Suspend, {ConstantTokenNone::get(Ctx), Builder.getTrue()}, "final");
+  SwitchInst *FinalSw = Builder.CreateSwitch(Final, SuspendBB, 2);
+  FinalSw->addCase(Builder.getInt8(0), TrapBB);
+  FinalSw->addCase(Builder.getInt8(1), CleanupBB);
+  Builder.SetInsertPoint(TrapBB);
+  Builder.CreateUnreachable();
+
+  // return v -> *out = v; final suspend
+  for (ReturnInst *R : Returns) {
+    Builder.SetInsertPoint(R);
+    if (Out)
+      Builder.CreateStore(R->getReturnValue(), Out);
+    Builder.CreateBr(FinalBB);
+    R->eraseFromParent();
+  }
+
+  // prefetch(next); suspend, right after the next node is known
+  for (Instruction *Next : Nexts) {
+    Instruction *IP = isa<PHINode>(Next)
+                          ? &*Next->getParent()->getFirstInsertionPt()
+                          : Next->getNextNode();
+    BasicBlock *Before = IP->getParent();
+    BasicBlock *Cont = SplitBlock(Before, IP);
+    Cont->setName(Before->getName() + ".resume");
+    Before->getTerminator()->eraseFromParent();
+    Builder.SetInsertPoint(Before);
+    Builder.SetCurrentDebugLocation(Next->getDebugLoc());
+    Builder.CreateCall(Prefetch,
+                       {Builder.CreatePointerCast(Next, I8PtrTy),
+                        Builder.getInt32(0), Builder.getInt32(3),
+                        Builder.getInt32(1)});
+    Value *S = Builder.CreateCall(
+        Suspend, {ConstantTokenNone::get(Ctx), Builder.getFalse()}, "step");
+    SwitchInst *Sw = Builder.CreateSwitch(S, SuspendBB, 2);
+    Sw->addCase(Builder.getInt8(0), Cont);
+    Sw->addCase(Builder.getInt8(1), CleanupBB);
+    ++NumSuspends;
+  }
+  return NF;
+}
+
+Function *getCoroScheduler(Module &M) {
+  if (Function *F = M.getFunction("cp.co.run"))
+    return F;
+  LLVMContext &Ctx = M.getContext();
+  Type *I8PtrTy = Type::getInt8PtrTy(Ctx);
+  Type *I64Ty = Type::getInt64Ty(Ctx);
+  Type *VoidTy = Type::getVoidTy(Ctx);
+  Function *F = Function::Create(
+      FunctionType::get(VoidTy, {I8PtrTy->getPointerTo(), I64Ty}, false),
+      GlobalValue::InternalLinkage, "cp.co.run", M);
+  F->addFnAttr(Attribute::NoUnwind);
+  Argument *Handles = F->getArg(0);
+  Argument *N = F->getArg(1);
+  Handles->setName("handles");
+  N->setName("n");
+  FunctionCallee Batch =
+      M.getOrInsertFunction("cp_co_batch", VoidTy, I64Ty, I64Ty);
+
+  // while (live) for (i < n) if (h[i]) done ? destroy, h[i] = 0 : resume
+  BasicBlock *Entry = BasicBlock::Create(Ctx, "entry", F);
+  BasicBlock *Round = BasicBlock::Create(Ctx, "round", F);
+  BasicBlock *Slot = BasicBlock::Create(Ctx, "slot", F);
+  BasicBlock *Check = BasicBlock::Create(Ctx, "check", F);
+  BasicBlock *Resume = BasicBlock::Create(Ctx, "resume", F);
+  BasicBlock *Finish = BasicBlock::Create(Ctx, "finish", F);
+  BasicBlock *Next = BasicBlock::Create(Ctx, "next", F);
+  BasicBlock *RoundEnd = BasicBlock::Create(Ctx, "round.end", F);
+  BasicBlock *Exit = BasicBlock::Create(Ctx, "exit", F);
+  Value *Zero = ConstantInt::get(I64Ty, 0);
+  Value *One = ConstantInt::get(I64Ty, 1);
+
+  IRBuilder<> Builder(Entry);
+  Builder.CreateCondBr(Builder.CreateICmpEQ(N, Zero), Exit, Round);
+
+  Builder.SetInsertPoint(Round);
+  PHINode *Live = Builder.CreatePHI(I64Ty, 2, "live");
+  PHINode *Resumes = Builder.CreatePHI(I64Ty, 2, "resumes");
+  Builder.CreateBr(Slot);
+
+  Builder.SetInsertPoint(Slot);
+  PHINode *I = Builder.CreatePHI(I64Ty, 2, "i");
+  PHINode *SlotLive = Builder.CreatePHI(I64Ty, 2, "slot.live");
+  PHINode *SlotResumes = Builder.CreatePHI(I64Ty, 2, "slot.resumes");
+  Value *Ptr = Builder.CreateGEP(I8PtrTy, Handles, I, "ptr");
+  Value *H = Builder.CreateLoad(I8PtrTy, Ptr, "h");
+  Builder.CreateCondBr(Builder.CreateIsNull(H), Next, Check);
+
+  Builder.SetInsertPoint(Check);
+  Value *Done =
+      Builder.CreateIntrinsic(Intrinsic::coro_done, {}, {H}, nullptr, "done");
+  Builder.CreateCondBr(Done, Finish, Resume);
+
+  Builder.SetInsertPoint(Resume);
+  Builder.CreateIntrinsic(Intrinsic::coro_resume, {}, {H});
+  Value *Resumed = Builder.CreateAdd(SlotResumes, One);
+  Builder.CreateBr(Next);
+
+  Builder.SetInsertPoint(Finish);
+  Builder.CreateIntrinsic(Intrinsic::coro_destroy, {}, {H});
+  Builder.CreateStore(ConstantPointerNull::get(cast<PointerType>(I8PtrTy)),
+                      Ptr);
+  Value *Finished = Builder.CreateSub(SlotLive, One);
+  Builder.CreateBr(Next);
+
+  Builder.SetInsertPoint(Next);
+  PHINode *NextLive = Builder.CreatePHI(I64Ty, 3, "next.live");
+  NextLive->addIncoming(SlotLive, Slot);
+  NextLive->addIncoming(SlotLive, Resume);
+  NextLive->addIncoming(Finished, Finish);
+  PHINode *NextResumes = Builder.CreatePHI(I64Ty, 3, "next.resumes");
+  NextResumes->addIncoming(SlotResumes, Slot);
+  NextResumes->addIncoming(Resumed, Resume);
+  NextResumes->addIncoming(SlotResumes, Finish);
+  Value *INext = Builder.CreateAdd(I, One, "i.next");
+  Builder.CreateCondBr(Builder.CreateICmpULT(INext, N), Slot, RoundEnd);
+
+  Builder.SetInsertPoint(RoundEnd);
+  Builder.CreateCondBr(Builder.CreateICmpEQ(NextLive, Zero), Exit, Round);
+
+  Live->addIncoming(N, Entry);
+  Live->addIncoming(NextLive, RoundEnd);
+  Resumes->addIncoming(Zero, Entry);
+  Resumes->addIncoming(NextResumes, RoundEnd);
+  I->addIncoming(Zero, Round);
+  I->addIncoming(INext, Next);
+  SlotLive->addIncoming(Live, Round);
+  SlotLive->addIncoming(NextLive, Next);
+  SlotResumes->addIncoming(Resumes, Round);
+  SlotResumes->addIncoming(NextResumes, Next);
+
+  Builder.SetInsertPoint(Exit);
+  PHINode *Total = Builder.CreatePHI(I64Ty, 2, "total");
+  Total->addIncoming(Zero, Entry);
+  Total->addIncoming(NextResumes, RoundEnd);
+  Builder.CreateCall(Batch, {N, Total});
+  Builder.CreateRetVoid();
+  return F;
+}
@@ -0,0 +1,529 @@
+#include "ParseCachegrindPass.h"
+#include "SharingProfile.h"
+
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "false-sharing-pad"
+
+/**
+ * Padding for false sharing found by the sharing profiler.
+ *
+ * An access whose executions are at least -cache-false-sharing-min false
+ * sharing misses in the -cache-sharing-profile table (see SharingProfile.cpp)
+ * is traced back to the object it addresses. If that is a writable global
+ * defined in, and only visible to, this module and every use of it indexes
+ * it with a GEP, it is rebuilt so that threads' data no longer share lines:
+ *
+ *  - an array gets each element padded to a multiple of the line size
+ *    (`long c[8]` becomes `{long, [56 x i8]} c[8]`), for threads that each
+ *    own an element;
+ *  - a struct gets each field the flagged accesses touch moved to the start
+ *    of a line, with the next field on the following line, for threads that
+ *    each own a field;
+ *  - anything else is padded to a line of its own.
+ *
+ * The new global is aligned to the line size (-cache-target or the profile's
+ * D1 geometry) and takes the old one's name. Its debug info is dropped, as
+ * it would describe the unpadded layout. Each global gets a
+ * FalseSharingPadded remark, or FalseSharingNotPadded saying why not.
+ *
+ * Site IDs are those the sharing instrumentation assigned, so this must run
+ * on the same IR, before any pass that adds or moves loads and stores.
+ */
+
+namespace {
+
+/// The struct behind T, looking through typedefs, qualifiers and arrays.
+const DICompositeType *structDIType(const DIType *T) {
+  while (T) {
+    if (auto *D = dyn_cast<DIDerivedType>(T)) {
+      if (D->getTag() == dwarf::DW_TAG_member ||
+          D->getTag() == dwarf::DW_TAG_pointer_type)
+        return nullptr;
+      T = D->getBaseType();
+      continue;
+    }
+    auto *C = dyn_cast<DICompositeType>(T);
+    if (!C)
+      return nullptr;
+    if (C->getTag() == dwarf::DW_TAG_array_type) {
+      T = C->getBaseType();
+      continue;
+    }
+    return C->getTag() == dwarf::DW_TAG_structure_type ? C : nullptr;
+  }
+  return nullptr;
+}
+
+/// Source name of the member of GV's struct (or struct element) type at
+/// byte Offset, or "" without debug info.
+std::string fieldName(const GlobalVariable *GV, uint64_t Offset) {
+  SmallVector<DIGlobalVariableExpression *, 1> GVEs;
+  GV->getDebugInfo(GVEs);
+  for (DIGlobalVariableExpression *GVE : GVEs) {
+    const DICompositeType *S = structDIType(GVE->getVariable()->getType());
+    if (!S)
+      continue;
+    for (const DINode *N : S->getElements()) {
+      auto *Member = dyn_cast<DIDerivedType>(N);
+      if (Member && Member->getTag() == dwarf::DW_TAG_member &&
+          Member->getOffsetInBits() == Offset * 8)
+        return Member->getName().str();
+    }
+  }
+  return "";
+}
+
+/// V without bitcasts (stripPointerCasts() would also drop the all-zero
+/// GEPs that select field 0).
+Value *stripBitCasts(Value *V) {
+  while (auto *BC = dyn_cast<BitCastOperator>(V))
+    V = BC->getOperand(0);
+  return V;
+}
+
+/// The GEP that indexes into the global Ptr is computed from, if any.
+GEPOperator *globalGEP(Value *Ptr) {
+  GEPOperator *Found = nullptr;
+  Value *V = stripBitCasts(Ptr);
+  while (auto *GEP = dyn_cast<GEPOperator>(V)) {
+    Found = GEP;
+    V = stripBitCasts(GEP->getPointerOperand());
+  }
+  return isa<GlobalVariable>(V) ? Found : nullptr;
+}
+
+/// The constant field index a GEP selects in a struct at index Pos, or -1.
+int fieldIndex(GEPOperator *GEP, unsigned Pos) {
+  if (GEP->getNumIndices() <= Pos)
+    return -1;
+  auto *C = dyn_cast<ConstantInt>(GEP->getOperand(1 + Pos));
+  return C ? int(C->getZExtValue()) : -1;
+}
+
+} // namespace
+
+std::string describeSharedObject(Value *Ptr, const DataLayout &DL) {
+  auto *GV = dyn_cast<GlobalVariable>(getUnderlyingObject(Ptr));
+  if (!GV)
+    return "";
+  std::string Name = GV->getName().str();
+  GEPOperator *GEP = globalGEP(Ptr);
+  Type *Ty = GV->getValueType();
+
+  // Which struct, and which index of the GEP selects its field
+  StructType *S = dyn_cast<StructType>(Ty);
+  unsigned Pos = 1;
+  if (auto *AT = dyn_cast<ArrayType>(Ty)) {
+    Name += "[] elements";
+    S = dyn_cast<StructType>(AT->getElementType());
+    Pos = 2;
+  }
+  int Field = GEP && S && !S->isOpaque() ? fieldIndex(GEP, Pos) : -1;
+  if (Field < 0 || unsigned(Field) >= S->getNumElements())
+    return Name;
+
+  std::string Desc = "field " + std::to_string(Field);
+  std::string FName =
+      fieldName(GV, DL.getStructLayout(S)->getElementOffset(Field));
+  if (!FName.empty())
+    Desc += " (" + FName + ")";
+  return Desc + " of " + Name;
+}
+
+namespace {
+
+struct FalseSharingPadImpl {
+  Module &M;
+  const DataLayout &DL;
+  ModuleAnalysisManager &MAM;
+  const std::map<uint32_t, SharingSiteStats> &Sites;
+  unsigned LineSize;
+
+  /// Flagged accesses per global, and the struct fields they touch
+  struct Candidate {
+    std::vector<Instruction *> Accesses;
+    std::set<unsigned> Fields;
+  };
+  std::map<GlobalVariable *, Candidate> Candidates;
+
+  FalseSharingPadImpl(Module &M, ModuleAnalysisManager &MAM,
+                      const std::map<uint32_t, SharingSiteStats> &Sites,
+                      unsigned LineSize)
+      : M(M), DL(M.getDataLayout()), MAM(MAM), Sites(Sites),
+        LineSize(LineSize) {}
+
+  OptimizationRemarkEmitter &getORE(Instruction *I) {
+    auto &FAM =
+        MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+    return FAM.getResult<OptimizationRemarkEmitterAnalysis>(*I->getFunction());
+  }
+
+  bool isFalseSharing(uint32_t ID) const {
+    auto It = Sites.find(ID);
+    return It != Sites.end() && It->second.FalseSharing &&
+           double(It->second.FalseSharing) / It->second.Accesses >=
+               FalseSharingMin;
+  }
+
+  /// Number the loads/stores as -cache-sharing-instrument did and collect
+  /// the flagged ones by object. Returns the number flagged.
+  unsigned findFalseSharing() {
+    unsigned NumFlagged = 0;
+    for (Function &F : M) {
+      if (F.isDeclaration())
+        continue;
+      std::map<FileLinePair, unsigned> Ordinals;
+      for (Instruction &I : instructions(F)) {
+        Value *Ptr = getLoadStorePointerOperand(&I);
+        FileLinePair fl;
+        if (!Ptr || !getFileLine(I, fl))
+          continue;
+        if (!isFalseSharing(prefetchSiteID(F, fl, Ordinals[fl]++)))
+          continue;
+        ++NumFlagged;
+
+        auto *GV = dyn_cast<GlobalVariable>(getUnderlyingObject(Ptr));
+        if (!GV) {
+          getORE(&I).emit([&]() {
+            return OptimizationRemarkMissed(DEBUG_TYPE,
+                                            "FalseSharingNotPadded", &I)
+                   << "false sharing on an object that isn't a global; pad "
+                      "it by hand";
+          });
+          continue;
+        }
+        Candidate &C = Candidates[GV];
+        C.Accesses.push_back(&I);
+        GEPOperator *GEP = globalGEP(Ptr);
+        if (auto *S = dyn_cast<StructType>(GV->getValueType())) {
+          int Field = GEP ? fieldIndex(GEP, 1) : -1;
+          if (Field >= 0 && unsigned(Field) < S->getNumElements())
+            C.Fields.insert(Field);
+        }
+      }
+    }
+    return NumFlagged;
+  }
+
+  /// Whether every pointer derived from Ptr, which points into one element
+  /// or field of a global, stays inside it. Each one, through casts, phis
+  /// and selects, must end at a load, a store through it or a GEP with
+  /// constant indices starting at 0. Anything else (a call, pointer
+  /// arithmetic, storing the pointer) may assume the unpadded layout, as
+  /// `bump(&c[0], t)` doing `p[t]++` would.
+  bool staysInElement(Value *Ptr) {
+    SmallVector<Value *, 8> Work{Ptr};
+    SmallPtrSet<Value *, 8> Seen{Ptr};
+    while (!Work.empty()) {
+      Value *V = Work.pop_back_val();
+      for (User *U : V->users()) {
+        if (isa<LoadInst>(U))
+          continue;
+        if (auto *SI = dyn_cast<StoreInst>(U)) {
+          if (SI->getValueOperand() == V)
+            return false;
+          continue;
+        }
+        bool Derived =
+            isa<BitCastOperator>(U) || isa<PHINode>(U) || isa<SelectInst>(U);
+        if (auto *GEP = dyn_cast<GEPOperator>(U)) {
+          auto *First = GEP->getNumIndices()
+                            ? dyn_cast<ConstantInt>(GEP->getOperand(1))
+                            : nullptr;
+          Derived = GEP->getPointerOperand() == V && First &&
+                    First->isZero() && GEP->hasAllConstantIndices();
+        }
+        if (!Derived)
+          return false;
+        if (Seen.insert(U).second)
+          Work.push_back(U);
+      }
+    }
+    return true;
+  }
+
+  /// Why GV can't be rebuilt with another layout, or "" if it can. Struct
+  /// users must select a constant field, and no pointer into an element or
+  /// field may leave it (see staysInElement).
+  std::string whyNotPaddable(GlobalVariable *GV) {
+    if (GV->isDeclaration())
+      return "it is defined in another module";
+    if (!GV->hasLocalLinkage())
+      return "other modules may rely on its layout";
+    if (GV->isConstant())
+      return "it is constant";
+    Type *Ty = GV->getValueType();
+    if (auto *S = dyn_cast<StructType>(Ty))
+      if (S->isPacked() || S->isOpaque())
+        return "it is a packed struct";
+    for (User *U : GV->users()) {
+      if (!isa<ArrayType>(Ty) && !isa<StructType>(Ty))
+        break; // replaced as a whole
+      auto *GEP = dyn_cast<GEPOperator>(U);
+      auto *Zero = GEP && GEP->getNumIndices() >= 2
+                       ? dyn_cast<ConstantInt>(GEP->getOperand(1))
+                       : nullptr;
+      if (!Zero || !Zero->isZero() || GEP->getSourceElementType() != Ty)
+        return "it is used other than by indexing into it";
+      if (isa<StructType>(Ty) && fieldIndex(GEP, 1) < 0)
+        return "it is used other than by indexing into it";
+      if (!staysInElement(GEP))
+        return "a pointer into it is passed on or offset";
+    }
+    return "";
+  }
+
+  Constant *padding(uint64_t Bytes) {
+    return ConstantAggregateZero::get(
+        ArrayType::get(Type::getInt8Ty(M.getContext()), Bytes));
+  }
+
+  uint64_t padTo(uint64_t Offset) const {
+    return alignTo(Offset, LineSize) - Offset;
+  }
+
+  /// Replace GV with a global of type NewTy and initializer Init, rewriting
+  /// each GEP user's indices with Remap.
+  GlobalVariable *
+  replaceGlobal(GlobalVariable *GV, Type *NewTy, Constant *Init,
+                function_ref<void(SmallVectorImpl<Value *> &)> Remap) {
+    auto *NewGV = new GlobalVariable(
+        M, NewTy, GV->isConstant(), GV->getLinkage(), Init, "", GV,
+        GV->getThreadLocalMode(), GV->getAddressSpace());
+    NewGV->copyAttributesFrom(GV);
+    NewGV->setAlignment(MaybeAlign(LineSize));
+    NewGV->takeName(GV);
+
+    if (!Remap) {
+      Type *I32Ty = Type::getInt32Ty(M.getContext());
+      Constant *Idx[] = {ConstantInt::get(I32Ty, 0),
+                         ConstantInt::get(I32Ty, 0)};
+      GV->replaceAllUsesWith(
+          ConstantExpr::getInBoundsGetElementPtr(NewTy, NewGV, Idx));
+      GV->eraseFromParent();
+      return NewGV;
+    }
+
+    SmallVector<User *, 16> Users(GV->users());
+    for (User *U : Users) {
+      auto *GEP = cast<GEPOperator>(U);
+      SmallVector<Value *, 4> Idx(GEP->idx_begin(), GEP->idx_end());
+      Remap(Idx);
+      if (auto *CE = dyn_cast<ConstantExpr>(GEP)) {
+        SmallVector<Constant *, 4> CIdx;
+        for (Value *V : Idx)
+          CIdx.push_back(cast<Constant>(V));
+        CE->replaceAllUsesWith(ConstantExpr::getGetElementPtr(
+            NewTy, NewGV, CIdx, GEP->isInBounds()));
+        CE->destroyConstant();
+        continue;
+      }
+      auto *Old = cast<GetElementPtrInst>(GEP);
+      IRBuilder<> Builder(Old);
+      Value *New = GEP->isInBounds()
+                       ? Builder.CreateInBoundsGEP(NewTy, NewGV, Idx)
+                       : Builder.CreateGEP(NewTy, NewGV, Idx);
+      New->takeName(Old);
+      if (auto *NewI = dyn_cast<Instruction>(New))
+        NewI->setDebugLoc(Old->getDebugLoc());
+      Old->replaceAllUsesWith(New);
+      Old->eraseFromParent();
+    }
+    GV->eraseFromParent();
+    return NewGV;
+  }
+
+  /// `E a[N]` -> `{E, pad} a[N]`: index (0, i, rest) becomes (0, i, 0, rest)
+  std::string padArray(GlobalVariable *GV, ArrayType *AT) {
+    Type *ElemTy = AT->getElementType();
+    uint64_t Size = DL.getTypeAllocSize(ElemTy);
+    uint64_t Pad = padTo(Size);
+    if (!Pad) {
+      GV->setAlignment(MaybeAlign(LineSize));
+      return "aligned " + GV->getName().str() + " (elements are whole lines)";
+    }
+
+    auto *PaddedTy = StructType::get(
+        M.getContext(), {ElemTy, ArrayType::get(Type::getInt8Ty(M.getContext()),
+                                                Pad)});
+    auto *NewTy = ArrayType::get(PaddedTy, AT->getNumElements());
+    Constant *Init = nullptr;
+    Constant *Old = GV->getInitializer();
+    if (Old->isNullValue()) {
+      Init = ConstantAggregateZero::get(NewTy);
+    } else {
+      std::vector<Constant *> Elems;
+      for (uint64_t i = 0; i < AT->getNumElements(); ++i)
+        Elems.push_back(ConstantStruct::get(
+            PaddedTy, {Old->getAggregateElement(i), padding(Pad)}));
+      Init = ConstantArray::get(NewTy, Elems);
+    }
+
+    std::string Name = GV->getName().str();
+    Type *I32Ty = Type::getInt32Ty(M.getContext());
+    replaceGlobal(GV, NewTy, Init, [&](SmallVectorImpl<Value *> &Idx) {
+      Idx.insert(Idx.begin() + 2, ConstantInt::get(I32Ty, 0));
+    });
+    return "padded the " + std::to_string(AT->getNumElements()) +
+           " elements of " + Name + " from " + std::to_string(Size) + " to " +
+           std::to_string(Size + Pad) + " bytes";
+  }
+
+  /// Put each flagged field, and the field after it, at the start of a line.
+  std::string padStruct(GlobalVariable *GV, StructType *S,
+                        const std::set<unsigned> &Fields) {
+    std::vector<Type *> Types;
+    std::vector<Constant *> Inits;
+    std::vector<unsigned> NewIndex;
+    Constant *Old = GV->getInitializer();
+    uint64_t Offset = 0;
+    std::string Moved;
+    for (unsigned k = 0; k < S->getNumElements(); ++k) {
+      Type *FieldTy = S->getElementType(k);
+      Offset = alignTo(Offset, DL.getABITypeAlign(FieldTy));
+      bool Flagged = Fields.count(k) || (k && Fields.count(k - 1));
+      if (Flagged && padTo(Offset)) {
+        Types.push_back(ArrayType::get(Type::getInt8Ty(M.getContext()),
+                                       padTo(Offset)));
+        Inits.push_back(padding(padTo(Offset)));
+        Offset += padTo(Offset);
+      }
+      if (Fields.count(k)) {
+        std::string FName = fieldName(
+            GV, DL.getStructLayout(S)->getElementOffset(k));
+        Moved += (Moved.empty() ? "" : ", ") +
+                 (FName.empty() ? std::to_string(k) : FName);
+      }
+      NewIndex.push_back(Types.size());
+      Types.push_back(FieldTy);
+      Inits.push_back(Old->getAggregateElement(k));
+      Offset += DL.getTypeAllocSize(FieldTy);
+    }
+    if (padTo(Offset)) {
+      Types.push_back(
+          ArrayType::get(Type::getInt8Ty(M.getContext()), padTo(Offset)));
+      Inits.push_back(padding(padTo(Offset)));
+    }
+
+    auto *NewTy = StructType::get(M.getContext(), Types);
+    std::string Name = GV->getName().str();
+    Type *I32Ty = Type::getInt32Ty(M.getContext());
+    replaceGlobal(GV, NewTy, ConstantStruct::get(NewTy, Inits),
+                  [&](SmallVectorImpl<Value *> &Idx) {
+                    unsigned k = cast<ConstantInt>(Idx[1])->getZExtValue();
+                    Idx[1] = ConstantInt::get(I32Ty, NewIndex[k]);
+                  });
+    return "moved field(s) " + Moved + " of " + Name +
+           " to lines of their own";
+  }
+
+  /// `T g` -> `{T, pad} g`, used through a GEP of its first field
+  std::string padScalar(GlobalVariable *GV) {
+    Type *Ty = GV->getValueType();
+    uint64_t Pad = padTo(DL.getTypeAllocSize(Ty));
+    std::string Name = GV->getName().str();
+    if (!Pad) {
+      GV->setAlignment(MaybeAlign(LineSize));
+      return "aligned " + Name + " to a line";
+    }
+    auto *NewTy = StructType::get(
+        M.getContext(),
+        {Ty, ArrayType::get(Type::getInt8Ty(M.getContext()), Pad)});
+    replaceGlobal(GV, NewTy,
+                  ConstantStruct::get(NewTy, {GV->getInitializer(),
+                                              padding(Pad)}),
+                  nullptr);
+    return "padded " + Name + " to a line of its own";
+  }
+
+  bool run() {
+    unsigned NumFlagged = findFalseSharing();
+    if (!NumFlagged) {
+      errs() << "false-sharing-pad: no accesses with false sharing\n";
+      return false;
+    }
+
+    unsigned NumPadded = 0;
+    for (auto &Entry : Candidates) {
+      GlobalVariable *GV = Entry.first;
+      Instruction *At = Entry.second.Accesses.front();
+      OptimizationRemarkEmitter &ORE = getORE(At);
+      std::string Why = whyNotPaddable(GV);
+      if (Why.empty() && isa<StructType>(GV->getValueType()) &&
+          Entry.second.Fields.empty())
+        Why = "no flagged access selects a field";
+      if (!Why.empty()) {
+        ORE.emit([&]() {
+          return OptimizationRemarkMissed(DEBUG_TYPE, "FalseSharingNotPadded",
+                                          At)
+                 << "false sharing on " << ore::NV("Global", GV->getName())
+                 << " not padded: " << Why;
+        });
+        continue;
+      }
+
+      std::string Done;
+      unsigned NumAccesses = Entry.second.Accesses.size();
+      if (auto *AT = dyn_cast<ArrayType>(GV->getValueType()))
+        Done = padArray(GV, AT);
+      else if (auto *S = dyn_cast<StructType>(GV->getValueType()))
+        Done = padStruct(GV, S, Entry.second.Fields);
+      else
+        Done = padScalar(GV);
+      ORE.emit([&]() {
+        return OptimizationRemark(DEBUG_TYPE, "FalseSharingPadded", At)
+               << ore::NV("Padding", Done) << " for "
+               << ore::NV("Accesses", NumAccesses)
+               << " access(es) with false sharing";
+      });
+      ++NumPadded;
+    }
+
+    errs() << "false-sharing-pad: padded " << NumPadded << " of "
+           << Candidates.size() << " globals with false sharing ("
+           << NumFlagged << " accesses, " << LineSize << " B lines)\n";
+    return NumPadded != 0;
+  }
+};
+
+} // namespace
+
+PreservedAnalyses FalseSharingPadPass::run(Module &M,
+                                           ModuleAnalysisManager &MAM) {
+  if (SharingProfile.empty()) {
+    errs() << "false-sharing-pad: no -cache-sharing-profile given\n";
+    return PreservedAnalyses::all();
+  }
+  std::map<uint32_t, SharingSiteStats> Sites;
+  if (!parseSharingProfile(SharingProfile, Sites)) {
+    errs() << "Failed to read sharing profile: " << SharingProfile << "\n";
+    return PreservedAnalyses::all();
+  }
+
+  CacheTarget Target;
+  loadCacheTarget(CacheCGFile, Target);
+
+  FalseSharingPadImpl Impl(M, MAM, Sites, Target.lineSize());
+  return Impl.run() ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
@@ -0,0 +1,284 @@
+#include "ParseCachegrindPass.h"
+
+#include "llvm/IR/Attributes.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/CodeExtractor.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<double> ICacheHotFraction(
+    "icache-hot-fraction",
+    cl::desc("Hottest functions covering this fraction of total Ir are "
+             "placed in .text.hot"),
+    cl::init(0.9));
+
+static cl::opt<bool> ICacheSplit(
+    "icache-split",
+    cl::desc("Outline never-executed regions of executed functions into "
+             ".text.unlikely"),
+    cl::init(true));
+
+static cl::opt<std::string> ICacheOrderFile(
+    "icache-order-file",
+    cl::desc("Write executed functions, hottest first, to this file for "
+             "the linker (e.g. lld --symbol-ordering-file)"),
+    cl::init(""));
+
+/**
+ * Instruction-side layout from Cachegrind's Ir/I1mr/ILmr columns.
+ *
+ * Per-line counts are summed over the distinct source lines of each basic
+ * block and function. Then:
+ *  - the hottest functions (by Ir, up to -icache-hot-fraction of the total)
+ *    go to .text.hot.<fn> and get the `hot` attribute;
+ *  - functions in profiled files that never executed go to
+ *    .text.unlikely.<fn> and get the `cold` attribute;
+ *  - with -icache-split, never-executed regions inside executed functions
+ *    (error paths, rare cases) are outlined into <fn>.cold.N functions in
+ *    .text.unlikely, so the hot path packs into fewer I-cache lines;
+ *  - with -icache-order-file, executed functions are listed hottest first.
+ *
+ * GNU ld and lld both group .text.hot.* and .text.unlikely.* sections in
+ * their default linker scripts.
+ */
+struct ICacheLayoutImpl {
+  Module &M;
+  const CachegrindProfile &Profile;
+  const std::map<FileLinePair, CacheMetrics> &lineMetrics;
+
+  /// Files that appear in the annotation; lines of these files that are
+  /// missing from lineMetrics were never executed.
+  std::set<std::string> ProfiledFiles;
+
+  struct FuncInfo {
+    Function *F = nullptr;
+    CacheMetrics Sum;
+    bool Profiled = false;
+  };
+
+  ICacheLayoutImpl(Module &M, const CachegrindProfile &Profile)
+      : M(M), Profile(Profile), lineMetrics(Profile.LineMetrics) {}
+
+  /// Sum instruction-side metrics over the distinct lines of Insts.
+  /// Profiled is set if any line belongs to a profiled file.
+  template <typename InstRange>
+  CacheMetrics sumLines(InstRange &&Insts, bool &Profiled, bool &HasLines) {
+    std::set<FileLinePair> Lines;
+    for (Instruction &I : Insts) {
+      FileLinePair fl;
+      if (Profile.getFileLine(I, fl) && fl.second > 0)
+        Lines.insert(fl);
+    }
+
+    CacheMetrics Sum;
+    Profiled = false;
+    HasLines = !Lines.empty();
+    for (const FileLinePair &fl : Lines) {
+      if (ProfiledFiles.count(fl.first))
+        Profiled = true;
+      auto it = lineMetrics.find(fl);
+      if (it == lineMetrics.end())
+        continue;
+      const CacheMetrics &cm = it->second;
+      Sum.Ir += cm.Ir;
+      Sum.I1mr += cm.I1mr;
+      Sum.ILmr += cm.ILmr;
+    }
+    return Sum;
+  }
+
+  FuncInfo summarizeFunction(Function &F) {
+    FuncInfo Info;
+    Info.F = &F;
+    bool HasLines = false;
+    Info.Sum = sumLines(instructions(F), Info.Profiled, HasLines);
+    return Info;
+  }
+
+  bool isColdBlock(BasicBlock &BB) {
+    if (BB.isEHPad() || isa<ReturnInst>(BB.getTerminator()))
+      return false;
+    bool Profiled = false, HasLines = false;
+    CacheMetrics Sum = sumLines(BB, Profiled, HasLines);
+    return HasLines && Profiled && Sum.Ir == 0;
+  }
+
+  /// Outline maximal never-executed single-entry regions of F.
+  unsigned splitColdRegions(Function &F) {
+    DominatorTree DT(F);
+    SmallPtrSet<BasicBlock *, 32> Cold;
+    for (BasicBlock &BB : F)
+      if (&BB != &F.getEntryBlock() && isColdBlock(BB))
+        Cold.insert(&BB);
+    if (Cold.empty())
+      return 0;
+
+    // Region roots: cold blocks whose immediate dominator is not cold.
+    // Each region is the cold part of the root's dominator subtree.
+    std::vector<SmallVector<BasicBlock *, 8>> Regions;
+    for (BasicBlock &BB : F) {
+      if (!Cold.count(&BB))
+        continue;
+      DomTreeNode *Node = DT.getNode(&BB);
+      if (!Node || (Node->getIDom() && Cold.count(Node->getIDom()->getBlock())))
+        continue;
+
+      SmallVector<BasicBlock *, 8> Region;
+      SmallVector<DomTreeNode *, 8> Worklist{Node};
+      while (!Worklist.empty()) {
+        DomTreeNode *N = Worklist.pop_back_val();
+        if (!Cold.count(N->getBlock()))
+          continue;
+        Region.push_back(N->getBlock());
+        for (DomTreeNode *Child : N->children())
+          Worklist.push_back(Child);
+      }
+      Regions.push_back(Region);
+    }
+
+    CodeExtractorAnalysisCache CEAC(F);
+    unsigned NumSplit = 0;
+    for (auto &Region : Regions) {
+      // DT goes stale after the first extraction, so don't hand it over.
+      CodeExtractor CE(Region, /*DT=*/nullptr, /*AggregateArgs=*/false,
+                       nullptr, nullptr, nullptr, /*AllowVarArgs=*/false,
+                       /*AllowAlloca=*/false, "cold");
+      if (!CE.isEligible())
+        continue;
+
+      Function *Outlined = CE.extractCodeRegion(CEAC);
+      if (!Outlined)
+        continue;
+
+      Outlined->addFnAttr(Attribute::Cold);
+      Outlined->addFnAttr(Attribute::NoInline);
+      Outlined->setSection(".text.unlikely." + Outlined->getName().str());
+      ++NumSplit;
+    }
+    return NumSplit;
+  }
+
+  bool writeOrderFile(const std::vector<FuncInfo> &Executed) {
+    std::error_code EC;
+    raw_fd_ostream OS(ICacheOrderFile, EC, sys::fs::OF_Text);
+    if (EC) {
+      errs() << "Failed to open order file " << ICacheOrderFile << ": "
+             << EC.message() << "\n";
+      return false;
+    }
+    for (const FuncInfo &Info : Executed)
+      OS << Info.F->getName() << "\n";
+    return true;
+  }
+
+  bool run() {
+    for (const auto &entry : lineMetrics)
+      ProfiledFiles.insert(entry.first.first);
+
+    std::vector<FuncInfo> Executed;
+    std::vector<Function *> NeverExecuted;
+    uint64_t TotalIr = 0;
+
+    for (Function &F : M) {
+      if (F.isDeclaration() || F.hasSection())
+        continue;
+
+      FuncInfo Info = summarizeFunction(F);
+      if (!Info.Profiled)
+        continue;
+
+      if (Info.Sum.Ir == 0) {
+        NeverExecuted.push_back(&F);
+      } else {
+        TotalIr += Info.Sum.Ir;
+        Executed.push_back(Info);
+      }
+    }
+
+    if (Executed.empty() && NeverExecuted.empty()) {
+      errs() << "icache-layout: no functions matched the profile\n";
+      return false;
+    }
+
+    std::stable_sort(Executed.begin(), Executed.end(),
+                     [](const FuncInfo &A, const FuncInfo &B) {
+                       return A.Sum.Ir > B.Sum.Ir;
+                     });
+
+    // Hot set: hottest functions up to ICacheHotFraction of all Ir
+    uint64_t HotIr = 0, HotI1mr = 0;
+    unsigned NumHot = 0;
+    errs() << "===== I-cache hot functions =====\n";
+    for (const FuncInfo &Info : Executed) {
+      if (NumHot > 0 && HotIr >= ICacheHotFraction * TotalIr)
+        break;
+      Info.F->addFnAttr(Attribute::Hot);
+      Info.F->setSection(".text.hot." + Info.F->getName().str());
+      HotIr += Info.Sum.Ir;
+      HotI1mr += Info.Sum.I1mr;
+      ++NumHot;
+
+      errs() << Info.F->getName()
+             << "  Ir="   << Info.Sum.Ir
+             << "  I1mr=" << Info.Sum.I1mr
+             << "  ILmr=" << Info.Sum.ILmr << "\n";
+    }
+    errs() << "===== End of I-cache hot functions =====\n";
+
+    for (Function *F : NeverExecuted) {
+      F->addFnAttr(Attribute::Cold);
+      F->setSection(".text.unlikely." + F->getName().str());
+    }
+
+    unsigned NumSplit = 0;
+    if (ICacheSplit) {
+      for (const FuncInfo &Info : Executed)
+        NumSplit += splitColdRegions(*Info.F);
+    }
+
+    if (!ICacheOrderFile.empty())
+      writeOrderFile(Executed);
+
+    uint64_t TotalI1mr = 0;
+    for (const FuncInfo &Info : Executed)
+      TotalI1mr += Info.Sum.I1mr;
+
+    errs() << "icache-layout: " << NumHot << " hot functions ("
+           << HotIr << " of " << TotalIr << " Ir, " << HotI1mr << " of "
+           << TotalI1mr << " I1mr), " << NeverExecuted.size()
+           << " never-executed functions, " << NumSplit
+           << " cold regions outlined\n";
+    return true;
+  }
+};
+
+PreservedAnalyses ICacheLayoutPass::run(Module &M,
+                                        ModuleAnalysisManager &MAM) {
+  if (CacheCGFile.empty()) {
+    errs() << "No file provided via -cache-cg-file\n";
+    return PreservedAnalyses::all();
+  }
+
+  const auto &Profile = MAM.getResult<CachegrindProfileAnalysis>(M);
+  if (!Profile.Loaded) {
+    errs() << "Failed to parse file: " << CacheCGFile << "\n";
+    return PreservedAnalyses::all();
+  }
+
+  ICacheLayoutImpl Impl(M, Profile);
+  return Impl.run() ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
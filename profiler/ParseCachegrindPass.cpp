@@ -1,10 +1,24 @@
+#include "ParseCachegrindPass.h"
+#include "ReuseProfile.h"
+#include "SharingProfile.h"
+#include "StrideProfile.h"
+
 #include "llvm/IR/PassManager.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
-
+#include "llvm/Transforms/Coroutines/CoroCleanup.h"
+#include "llvm/Transforms/Coroutines/CoroEarly.h"
+#include "llvm/Transforms/Coroutines/CoroSplit.h"
+
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instruction.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/IRBuilder.h"
@@ -13,24 +27,20 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/ADT/SmallVector.h"
 
-#include <algorithm> // for std::remove
 #include <cstdint>
-#include <fstream>
 #include <map>
-#include <regex>
-#include <sstream>
 #include <string>
 
 using namespace llvm;
 
-typedef std::pair<std::string, int> FileLinePair;
+#define DEBUG_TYPE "parse-cachegrind"
 
-static cl::opt<std::string> CacheCGFile(
+cl::opt<std::string> CacheCGFile(
     "cache-cg-file",
     cl::desc("Path to cg_annotate output"),
     cl::init(""));
 
-static cl::opt<uint64_t> MissThreshold(
+cl::opt<uint64_t> MissThreshold(
     "cache-miss-threshold",
     cl::desc("Total data cache misses (D1mr+DLmr+D1mw+DLmw) needed to prefetch"),
     // cl::init(3000000000)); // tweak via CLI
@@ -38,81 +48,247 @@ static cl::opt<uint64_t> MissThreshold(
 
 static cl::opt<unsigned> PrefetchDistance(
     "cache-prefetch-distance",
-    cl::desc("Prefetch this many elements ahead along a non-constant GEP index"),
+    cl::desc("Prefetch this many elements ahead along a non-constant GEP "
+             "index (default: from the cache target's miss latency and the "
+             "loop's size, or 4 outside loops)"),
     cl::init(4)); // default lookahead
 
-// Constants
-const std::string AutoAnnotatedPrefix = "-- Auto-annotated source:";
-const std::string EndAnnotatedBlock =
-    "--------------------------------------------------------------------------"
-    "------";
-
-static std::string normalizeFileName(const std::string &Path) {
-  std::string S = Path;
-  // Strip directory components: keep only the basename
-  auto pos = S.find_last_of("/\\");
-  if (pos != std::string::npos)
-    S = S.substr(pos + 1);
-  return S;
-}
+static cl::opt<unsigned> PrefetchMaxDistance(
+    "cache-prefetch-max-distance",
+    cl::desc("Upper bound on the distance derived from the cache target"),
+    cl::init(64));
 
-/**
- * Metrics from Cachegrind for a specific line.
- */
-struct CacheMetrics {
-  uint64_t Dr = 0;
-  uint64_t D1mr = 0;
-  uint64_t DLmr = 0;
-  uint64_t Dw = 0;
-  uint64_t D1mw = 0;
-  uint64_t DLmw = 0;
-};
+static cl::opt<std::string> PrefetchDecisionsIn(
+    "cache-prefetch-decisions",
+    cl::desc("Per-site decision file; listed sites use its distances (0 = "
+             "skip). Without -cache-cg-file only listed sites are prefetched"),
+    cl::init(""));
+
+static cl::opt<std::string> PrefetchDecisionsOut(
+    "cache-prefetch-decisions-out",
+    cl::desc("Write the per-site decisions used for this module here"),
+    cl::init(""));
+
+static cl::opt<std::string> RetuneProfile(
+    "cache-retune-profile",
+    cl::desc("cg_annotate output of a binary built from "
+             "-cache-prefetch-decisions; sites still being tuned are "
+             "updated from it before prefetching"),
+    cl::init(""));
+
+static cl::opt<std::string> EmitPlan(
+    "cache-emit-plan",
+    cl::desc("Write the per-site prefetch plan (JSON, or YAML for .yaml/.yml) "
+             "and leave the module unchanged"),
+    cl::init(""));
+
+static cl::opt<std::string> ApplyPlan(
+    "cache-apply-plan",
+    cl::desc("Insert exactly the prefetches of this plan; no profile needed"),
+    cl::init(""));
+
+static cl::opt<bool> DumpMetrics(
+    "cache-dump-metrics",
+    cl::desc("Print the parsed per-line Cachegrind metrics"),
+    cl::init(false));
+
+static cl::opt<bool> SkipColdFunctions(
+    "cache-skip-cold-functions",
+    cl::desc("Skip functions with no hot line between their first line and "
+             "the next function's without reading their instructions"),
+    cl::init(true));
+
+static cl::opt<bool> PrefetchInstrument(
+    "cache-prefetch-instrument",
+    cl::desc("Call the cp_runtime prefetch accounting hooks around every "
+             "access and inserted prefetch (link with cp_runtime)"),
+    cl::init(false));
+
+static cl::opt<std::string> PrefetchFeedback(
+    "cache-prefetch-feedback",
+    cl::desc("Per-site table from an instrumented run; sites that fail "
+             "-cache-prefetch-min-useful/-max-redundant are not prefetched"),
+    cl::init(""));
+
+static cl::opt<double> PrefetchMinUseful(
+    "cache-prefetch-min-useful",
+    cl::desc("Minimum (useful + late) / (useful + late + early) for a site "
+             "to be kept"),
+    cl::init(0.25));
+
+static cl::opt<double> PrefetchMaxRedundant(
+    "cache-prefetch-max-redundant",
+    cl::desc("Maximum redundant / issued for a site to be kept"),
+    cl::init(0.99));
+
+static cl::opt<bool> ReuseInstrument(
+    "cache-reuse-instrument",
+    cl::desc("Call the cp_runtime reuse-distance profiler before every "
+             "load/store instead of prefetching (link with cp_runtime)"),
+    cl::init(false));
+
+static cl::opt<std::string> ReuseProfile(
+    "cache-reuse-profile",
+    cl::desc("Per-access table from a -cache-reuse-instrument run; hot loads "
+             "whose misses are mostly capacity or conflict misses are not "
+             "prefetched"),
+    cl::init(""));
+
+static cl::opt<bool> StrideInstrument(
+    "cache-stride-instrument",
+    cl::desc("Call the cp_runtime stride profiler before every load instead "
+             "of prefetching (link with cp_runtime)"),
+    cl::init(false));
+
+static cl::opt<std::string> StrideProfile(
+    "cache-stride-profile",
+    cl::desc("Per-load table from a -cache-stride-instrument run; loads with "
+             "no index to advance are prefetched at addr + stride * distance"),
+    cl::init(""));
+
+static cl::opt<double> StrideMinStable(
+    "cache-stride-min-stable",
+    cl::desc("Minimum fraction of a load's address deltas equal to its "
+             "profiled stride for the stride to be used"),
+    cl::init(0.75));
+
+static cl::opt<bool> SharingInstrument(
+    "cache-sharing-instrument",
+    cl::desc("Call the cp_runtime sharing profiler before every load/store "
+             "instead of prefetching (link with cp_runtime)"),
+    cl::init(false));
+
+cl::opt<std::string> SharingProfile(
+    "cache-sharing-profile",
+    cl::desc("Per-thread table from a -cache-sharing-instrument run; false "
+             "sharing is reported and lines other threads write are not "
+             "prefetched"),
+    cl::init(""));
+
+static cl::opt<double> SharedLineMax(
+    "cache-shared-line-max",
+    cl::desc("Maximum fraction of an access's executions that miss on, or "
+             "take, a line from another thread for it to be prefetched"),
+    cl::init(0.05));
+
+cl::opt<double> FalseSharingMin(
+    "cache-false-sharing-min",
+    cl::desc("Minimum fraction of an access's executions that are false "
+             "sharing misses for a FalseSharing remark"),
+    cl::init(0.01));
 
 struct ParseCachegrindPass : public PassInfoMixin<ParseCachegrindPass> {
 
-  /// Maps (filename, line number) -> cachegrind information
-  std::map<FileLinePair, CacheMetrics> lineMetrics;
+  /// The -cache-cg-file profile (empty without one), set by run()
+  const CachegrindProfile *Profile = nullptr;
+
+  /// Maps prefetch site ID -> counts from an instrumented run
+  std::map<uint32_t, PrefetchSiteStats> siteFeedback;
+
+  /// Maps prefetch site ID -> decision (distance, tuning state)
+  std::map<uint32_t, PrefetchDecision> decisions;
+
+  /// Maps prefetch site ID -> miss classes from a reuse-distance run
+  std::map<uint32_t, ReuseSiteStats> reuseStats;
+
+  /// Maps prefetch site ID -> dominant address delta from a stride run
+  std::map<uint32_t, StrideSiteStats> strideStats;
+
+  /// Maps prefetch site ID -> per-thread sharing counts, summed
+  std::map<uint32_t, SharingSiteStats> sharingStats;
+
+  /// Accesses reported as false sharing so far
+  unsigned NumFalseSharing = 0;
+
+  /// True if the sharing profile says the lines of this access move
+  /// between threads too often for a prefetched copy to survive
+  bool isSharedLine(uint32_t ID) {
+    auto It = sharingStats.find(ID);
+    if (It == sharingStats.end() || !It->second.Accesses)
+      return false;
+    const SharingSiteStats &S = It->second;
+    return double(S.Coherence + S.SharedWrites) / S.Accesses > SharedLineMax;
+  }
+
+  /// The profiled stride of a load, or 0 if it has none or it isn't stable
+  int64_t learnedStride(uint32_t ID) {
+    auto It = strideStats.find(ID);
+    if (It == strideStats.end() || It->second.stability() < StrideMinStable)
+      return 0;
+    return It->second.Stride;
+  }
+
+  /// True if feedback says the prefetch at this site didn't pay off
+  bool isPrunedSite(uint32_t ID) {
+    auto it = siteFeedback.find(ID);
+    if (it == siteFeedback.end() || it->second.Issued == 0)
+      return false;
+    return it->second.usefulFraction() < PrefetchMinUseful ||
+           it->second.redundantFraction() > PrefetchMaxRedundant;
+  }
 
   bool isHotLine(const FileLinePair &fl) {
-    auto it = lineMetrics.find(fl);
-    if (it == lineMetrics.end())
+    auto it = Profile->LineMetrics.find(fl);
+    if (it == Profile->LineMetrics.end())
       return false;
 
     const CacheMetrics &cm = it->second;
-    uint64_t totalMisses = cm.D1mr + cm.DLmr + cm.D1mw + cm.DLmw;
-    return totalMisses >= MissThreshold;
+    return cm.totalMisses() >= MissThreshold;
+  }
+
+  /// Append the profile counts of fl, if it has any, to a remark.
+  void addMisses(DiagnosticInfoOptimizationBase &R, const FileLinePair &fl) {
+    auto it = Profile->LineMetrics.find(fl);
+    if (it == Profile->LineMetrics.end())
+      return;
+    const CacheMetrics &cm = it->second;
+    R << " [D1mr=" << ore::NV("D1mr", cm.D1mr)
+      << " DLmr=" << ore::NV("DLmr", cm.DLmr)
+      << " D1mw=" << ore::NV("D1mw", cm.D1mw)
+      << " DLmw=" << ore::NV("DLmw", cm.DLmw) << "]";
   }
 
   /// Try to compute a "future" address for prefetching by bumping a
-  /// non-constant index of a GEP by PrefetchDistance. Returns nullptr
-  /// if we can't do anything better than the original address.
-  Value *computeFutureAddress(Value *Addr, IRBuilder<> &Builder) {
+  /// non-constant index of a GEP by Distance. Returns nullptr, with the
+  /// reason in Why, if we can't do anything better than the original
+  /// address. The bumped index is kept in bounds by Bounds (see
+  /// PrefetchBounds.cpp).
+  Value *computeFutureAddress(Value *Addr, Instruction *I, unsigned Distance,
+                              PrefetchBounds &Bounds, IRBuilder<> &Builder,
+                              const char *&Why) {
     // Only handle GetElementPtr for now. This covers typical array/pointer code.
     auto *GEP = dyn_cast<GetElementPtrInst>(Addr);
-    if (!GEP)
+    if (!GEP) {
+      Why = "address is not a GEP";
       return nullptr;
+    }
 
     SmallVector<Value *, 8> NewIndices;
     bool Updated = false;
 
     // Copy all indices, but bump the first non-constant integer index we see.
+    unsigned Pos = 0;
     for (Value *Idx : GEP->indices()) {
       if (!Updated &&
           !isa<Constant>(Idx) &&
           Idx->getType()->isIntegerTy()) {
-        // idx' = idx + PrefetchDistance
+        // idx' = idx + Distance
         Value *Off = Builder.getIntN(
-            Idx->getType()->getIntegerBitWidth(), PrefetchDistance);
+            Idx->getType()->getIntegerBitWidth(), Distance);
         Value *NewIdx = Builder.CreateAdd(Idx, Off, "prefetch.idx");
+        NewIdx = Bounds.boundIndex(GEP, Pos, NewIdx, Distance, I, Builder);
         NewIndices.push_back(NewIdx);
         Updated = true;
       } else {
         NewIndices.push_back(Idx);
       }
+      ++Pos;
     }
 
-    if (!Updated)
-      return nullptr; // nothing to bump -> can't compute a future address
+    if (!Updated) {
+      Why = "no non-constant index"; // can't compute a future address
+      return nullptr;
+    }
 
     // Build a new GEP with the updated indices
     return Builder.CreateGEP(
@@ -123,34 +299,58 @@ struct ParseCachegrindPass : public PassInfoMixin<ParseCachegrindPass> {
   }
 
   /// Insert a prefetch call, ideally on a future address derived from the
-  /// current load/store address. Falls back to prefetching the same address
-  /// if we can't analyze the pattern.
-  bool insertPrefetch(Instruction *I) {
+  /// current load/store address. If we can't analyze the pattern, uses the
+  /// site's profiled stride (LearnedStride analysis remark) or falls back to
+  /// prefetching the same address (SameAddress analysis remark). Returns the
+  /// prefetch call, or nullptr.
+  CallInst *insertPrefetch(Instruction *I, const PrefetchSite &Site,
+                           PrefetchBounds &Bounds,
+                           OptimizationRemarkEmitter &ORE) {
   IRBuilder<> Builder(I);
 
   Value *Addr = nullptr;
 
   if (auto *LI = dyn_cast<LoadInst>(I)) {
-    // Only prefetch loads
     Addr = LI->getPointerOperand();
   } else if (auto *SI = dyn_cast<StoreInst>(I)) {
-    // Skip stores entirely
-    return false;
+    // Stores only get (write) prefetches when a plan asks for them
+    if (Site.RW != 1)
+      return nullptr;
+    Addr = SI->getPointerOperand();
   } else {
-    return false; // not a load/store
+    return nullptr; // not a load/store
   }
 
   if (!Addr)
-    return false;
+    return nullptr;
 
   Module *M = I->getModule();
   LLVMContext &Ctx = M->getContext();
 
   // Try to compute a "future" address in the same loop
-  Value *PrefAddr = computeFutureAddress(Addr, Builder);
-  if (!PrefAddr) {
+  const char *Why = nullptr;
+  Value *PrefAddr =
+      computeFutureAddress(Addr, I, Site.Distance, Bounds, Builder, Why);
+  if (!PrefAddr && Site.Stride) {
+    // addr + stride * distance, in bytes; prefetches never fault
+    int64_t Offset = Site.Stride * (int64_t)Site.Distance;
+    Value *Base = Builder.CreateBitCast(
+        Addr,
+        Builder.getInt8PtrTy(Addr->getType()->getPointerAddressSpace()));
+    PrefAddr = Builder.CreateGEP(Builder.getInt8Ty(), Base,
+                                 Builder.getInt64(Offset), "prefetch.addr");
+    ORE.emit([&]() {
+      return OptimizationRemarkAnalysis(DEBUG_TYPE, "LearnedStride", I)
+             << ore::NV("Reason", Why) << "; using the profiled stride of "
+             << ore::NV("Stride", Site.Stride) << " B";
+    });
+  } else if (!PrefAddr) {
     // Fall back to prefetching the same address (still sometimes useful)
     PrefAddr = Addr;
+    ORE.emit([&]() {
+      return OptimizationRemarkAnalysis(DEBUG_TYPE, "SameAddress", I)
+             << "fell back to same address: " << ore::NV("Reason", Why);
+    });
   }
 
   // Cast to i8* as required by llvm.prefetch
@@ -164,194 +364,629 @@ struct ParseCachegrindPass : public PassInfoMixin<ParseCachegrindPass> {
   // rw: 0 = read, 1 = write
   // locality: 0 (none) .. 3 (high)
   // cache_type: 1 = data cache
-  Value *RW        = Builder.getInt32(0); // read prefetch
-  Value *Locality  = Builder.getInt32(3); // high locality
+  Value *RW        = Builder.getInt32(Site.RW);       // 0 unless planned
+  Value *Locality  = Builder.getInt32(Site.Locality); // 3 unless planned
   Value *CacheType = Builder.getInt32(1); // data cache
 
-  Builder.CreateCall(PrefetchFn, {AddrI8, RW, Locality, CacheType});
-  return true;
+  return Builder.CreateCall(PrefetchFn, {AddrI8, RW, Locality, CacheType});
 }
 
 
-  bool parseInputFile(const std::string &path) {
-    std::ifstream ifs(path);
-    if (!ifs) {
-      errs() << "Failed to open cachegrind file: " << path << "\n";
+  /// Load the decision file and, given a profile of the binary built from
+  /// it, retune it. Returns false on a read error.
+  bool loadDecisions() {
+    if (!readPrefetchDecisions(PrefetchDecisionsIn, decisions)) {
+      errs() << "Failed to read decision file: " << PrefetchDecisionsIn << "\n";
       return false;
     }
+    if (RetuneProfile.empty())
+      return true;
 
-    std::string line;
-    std::string currentFile;
-    int lineNumber = 0;
-
-    while (std::getline(ifs, line)) {
-      // Start of an annotated block: "-- Auto-annotated source:  filename"
-      if (line.rfind(AutoAnnotatedPrefix, 0) == 0) {
-        auto filename = line.substr(AutoAnnotatedPrefix.size());
-        std::string trimmed =
-            std::regex_replace(filename, std::regex("^ +| +$|( ) +"), "$1");
+    std::map<FileLinePair, CacheMetrics> Measured;
+    if (!parseCachegrindFile(RetuneProfile, Measured)) {
+      errs() << "Failed to parse file: " << RetuneProfile << "\n";
+      return false;
+    }
+    unsigned StillTuning =
+        retunePrefetchDecisions(decisions, Profile->LineMetrics, Measured,
+                                Profile->Target);
+    errs() << "Retune: " << StillTuning << " of " << decisions.size()
+           << " sites still tuning\n";
+    return true;
+  }
 
-        currentFile = normalizeFileName(trimmed);
-        lineNumber = 0;
-        std::getline(ifs, line); // skip first dashed block
+  /// A load planned for prefetching, for finding others on the same line
+  struct PlannedLoad {
+    const Loop *L;
+    const SCEV *Ptr;
+    uint32_t ID;
+  };
+
+  /// Fit a new hot load's prefetch to the cache target: a distance that
+  /// covers the expected miss latency in iterations of its loop and reaches
+  /// at least the next line, and a locality from the bytes the loop walks
+  /// before coming back (its footprint) against D1 and LL. Returns false,
+  /// with the site dropped, if a load already planned in the same loop is
+  /// within a line of this one. Stride is set to the load's constant step
+  /// per iteration, if it has one, or else to its profiled stride.
+  bool modelSite(LoadInst &Load, FunctionAnalysisManager &FAM,
+                 PrefetchSite &Site, std::vector<PlannedLoad> &Planned,
+                 std::map<const Loop *, unsigned> &IterCosts,
+                 int64_t &Stride) {
+    Function &F = *Load.getFunction();
+    Loop *L = FAM.getResult<LoopAnalysis>(F).getLoopFor(Load.getParent());
+    if (!L)
+      return true;
+    ScalarEvolution &SE = FAM.getResult<ScalarEvolutionAnalysis>(F);
+    const CacheTarget &T = Profile->Target;
+
+    const SCEV *Ptr = SE.getSCEV(Load.getPointerOperand());
+    for (const PlannedLoad &P : Planned) {
+      if (P.L != L || P.Ptr->getType() != Ptr->getType())
         continue;
+      auto *Diff = dyn_cast<SCEVConstant>(SE.getMinusSCEV(Ptr, P.Ptr));
+      if (Diff && Diff->getAPInt().abs().ult(T.lineSize())) {
+        Site.Distance = 0;
+        Site.Reason = "within a cache line of site " + std::to_string(P.ID);
+        return false;
       }
+    }
+    Planned.push_back({L, Ptr, Site.ID});
+
+    unsigned &IterCost = IterCosts[L];
+    if (!IterCost)
+      for (BasicBlock *BB : L->blocks())
+        for (Instruction &I : *BB)
+          IterCost += !isa<PHINode>(I) && !isa<DbgInfoIntrinsic>(I);
+
+    if (auto *AR = dyn_cast<SCEVAddRecExpr>(Ptr))
+      if (AR->getLoop() == L)
+        if (auto *Step = dyn_cast<SCEVConstant>(AR->getStepRecurrence(SE)))
+          Stride = Step->getAPInt().getSExtValue();
+    bool Profiled = !Stride && Site.Stride;
+    if (Profiled)
+      Stride = Site.Stride;
+    uint64_t Footprint = 0;
+    if (unsigned Trips = SE.getSmallConstantTripCount(L))
+      Footprint = uint64_t(Stride < 0 ? -Stride : Stride) * Trips;
+
+    // The profile is shared with the other passes: look up, don't insert.
+    // A decision-file site may have no profiled line at all.
+    static const CacheMetrics NoMetrics;
+    auto MI = Profile->LineMetrics.find(Site.Loc);
+    const CacheMetrics &CM =
+        MI == Profile->LineMetrics.end() ? NoMetrics : MI->second;
+    if (!PrefetchDistance.getNumOccurrences())
+      Site.Distance = T.distanceFor(CM, IterCost, Stride, PrefetchMaxDistance);
+    Site.Locality = T.localityFor(Footprint);
+    Site.Reason += "; " + std::to_string(T.missLatency(CM)) +
+                   " cycles/miss, " + std::to_string(IterCost) +
+                   " instructions/iteration";
+    if (Stride)
+      Site.Reason += ", " + std::to_string(Stride) +
+                     (Profiled ? " B profiled stride" : " B stride");
+    if (Footprint)
+      Site.Reason += ", " + std::to_string(Footprint) + " B footprint";
+    return true;
+  }
 
-      // End of an annotated block (but skip the first dashed line after filename)
-      if (!currentFile.empty() &&
-          line.rfind(EndAnnotatedBlock, 0) == 0 &&
-          lineNumber != 0) {
-        currentFile.clear();
-        continue;
-      }
+  /// Keep or drop a hot load's prefetch by the class of most of its misses
+  /// in the reuse profile. Compulsory misses and capacity misses of a
+  /// constant-stride stream (kept with locality 0: the data won't be back)
+  /// are what prefetching hides. Other capacity misses call for tiling or
+  /// loop interchange, conflict misses for padding or realignment; those
+  /// sites are dropped with a remark saying so.
+  void applyReuseVerdict(Instruction &I, PrefetchSite &Site, int64_t Stride,
+                         OptimizationRemarkEmitter &ORE) {
+    auto It = reuseStats.find(Site.ID);
+    if (It == reuseStats.end() || !It->second.classified())
+      return;
+    const ReuseSiteStats &S = It->second;
+    std::string Counts = std::to_string(S.Compulsory) + " compulsory, " +
+                         std::to_string(S.Capacity) + " capacity, " +
+                         std::to_string(S.Conflict) + " conflict misses";
+
+    if (S.Compulsory >= S.Capacity && S.Compulsory >= S.Conflict) {
+      Site.Reason += "; " + Counts;
+      return;
+    }
+    if (S.Capacity >= S.Conflict && Stride) {
+      Site.Locality = 0;
+      Site.Reason += "; streaming, " + Counts;
+      return;
+    }
 
-      // Not in an annotated block? Skip.
-      if (currentFile.empty())
-        continue;
+    bool Capacity = S.Capacity >= S.Conflict;
+    Site.Distance = 0;
+    Site.Reason = Capacity ? "capacity misses: tile or interchange"
+                           : "conflict misses: pad or realign";
+    ORE.emit([&]() {
+      OptimizationRemarkMissed R(DEBUG_TYPE,
+                                 Capacity ? "CapacityMisses" : "ConflictMisses",
+                                 &I);
+      R << ore::NV("Reason", Site.Reason) << " ("
+        << ore::NV("Compulsory", S.Compulsory) << " compulsory, "
+        << ore::NV("Capacity", S.Capacity) << " capacity, "
+        << ore::NV("Conflict", S.Conflict) << " conflict)";
+      addMisses(R, Site.Loc);
+      return R;
+    });
+  }
 
-      // Skip header row: "Ir I1mr ILmr ..."
-      if (line.rfind("Ir", 0) == 0)
-        continue;
+  /// Report an access whose misses are mostly other threads' writes to
+  /// other bytes of its lines, hot or not: padding, not prefetching, fixes
+  /// those (see FalseSharingPadPass.cpp).
+  void reportFalseSharing(Instruction &I, uint32_t ID,
+                          OptimizationRemarkEmitter &ORE) {
+    auto It = sharingStats.find(ID);
+    if (It == sharingStats.end() || !It->second.FalseSharing ||
+        double(It->second.FalseSharing) / It->second.Accesses < FalseSharingMin)
+      return;
+    const SharingSiteStats &S = It->second;
+    std::string Object = describeSharedObject(
+        getLoadStorePointerOperand(&I), I.getModule()->getDataLayout());
+    ++NumFalseSharing;
+    ORE.emit([&]() {
+      return OptimizationRemarkAnalysis(DEBUG_TYPE, "FalseSharing", &I)
+             << "false sharing: " << ore::NV("FalseSharing", S.FalseSharing)
+             << " of " << ore::NV("Accesses", S.Accesses)
+             << " accesses by " << ore::NV("Threads", S.Threads)
+             << " threads missed on a line another thread wrote elsewhere"
+             << (Object.empty() ? "" : " (") << ore::NV("Object", Object)
+             << (Object.empty() ? "" : ")");
+    });
+  }
+
+  void emitSharedLine(Instruction &I, const PrefetchSite &Site,
+                      const SharingSiteStats &S,
+                      OptimizationRemarkEmitter &ORE) {
+    ORE.emit([&]() {
+      OptimizationRemarkMissed R(DEBUG_TYPE, "SharedLine", &I);
+      R << ore::NV("Reason", Site.Reason) << ": "
+        << ore::NV("Coherence", S.Coherence) << " coherence misses, "
+        << ore::NV("SharedWrites", S.SharedWrites) << " shared writes in "
+        << ore::NV("Accesses", S.Accesses) << " accesses by "
+        << ore::NV("Threads", S.Threads) << " threads";
+      addMisses(R, Site.Loc);
+      return R;
+    });
+  }
 
-      // Blank line: don't advance lineNumber
-      if (line.empty())
+  /// Decide, without touching the IR, which accesses of F get a prefetch
+  /// and how, appending them to Sites. Sites that were considered but
+  /// dropped are kept with distance 0 so the plan shows why; every access
+  /// gets a remark saying why it was or wasn't planned.
+  void planFunction(Function &F, FunctionAnalysisManager &FAM,
+                    std::vector<PrefetchSite> &Sites) {
+    auto &ORE = FAM.getResult<OptimizationRemarkEmitterAnalysis>(F);
+
+    // Accesses seen so far per line, for stable site IDs
+    std::map<FileLinePair, unsigned> Ordinals;
+    std::vector<PlannedLoad> Planned;
+    std::map<const Loop *, unsigned> IterCosts;
+    int64_t Stride;
+
+    for (Instruction &I : instructions(F)) {
+      // Only care about loads and stores
+      if (!isa<LoadInst>(&I) && !isa<StoreInst>(&I))
         continue;
 
-      // Left trim spaces
-      auto trimmedLine = std::regex_replace(line, std::regex("^ +"), "$1");
+      // Need debug info to map back to source line
+      FileLinePair fl;
+      if (!Profile->getFileLine(I, fl))
+        continue;
 
-      // Handle line skips: "-- line 39 -----------"
-      if (trimmedLine.rfind("-- line", 0) == 0) {
-        std::stringstream ss(trimmedLine.substr(std::strlen("-- line")));
-        int ln = 0;
-        ss >> ln;
-        lineNumber = ln - 1;
+      PrefetchSite Site;
+      Site.Ordinal = Ordinals[fl]++;
+      Site.ID = prefetchSiteID(F, fl, Site.Ordinal);
+      Site.Function = F.getName().str();
+      Site.Loc = fl;
+      Site.Distance = PrefetchDistance;
+      reportFalseSharing(I, Site.ID, ORE);
+
+      // A decision overrides hotness and the distance modelSite() picks;
+      // new hot sites start tuning at that distance
+      auto DI = decisions.find(Site.ID);
+      if (DI != decisions.end()) {
+        Site.Reason = std::string("decision file: ") + DI->second.stateName();
+      } else if (isHotLine(fl)) {
+        uint64_t Misses = Profile->LineMetrics.find(fl)->second.totalMisses();
+        Site.Reason = "hot line: " + std::to_string(Misses) + " data misses";
+      } else {
+        ORE.emit([&]() {
+          OptimizationRemarkMissed R(DEBUG_TYPE, "NotHot", &I);
+          auto it = Profile->LineMetrics.find(fl);
+          R << "not hot: "
+            << ore::NV("Misses", it == Profile->LineMetrics.end()
+                                     ? 0
+                                     : it->second.totalMisses())
+            << " data misses, threshold "
+            << ore::NV("Threshold", MissThreshold.getValue());
+          addMisses(R, fl);
+          return R;
+        });
         continue;
       }
 
-      ++lineNumber;
-
-      // Sanity check: first token should start with a digit
-      if (trimmedLine.empty() ||
-          !std::isdigit(static_cast<unsigned char>(trimmedLine[0]))) {
+      // The planner only prefetches loads
+      if (!isa<LoadInst>(&I)) {
+        ORE.emit([&]() {
+          OptimizationRemarkMissed R(DEBUG_TYPE, "StoreSkipped", &I);
+          R << "store skipped";
+          addMisses(R, fl);
+          return R;
+        });
         continue;
       }
 
-      std::stringstream ss(trimmedLine);
-      uint64_t fields[6];
-      std::string temp;
-
-      // Skip first three fields (Ir I1mr ILmr)
-      ss >> temp >> temp >> temp;
-
-      // Read Dr, D1mr, DLmr, Dw, D1mw, DLmw
-      for (int i = 0; i < 6; ++i) {
-        if (!(ss >> temp)) {
-          fields[i] = 0;
-          continue;
-        }
+      Site.Stride = learnedStride(Site.ID);
+      Stride = 0;
+      if (!modelSite(cast<LoadInst>(I), FAM, Site, Planned, IterCosts,
+                     Stride)) {
+        ORE.emit([&]() {
+          OptimizationRemarkMissed R(DEBUG_TYPE, "SameLine", &I);
+          R << ore::NV("Reason", Site.Reason);
+          addMisses(R, fl);
+          return R;
+        });
+        Sites.push_back(Site);
+        continue;
+      }
 
-        // Strip commas from numbers like "7,004"
-        temp.erase(std::remove(temp.begin(), temp.end(), ','), temp.end());
+      applyReuseVerdict(I, Site, Stride, ORE);
 
-        if (temp.empty() ||
-            !std::isdigit(static_cast<unsigned char>(temp[0]))) {
-          fields[i] = 0;
-          continue;
-        }
+      // Locality and the reuse verdict still come from the model
+      bool DecisionPruned = false;
+      if (Site.Distance && DI != decisions.end()) {
+        Site.Distance = DI->second.Distance;
+        DecisionPruned = !Site.Distance;
+      }
+      if (Site.Distance && isSharedLine(Site.ID)) {
+        const SharingSiteStats &S = sharingStats[Site.ID];
+        Site.Distance = 0;
+        Site.Reason = "line shared with other threads";
+        emitSharedLine(I, Site, S, ORE);
+      }
 
-        fields[i] = static_cast<uint64_t>(std::stoull(temp));
+      if (Site.Distance && isPrunedSite(Site.ID)) {
+        const PrefetchSiteStats &S = siteFeedback[Site.ID];
+        ORE.emit([&]() {
+          OptimizationRemarkMissed R(DEBUG_TYPE, "PrunedByFeedback", &I);
+          R << "pruned by accounting feedback: useful "
+            << ore::NV("Useful", S.Useful) << ", late "
+            << ore::NV("Late", S.Late) << ", early "
+            << ore::NV("Early", S.Early) << ", redundant "
+            << ore::NV("Redundant", S.Redundant) << " of "
+            << ore::NV("Issued", S.Issued);
+          addMisses(R, fl);
+          return R;
+        });
+        Site.Distance = 0;
+        Site.Reason = "pruned by accounting feedback";
+      } else if (DecisionPruned) {
+        ORE.emit([&]() {
+          OptimizationRemarkMissed R(DEBUG_TYPE, "DecisionPruned", &I);
+          R << "pruned by decision file";
+          addMisses(R, fl);
+          return R;
+        });
       }
 
-      CacheMetrics &cm = lineMetrics[{currentFile, lineNumber}];
-      cm.Dr   += fields[0];
-      cm.D1mr += fields[1];
-      cm.DLmr += fields[2];
-      cm.Dw   += fields[3];
-      cm.D1mw += fields[4];
-      cm.DLmw += fields[5];
+      if (Site.Distance && DI == decisions.end()) {
+        PrefetchDecision &D = decisions[Site.ID];
+        D.ID = Site.ID;
+        D.Function = Site.Function;
+        D.Loc = fl;
+        D.Distance = Site.Distance;
+      }
+      Sites.push_back(Site);
     }
-
-    errs() << "Parsed " << lineMetrics.size()
-           << " annotated lines from cachegrind\n";
-    return !lineMetrics.empty();
   }
 
-  PreservedAnalyses run(Module &M, ModuleAnalysisManager &MAM) {
-    if (CacheCGFile.empty()) {
-      errs() << "No file provided via -cache-cg-file\n";
-      return PreservedAnalyses::all();
+  std::vector<PrefetchSite> planSites(Module &M,
+                                      FunctionAnalysisManager &FAM) {
+    std::vector<PrefetchSite> Sites;
+    unsigned NumFunctions = 0, NumCold = 0;
+    for (Function &F : M) {
+      if (F.isDeclaration())
+        continue;
+      ++NumFunctions;
+      // A decision file may list sites in any function
+      if (SkipColdFunctions && PrefetchDecisionsIn.empty() &&
+          Profile->isColdFunction(F)) {
+        ++NumCold;
+        continue;
+      }
+      planFunction(F, FAM, Sites);
     }
+    if (NumCold)
+      errs() << "parse-cachegrind: skipped " << NumCold << " of "
+             << NumFunctions << " functions with no hot line\n";
+    if (NumFalseSharing)
+      errs() << "parse-cachegrind: " << NumFalseSharing
+             << " accesses with false sharing (FalseSharing remarks)\n";
+    return Sites;
+  }
 
-    if (!parseInputFile(CacheCGFile)) {
-      errs() << "Failed to parse file: " << CacheCGFile << "\n";
-      return PreservedAnalyses::all();
+  /// Sites of one function, keyed by file:line and ordinal
+  typedef std::map<std::pair<FileLinePair, unsigned>, const PrefetchSite *>
+      FunctionSites;
+
+  /// Insert the prefetches of F's Sites, counting them in NumApplied.
+  /// Returns true if the IR changed.
+  bool applyFunction(Function &F, const FunctionSites &Sites,
+                     FunctionAnalysisManager &FAM, unsigned &NumApplied) {
+    auto &ORE = FAM.getResult<OptimizationRemarkEmitterAnalysis>(F);
+    PrefetchBounds Bounds(F, FAM.getResult<LoopAnalysis>(F),
+                          FAM.getResult<ScalarEvolutionAnalysis>(F),
+                          FAM.getResult<DominatorTreeAnalysis>(F), ORE,
+                          Profile->LineMetrics);
+    bool FnChanged = false;
+
+    // Collect first: inserting prefetches adds instructions
+    std::vector<std::pair<Instruction *, const PrefetchSite *>> Work;
+    std::map<FileLinePair, unsigned> Ordinals;
+    for (Instruction &I : instructions(F)) {
+      FileLinePair fl;
+      if ((!isa<LoadInst>(&I) && !isa<StoreInst>(&I)) ||
+          !Profile->getFileLine(I, fl))
+        continue;
+      auto SI = Sites.find({fl, Ordinals[fl]++});
+      if (SI != Sites.end())
+        Work.push_back({&I, SI->second});
     }
 
-    errs() << "===== Parsed Cachegrind Line Metrics =====\n";
-    for (const auto &entry : lineMetrics) {
-      const auto &file = entry.first.first;
-      int line = entry.first.second;
-      const CacheMetrics &cm = entry.second;
-
-      errs() << file << ":" << line
-             << "  Dr="   << cm.Dr
-             << "  D1mr=" << cm.D1mr
-             << "  DLmr=" << cm.DLmr
-             << "  Dw="   << cm.Dw
-             << "  D1mw=" << cm.D1mw
-             << "  DLmw=" << cm.DLmw << "\n";
+    for (auto &Item : Work) {
+      Instruction *I = Item.first;
+      const PrefetchSite &Site = *Item.second;
+      // A write prefetch takes the line from the threads sharing it
+      if (Site.RW == 1 && isSharedLine(Site.ID)) {
+        PrefetchSite Shared = Site;
+        Shared.Reason = "no write prefetch of a line shared with other threads";
+        emitSharedLine(*I, Shared, sharingStats[Site.ID], ORE);
+        continue;
+      }
+      CallInst *Prefetch = insertPrefetch(I, Site, Bounds, ORE);
+      if (!Prefetch) {
+        ORE.emit([&]() {
+          OptimizationRemarkMissed R(DEBUG_TYPE, "StoreSkipped", I);
+          R << "store skipped: plan asks for rw "
+            << ore::NV("RW", Site.RW);
+          addMisses(R, Site.Loc);
+          return R;
+        });
+        continue;
+      }
+      tagPrefetchSite(Prefetch, Site.ID, Site.Loc);
+      ORE.emit([&]() {
+        OptimizationRemark R(DEBUG_TYPE, "PrefetchInserted", I);
+        R << "prefetch inserted, distance "
+          << ore::NV("Distance", Site.Distance) << ", locality "
+          << ore::NV("Locality", Site.Locality) << ", rw "
+          << ore::NV("RW", Site.RW) << ", site "
+          << ore::NV("SiteID", Site.ID) << "; "
+          << ore::NV("Reason", Site.Reason);
+        addMisses(R, Site.Loc);
+        return R;
+      });
+      FnChanged = true;
+      ++NumApplied;
     }
-    errs() << "===== End of Cachegrind Metrics =====\n";
+
+    FnChanged |= Bounds.finish();
+    return FnChanged;
+  }
+
+  /// Insert the prefetches of Sites. Sites are matched to accesses by
+  /// function, file:line and ordinal, so a plan applies to any build of
+  /// the same source.
+  bool applySites(Module &M, ModuleAnalysisManager &MAM,
+                  const std::vector<PrefetchSite> &Sites) {
+    std::map<std::string, FunctionSites> ByFunction;
+    for (const PrefetchSite &Site : Sites)
+      if (Site.Distance)
+        ByFunction[Site.Function][{Site.Loc, Site.Ordinal}] = &Site;
 
     bool Changed = false;
+    unsigned NumApplied = 0;
+    auto &FAM =
+        MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
 
-    // Walk all functions/blocks/instructions
     for (Function &F : M) {
-      if (F.isDeclaration())
+      auto FI = ByFunction.find(F.getName().str());
+      if (F.isDeclaration() || FI == ByFunction.end())
         continue;
 
-      for (BasicBlock &BB : F) {
-        for (Instruction &I : BB) {
-          // Only care about loads and stores
-          if (!isa<LoadInst>(&I) && !isa<StoreInst>(&I))
-            continue;
+      if (applyFunction(F, FI->second, FAM, NumApplied)) {
+        FAM.invalidate(F, PreservedAnalyses::none());
+        Changed = true;
+      }
+    }
 
-          // Need debug info to map back to source line
-          const DebugLoc &DL = I.getDebugLoc();
-          if (!DL)
-            continue;
+    unsigned NumPlanned = 0;
+    for (const PrefetchSite &Site : Sites)
+      NumPlanned += Site.Distance != 0;
+    errs() << "parse-cachegrind: inserted " << NumApplied << " of "
+           << NumPlanned << " planned prefetches";
+    if (NumApplied != NumPlanned)
+      errs() << " (sites not found or not prefetchable)";
+    errs() << "\n";
+    return Changed;
+  }
 
-          auto *Scope = dyn_cast<DIScope>(DL.getScope());
-          if (!Scope)
-            continue;
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &MAM) {
+    std::vector<PrefetchSite> Sites;
+    CachegrindProfile NoProfile;
+    Profile = &NoProfile;
+
+    // Profiling builds: the only change is the instrumentation
+    if (ReuseInstrument || StrideInstrument || SharingInstrument) {
+      if (ReuseInstrument)
+        errs() << "Instrumented "
+               << instrumentAccessSites(M, "cp_rd_access", false)
+               << " accesses for reuse-distance profiling\n";
+      if (StrideInstrument)
+        errs() << "Instrumented "
+               << instrumentAccessSites(M, "cp_st_access", true)
+               << " loads for stride profiling\n";
+      if (SharingInstrument)
+        errs() << "Instrumented "
+               << instrumentAccessSites(M, "cp_sh_access", false, true)
+               << " accesses for sharing profiling\n";
+      return PreservedAnalyses::none();
+    }
 
-          std::string FileName = normalizeFileName(Scope->getFilename().str());
-          int Line = DL.getLine();
+    // Plans and profiles alike are checked against the threads' sharing
+    if (!SharingProfile.empty() &&
+        !parseSharingProfile(SharingProfile, sharingStats))
+      errs() << "Failed to read sharing profile: " << SharingProfile << "\n";
 
-          FileLinePair fl(FileName, Line);
+    if (!ApplyPlan.empty()) {
+      // Phase two: the plan is the only input
+      if (!readPrefetchPlan(ApplyPlan, Sites)) {
+        errs() << "Failed to read plan: " << ApplyPlan << "\n";
+        return PreservedAnalyses::all();
+      }
+    } else {
+      // A decision file alone is enough to replay earlier decisions
+      if (CacheCGFile.empty() && PrefetchDecisionsIn.empty()) {
+        errs() << "No file provided via -cache-cg-file\n";
+        return PreservedAnalyses::all();
+      }
 
-          if (!isHotLine(fl))
-            continue;
+      if (!CacheCGFile.empty()) {
+        Profile = &MAM.getResult<CachegrindProfileAnalysis>(M);
+        if (!Profile->Loaded) {
+          errs() << "Failed to parse file: " << CacheCGFile << "\n";
+          return PreservedAnalyses::all();
+        }
+      } else {
+        loadCacheTarget("", NoProfile.Target);
+      }
 
-          if (insertPrefetch(&I)) {
-            errs() << "Inserting prefetch for hot line "
-                 << FileName << ":" << Line << "\n";
-            Changed = true;
-          }
+      if (DumpMetrics) {
+        errs() << "===== Parsed Cachegrind Line Metrics =====\n";
+        for (const auto &entry : Profile->LineMetrics) {
+          const auto &file = entry.first.first;
+          int line = entry.first.second;
+          const CacheMetrics &cm = entry.second;
+
+          errs() << file << ":" << line
+                 << "  Dr="   << cm.Dr
+                 << "  D1mr=" << cm.D1mr
+                 << "  DLmr=" << cm.DLmr
+                 << "  Dw="   << cm.Dw
+                 << "  D1mw=" << cm.D1mw
+                 << "  DLmw=" << cm.DLmw << "\n";
         }
+        for (const auto &entry : Profile->Files)
+          errs() << entry.first << ": lines " << entry.second.MinLine << "-"
+                 << entry.second.MaxLine << ", " << entry.second.Misses
+                 << " data misses, " << entry.second.HotLines.size()
+                 << " hot lines, " << entry.second.FunctionStarts.size()
+                 << " functions\n";
+        errs() << "Cache target " << describeCacheTarget(Profile->Target)
+               << "\n";
+        errs() << "===== End of Cachegrind Metrics =====\n";
+      }
+
+      if (!PrefetchDecisionsIn.empty() && !loadDecisions())
+        return PreservedAnalyses::all();
+
+      if (!PrefetchFeedback.empty() &&
+          !parsePrefetchFeedback(PrefetchFeedback, siteFeedback))
+        errs() << "Failed to read prefetch feedback: " << PrefetchFeedback
+               << "\n";
+
+      if (!ReuseProfile.empty() && !parseReuseProfile(ReuseProfile, reuseStats))
+        errs() << "Failed to read reuse profile: " << ReuseProfile << "\n";
+
+      if (!StrideProfile.empty() &&
+          !parseStrideProfile(StrideProfile, strideStats))
+        errs() << "Failed to read stride profile: " << StrideProfile << "\n";
+
+      auto &FAM =
+          MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+      Sites = planSites(M, FAM);
+
+      if (!PrefetchDecisionsOut.empty())
+        writePrefetchDecisions(PrefetchDecisionsOut, decisions);
+
+      // Phase one: write the plan, leave the IR alone
+      if (!EmitPlan.empty()) {
+        if (writePrefetchPlan(EmitPlan, Sites))
+          errs() << "Wrote " << Sites.size() << " sites to " << EmitPlan
+                 << "\n";
+        return PreservedAnalyses::all();
       }
     }
 
+    bool Changed = applySites(M, MAM, Sites);
+
+    if (PrefetchInstrument) {
+      unsigned NumSites = instrumentPrefetchSites(M);
+      errs() << "Instrumented " << NumSites
+             << " prefetch sites for accounting\n";
+      Changed = true;
+    }
+
     return Changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
   }
 };
 
+/**
+ * parse-cachegrind one function at a time, so it can be scheduled in a
+ * function pipeline next to the passes whose LoopInfo and ScalarEvolution it
+ * reuses. Prefetches hot lines of the profile only: plans, decision files,
+ * feedback and instrumentation need the whole module (use parse-cachegrind).
+ * The profile is the cached CachegrindProfileAnalysis result; functions with
+ * no hot line in their span return after one lookup.
+ */
+struct ParseCachegrindFunctionPass
+    : public PassInfoMixin<ParseCachegrindFunctionPass> {
+  bool WarnedNoProfile = false;
+
+  /// run.sh's -O0 IR is all optnone, which the pass manager would skip
+  static bool isRequired() { return true; }
+
+  PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM) {
+    if (F.isDeclaration())
+      return PreservedAnalyses::all();
+
+    auto &MAMProxy = FAM.getResult<ModuleAnalysisManagerFunctionProxy>(F);
+    auto *Profile =
+        MAMProxy.getCachedResult<CachegrindProfileAnalysis>(*F.getParent());
+    if (!Profile) {
+      if (!WarnedNoProfile)
+        errs() << "parse-cachegrind-function: run "
+                  "require<cachegrind-profile> first\n";
+      WarnedNoProfile = true;
+      return PreservedAnalyses::all();
+    }
+    if (!Profile->Loaded || (SkipColdFunctions && Profile->isColdFunction(F)))
+      return PreservedAnalyses::all();
+
+    ParseCachegrindPass Impl;
+    Impl.Profile = Profile;
+    std::vector<PrefetchSite> Sites;
+    Impl.planFunction(F, FAM, Sites);
+
+    ParseCachegrindPass::FunctionSites ByLoc;
+    for (const PrefetchSite &Site : Sites)
+      if (Site.Distance)
+        ByLoc[{Site.Loc, Site.Ordinal}] = &Site;
+    unsigned NumApplied = 0;
+    if (ByLoc.empty() || !Impl.applyFunction(F, ByLoc, FAM, NumApplied))
+      return PreservedAnalyses::all();
+    return PreservedAnalyses::none();
+  }
+};
+
 extern "C" PassPluginLibraryInfo LLVM_ATTRIBUTE_WEAK llvmGetPassPluginInfo() {
   return {
       LLVM_PLUGIN_API_VERSION,
       "ParseCachegrindPass",
-      "v0.2", // bumped version
+      CP_PASS_VERSION, // set in profiler/CMakeLists.txt
       [](PassBuilder &PB) {
         PB.registerPipelineParsingCallback(
             [](StringRef Name,
@@ -361,7 +996,73 @@ extern "C" PassPluginLibraryInfo LLVM_ATTRIBUTE_WEAK llvmGetPassPluginInfo() {
                 MPM.addPass(ParseCachegrindPass());
                 return true;
               }
+              if (Name == "require<cachegrind-profile>") {
+                MPM.addPass(
+                    RequireAnalysisPass<CachegrindProfileAnalysis, Module>());
+                return true;
+              }
+              // At module level: load the profile, then run on every function
+              if (Name == "parse-cachegrind-function") {
+                MPM.addPass(
+                    RequireAnalysisPass<CachegrindProfileAnalysis, Module>());
+                MPM.addPass(createModuleToFunctionPassAdaptor(
+                    ParseCachegrindFunctionPass()));
+                return true;
+              }
+              if (Name == "pool-alloc") {
+                MPM.addPass(PoolAllocPass());
+                return true;
+              }
+              if (Name == "false-sharing-pad") {
+                MPM.addPass(FalseSharingPadPass());
+                return true;
+              }
+              if (Name == "icache-layout") {
+                MPM.addPass(ICacheLayoutPass());
+                return true;
+              }
+              if (Name == "cachegrind-block-weights") {
+                MPM.addPass(BlockWeightsPass());
+                return true;
+              }
+              if (Name == "cachegrind-swp") {
+                MPM.addPass(SoftwarePipelinePass());
+                return true;
+              }
+              if (Name == "cachegrind-runahead") {
+                MPM.addPass(RunAheadPass());
+                return true;
+              }
+              if (Name == "cachegrind-batch") {
+                MPM.addPass(BatchPrefetchPass());
+                return true;
+              }
+              if (Name == "cachegrind-coro") {
+                // The lookup coroutines are lowered right away: clang
+                // compiling the .ll wouldn't run the coroutine passes
+                MPM.addPass(CoroInterleavePass());
+                MPM.addPass(createModuleToFunctionPassAdaptor(CoroEarlyPass()));
+                MPM.addPass(
+                    createModuleToPostOrderCGSCCPassAdaptor(CoroSplitPass()));
+                MPM.addPass(
+                    createModuleToFunctionPassAdaptor(CoroCleanupPass()));
+                return true;
+              }
               return false;
             });
+        PB.registerPipelineParsingCallback(
+            [](StringRef Name,
+               FunctionPassManager &FPM,
+               ArrayRef<PassBuilder::PipelineElement>) {
+              if (Name == "parse-cachegrind-function") {
+                FPM.addPass(ParseCachegrindFunctionPass());
+                return true;
+              }
+              return false;
+            });
+        PB.registerAnalysisRegistrationCallback(
+            [](ModuleAnalysisManager &MAM) {
+              MAM.registerPass([] { return CachegrindProfileAnalysis(); });
+            });
       }};
 }
@@ -0,0 +1,444 @@
+#ifndef PARSE_CACHEGRIND_PASS_H
+#define PARSE_CACHEGRIND_PASS_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Support/CommandLine.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace llvm {
+class AssumptionCache;
+class DIFile;
+class DominatorTree;
+class GetElementPtrInst;
+class Loop;
+class LoopInfo;
+class OptimizationRemarkEmitter;
+class SCEV;
+class SCEVAddRecExpr;
+class ScalarEvolution;
+} // namespace llvm
+
+typedef std::pair<std::string, int> FileLinePair;
+
+// Shared with the other passes in this plugin (defined in
+// ParseCachegrindPass.cpp).
+extern llvm::cl::opt<std::string> CacheCGFile;
+extern llvm::cl::opt<uint64_t> MissThreshold;
+extern llvm::cl::opt<std::string> SharingProfile;
+extern llvm::cl::opt<double> FalseSharingMin;
+
+/**
+ * Metrics from Cachegrind for a specific line.
+ */
+struct CacheMetrics {
+  uint64_t Ir = 0;
+  uint64_t I1mr = 0;
+  uint64_t ILmr = 0;
+  uint64_t Dr = 0;
+  uint64_t D1mr = 0;
+  uint64_t DLmr = 0;
+  uint64_t Dw = 0;
+  uint64_t D1mw = 0;
+  uint64_t DLmw = 0;
+
+  uint64_t totalMisses() const { return D1mr + DLmr + D1mw + DLmw; }
+  uint64_t instrMisses() const { return I1mr + ILmr; }
+};
+
+/// Geometry of one cache level, as Cachegrind describes it.
+struct CacheLevel {
+  uint64_t Size = 0; ///< bytes
+  unsigned LineSize = 64;
+  unsigned Assoc = 8;
+};
+
+/**
+ * The cache hierarchy prefetch decisions are made for (see CacheTarget.cpp):
+ * Cachegrind's I1/D1/LL geometry plus what a D1 miss that hits LL, and an LL
+ * miss, cost in cycles.
+ */
+struct CacheTarget {
+  std::string Name = "x86-64";
+  CacheLevel I1 = {32768, 64, 8};
+  CacheLevel D1 = {32768, 64, 8};
+  CacheLevel LL = {8388608, 64, 16};
+  unsigned L1MissLatency = 14;  ///< D1 miss that hits LL
+  unsigned LLMissLatency = 200; ///< LL miss (memory)
+
+  unsigned lineSize() const { return D1.LineSize; }
+
+  /// Expected cycles of one miss on a line, from its D1mr/DLmr split.
+  unsigned missLatency(const CacheMetrics &CM) const;
+
+  /// Iterations ahead that hide missLatency(CM) behind IterCost cycles per
+  /// iteration, and reach at least the next line of a walk of Stride bytes
+  /// per iteration (0 = unknown). Between 1 and MaxDistance.
+  unsigned distanceFor(const CacheMetrics &CM, unsigned IterCost,
+                       int64_t Stride, unsigned MaxDistance) const;
+
+  /// llvm.prefetch locality for data that is reused after Footprint bytes
+  /// (0 = unknown): 3 if that fits D1, 2 if it fits LL, else 0.
+  unsigned localityFor(uint64_t Footprint) const;
+};
+
+/// Fill T from -cache-target (a preset name or a JSON file) if given, else
+/// from the I1/D1/LL lines in the header of ProfilePath (cg_annotate output
+/// or a cachegrind.out file), else leave the x86-64 defaults. Returns false,
+/// after saying which default it falls back to, if -cache-target can't be
+/// read.
+bool loadCacheTarget(const std::string &ProfilePath, CacheTarget &T);
+
+/// One-line summary of T, e.g. for -cache-dump-metrics.
+std::string describeCacheTarget(const CacheTarget &T);
+
+/// Strip directory components so IR filenames match cg_annotate's.
+std::string normalizeFileName(const std::string &Path);
+
+/// Parse cg_annotate --auto=yes output into per-line metrics.
+/// Returns false if the file can't be read or contains no annotated lines.
+bool parseCachegrindFile(const std::string &Path,
+                         std::map<FileLinePair, CacheMetrics> &LineMetrics);
+
+/// Map an instruction back to its (normalized file, line) via debug info.
+/// Returns false if the instruction has no usable debug location.
+bool getFileLine(const llvm::Instruction &I, FileLinePair &FL);
+
+/**
+ * The -cache-cg-file profile, loaded once per module by
+ * CachegrindProfileAnalysis and shared by every pass of the plugin in the
+ * same pipeline. It is read-only once built: passes hold it by const
+ * reference, and the normalized name of every DIFile in the module is
+ * filled in up front so mapping an access to its line doesn't rebuild the
+ * filename every time.
+ */
+class CachegrindProfile {
+public:
+  /// Maps (filename, line number) -> cachegrind information
+  std::map<FileLinePair, CacheMetrics> LineMetrics;
+
+  /**
+   * What the profile says about one source file: the range of its annotated
+   * lines, their total data misses, the lines at or above
+   * -cache-miss-threshold and the first lines of the module's functions in
+   * it (each function is taken to span up to the next one).
+   */
+  struct FileSummary {
+    int MinLine = 0;
+    int MaxLine = 0;
+    uint64_t Misses = 0;
+    std::vector<int> HotLines;       ///< sorted
+    std::vector<int> FunctionStarts; ///< sorted
+  };
+
+  /// Profiled files by normalized name
+  std::map<std::string, FileSummary> Files;
+
+  /// False if there was no -cache-cg-file or it couldn't be parsed
+  bool Loaded = false;
+
+  /// The machine to optimize for (see loadCacheTarget)
+  CacheTarget Target;
+
+  /// getFileLine() with the filename looked up per DIFile.
+  bool getFileLine(const llvm::Instruction &I, FileLinePair &FL) const;
+
+  /// True if F can't contain a hot access: it has no debug info, or no hot
+  /// line lies between its DISubprogram line and the next function of its
+  /// file. Only F's own span is checked, so hot lines inlined into F from
+  /// elsewhere are missed (see -cache-skip-cold-functions).
+  bool isColdFunction(const llvm::Function &F) const;
+
+  /// The profile doesn't depend on the IR: keep it for the whole pipeline.
+  bool invalidate(llvm::Module &, const llvm::PreservedAnalyses &,
+                  llvm::ModuleAnalysisManager::Invalidator &) {
+    return false;
+  }
+
+  /// Normalized name of File: the memoized one for the DIFiles seen by
+  /// CachegrindProfileAnalysis, computed again for any added since.
+  std::string fileName(const llvm::DIFile *File) const;
+
+private:
+  friend struct CachegrindProfileAnalysis;
+
+  llvm::DenseMap<const llvm::DIFile *, std::string> FileNames;
+};
+
+/// Parses -cache-cg-file (see CachegrindProfile.cpp). Function passes get
+/// it with getCachedResult, so their pipeline must require it first:
+/// -passes='require<cachegrind-profile>,function(...)'.
+struct CachegrindProfileAnalysis
+    : public llvm::AnalysisInfoMixin<CachegrindProfileAnalysis> {
+  using Result = CachegrindProfile;
+  Result run(llvm::Module &M, llvm::ModuleAnalysisManager &MAM);
+
+private:
+  friend llvm::AnalysisInfoMixin<CachegrindProfileAnalysis>;
+  static llvm::AnalysisKey Key;
+};
+
+/// Per-site counts from the prefetch accounting runtime
+/// (runtime/cp_prefetch_sim.c).
+struct PrefetchSiteStats {
+  std::string Loc;
+  uint64_t Issued = 0;
+  uint64_t Useful = 0;
+  uint64_t Late = 0;
+  uint64_t Early = 0;
+  uint64_t Redundant = 0;
+
+  /// Of the prefetches that brought a line in, the fraction whose line was
+  /// then demanded (late ones included: they still hid part of the miss).
+  double usefulFraction() const {
+    uint64_t Fills = Useful + Late + Early;
+    return Fills ? double(Useful + Late) / Fills : 0.0;
+  }
+
+  /// Fraction of issued prefetches that found the line already cached.
+  /// Per-element prefetching of a sequential walk is (elements per line - 1)
+  /// / (elements per line) redundant by construction.
+  double redundantFraction() const {
+    return Issued ? double(Redundant) / Issued : 0.0;
+  }
+};
+
+/// Stable ID of the prefetch for the Ordinal-th load/store on FL in F.
+uint32_t prefetchSiteID(const llvm::Function &F, const FileLinePair &FL,
+                        unsigned Ordinal);
+
+/// Attach !cp.prefetch.site to an inserted prefetch.
+void tagPrefetchSite(llvm::CallInst *Prefetch, uint32_t ID,
+                     const FileLinePair &FL);
+
+/// Read a prefetch's !cp.prefetch.site. Returns false if it has none.
+bool getPrefetchSite(const llvm::Instruction &I, uint32_t &ID,
+                     std::string &Loc);
+
+/// Parse the table written by the accounting runtime, keyed by site ID.
+bool parsePrefetchFeedback(const std::string &Path,
+                           std::map<uint32_t, PrefetchSiteStats> &Sites);
+
+/// Insert cp_pf_access/cp_pf_prefetch calls for the accounting runtime.
+/// Returns the number of instrumented prefetch sites.
+unsigned instrumentPrefetchSites(llvm::Module &M);
+
+/// mem2reg for F's entry-block allocas (see TransformUtils.cpp). Returns
+/// false if there was nothing to promote.
+bool promoteAllocas(llvm::Function &F, llvm::DominatorTree &DT,
+                    llvm::AssumptionCache &AC);
+
+/// promoteAllocas(F), if Probe finds something to transform in a promoted
+/// copy of F (analysed through FAM, then deleted). Returns whether F was
+/// promoted; its analyses are then invalidated except the CFG's.
+bool promoteAllocasIfUseful(llvm::Function &F,
+                            llvm::FunctionAnalysisManager &FAM,
+                            llvm::function_ref<bool(llvm::Function &)> Probe);
+
+/// Intrinsics that write no memory a transformation must keep loads
+/// ordered against: prefetch, lifetime markers, assume and debug info.
+bool isHarmlessCall(const llvm::Instruction &I);
+
+/// Whether F is marked __attribute__((annotate("cp_interleave"))).
+bool isInterleaveMarked(const llvm::Function &F);
+
+/// Whether F (and what it calls) writes only its own stack.
+bool writesOnlyStack(const llvm::Function &F, unsigned Depth = 0);
+
+/// i8* F.coro(F's params..., RetTy* out): a copy of F as a coroutine that
+/// prefetches the next node of each pointer-chasing loop and suspends.
+/// Returns null if F writes other memory or has no such loop.
+llvm::Function *createLookupCoroutine(llvm::Function &F,
+                                      unsigned &NumSuspends);
+
+/// void cp.co.run(i8** handles, i64 n): resumes the coroutines round-robin
+/// until all are done, then destroys them.
+llvm::Function *getCoroScheduler(llvm::Module &M);
+
+/// What to do with one prefetch site, as read from / written to a decision
+/// file (see PrefetchDecisions.cpp).
+struct PrefetchDecision {
+  enum Status { Tune, Fixed, Pruned };
+
+  uint32_t ID = 0;
+  std::string Function;
+  FileLinePair Loc;
+  unsigned Distance = 0; ///< 0 = don't prefetch
+  unsigned BestDistance = 0;
+  int64_t BestNet = 0;
+  Status State = Tune;
+
+  const char *stateName() const;
+};
+
+/// Parse "file:line". Returns false if there is no line number.
+bool parseFileLine(const std::string &Loc, FileLinePair &FL);
+
+bool readPrefetchDecisions(const std::string &Path,
+                           std::map<uint32_t, PrefetchDecision> &Decisions);
+bool writePrefetchDecisions(
+    const std::string &Path,
+    const std::map<uint32_t, PrefetchDecision> &Decisions);
+
+/// Update the distances of sites still being tuned from the profile of a
+/// binary built with them. Returns the number of sites still tuning.
+/// Misses saved are weighed with Target's latencies.
+unsigned
+retunePrefetchDecisions(std::map<uint32_t, PrefetchDecision> &Decisions,
+                        const std::map<FileLinePair, CacheMetrics> &Base,
+                        const std::map<FileLinePair, CacheMetrics> &Measured,
+                        const CacheTarget &Target);
+
+/// One entry of a prefetch plan (see PrefetchPlan.cpp). Distance 0 records a
+/// site that was considered and dropped.
+struct PrefetchSite {
+  uint32_t ID = 0;
+  std::string Function;
+  FileLinePair Loc;
+  unsigned Ordinal = 0; ///< among the loads/stores of Loc in Function
+  unsigned Distance = 0;
+  unsigned Locality = 3;
+  unsigned RW = 0;
+  /// Bytes per iteration learned by the stride profiler, used when the
+  /// address has no index to advance (0 = none)
+  int64_t Stride = 0;
+  std::string Reason;
+};
+
+/// Write Sites as JSON, or YAML if Path ends in .yaml/.yml.
+bool writePrefetchPlan(const std::string &Path,
+                       const std::vector<PrefetchSite> &Sites);
+bool readPrefetchPlan(const std::string &Path,
+                      std::vector<PrefetchSite> &Sites);
+
+enum class BoundsMode { None, Clamp, Peel };
+
+/**
+ * Keeps `idx + PrefetchDistance` from running past the end of the object in
+ * the last iterations of a loop (see PrefetchBounds.cpp). One instance per
+ * function: boundIndex() is called for each bumped index as prefetches are
+ * inserted, finish() then peels loops in peel mode and reports, per loop,
+ * what clamping and peeling would cost (as a PrefetchBounds analysis remark).
+ */
+class PrefetchBounds {
+public:
+  PrefetchBounds(llvm::Function &F, llvm::LoopInfo &LI,
+                 llvm::ScalarEvolution &SE, llvm::DominatorTree &DT,
+                 llvm::OptimizationRemarkEmitter &ORE,
+                 const std::map<FileLinePair, CacheMetrics> &LineMetrics);
+
+  /// Bound NewIdx, GEP index Pos bumped by Distance, for a prefetch
+  /// inserted before At. Returns the index to use.
+  llvm::Value *boundIndex(llvm::GetElementPtrInst *GEP, unsigned Pos,
+                          llvm::Value *NewIdx, unsigned Distance,
+                          llvm::Instruction *At, llvm::IRBuilder<> &Builder);
+
+  /// Peel loops in peel mode and emit the report. Returns true if the IR
+  /// changed.
+  bool finish();
+
+private:
+  struct PeelCheck {
+    const llvm::SCEVAddRecExpr *Index;
+    const llvm::SCEV *Limit;
+    unsigned Distance;
+  };
+
+  struct LoopState {
+    llvm::Loop *L = nullptr;
+    BoundsMode Mode = BoundsMode::Clamp;
+    bool PeelFallback = false;
+    unsigned NumPrefetches = 0;
+    unsigned NumUnbounded = 0;
+    unsigned NumClamped = 0;
+    unsigned NumPeelClamped = 0;
+    size_t ClonedInsts = 0;
+    uint64_t Iterations = 0;
+    std::vector<PeelCheck> Checks;
+  };
+
+  llvm::Function &F;
+  llvm::LoopInfo &LI;
+  llvm::ScalarEvolution &SE;
+  llvm::DominatorTree &DT;
+  llvm::OptimizationRemarkEmitter &ORE;
+  const std::map<FileLinePair, CacheMetrics> &LineMetrics;
+  std::vector<LoopState> Loops;
+
+  static FileLinePair loopKey(llvm::Loop *L);
+  BoundsMode modeFor(llvm::Loop *L);
+  LoopState &stateFor(llvm::Loop *L);
+  const llvm::SCEV *scevLimit(llvm::Value *Idx, llvm::Loop *L,
+                              llvm::Instruction *At);
+  bool canPeel(llvm::Loop *L);
+  bool peel(LoopState &S);
+};
+
+/// Redirects malloc/free of hot recursive node types to per-type bump
+/// arenas in cp_runtime (see runtime/cp_pool.c).
+struct PoolAllocPass : public llvm::PassInfoMixin<PoolAllocPass> {
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &MAM);
+};
+
+/// Pads and aligns the globals behind accesses with false sharing in
+/// -cache-sharing-profile so threads' data sit on separate lines (see
+/// FalseSharingPadPass.cpp).
+struct FalseSharingPadPass : public llvm::PassInfoMixin<FalseSharingPadPass> {
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &MAM);
+};
+
+/// Hot/cold function placement, cold-region outlining and a linker order
+/// file driven by the Ir/I1mr/ILmr columns.
+struct ICacheLayoutPass : public llvm::PassInfoMixin<ICacheLayoutPass> {
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &MAM);
+};
+
+/// Converts per-line Ir into !prof branch weights, function entry counts
+/// and a profile summary.
+struct BlockWeightsPass : public llvm::PassInfoMixin<BlockWeightsPass> {
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &MAM);
+};
+
+/// Issues hot affine loads of innermost loops several iterations ahead
+/// into rotating registers (software pipelining).
+struct SoftwarePipelinePass
+    : public llvm::PassInfoMixin<SoftwarePipelinePass> {
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &MAM);
+};
+
+/// Runs the next-pointer slice of hot pointer-chasing loops ahead on a
+/// helper thread (see RunAheadPass.cpp and runtime/cp_runahead.c).
+struct RunAheadPass : public llvm::PassInfoMixin<RunAheadPass> {
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &MAM);
+};
+
+/// Strip-mines loops with hot indirect loads into batches whose addresses
+/// are all prefetched first (group prefetching).
+struct BatchPrefetchPass : public llvm::PassInfoMixin<BatchPrefetchPass> {
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &MAM);
+};
+
+/// Runs batches of calls to a pointer-chasing lookup as coroutines,
+/// interleaved round-robin (see CoroInterleave.cpp). The pipeline name
+/// cachegrind-coro also lowers the coroutines.
+struct CoroInterleavePass : public llvm::PassInfoMixin<CoroInterleavePass> {
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &MAM);
+};
+
+#endif // PARSE_CACHEGRIND_PASS_H
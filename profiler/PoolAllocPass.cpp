@@ -0,0 +1,290 @@
+#include "ParseCachegrindPass.h"
+
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallVector.h"
+
+#include <map>
+#include <string>
+
+using namespace llvm;
+
+/**
+ * Automatic pool allocation for linked data structures, in the spirit of
+ * Lattner & Adve's "Automatic Pool Allocation" (PLDI'05), but much simpler:
+ *
+ *  1. A struct type S is a candidate if it has a field of type S* (a
+ *     recursive node type) and some loop walks that field (`p = p->next`)
+ *     on a line whose Cachegrind miss count is >= -cache-miss-threshold.
+ *  2. Every `malloc(sizeof(S))` whose result is cast to S* is redirected to
+ *     cp_pool_alloc() on a per-type bump arena, so nodes allocated one after
+ *     another end up adjacent in memory.
+ *  3. free() of an S* goes to that pool's freelist. Frees and reallocs we
+ *     can't attribute to a type go through cp_pool_free_any() /
+ *     cp_pool_realloc_any(), which fall back to libc for non-pool memory.
+ *
+ * Relies on typed pointers (the LLVM 14 default) to see the node type of a
+ * malloc result; with opaque pointers no candidates are found.
+ */
+struct PoolAllocImpl {
+  Module &M;
+  const DataLayout &DL;
+  const CachegrindProfile &Profile;
+  const std::map<FileLinePair, CacheMetrics> &lineMetrics;
+
+  /// Candidate node type -> its pool handle global (void *)
+  std::map<StructType *, GlobalVariable *> Pools;
+
+  PoolAllocImpl(Module &M, const CachegrindProfile &Profile)
+      : M(M), DL(M.getDataLayout()), Profile(Profile),
+        lineMetrics(Profile.LineMetrics) {}
+
+  bool isHotLine(const Instruction &I) {
+    FileLinePair fl;
+    if (!Profile.getFileLine(I, fl))
+      return false;
+    auto it = lineMetrics.find(fl);
+    return it != lineMetrics.end() &&
+           it->second.totalMisses() >= MissThreshold;
+  }
+
+  /// Does S contain a field that points to another S?
+  static bool isRecursiveType(StructType *S) {
+    if (S->isOpaque() || S->isLiteral())
+      return false;
+    for (Type *ElemTy : S->elements()) {
+      auto *PT = dyn_cast<PointerType>(ElemTy);
+      if (PT && !PT->isOpaque() && PT->getPointerElementType() == S)
+        return true;
+    }
+    return false;
+  }
+
+  /// If LI loads a node's self-pointer field (`p->next`), return the node
+  /// type, else nullptr.
+  static StructType *getTraversedType(LoadInst *LI) {
+    auto *GEP = dyn_cast<GetElementPtrInst>(LI->getPointerOperand());
+    if (!GEP)
+      return nullptr;
+    auto *S = dyn_cast<StructType>(GEP->getSourceElementType());
+    if (!S || !isRecursiveType(S))
+      return nullptr;
+    auto *PT = dyn_cast<PointerType>(LI->getType());
+    if (!PT || PT->isOpaque() || PT->getPointerElementType() != S)
+      return nullptr;
+    return S;
+  }
+
+  /// Find node types that are walked inside a loop on a hot line.
+  SetVector<StructType *> findHotNodeTypes(ModuleAnalysisManager &MAM) {
+    SetVector<StructType *> Hot;
+    auto &FAM =
+        MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+
+    for (Function &F : M) {
+      if (F.isDeclaration())
+        continue;
+
+      LoopInfo &LI = FAM.getResult<LoopAnalysis>(F);
+      for (BasicBlock &BB : F) {
+        if (!LI.getLoopFor(&BB))
+          continue;
+
+        for (Instruction &I : BB) {
+          auto *Load = dyn_cast<LoadInst>(&I);
+          if (!Load)
+            continue;
+
+          StructType *S = getTraversedType(Load);
+          if (S && isHotLine(*Load))
+            Hot.insert(S);
+        }
+      }
+    }
+    return Hot;
+  }
+
+  /// Return the node type a call's i8* result is cast to, if any.
+  static StructType *getCastNodeType(CallInst *CI) {
+    for (User *U : CI->users()) {
+      auto *BC = dyn_cast<BitCastInst>(U);
+      if (!BC)
+        continue;
+      auto *PT = dyn_cast<PointerType>(BC->getType());
+      if (!PT || PT->isOpaque())
+        continue;
+      if (auto *S = dyn_cast<StructType>(PT->getPointerElementType()))
+        return S;
+    }
+    return nullptr;
+  }
+
+  /// Return the node type an i8* argument was cast from, if any.
+  static StructType *getCastSourceType(Value *V) {
+    auto *BC = dyn_cast<BitCastOperator>(V);
+    if (!BC)
+      return nullptr;
+    auto *PT = dyn_cast<PointerType>(BC->getSrcTy());
+    if (!PT || PT->isOpaque())
+      return nullptr;
+    return dyn_cast<StructType>(PT->getPointerElementType());
+  }
+
+  static Function *getCallee(CallInst *CI) {
+    return dyn_cast_or_null<Function>(
+        CI->getCalledOperand()->stripPointerCasts());
+  }
+
+  GlobalVariable *getOrCreatePool(StructType *S) {
+    auto it = Pools.find(S);
+    if (it != Pools.end())
+      return it->second;
+
+    Type *I8PtrTy = Type::getInt8PtrTy(M.getContext());
+    std::string Name = "__cp_pool." + S->getName().str();
+    auto *GV = new GlobalVariable(M, I8PtrTy, /*isConstant=*/false,
+                                  GlobalValue::InternalLinkage,
+                                  ConstantPointerNull::get(
+                                      cast<PointerType>(I8PtrTy)),
+                                  Name);
+    Pools[S] = GV;
+    return GV;
+  }
+
+  bool run(ModuleAnalysisManager &MAM) {
+    SetVector<StructType *> Hot = findHotNodeTypes(MAM);
+    if (Hot.empty()) {
+      errs() << "pool-alloc: no hot recursive node types found\n";
+      return false;
+    }
+
+    LLVMContext &Ctx = M.getContext();
+    Type *I8PtrTy = Type::getInt8PtrTy(Ctx);
+    Type *SizeTy = DL.getIntPtrType(Ctx);
+    Type *VoidTy = Type::getVoidTy(Ctx);
+
+    FunctionCallee PoolAlloc = M.getOrInsertFunction(
+        "cp_pool_alloc", I8PtrTy, I8PtrTy->getPointerTo(), SizeTy, SizeTy);
+    FunctionCallee PoolFree = M.getOrInsertFunction(
+        "cp_pool_free", VoidTy, I8PtrTy->getPointerTo(), I8PtrTy);
+    FunctionCallee PoolFreeAny =
+        M.getOrInsertFunction("cp_pool_free_any", VoidTy, I8PtrTy);
+    FunctionCallee PoolReallocAny = M.getOrInsertFunction(
+        "cp_pool_realloc_any", I8PtrTy, I8PtrTy, SizeTy);
+
+    SmallVector<CallInst *, 16> Mallocs, Frees, Reallocs;
+    for (Function &F : M) {
+      for (BasicBlock &BB : F) {
+        for (Instruction &I : BB) {
+          auto *CI = dyn_cast<CallInst>(&I);
+          if (!CI)
+            continue;
+          Function *Callee = getCallee(CI);
+          if (!Callee)
+            continue;
+
+          StringRef Name = Callee->getName();
+          if (Name == "malloc")
+            Mallocs.push_back(CI);
+          else if (Name == "free")
+            Frees.push_back(CI);
+          else if (Name == "realloc")
+            Reallocs.push_back(CI);
+        }
+      }
+    }
+
+    // 1. malloc(sizeof(S)) -> cp_pool_alloc(&pool.S, sizeof(S), alignof(S))
+    unsigned NumAllocs = 0;
+    for (CallInst *CI : Mallocs) {
+      StructType *S = getCastNodeType(CI);
+      if (!S || !Hot.count(S))
+        continue;
+
+      // Only single-node allocations; arrays of nodes are already contiguous.
+      auto *Size = dyn_cast<ConstantInt>(CI->getArgOperand(0));
+      if (!Size || Size->getZExtValue() != DL.getTypeAllocSize(S))
+        continue;
+
+      IRBuilder<> Builder(CI);
+      Value *Align =
+          ConstantInt::get(SizeTy, DL.getABITypeAlign(S).value());
+      Value *Sz = Builder.CreateZExtOrTrunc(CI->getArgOperand(0), SizeTy);
+      CallInst *NewCI = Builder.CreateCall(
+          PoolAlloc, {getOrCreatePool(S), Sz, Align});
+      NewCI->setDebugLoc(CI->getDebugLoc());
+      NewCI->takeName(CI);
+      CI->replaceAllUsesWith(NewCI);
+      CI->eraseFromParent();
+      ++NumAllocs;
+    }
+
+    if (NumAllocs == 0) {
+      errs() << "pool-alloc: hot node types have no single-node malloc "
+                "sites\n";
+      return false;
+    }
+
+    // 2. free(S*) -> cp_pool_free(&pool.S, p); anything else that might be
+    //    pool memory -> cp_pool_free_any(p)
+    unsigned NumFrees = 0;
+    for (CallInst *CI : Frees) {
+      Value *Ptr = CI->getArgOperand(0);
+      StructType *S = getCastSourceType(Ptr);
+
+      IRBuilder<> Builder(CI);
+      CallInst *NewCI;
+      if (S && Pools.count(S)) {
+        NewCI = Builder.CreateCall(PoolFree, {Pools[S], Ptr});
+        ++NumFrees;
+      } else {
+        NewCI = Builder.CreateCall(PoolFreeAny, {Ptr});
+      }
+      NewCI->setDebugLoc(CI->getDebugLoc());
+      CI->eraseFromParent();
+    }
+
+    // 3. realloc may be handed a pool node; let the runtime sort it out.
+    for (CallInst *CI : Reallocs) {
+      IRBuilder<> Builder(CI);
+      Value *Sz = Builder.CreateZExtOrTrunc(CI->getArgOperand(1), SizeTy);
+      CallInst *NewCI =
+          Builder.CreateCall(PoolReallocAny, {CI->getArgOperand(0), Sz});
+      NewCI->setDebugLoc(CI->getDebugLoc());
+      NewCI->takeName(CI);
+      CI->replaceAllUsesWith(NewCI);
+      CI->eraseFromParent();
+    }
+
+    for (auto &Entry : Pools) {
+      errs() << "pool-alloc: pooling " << Entry.first->getName() << " ("
+             << DL.getTypeAllocSize(Entry.first) << " bytes/node)\n";
+    }
+    errs() << "pool-alloc: rewrote " << NumAllocs << " malloc and "
+           << NumFrees << " typed free sites\n";
+    return true;
+  }
+};
+
+PreservedAnalyses PoolAllocPass::run(Module &M, ModuleAnalysisManager &MAM) {
+  if (CacheCGFile.empty()) {
+    errs() << "No file provided via -cache-cg-file\n";
+    return PreservedAnalyses::all();
+  }
+
+  const auto &Profile = MAM.getResult<CachegrindProfileAnalysis>(M);
+  if (!Profile.Loaded) {
+    errs() << "Failed to parse file: " << CacheCGFile << "\n";
+    return PreservedAnalyses::all();
+  }
+
+  PoolAllocImpl Impl(M, Profile);
+  return Impl.run(MAM) ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
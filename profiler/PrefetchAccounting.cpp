@@ -0,0 +1,135 @@
+#include "ParseCachegrindPass.h"
+
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+using namespace llvm;
+
+/**
+ * Site IDs and runtime accounting for inserted prefetches.
+ *
+ * Every prefetch the pass inserts carries
+ *   !cp.prefetch.site !{i32 <id>, !"file:line"}
+ * where the ID hashes the function name, file, line and the ordinal of the
+ * prefetched access among the loads and stores of that line. It stays the same
+ * across runs as long as the source of that line doesn't change, so the
+ * runtime's per-site table (runtime/cp_prefetch_sim.c) can be fed back into
+ * the next compilation to prune sites that don't pay off.
+ */
+
+static const char *SiteMDName = "cp.prefetch.site";
+
+uint32_t prefetchSiteID(const Function &F, const FileLinePair &FL,
+                        unsigned Ordinal) {
+  std::string Key = F.getName().str() + ":" + FL.first + ":" +
+                    std::to_string(FL.second) + ":" + std::to_string(Ordinal);
+  // 32-bit FNV-1a
+  uint32_t H = 2166136261u;
+  for (unsigned char C : Key) {
+    H ^= C;
+    H *= 16777619u;
+  }
+  return H;
+}
+
+void tagPrefetchSite(CallInst *Prefetch, uint32_t ID, const FileLinePair &FL) {
+  LLVMContext &Ctx = Prefetch->getContext();
+  Metadata *Ops[] = {
+      ConstantAsMetadata::get(ConstantInt::get(Type::getInt32Ty(Ctx), ID)),
+      MDString::get(Ctx, FL.first + ":" + std::to_string(FL.second))};
+  Prefetch->setMetadata(SiteMDName, MDNode::get(Ctx, Ops));
+}
+
+bool getPrefetchSite(const Instruction &I, uint32_t &ID, std::string &Loc) {
+  MDNode *MD = I.getMetadata(SiteMDName);
+  if (!MD || MD->getNumOperands() != 2)
+    return false;
+  auto *C = mdconst::dyn_extract<ConstantInt>(MD->getOperand(0));
+  auto *S = dyn_cast<MDString>(MD->getOperand(1));
+  if (!C || !S)
+    return false;
+  ID = (uint32_t)C->getZExtValue();
+  Loc = S->getString().str();
+  return true;
+}
+
+bool parsePrefetchFeedback(const std::string &Path,
+                           std::map<uint32_t, PrefetchSiteStats> &Sites) {
+  std::ifstream In(Path);
+  if (!In.is_open())
+    return false;
+
+  std::string Line;
+  while (std::getline(In, Line)) {
+    if (Line.empty() || Line[0] == '#')
+      continue;
+    std::istringstream SS(Line);
+    uint32_t ID;
+    PrefetchSiteStats S;
+    if (!(SS >> ID >> S.Loc >> S.Issued >> S.Useful >> S.Late >> S.Early >>
+          S.Redundant))
+      continue;
+    Sites[ID] = S;
+  }
+  return true;
+}
+
+unsigned instrumentPrefetchSites(Module &M) {
+  LLVMContext &Ctx = M.getContext();
+  Type *VoidTy = Type::getVoidTy(Ctx);
+  Type *I8PtrTy = Type::getInt8PtrTy(Ctx);
+  Type *I32Ty = Type::getInt32Ty(Ctx);
+  FunctionCallee Access =
+      M.getOrInsertFunction("cp_pf_access", VoidTy, I8PtrTy);
+  FunctionCallee Prefetch =
+      M.getOrInsertFunction("cp_pf_prefetch", VoidTy, I32Ty, I8PtrTy, I8PtrTy);
+
+  std::vector<Instruction *> Work;
+  for (Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+    for (BasicBlock &BB : F)
+      for (Instruction &I : BB)
+        if (isa<LoadInst>(I) || isa<StoreInst>(I) || isa<IntrinsicInst>(I))
+          Work.push_back(&I);
+  }
+
+  std::map<std::string, Constant *> LocStrings;
+  unsigned NumSites = 0;
+  for (Instruction *I : Work) {
+    IRBuilder<> Builder(I);
+    if (auto *LI = dyn_cast<LoadInst>(I)) {
+      Builder.CreateCall(Access, {Builder.CreatePointerCast(
+                                     LI->getPointerOperand(), I8PtrTy)});
+      continue;
+    }
+    if (auto *SI = dyn_cast<StoreInst>(I)) {
+      Builder.CreateCall(Access, {Builder.CreatePointerCast(
+                                     SI->getPointerOperand(), I8PtrTy)});
+      continue;
+    }
+
+    auto *II = cast<IntrinsicInst>(I);
+    uint32_t ID;
+    std::string Loc;
+    if (II->getIntrinsicID() != Intrinsic::prefetch ||
+        !getPrefetchSite(*II, ID, Loc))
+      continue;
+
+    Constant *&Str = LocStrings[Loc];
+    if (!Str)
+      Str = Builder.CreateGlobalStringPtr(Loc, "cp.pf.loc");
+    Builder.CreateCall(Prefetch,
+                       {Builder.getInt32(ID), II->getArgOperand(0), Str});
+    ++NumSites;
+  }
+  return NumSites;
+}
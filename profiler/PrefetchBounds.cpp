@@ -0,0 +1,351 @@
+#include "ParseCachegrindPass.h"
+
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/GetElementPtrTypeIterator.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/LoopUtils.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+#include <algorithm>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "parse-cachegrind"
+
+static cl::opt<BoundsMode> PrefetchBoundsMode(
+    "cache-prefetch-bounds",
+    cl::desc("How prefetches near the end of a loop stay in bounds"),
+    cl::init(BoundsMode::Clamp),
+    cl::values(
+        clEnumValN(BoundsMode::None, "none", "idx + distance, unbounded"),
+        clEnumValN(BoundsMode::Clamp, "clamp",
+                   "min(idx + distance, last valid index)"),
+        clEnumValN(BoundsMode::Peel, "peel",
+                   "run the last iterations in a prefetch-free epilogue "
+                   "copy of the loop (needs SSA loops, e.g. after mem2reg "
+                   "and loop-simplify; run.sh's -O0 IR falls back to "
+                   "clamp)")));
+
+static cl::list<std::string> PrefetchBoundsLoop(
+    "cache-prefetch-bounds-loop",
+    cl::desc("Per-loop override <file>:<line>=none|clamp|peel, where line is "
+             "the loop header's source line"),
+    cl::CommaSeparated);
+
+/**
+ * Bounds for prefetch indices. The limit of a bumped index is, in order of
+ * preference:
+ *  - the static bound of the array it indexes (`A[N]` -> N-1), which also
+ *    works at -O0 where SCEV sees only allocas;
+ *  - the value of the index's add recurrence in the loop's last iteration,
+ *    from SCEV's backedge-taken count.
+ * Clamp mode rewrites the index to min(idx + distance, limit), costing an
+ * icmp/select per prefetch per iteration. Peel mode leaves the prefetches
+ * alone and instead tests once per iteration in the header whether any of
+ * them would pass its limit; from then on the loop continues in a copy
+ * without prefetches. Peeling needs an innermost loop that exits from its
+ * header; other loops fall back to clamp.
+ */
+
+/// Rough per-iteration instruction costs used in the report
+static const unsigned ClampCost = 2; // icmp + select per prefetch
+static const unsigned PeelCost = 3;  // add + icmp + and per check
+
+PrefetchBounds::PrefetchBounds(
+    Function &F, LoopInfo &LI, ScalarEvolution &SE, DominatorTree &DT,
+    OptimizationRemarkEmitter &ORE,
+    const std::map<FileLinePair, CacheMetrics> &LineMetrics)
+    : F(F), LI(LI), SE(SE), DT(DT), ORE(ORE), LineMetrics(LineMetrics) {}
+
+FileLinePair PrefetchBounds::loopKey(Loop *L) {
+  for (Instruction &I : *L->getHeader()) {
+    FileLinePair fl;
+    if (getFileLine(I, fl))
+      return fl;
+  }
+  return FileLinePair("?", 0);
+}
+
+BoundsMode PrefetchBounds::modeFor(Loop *L) {
+  FileLinePair Key = loopKey(L);
+  std::string Name = Key.first + ":" + std::to_string(Key.second);
+  for (const std::string &Entry : PrefetchBoundsLoop) {
+    auto Eq = Entry.find('=');
+    if (Eq == std::string::npos || Entry.substr(0, Eq) != Name)
+      continue;
+    std::string Mode = Entry.substr(Eq + 1);
+    if (Mode == "none")
+      return BoundsMode::None;
+    if (Mode == "peel")
+      return BoundsMode::Peel;
+    return BoundsMode::Clamp;
+  }
+  return PrefetchBoundsMode;
+}
+
+PrefetchBounds::LoopState &PrefetchBounds::stateFor(Loop *L) {
+  for (LoopState &S : Loops)
+    if (S.L == L)
+      return S;
+  Loops.push_back(LoopState());
+  LoopState &S = Loops.back();
+  S.L = L;
+  S.Mode = modeFor(L);
+  if (S.Mode == BoundsMode::Peel && !canPeel(L)) {
+    S.Mode = BoundsMode::Clamp;
+    S.PeelFallback = true;
+  }
+  return S;
+}
+
+/// Number of elements of the array that GEP index Pos indexes into, or 0
+/// if unknown (index 0 walks the pointer, so it never has a static bound).
+static uint64_t arrayBound(GetElementPtrInst *GEP, unsigned Pos) {
+  Type *Outer = nullptr;
+  unsigned i = 0;
+  for (auto GTI = gep_type_begin(GEP), E = gep_type_end(GEP); GTI != E;
+       ++GTI, ++i) {
+    if (i == Pos) {
+      auto *AT = dyn_cast_or_null<ArrayType>(Outer);
+      return AT ? AT->getNumElements() : 0;
+    }
+    Outer = GTI.getIndexedType();
+  }
+  return 0;
+}
+
+/// SCEV for the largest value Idx takes in L, or nullptr.
+const SCEV *PrefetchBounds::scevLimit(Value *Idx, Loop *L, Instruction *At) {
+  auto *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(Idx));
+  if (!AR || AR->getLoop() != L || !AR->isAffine() ||
+      !SE.isKnownPositive(AR->getStepRecurrence(SE)))
+    return nullptr;
+
+  BasicBlock *Exiting = L->getExitingBlock();
+  if (!Exiting || !L->getLoopPreheader())
+    return nullptr;
+  const SCEV *BTC = SE.getBackedgeTakenCount(L);
+  if (isa<SCEVCouldNotCompute>(BTC))
+    return nullptr;
+
+  // Code before the exit test runs BTC+1 times, code after it BTC times
+  const SCEV *LastIter = DT.dominates(At->getParent(), Exiting)
+                             ? BTC
+                             : SE.getMinusSCEV(BTC, SE.getOne(BTC->getType()));
+  const SCEV *Limit = AR->evaluateAtIteration(LastIter, SE);
+  if (!SE.isLoopInvariant(Limit, L) || !isSafeToExpand(Limit, SE))
+    return nullptr;
+  return Limit;
+}
+
+bool PrefetchBounds::canPeel(Loop *L) {
+  BasicBlock *Header = L->getHeader();
+  if (!L->isInnermost() || !L->getLoopPreheader() ||
+      L->getExitingBlock() != Header || !L->getUniqueExitBlock() ||
+      !L->hasDedicatedExits())
+    return false;
+
+  auto *BI = dyn_cast<BranchInst>(Header->getTerminator());
+  if (!BI || !BI->isConditional())
+    return false;
+
+  // The iteration that fails the check runs the header twice (once in
+  // each copy), so the header must be free of side effects
+  for (Instruction &I : *Header) {
+    auto *II = dyn_cast<IntrinsicInst>(&I);
+    if (II && II->getIntrinsicID() == Intrinsic::prefetch)
+      continue;
+    if (I.mayHaveSideEffects())
+      return false;
+  }
+
+  // Only the header exits, so any value used after the loop can be routed
+  // through a phi in the exit block; peel() does that (formLCSSA) before it
+  // changes anything.
+  return true;
+}
+
+Value *PrefetchBounds::boundIndex(GetElementPtrInst *GEP, unsigned Pos,
+                                  Value *NewIdx, unsigned Distance,
+                                  Instruction *At, IRBuilder<> &Builder) {
+  Loop *L = LI.getLoopFor(At->getParent());
+  if (!L)
+    return NewIdx;
+
+  LoopState &S = stateFor(L);
+  ++S.NumPrefetches;
+
+  FileLinePair fl;
+  if (getFileLine(*At, fl)) {
+    auto it = LineMetrics.find(fl);
+    if (it != LineMetrics.end())
+      // The prefetched load reads its line once per iteration; counting
+      // Dw too would double loops like a[i] += x
+      S.Iterations = std::max(S.Iterations, it->second.Dr);
+  }
+
+  if (S.Mode == BoundsMode::None)
+    return NewIdx;
+
+  Value *Idx = GEP->getOperand(Pos + 1);
+  Type *IdxTy = Idx->getType();
+
+  // Prefer the object's static bound, else the loop's SCEV range
+  const SCEV *LimitS = nullptr;
+  if (uint64_t N = arrayBound(GEP, Pos))
+    LimitS = SE.getConstant(IdxTy, N - 1);
+  else
+    LimitS = scevLimit(Idx, L, At);
+
+  if (!LimitS) {
+    ++S.NumUnbounded;
+    return NewIdx;
+  }
+
+  // Peel needs the index as a recurrence so the header can tell when the
+  // next prefetch would pass the limit
+  if (S.Mode == BoundsMode::Peel) {
+    auto *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(Idx));
+    if (AR && AR->getLoop() == L) {
+      S.Checks.push_back({AR, LimitS, Distance});
+      return NewIdx;
+    }
+    ++S.NumPeelClamped;
+  }
+
+  ++S.NumClamped;
+  SCEVExpander Expander(SE, F.getParent()->getDataLayout(), "prefetch");
+  BasicBlock *Preheader = L->getLoopPreheader();
+  Value *Limit = Expander.expandCodeFor(
+      LimitS, IdxTy, Preheader ? Preheader->getTerminator() : At);
+  Value *InRange = Builder.CreateICmpSLT(NewIdx, Limit, "prefetch.inrange");
+  return Builder.CreateSelect(InRange, NewIdx, Limit, "prefetch.clamped");
+}
+
+/// Clone L as a prefetch-free epilogue. The original loop keeps running
+/// while every peel check holds; the first iteration in which some
+/// idx + distance would pass its limit continues in the copy instead.
+bool PrefetchBounds::peel(LoopState &S) {
+  Loop *L = S.L;
+  BasicBlock *Header = L->getHeader();
+  BasicBlock *Exit = L->getUniqueExitBlock();
+  auto *BI = cast<BranchInst>(Header->getTerminator());
+
+  // 0. Values leaving the loop go through phis in the exit block, which
+  //    step 3 rewires to the epilogue copy
+  formLCSSA(*L, DT, &LI, &SE);
+
+  // 1. Clone the loop body
+  ValueToValueMapTy VMap;
+  SmallVector<BasicBlock *, 16> NewBlocks;
+  for (BasicBlock *BB : L->blocks()) {
+    BasicBlock *NB = CloneBasicBlock(BB, VMap, ".epi", &F);
+    VMap[BB] = NB;
+    NewBlocks.push_back(NB);
+    S.ClonedInsts += BB->size();
+  }
+  remapInstructionsInBlocks(NewBlocks, VMap);
+  auto *EpiHeader = cast<BasicBlock>(VMap[Header]);
+
+  // 2. The copy is entered from the original header with its current phi
+  //    values, instead of from the preheader
+  BasicBlock *Preheader = L->getLoopPreheader();
+  for (PHINode &PN : Header->phis()) {
+    auto *EpiPN = cast<PHINode>(VMap[&PN]);
+    int Idx = EpiPN->getBasicBlockIndex(Preheader);
+    EpiPN->setIncomingBlock(Idx, Header);
+    EpiPN->setIncomingValue(Idx, &PN);
+  }
+
+  // 3. Exit phis now receive the copy's values
+  for (PHINode &PN : Exit->phis()) {
+    int Idx = PN.getBasicBlockIndex(Header);
+    if (Idx < 0)
+      continue;
+    Value *V = PN.getIncomingValue(Idx);
+    auto It = VMap.find(V);
+    PN.addIncoming(It != VMap.end() ? (Value *)It->second : V, EpiHeader);
+    PN.removeIncomingValue(Idx, /*DeletePHIIfEmpty=*/false);
+  }
+
+  // 4. No prefetches in the epilogue
+  for (BasicBlock *NB : NewBlocks) {
+    for (auto It = NB->begin(); It != NB->end();) {
+      auto *II = dyn_cast<IntrinsicInst>(&*It++);
+      if (II && II->getIntrinsicID() == Intrinsic::prefetch) {
+        Value *Addr = II->getArgOperand(0);
+        II->eraseFromParent();
+        RecursivelyDeleteTriviallyDeadInstructions(Addr);
+      }
+    }
+  }
+
+  // 5. Header: stay in the main loop only while all checks hold
+  SCEVExpander Expander(SE, F.getParent()->getDataLayout(), "prefetch");
+  IRBuilder<> Builder(BI);
+  Value *InBounds = nullptr;
+  for (const PeelCheck &C : S.Checks) {
+    Type *Ty = C.Index->getType();
+    Value *Cur = Expander.expandCodeFor(C.Index, Ty, BI);
+    Value *Limit = Expander.expandCodeFor(C.Limit, Ty,
+                                          Preheader->getTerminator());
+    Value *Next = Builder.CreateAdd(Cur, ConstantInt::get(Ty, C.Distance));
+    Value *Ok = Builder.CreateICmpSLE(Next, Limit, "prefetch.peel.ok");
+    InBounds = InBounds ? Builder.CreateAnd(InBounds, Ok) : Ok;
+  }
+
+  bool StayOnTrue = L->contains(BI->getSuccessor(0));
+  BasicBlock *Body = BI->getSuccessor(StayOnTrue ? 0 : 1);
+  Value *Stay = BI->getCondition();
+  if (!StayOnTrue)
+    Stay = Builder.CreateNot(Stay);
+  Stay = Builder.CreateAnd(Stay, InBounds, "prefetch.peel.stay");
+  Builder.CreateCondBr(Stay, Body, EpiHeader);
+  BI->eraseFromParent();
+  SE.forgetLoop(L);
+  return true;
+}
+
+bool PrefetchBounds::finish() {
+  bool Changed = false;
+  for (LoopState &S : Loops) {
+    bool Peeled = S.Mode == BoundsMode::Peel && !S.Checks.empty() &&
+                  peel(S);
+    Changed |= Peeled;
+
+    uint64_t Iters = S.Iterations;
+    const char *Using = S.Mode == BoundsMode::None ? "none"
+                        : Peeled                   ? "peel"
+                        : S.NumClamped             ? "clamp"
+                                                   : "none (no limit known)";
+    ORE.emit([&]() {
+      OptimizationRemarkAnalysis R(DEBUG_TYPE, "PrefetchBounds",
+                                   S.L->getStartLoc(), S.L->getHeader());
+      R << ore::NV("Prefetches", S.NumPrefetches) << " prefetches ("
+        << ore::NV("Unbounded", S.NumUnbounded) << " without a known limit), ~"
+        << ore::NV("Iterations", Iters) << " iterations; clamp cost +"
+        << ore::NV("ClampCost", ClampCost * S.NumPrefetches * Iters)
+        << " instrs, peel cost +"
+        << ore::NV("PeelCost",
+                   PeelCost * std::max<size_t>(S.Checks.size(), 1) * Iters)
+        << " instrs and +" << ore::NV("ClonedInsts", S.ClonedInsts)
+        << " static instrs; using " << ore::NV("Using", Using);
+      if (S.PeelFallback)
+        R << " (loop shape can't be peeled)";
+      if (S.NumPeelClamped)
+        R << " (some indices not SCEV-analyzable)";
+      return R;
+    });
+  }
+  return Changed;
+}
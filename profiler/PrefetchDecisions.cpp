@@ -0,0 +1,168 @@
+#include "ParseCachegrindPass.h"
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <fstream>
+#include <sstream>
+
+using namespace llvm;
+
+static cl::opt<unsigned> RetuneL1Penalty(
+    "cache-retune-l1-penalty",
+    cl::desc("Cycles charged per L1 data miss when weighing a site's "
+             "savings against its Ir overhead (default: the cache target's "
+             "L1 miss latency)"));
+
+static cl::opt<unsigned> RetuneLLPenalty(
+    "cache-retune-ll-penalty",
+    cl::desc("Extra cycles charged per last-level data miss (default: the "
+             "cache target's LL miss latency minus its L1 miss latency)"));
+
+static cl::opt<unsigned> RetuneMaxDistance(
+    "cache-retune-max-distance",
+    cl::desc("Largest prefetch distance the retuner tries"),
+    cl::init(64));
+
+/**
+ * Per-site prefetch decisions for the closed loop in iterate.sh.
+ *
+ * Each site (see PrefetchAccounting.cpp for the IDs) goes through
+ *   tune   -> the current distance is being measured;
+ *   fixed  -> distance settled on the best measured one;
+ *   pruned -> no distance beat not prefetching at all.
+ * Measuring compares the baseline profile with the profile of a binary built
+ * from the current decisions, on the site's own line: misses saved, weighted
+ * by -cache-retune-l1-penalty/-ll-penalty, minus extra Ir (the prefetch code
+ * carries the line of the access it serves). While that net gain improves
+ * the distance doubles; once it stops the site falls back to the best
+ * distance seen. Sites sharing a line are credited with the same gain.
+ */
+
+const char *PrefetchDecision::stateName() const {
+  switch (State) {
+  case PrefetchDecision::Tune:
+    return "tune";
+  case PrefetchDecision::Fixed:
+    return "fixed";
+  case PrefetchDecision::Pruned:
+    return "pruned";
+  }
+  return "tune";
+}
+
+bool parseFileLine(const std::string &Loc, FileLinePair &FL) {
+  auto Colon = Loc.rfind(':');
+  if (Colon == std::string::npos)
+    return false;
+  FL.first = Loc.substr(0, Colon);
+  FL.second = std::atoi(Loc.c_str() + Colon + 1);
+  return FL.second > 0;
+}
+
+bool readPrefetchDecisions(const std::string &Path,
+                           std::map<uint32_t, PrefetchDecision> &Decisions) {
+  std::ifstream In(Path);
+  if (!In.is_open())
+    return false;
+
+  std::string Line;
+  while (std::getline(In, Line)) {
+    if (Line.empty() || Line[0] == '#')
+      continue;
+    std::istringstream SS(Line);
+    PrefetchDecision D;
+    std::string Loc, State;
+    if (!(SS >> D.ID >> D.Function >> Loc >> D.Distance >> D.BestDistance >>
+          D.BestNet >> State) ||
+        !parseFileLine(Loc, D.Loc))
+      continue;
+    D.State = State == "fixed"    ? PrefetchDecision::Fixed
+              : State == "pruned" ? PrefetchDecision::Pruned
+                                  : PrefetchDecision::Tune;
+    Decisions[D.ID] = D;
+  }
+  return true;
+}
+
+bool writePrefetchDecisions(
+    const std::string &Path,
+    const std::map<uint32_t, PrefetchDecision> &Decisions) {
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::OF_Text);
+  if (EC) {
+    errs() << "Failed to open decision file " << Path << ": " << EC.message()
+           << "\n";
+    return false;
+  }
+  OS << "# id function file:line distance best_distance best_net state\n";
+  for (const auto &Entry : Decisions) {
+    const PrefetchDecision &D = Entry.second;
+    OS << D.ID << " " << D.Function << " " << D.Loc.first << ":"
+       << D.Loc.second << " " << D.Distance << " " << D.BestDistance << " "
+       << D.BestNet << " " << D.stateName() << "\n";
+  }
+  return true;
+}
+
+/// Cycles saved on FL between the baseline and the measured profile. An
+/// LL miss is also a D1 miss, so it is charged both penalties.
+static int64_t netGain(const std::map<FileLinePair, CacheMetrics> &Base,
+                       const std::map<FileLinePair, CacheMetrics> &Measured,
+                       const FileLinePair &FL, int64_t L1Penalty,
+                       int64_t LLPenalty) {
+  CacheMetrics B, M;
+  auto BI = Base.find(FL);
+  if (BI != Base.end())
+    B = BI->second;
+  auto MI = Measured.find(FL);
+  if (MI != Measured.end())
+    M = MI->second;
+
+  int64_t L1Saved = int64_t(B.D1mr + B.D1mw) - int64_t(M.D1mr + M.D1mw);
+  int64_t LLSaved = int64_t(B.DLmr + B.DLmw) - int64_t(M.DLmr + M.DLmw);
+  int64_t Overhead = int64_t(M.Ir) - int64_t(B.Ir);
+  return L1Saved * L1Penalty + LLSaved * LLPenalty - Overhead;
+}
+
+unsigned
+retunePrefetchDecisions(std::map<uint32_t, PrefetchDecision> &Decisions,
+                        const std::map<FileLinePair, CacheMetrics> &Base,
+                        const std::map<FileLinePair, CacheMetrics> &Measured,
+                        const CacheTarget &Target) {
+  int64_t L1Penalty = RetuneL1Penalty.getNumOccurrences()
+                          ? RetuneL1Penalty
+                          : Target.L1MissLatency;
+  int64_t LLPenalty =
+      RetuneLLPenalty.getNumOccurrences()
+          ? RetuneLLPenalty
+          : int64_t(Target.LLMissLatency) - Target.L1MissLatency;
+  unsigned StillTuning = 0;
+  for (auto &Entry : Decisions) {
+    PrefetchDecision &D = Entry.second;
+    if (D.State != PrefetchDecision::Tune)
+      continue;
+
+    int64_t Net = netGain(Base, Measured, D.Loc, L1Penalty, LLPenalty);
+    errs() << "Retune " << D.Loc.first << ":" << D.Loc.second << " [" << D.ID
+           << "] distance " << D.Distance << ": net " << Net << " (best "
+           << D.BestNet << " at " << D.BestDistance << ")";
+
+    if (Net > D.BestNet) {
+      D.BestNet = Net;
+      D.BestDistance = D.Distance;
+      if (D.Distance * 2 <= RetuneMaxDistance) {
+        D.Distance *= 2;
+        ++StillTuning;
+        errs() << " -> try " << D.Distance << "\n";
+        continue;
+      }
+    }
+
+    // No further improvement: settle on the best distance seen
+    D.Distance = D.BestDistance;
+    D.State = D.Distance ? PrefetchDecision::Fixed : PrefetchDecision::Pruned;
+    errs() << " -> " << D.stateName() << " at " << D.Distance << "\n";
+  }
+  return StillTuning;
+}
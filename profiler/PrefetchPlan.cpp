@@ -0,0 +1,167 @@
+#include "ParseCachegrindPass.h"
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/YAMLTraits.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+/**
+ * Prefetch plans: the decisions of one planning run (-cache-emit-plan), to
+ * be inspected, edited, versioned and applied later (-cache-apply-plan)
+ * without Valgrind. A site is identified by function, file:line and the
+ * ordinal of the access among that line's loads/stores in the function;
+ * the ID is informational (it is derived from the same fields).
+ *
+ *   {"version": 1, "sites": [{"id": 1240038723, "function": "sum",
+ *     "file": "b.c", "line": 4, "ordinal": 0, "distance": 4,
+ *     "locality": 3, "rw": 0, "reason": "hot line: 900 data misses"}]}
+ *
+ * A site with a profiled stride (-cache-stride-profile) also has "stride",
+ * in bytes per iteration.
+ *
+ * The same fields in YAML are used when the path ends in .yaml or .yml.
+ */
+
+static const unsigned PlanVersion = 1;
+
+namespace {
+struct PlanDoc {
+  unsigned Version = PlanVersion;
+  std::vector<PrefetchSite> Sites;
+};
+} // namespace
+
+LLVM_YAML_IS_SEQUENCE_VECTOR(PrefetchSite)
+
+namespace llvm {
+namespace yaml {
+template <> struct MappingTraits<PrefetchSite> {
+  static void mapping(IO &IO, PrefetchSite &Site) {
+    IO.mapRequired("id", Site.ID);
+    IO.mapRequired("function", Site.Function);
+    IO.mapRequired("file", Site.Loc.first);
+    IO.mapRequired("line", Site.Loc.second);
+    IO.mapRequired("ordinal", Site.Ordinal);
+    IO.mapRequired("distance", Site.Distance);
+    IO.mapOptional("locality", Site.Locality);
+    IO.mapOptional("rw", Site.RW);
+    IO.mapOptional("stride", Site.Stride, (int64_t)0);
+    IO.mapOptional("reason", Site.Reason);
+  }
+};
+
+template <> struct MappingTraits<PlanDoc> {
+  static void mapping(IO &IO, PlanDoc &Doc) {
+    IO.mapRequired("version", Doc.Version);
+    IO.mapRequired("sites", Doc.Sites);
+  }
+};
+} // namespace yaml
+} // namespace llvm
+
+static bool isYAMLPath(StringRef Path) {
+  return Path.endswith(".yaml") || Path.endswith(".yml");
+}
+
+static json::Value toJSON(const PrefetchSite &Site) {
+  json::Object O{{"id", Site.ID},
+                 {"function", Site.Function},
+                 {"file", Site.Loc.first},
+                 {"line", Site.Loc.second},
+                 {"ordinal", Site.Ordinal},
+                 {"distance", Site.Distance},
+                 {"locality", Site.Locality},
+                 {"rw", Site.RW},
+                 {"reason", Site.Reason}};
+  if (Site.Stride)
+    O["stride"] = Site.Stride;
+  return O;
+}
+
+static bool fromJSON(const json::Value &V, PrefetchSite &Site, json::Path P) {
+  json::ObjectMapper O(V, P);
+  int64_t ID = 0, Line = 0, Ordinal = 0, Distance = 0;
+  int64_t Locality = 3, RW = 0;
+  if (!O || !O.map("id", ID) || !O.map("function", Site.Function) ||
+      !O.map("file", Site.Loc.first) || !O.map("line", Line) ||
+      !O.map("ordinal", Ordinal) || !O.map("distance", Distance) ||
+      !O.mapOptional("locality", Locality) || !O.mapOptional("rw", RW) ||
+      !O.mapOptional("stride", Site.Stride) ||
+      !O.mapOptional("reason", Site.Reason))
+    return false;
+  Site.ID = (uint32_t)ID;
+  Site.Loc.second = (int)Line;
+  Site.Ordinal = (unsigned)Ordinal;
+  Site.Distance = (unsigned)Distance;
+  Site.Locality = (unsigned)Locality;
+  Site.RW = (unsigned)RW;
+  return true;
+}
+
+bool writePrefetchPlan(const std::string &Path,
+                       const std::vector<PrefetchSite> &Sites) {
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::OF_Text);
+  if (EC) {
+    errs() << "Failed to open plan " << Path << ": " << EC.message() << "\n";
+    return false;
+  }
+
+  if (isYAMLPath(Path)) {
+    PlanDoc Doc;
+    Doc.Sites = Sites;
+    yaml::Output Out(OS);
+    Out << Doc;
+    return true;
+  }
+
+  json::Array Array;
+  for (const PrefetchSite &Site : Sites)
+    Array.push_back(toJSON(Site));
+  OS << formatv("{0:2}", json::Value(json::Object{
+                             {"version", PlanVersion},
+                             {"sites", std::move(Array)}}))
+     << "\n";
+  return true;
+}
+
+bool readPrefetchPlan(const std::string &Path,
+                      std::vector<PrefetchSite> &Sites) {
+  auto Buf = MemoryBuffer::getFile(Path);
+  if (!Buf)
+    return false;
+
+  PlanDoc Doc;
+  if (isYAMLPath(Path)) {
+    yaml::Input In((*Buf)->getBuffer());
+    In >> Doc;
+    if (In.error())
+      return false;
+  } else {
+    Expected<json::Value> V = json::parse((*Buf)->getBuffer());
+    if (!V) {
+      errs() << "plan: " << toString(V.takeError()) << "\n";
+      return false;
+    }
+    json::Path::Root Root("plan");
+    json::ObjectMapper O(*V, Root);
+    int64_t Version = 0;
+    if (!O || !O.map("version", Version) || !O.map("sites", Doc.Sites)) {
+      errs() << "plan: " << toString(Root.getError()) << "\n";
+      return false;
+    }
+    Doc.Version = (unsigned)Version;
+  }
+
+  if (Doc.Version != PlanVersion) {
+    errs() << "plan: unsupported version " << Doc.Version << "\n";
+    return false;
+  }
+  Sites = std::move(Doc.Sites);
+  return true;
+}
@@ -0,0 +1,144 @@
+#include "ParseCachegrindPass.h"
+#include "ReuseProfile.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+using namespace llvm;
+
+/**
+ * Reuse-distance profiling: why hot lines miss, not just how often.
+ *
+ * -cache-reuse-instrument puts a cp_rd_access(id, addr, "file:line") call
+ * before every load and store, where id is the prefetch site ID the access
+ * would get (function, file:line, ordinal; see PrefetchAccounting.cpp). The
+ * runtime (runtime/cp_reuse.c) classifies each miss as compulsory, capacity
+ * or conflict from the access's reuse distance, and -cache-reuse-profile
+ * reads its table back so the planner can tell streams worth prefetching
+ * from misses that need a different transformation.
+ *
+ * The stride and sharing profilers (StrideProfile.cpp, SharingProfile.cpp)
+ * instrument accesses the same way.
+ */
+
+bool parseReuseProfile(const std::string &Path,
+                       std::map<uint32_t, ReuseSiteStats> &Sites) {
+  std::ifstream In(Path);
+  if (!In.is_open())
+    return false;
+
+  std::string Line;
+  unsigned LineNo = 0;
+  while (std::getline(In, Line)) {
+    ++LineNo;
+    if (Line.empty() || Line[0] == '#')
+      continue;
+    std::istringstream SS(Line);
+    uint32_t ID;
+    ReuseSiteStats S;
+    std::string Hist;
+    if (!(SS >> ID >> S.Loc >> S.Accesses >> S.Misses >> S.Compulsory >>
+          S.Capacity >> S.Conflict >> Hist))
+      continue;
+    SmallVector<StringRef, 16> Counts;
+    StringRef(Hist).split(Counts, ',');
+    bool Bad = false;
+    for (StringRef Count : Counts) {
+      uint64_t N;
+      if ((Bad = Count.getAsInteger(10, N)))
+        break;
+      S.Histogram.push_back(N);
+    }
+    if (Bad) {
+      errs() << "Bad histogram in reuse profile " << Path << ":" << LineNo
+             << ": " << Hist << "\n";
+      continue;
+    }
+    Sites[ID] = S;
+  }
+  return true;
+}
+
+unsigned instrumentAccessSites(Module &M, const char *Hook, bool LoadsOnly,
+                               bool WithSize) {
+  LLVMContext &Ctx = M.getContext();
+  const DataLayout &DL = M.getDataLayout();
+  Type *I8PtrTy = Type::getInt8PtrTy(Ctx);
+  Type *I32Ty = Type::getInt32Ty(Ctx);
+  SmallVector<Type *, 5> Params = {I32Ty, I8PtrTy};
+  if (WithSize)
+    Params.append({I32Ty, I32Ty});
+  Params.push_back(I8PtrTy);
+  FunctionCallee Access = M.getOrInsertFunction(
+      Hook, FunctionType::get(Type::getVoidTy(Ctx), Params, false));
+
+  std::map<std::string, Constant *> LocStrings;
+  unsigned NumAccesses = 0;
+  for (Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+
+    // Collect first, numbering accesses per line as the planner does
+    std::vector<std::pair<Instruction *, Value *>> Work;
+    std::vector<std::pair<uint32_t, FileLinePair>> Sites;
+    std::map<FileLinePair, unsigned> Ordinals;
+    for (Instruction &I : instructions(F)) {
+      Value *Ptr = nullptr;
+      if (auto *LI = dyn_cast<LoadInst>(&I))
+        Ptr = LI->getPointerOperand();
+      else if (auto *SI = dyn_cast<StoreInst>(&I))
+        Ptr = SI->getPointerOperand();
+      else
+        continue;
+
+      FileLinePair fl;
+      uint32_t ID = 0;
+      if (getFileLine(I, fl))
+        ID = prefetchSiteID(F, fl, Ordinals[fl]++);
+      else
+        fl.second = 0;
+      if (LoadsOnly && !isa<LoadInst>(&I))
+        continue;
+      Work.push_back({&I, Ptr});
+      Sites.push_back({ID, fl});
+    }
+
+    for (size_t i = 0; i < Work.size(); ++i) {
+      IRBuilder<> Builder(Work[i].first);
+      const FileLinePair &fl = Sites[i].second;
+      Constant *Loc = ConstantPointerNull::get(cast<PointerType>(I8PtrTy));
+      if (fl.second) {
+        std::string Name = fl.first + ":" + std::to_string(fl.second);
+        Constant *&Str = LocStrings[Name];
+        if (!Str)
+          Str = Builder.CreateGlobalStringPtr(Name, "cp.access.loc");
+        Loc = Str;
+      }
+      Instruction *I = Work[i].first;
+      SmallVector<Value *, 5> Args = {
+          Builder.getInt32(Sites[i].first),
+          Builder.CreatePointerCast(Work[i].second, I8PtrTy)};
+      if (WithSize) {
+        Type *Ty = isa<LoadInst>(I) ? I->getType()
+                                    : cast<StoreInst>(I)->getValueOperand()
+                                          ->getType();
+        Args.push_back(Builder.getInt32(DL.getTypeStoreSize(Ty)));
+        Args.push_back(Builder.getInt32(isa<StoreInst>(I)));
+      }
+      Args.push_back(Loc);
+      Builder.CreateCall(Access, Args);
+      ++NumAccesses;
+    }
+  }
+  return NumAccesses;
+}
@@ -0,0 +1,39 @@
+#ifndef REUSE_PROFILE_H
+#define REUSE_PROFILE_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace llvm {
+class Module;
+} // namespace llvm
+
+/// Per-access counts from the reuse-distance runtime (runtime/cp_reuse.c),
+/// keyed by the access's prefetch site ID.
+struct ReuseSiteStats {
+  std::string Loc;
+  uint64_t Accesses = 0;
+  uint64_t Misses = 0;
+  uint64_t Compulsory = 0;
+  uint64_t Capacity = 0;
+  uint64_t Conflict = 0;
+  /// Bucket 0: distance 0, bucket b: [2^(b-1), 2^b) lines, last: cold
+  std::vector<uint64_t> Histogram;
+
+  uint64_t classified() const { return Compulsory + Capacity + Conflict; }
+};
+
+/// Parse the table written by the reuse-distance runtime, keyed by site ID.
+bool parseReuseProfile(const std::string &Path,
+                       std::map<uint32_t, ReuseSiteStats> &Sites);
+
+/// Insert calls to Hook(i32 site ID, i8* addr, i8* "file:line") before every
+/// load, and every store unless LoadsOnly, for the reuse-distance, stride and
+/// sharing runtimes. WithSize adds (i32 size, i32 is_write) before the
+/// location. Returns the number of instrumented accesses.
+unsigned instrumentAccessSites(llvm::Module &M, const char *Hook,
+                               bool LoadsOnly, bool WithSize = false);
+
+#endif // REUSE_PROFILE_H
@@ -0,0 +1,366 @@
+#include "ParseCachegrindPass.h"
+
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/ADT/SmallVector.h"
+
+#include <set>
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<unsigned> RunAheadDistance(
+    "runahead-distance",
+    cl::desc("Most nodes the helper thread may run ahead of the loop "
+             "(0 = the runtime's CP_RA_AHEAD, default 64)"),
+    cl::init(0));
+
+/**
+ * Helper-thread run-ahead for hot pointer-chasing loops, in the spirit of
+ * software-based helper threads for precomputation (Kim & Yeung, Luk's
+ * "Tolerating memory latency through software-controlled pre-execution").
+ *
+ * Prefetching from the loop itself can't help `while (p) { ...; p = p->next;
+ * }`: the next address is only known once the current node has arrived, so
+ * the walk runs at one memory latency per node however the prefetches are
+ * placed. A second thread can walk the same list ahead of it instead:
+ *
+ *   loop.runahead(start, h):             ; outlined address slice
+ *     for (p = start; p = cp_ra_step(h, p); )
+ *       prefetch each line of *p the loop reads; p = p->next
+ *
+ *   h = cp_ra_start(loop.runahead, head, -runahead-distance)  ; preheader
+ *   while (p) { cp_ra_progress(h, p); ... }                    ; header
+ *   cp_ra_stop(h)                                              ; each exit
+ *
+ * The runtime (runtime/cp_runahead.c) runs the slice on its helper thread,
+ * keeps it no more than the distance ahead, and resyncs it if it falls
+ * behind. The nodes it touches are then in the shared cache levels when the
+ * loop gets to them.
+ *
+ * A loop is a candidate if it is innermost, in simplified form with
+ * dedicated exits, and:
+ *  - a header phi p is reloaded each iteration from a constant offset into
+ *    *p (the slice: constant GEPs/bitcasts and one load);
+ *  - it exits when p is null, so the helper stops at the end of the list;
+ *  - some load from *p is on a line at or above -cache-miss-threshold;
+ *  - nothing in it may write the next pointers: no calls that write memory,
+ *    and no store alias analysis can't separate from the slice's load.
+ *
+ * -O0 IR keeps p in an alloca, so as for software pipelining a hot function
+ * is promoted to SSA (mem2reg) only if a promoted copy of it has a candidate.
+ */
+struct RunAheadImpl {
+  Module &M;
+  const CachegrindProfile &Profile;
+  const std::map<FileLinePair, CacheMetrics> &lineMetrics;
+
+  /// One pointer-chasing loop to run ahead
+  struct Candidate {
+    Loop *L = nullptr;
+    PHINode *Node = nullptr;
+    LoadInst *Next = nullptr;
+    /// From Node out to Next's address
+    SmallVector<Instruction *, 4> Slice;
+    /// Line-aligned offsets into *Node the loop loads from
+    std::set<int64_t> Lines;
+  };
+
+  RunAheadImpl(Module &M, const CachegrindProfile &Profile)
+      : M(M), Profile(Profile), lineMetrics(Profile.LineMetrics) {}
+
+  bool isHotLine(const Instruction &I) {
+    FileLinePair fl;
+    if (!Profile.getFileLine(I, fl))
+      return false;
+    auto it = lineMetrics.find(fl);
+    return it != lineMetrics.end() &&
+           it->second.totalMisses() >= MissThreshold;
+  }
+
+  bool hasHotLine(Function &F) {
+    for (Instruction &I : instructions(F))
+      if (isa<LoadInst>(I) && isHotLine(I))
+        return true;
+    return false;
+  }
+
+  /// If Ptr is Base plus constant GEPs and bitcasts, append them (outermost
+  /// first) to Chain and return true.
+  static bool constantChain(Value *Ptr, Value *Base,
+                            SmallVectorImpl<Instruction *> &Chain) {
+    while (Ptr != Base) {
+      auto *I = dyn_cast<Instruction>(Ptr);
+      if (auto *GEP = dyn_cast_or_null<GetElementPtrInst>(I)) {
+        if (!GEP->hasAllConstantIndices())
+          return false;
+      } else if (!isa_and_nonnull<BitCastInst>(I)) {
+        return false;
+      }
+      Chain.push_back(I);
+      Ptr = I->getOperand(0);
+    }
+    return true;
+  }
+
+  /// Byte offset of the address Chain computes from its base.
+  int64_t chainOffset(ArrayRef<Instruction *> Chain) {
+    const DataLayout &DL = M.getDataLayout();
+    int64_t Offset = 0;
+    for (Instruction *I : Chain) {
+      if (auto *GEP = dyn_cast<GetElementPtrInst>(I)) {
+        APInt Off(DL.getIndexTypeSizeInBits(GEP->getType()), 0);
+        GEP->accumulateConstantOffset(DL, Off);
+        Offset += Off.getSExtValue();
+      }
+    }
+    return Offset;
+  }
+
+  /// Does some exiting block leave the loop when P is null?
+  static bool exitsOnNull(Loop *L, PHINode *P) {
+    SmallVector<BasicBlock *, 4> Exiting;
+    L->getExitingBlocks(Exiting);
+    for (BasicBlock *BB : Exiting) {
+      auto *Br = dyn_cast<BranchInst>(BB->getTerminator());
+      if (!Br || !Br->isConditional())
+        continue;
+      auto *Cmp = dyn_cast<ICmpInst>(Br->getCondition());
+      if (!Cmp || !Cmp->isEquality())
+        continue;
+      Value *A = Cmp->getOperand(0)->stripPointerCasts();
+      Value *B = Cmp->getOperand(1)->stripPointerCasts();
+      if ((A == P && isa<ConstantPointerNull>(B)) ||
+          (B == P && isa<ConstantPointerNull>(A)))
+        return true;
+    }
+    return false;
+  }
+
+  bool findCandidate(Loop *L, AAResults &AA, Candidate &C) {
+    BasicBlock *Latch = L->getLoopLatch();
+    if (!L->getLoopPreheader() || !Latch || !L->hasDedicatedExits())
+      return false;
+
+    for (PHINode &P : L->getHeader()->phis()) {
+      if (!P.getType()->isPointerTy())
+        continue;
+      auto *Next = dyn_cast<LoadInst>(
+          P.getIncomingValueForBlock(Latch)->stripPointerCasts());
+      SmallVector<Instruction *, 4> Chain;
+      if (!Next || !Next->isSimple() || !L->contains(Next) ||
+          !constantChain(Next->getPointerOperand(), &P, Chain) ||
+          !exitsOnNull(L, &P))
+        continue;
+
+      C = Candidate();
+      C.L = L;
+      C.Node = &P;
+      C.Next = Next;
+      C.Slice.assign(Chain.rbegin(), Chain.rend());
+      break;
+    }
+    if (!C.Node)
+      return false;
+
+    int64_t LineSize = Profile.Target.lineSize();
+    MemoryLocation NextLoc = MemoryLocation::get(C.Next);
+    bool Hot = false;
+    for (BasicBlock *BB : C.L->blocks()) {
+      for (Instruction &I : *BB) {
+        if (auto *SI = dyn_cast<StoreInst>(&I)) {
+          if (!AA.isNoAlias(NextLoc, MemoryLocation::get(SI)))
+            return false; // the loop may relink the list
+          continue;
+        }
+        if (I.mayWriteToMemory() && !isHarmlessCall(I))
+          return false;
+        auto *LI = dyn_cast<LoadInst>(&I);
+        SmallVector<Instruction *, 4> Chain;
+        if (!LI || !constantChain(LI->getPointerOperand(), C.Node, Chain))
+          continue;
+        int64_t Offset = chainOffset(Chain);
+        int64_t Line = Offset / LineSize - (Offset % LineSize < 0);
+        C.Lines.insert(Line * LineSize);
+        Hot |= isHotLine(*LI);
+      }
+    }
+    return Hot;
+  }
+
+  /// void <F>.runahead(i8* start, i8* handle): the address slice of C.
+  Function *outlineSlice(Candidate &C, FunctionCallee Step) {
+    LLVMContext &Ctx = M.getContext();
+    Type *I8PtrTy = Type::getInt8PtrTy(Ctx);
+    Function *F = C.L->getHeader()->getParent();
+    Function *Helper = Function::Create(
+        FunctionType::get(Type::getVoidTy(Ctx), {I8PtrTy, I8PtrTy}, false),
+        GlobalValue::InternalLinkage, F->getName() + ".runahead", M);
+    Helper->addFnAttr(Attribute::NoUnwind);
+    Argument *Start = Helper->getArg(0);
+    Argument *Handle = Helper->getArg(1);
+    Start->setName("start");
+    Handle->setName("handle");
+
+    BasicBlock *Entry = BasicBlock::Create(Ctx, "entry", Helper);
+    BasicBlock *Walk = BasicBlock::Create(Ctx, "walk", Helper);
+    BasicBlock *Touch = BasicBlock::Create(Ctx, "touch", Helper);
+    BasicBlock *Exit = BasicBlock::Create(Ctx, "exit", Helper);
+    IRBuilder<> Builder(Entry);
+    Builder.CreateBr(Walk);
+
+    // p = cp_ra_step(handle, p): throttled, resynced, NULL to stop
+    Builder.SetInsertPoint(Walk);
+    PHINode *P = Builder.CreatePHI(I8PtrTy, 2, "p");
+    P->addIncoming(Start, Entry);
+    Value *Node = Builder.CreateCall(Step, {Handle, P}, "node");
+    Builder.CreateCondBr(Builder.CreateIsNull(Node), Exit, Touch);
+
+    // Touch the lines the loop reads, then follow the next pointer
+    Builder.SetInsertPoint(Touch);
+    for (int64_t Offset : C.Lines) {
+      Value *Line = Offset ? Builder.CreateConstGEP1_64(Builder.getInt8Ty(),
+                                                         Node, Offset)
+                           : Node;
+      Builder.CreateIntrinsic(Intrinsic::prefetch, {I8PtrTy},
+                              {Line, Builder.getInt32(0), Builder.getInt32(3),
+                               Builder.getInt32(1)});
+    }
+    Value *Cur = Builder.CreateBitCast(Node, C.Node->getType());
+    for (Instruction *I : C.Slice) {
+      Instruction *New = I->clone();
+      New->setOperand(0, Cur);
+      New->setDebugLoc(DebugLoc());
+      Builder.Insert(New);
+      Cur = New;
+    }
+    LoadInst *Next = Builder.CreateAlignedLoad(C.Next->getType(), Cur,
+                                               C.Next->getAlign(), "next");
+    P->addIncoming(Builder.CreateBitCast(Next, I8PtrTy), Touch);
+    Builder.CreateBr(Walk);
+
+    Builder.SetInsertPoint(Exit);
+    Builder.CreateRetVoid();
+    return Helper;
+  }
+
+  void runAhead(Candidate &C) {
+    LLVMContext &Ctx = M.getContext();
+    Type *I8PtrTy = Type::getInt8PtrTy(Ctx);
+    Type *VoidTy = Type::getVoidTy(Ctx);
+    FunctionType *SliceTy = FunctionType::get(VoidTy, {I8PtrTy, I8PtrTy},
+                                              false);
+    FunctionCallee Start = M.getOrInsertFunction(
+        "cp_ra_start", I8PtrTy, SliceTy->getPointerTo(), I8PtrTy,
+        Type::getInt32Ty(Ctx));
+    FunctionCallee Progress = M.getOrInsertFunction(
+        "cp_ra_progress", VoidTy, I8PtrTy, I8PtrTy);
+    FunctionCallee Step =
+        M.getOrInsertFunction("cp_ra_step", I8PtrTy, I8PtrTy, I8PtrTy);
+    FunctionCallee Stop =
+        M.getOrInsertFunction("cp_ra_stop", VoidTy, I8PtrTy);
+
+    Function *Helper = outlineSlice(C, Step);
+    Loop *L = C.L;
+    BasicBlock *Preheader = L->getLoopPreheader();
+    DebugLoc DL = C.Next->getDebugLoc();
+
+    IRBuilder<> Builder(Preheader->getTerminator());
+    Value *Head = C.Node->getIncomingValueForBlock(Preheader);
+    CallInst *Handle = Builder.CreateCall(
+        Start, {Helper, Builder.CreatePointerCast(Head, I8PtrTy),
+                Builder.getInt32(RunAheadDistance)},
+        "runahead");
+    Handle->setDebugLoc(DL);
+
+    Builder.SetInsertPoint(&*L->getHeader()->getFirstInsertionPt());
+    Builder.CreateCall(Progress,
+                       {Handle, Builder.CreatePointerCast(C.Node, I8PtrTy)})
+        ->setDebugLoc(DL);
+
+    SmallVector<BasicBlock *, 4> Exits;
+    L->getUniqueExitBlocks(Exits);
+    for (BasicBlock *Exit : Exits) {
+      Builder.SetInsertPoint(&*Exit->getFirstInsertionPt());
+      Builder.CreateCall(Stop, {Handle})->setDebugLoc(DL);
+    }
+  }
+
+  /// Whether some innermost loop of F can be run ahead.
+  bool hasCandidateLoop(Function &F, FunctionAnalysisManager &FAM) {
+    LoopInfo &LI = FAM.getResult<LoopAnalysis>(F);
+    AAResults &AA = FAM.getResult<AAManager>(F);
+    for (Loop *L : LI.getLoopsInPreorder()) {
+      Candidate C;
+      if (L->isInnermost() && findCandidate(L, AA, C))
+        return true;
+    }
+    return false;
+  }
+
+  bool run(ModuleAnalysisManager &MAM) {
+    auto &FAM =
+        MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+    unsigned NumLoops = 0;
+    bool Changed = false;
+
+    std::vector<Function *> Functions;
+    for (Function &F : M)
+      if (!F.isDeclaration() && hasHotLine(F))
+        Functions.push_back(&F);
+
+    for (Function *F : Functions) {
+      if (promoteAllocasIfUseful(*F, FAM, [&](Function &Copy) {
+            return hasCandidateLoop(Copy, FAM);
+          }))
+        Changed = true;
+
+      LoopInfo &LI = FAM.getResult<LoopAnalysis>(*F);
+      AAResults &AA = FAM.getResult<AAManager>(*F);
+      std::vector<Candidate> Candidates;
+      for (Loop *L : LI.getLoopsInPreorder()) {
+        Candidate C;
+        if (L->isInnermost() && findCandidate(L, AA, C))
+          Candidates.push_back(C);
+      }
+
+      for (Candidate &C : Candidates) {
+        FileLinePair fl;
+        Profile.getFileLine(*C.Next, fl);
+        errs() << "runahead: helper thread walks the list loaded at "
+               << fl.first << ":" << fl.second << " ("
+               << C.Lines.size() << " line(s) per node)\n";
+        runAhead(C);
+        ++NumLoops;
+      }
+      if (!Candidates.empty()) {
+        FAM.invalidate(*F, PreservedAnalyses::none());
+        Changed = true;
+      }
+    }
+
+    errs() << "runahead: " << NumLoops << " loops run ahead\n";
+    return Changed;
+  }
+};
+
+PreservedAnalyses RunAheadPass::run(Module &M, ModuleAnalysisManager &MAM) {
+  if (CacheCGFile.empty()) {
+    errs() << "No file provided via -cache-cg-file\n";
+    return PreservedAnalyses::all();
+  }
+
+  const auto &Profile = MAM.getResult<CachegrindProfileAnalysis>(M);
+  if (!Profile.Loaded) {
+    errs() << "Failed to parse file: " << CacheCGFile << "\n";
+    return PreservedAnalyses::all();
+  }
+
+  RunAheadImpl Impl(M, Profile);
+  return Impl.run(MAM) ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
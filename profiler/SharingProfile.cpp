@@ -0,0 +1,50 @@
+#include "ParseCachegrindPass.h"
+#include "SharingProfile.h"
+
+#include <fstream>
+#include <sstream>
+
+/**
+ * Sharing profiles: what Cachegrind can't see in multithreaded programs.
+ *
+ * Cachegrind runs the threads one at a time through a single cache, so it
+ * reports neither coherence misses nor false sharing, and a hot line may be
+ * hot because threads take it from each other. -cache-sharing-instrument
+ * puts a cp_sh_access(id, addr, size, is_write, "file:line") call before
+ * every load and store; the runtime (runtime/cp_sharing.c) keeps per-thread
+ * counts for each access. -cache-sharing-profile reads them back: false
+ * sharing is reported, and lines other threads write are not prefetched
+ * (a prefetched copy would be invalidated before use, and a write prefetch
+ * takes the line away from its other users early).
+ */
+
+bool parseSharingProfile(const std::string &Path,
+                         std::map<uint32_t, SharingSiteStats> &Sites) {
+  std::ifstream In(Path);
+  if (!In.is_open())
+    return false;
+
+  std::string Line;
+  while (std::getline(In, Line)) {
+    if (Line.empty() || Line[0] == '#')
+      continue;
+    std::istringstream SS(Line);
+    uint32_t ID;
+    unsigned Thread;
+    std::string Loc;
+    uint64_t Accesses, Writes, Coherence, FalseSharing, SharedWrites;
+    if (!(SS >> ID >> Loc >> Thread >> Accesses >> Writes >> Coherence >>
+          FalseSharing >> SharedWrites))
+      continue;
+    // One row per thread
+    SharingSiteStats &S = Sites[ID];
+    S.Loc = Loc;
+    S.Threads++;
+    S.Accesses += Accesses;
+    S.Writes += Writes;
+    S.Coherence += Coherence;
+    S.FalseSharing += FalseSharing;
+    S.SharedWrites += SharedWrites;
+  }
+  return true;
+}
@@ -0,0 +1,35 @@
+#ifndef SHARING_PROFILE_H
+#define SHARING_PROFILE_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace llvm {
+class DataLayout;
+class Value;
+} // namespace llvm
+
+/// Per-access counts from the sharing runtime (runtime/cp_sharing.c), summed
+/// over the threads that ran the access.
+struct SharingSiteStats {
+  std::string Loc;
+  unsigned Threads = 0;
+  uint64_t Accesses = 0;
+  uint64_t Writes = 0;
+  uint64_t Coherence = 0;    ///< misses on a line another thread wrote
+  uint64_t FalseSharing = 0; ///< ... to bytes that thread didn't write
+  uint64_t SharedWrites = 0; ///< writes taking a line from other threads
+};
+
+/// Parse the table written by the sharing runtime, keyed by site ID.
+bool parseSharingProfile(const std::string &Path,
+                         std::map<uint32_t, SharingSiteStats> &Sites);
+
+/// What Ptr addresses, for false sharing reports: "field 1 (bytes) of
+/// counters[] elements", "field 0 (hits) of stats", "total" or "" if it
+/// isn't a global. Field names come from the global's debug info.
+std::string describeSharedObject(llvm::Value *Ptr,
+                                 const llvm::DataLayout &DL);
+
+#endif // SHARING_PROFILE_H
@@ -0,0 +1,420 @@
+#include "ParseCachegrindPass.h"
+
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
+#include "llvm/ADT/SmallVector.h"
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "cachegrind-swp"
+
+static cl::opt<unsigned> SWPMaxDistance(
+    "swp-max-distance",
+    cl::desc("Upper bound on how many iterations ahead loads are issued"),
+    cl::init(8));
+
+static cl::opt<unsigned> SWPMaxRegs(
+    "swp-max-regs",
+    cl::desc("Upper bound on rotating registers (loads x distance) per loop"),
+    cl::init(16));
+
+static cl::opt<unsigned> SWPL1MissLatency(
+    "swp-l1-miss-latency",
+    cl::desc("Cycles for a D1 miss that hits in LL (default: the cache "
+             "target's)"));
+
+static cl::opt<unsigned> SWPLLMissLatency(
+    "swp-ll-miss-latency",
+    cl::desc("Cycles for an LL miss (memory) (default: the cache "
+             "target's)"));
+
+/**
+ * Software pipelining of hot innermost loops: each hot affine load is issued
+ * d iterations ahead of its use into a chain of rotating registers (header
+ * phis), so a miss overlaps the compute of the d iterations in between.
+ *
+ *   prologue (preheader):  r[j] = a[j]                 for j < d
+ *   kernel   (loop body):  x = r[0]; t = a[min(n+d, last)]; ...
+ *                          r[j] <- r[j+1], r[d-1] <- t  (at the latch)
+ *
+ * The epilogue is folded into the kernel: for the last d iterations the
+ * ahead index is clamped to the last iteration the load executes in, so no
+ * address past the original access range is ever touched.
+ *
+ * d = ceil(expected miss latency / estimated cycles per iteration), where
+ * the latency is the cache target's (see CacheTarget.cpp), weighted by the
+ * line's D1mr vs DLmr split.
+ *
+ * Legality: the loop must be in simplified form with a single exiting block
+ * and a computable backedge-taken count; the load must be simple, execute
+ * every iteration (dominate the latch), have an affine address with a
+ * constant stride, and no store or call in the loop may alias it. Alias
+ * analysis must prove that: loads and stores through pointer parameters
+ * that may overlap (susan_edges' in[] and r[]) keep a loop unpipelined.
+ *
+ * -O0 IR keeps induction variables in allocas, where SCEV can't see them.
+ * A hot function is promoted to SSA (mem2reg) only if a promoted copy of it
+ * has a loop to pipeline (promoteAllocasIfUseful).
+ */
+struct SoftwarePipelineImpl {
+  Module &M;
+  const CachegrindProfile &Profile;
+  const std::map<FileLinePair, CacheMetrics> &lineMetrics;
+
+  /// Profile.Target with the -swp-*-latency overrides
+  CacheTarget Target;
+
+  struct Candidate {
+    LoadInst *Load;
+    const SCEVAddRecExpr *AR;
+    unsigned Distance;
+  };
+
+  SoftwarePipelineImpl(Module &M, const CachegrindProfile &Profile)
+      : M(M), Profile(Profile), lineMetrics(Profile.LineMetrics),
+        Target(Profile.Target) {
+    if (SWPL1MissLatency.getNumOccurrences())
+      Target.L1MissLatency = SWPL1MissLatency;
+    if (SWPLLMissLatency.getNumOccurrences())
+      Target.LLMissLatency = SWPLLMissLatency;
+  }
+
+  const CacheMetrics *getHotMetrics(const Instruction &I) {
+    FileLinePair fl;
+    if (!Profile.getFileLine(I, fl))
+      return nullptr;
+    auto it = lineMetrics.find(fl);
+    if (it == lineMetrics.end() || it->second.totalMisses() < MissThreshold)
+      return nullptr;
+    return &it->second;
+  }
+
+  bool hasHotLine(Function &F) {
+    for (Instruction &I : instructions(F))
+      if (isa<LoadInst>(I) && getHotMetrics(I))
+        return true;
+    return false;
+  }
+
+  bool collectCandidates(Loop *L, ScalarEvolution &SE, DominatorTree &DT,
+                         AAResults &AA, std::vector<Candidate> &Out) {
+    BasicBlock *Latch = L->getLoopLatch();
+    unsigned IterCost = 0;
+    SmallVector<StoreInst *, 8> Stores;
+
+    for (BasicBlock *BB : L->blocks()) {
+      for (Instruction &I : *BB) {
+        if (isa<PHINode>(I) || isa<DbgInfoIntrinsic>(I))
+          continue;
+        ++IterCost;
+        if (auto *SI = dyn_cast<StoreInst>(&I)) {
+          Stores.push_back(SI);
+          continue;
+        }
+        if (I.mayWriteToMemory() && !isHarmlessCall(I))
+          return false; // unknown writes: can't move loads across them
+      }
+    }
+
+    std::vector<std::pair<const CacheMetrics *, Candidate>> Found;
+    for (BasicBlock *BB : L->blocks()) {
+      if (!DT.dominates(BB, Latch))
+        continue; // must execute every iteration
+      for (Instruction &I : *BB) {
+        auto *LI = dyn_cast<LoadInst>(&I);
+        if (!LI || !LI->isSimple())
+          continue;
+        const CacheMetrics *cm = getHotMetrics(*LI);
+        if (!cm)
+          continue;
+
+        auto *AR =
+            dyn_cast<SCEVAddRecExpr>(SE.getSCEV(LI->getPointerOperand()));
+        if (!AR || AR->getLoop() != L || !AR->isAffine() ||
+            !isa<SCEVConstant>(AR->getStepRecurrence(SE)) ||
+            !SE.isLoopInvariant(AR->getStart(), L) ||
+            !isSafeToExpand(AR->getStart(), SE))
+          continue;
+
+        MemoryLocation LoadLoc = MemoryLocation::getBeforeOrAfter(
+            LI->getPointerOperand());
+        bool Aliased = false;
+        for (StoreInst *SI : Stores) {
+          if (!AA.isNoAlias(LoadLoc, MemoryLocation::getBeforeOrAfter(
+                                         SI->getPointerOperand()))) {
+            Aliased = true;
+            break;
+          }
+        }
+        if (Aliased)
+          continue;
+
+        unsigned D = (Target.missLatency(*cm) + IterCost - 1) / IterCost;
+        D = std::max(1u, std::min(D, (unsigned)SWPMaxDistance));
+        Found.push_back({cm, {LI, AR, D}});
+      }
+    }
+
+    // Hottest loads first, within the rotating-register budget
+    std::stable_sort(Found.begin(), Found.end(), [](auto &A, auto &B) {
+      return A.first->totalMisses() > B.first->totalMisses();
+    });
+    unsigned Regs = 0;
+    for (auto &Entry : Found) {
+      if (Regs + Entry.second.Distance > SWPMaxRegs)
+        continue;
+      Regs += Entry.second.Distance;
+      Out.push_back(Entry.second);
+    }
+    return !Out.empty();
+  }
+
+  /// Address of C's load in iteration Idx: base + Idx * stride, where Base
+  /// is the i8* start address.
+  Value *addressAt(IRBuilder<> &Builder, const Candidate &C, Value *Base,
+                   Value *Idx, ScalarEvolution &SE) {
+    LLVMContext &Ctx = M.getContext();
+    Type *OffTy = M.getDataLayout().getIndexType(Base->getType());
+    auto *Step = cast<SCEVConstant>(C.AR->getStepRecurrence(SE));
+    Value *Off = Builder.CreateMul(
+        Builder.CreateZExtOrTrunc(Idx, OffTy),
+        ConstantInt::get(OffTy, Step->getAPInt().sextOrTrunc(
+                                    OffTy->getIntegerBitWidth())),
+        "swp.off");
+    Value *Addr = Builder.CreateGEP(Type::getInt8Ty(Ctx), Base, Off,
+                                    "swp.addr");
+    return Builder.CreateBitCast(Addr, C.Load->getPointerOperandType());
+  }
+
+  static Value *umin(IRBuilder<> &Builder, Value *A, Value *B) {
+    return Builder.CreateSelect(Builder.CreateICmpULT(A, B), A, B);
+  }
+
+  /// Whether L has the shape pipelineLoop() needs: simplified, with one
+  /// exiting block and an expandable backedge-taken count.
+  static bool hasPipelineShape(Loop *L, ScalarEvolution &SE) {
+    if (!L->getLoopPreheader() || !L->getLoopLatch() ||
+        !L->getExitingBlock() || !L->hasDedicatedExits())
+      return false;
+    const SCEV *BTC = SE.getBackedgeTakenCount(L);
+    return !isa<SCEVCouldNotCompute>(BTC) && isSafeToExpand(BTC, SE);
+  }
+
+  /// Whether some innermost loop of F has loads to pipeline.
+  bool hasCandidateLoop(Function &F, FunctionAnalysisManager &FAM) {
+    LoopInfo &LI = FAM.getResult<LoopAnalysis>(F);
+    ScalarEvolution &SE = FAM.getResult<ScalarEvolutionAnalysis>(F);
+    DominatorTree &DT = FAM.getResult<DominatorTreeAnalysis>(F);
+    AAResults &AA = FAM.getResult<AAManager>(F);
+    for (Loop *L : LI.getLoopsInPreorder()) {
+      std::vector<Candidate> Cands;
+      if (L->isInnermost() && hasPipelineShape(L, SE) &&
+          collectCandidates(L, SE, DT, AA, Cands))
+        return true;
+    }
+    return false;
+  }
+
+  bool pipelineLoop(Loop *L, ScalarEvolution &SE, DominatorTree &DT,
+                    LoopInfo &LI, AAResults &AA,
+                    OptimizationRemarkEmitter &ORE) {
+    if (!hasPipelineShape(L, SE))
+      return false;
+    BasicBlock *Preheader = L->getLoopPreheader();
+    BasicBlock *Header = L->getHeader();
+    BasicBlock *Latch = L->getLoopLatch();
+    BasicBlock *Exiting = L->getExitingBlock();
+    const SCEV *BTC = SE.getBackedgeTakenCount(L);
+
+    std::vector<Candidate> Cands;
+    if (!collectCandidates(L, SE, DT, AA, Cands))
+      return false;
+
+    // All candidates must agree on whether they run BTC or BTC+1 times;
+    // loads that come before the exit test run one extra time.
+    bool BeforeExit = DT.dominates(Cands[0].Load->getParent(), Exiting);
+    for (const Candidate &C : Cands)
+      if (DT.dominates(C.Load->getParent(), Exiting) != BeforeExit)
+        return false;
+
+    const DataLayout &DL = M.getDataLayout();
+    SCEVExpander Expander(SE, DL, "swp");
+    Instruction *PreTerm = Preheader->getTerminator();
+    Type *IdxTy = BTC->getType();
+
+    // Last iteration in which the loads execute
+    const SCEV *LastS =
+        BeforeExit ? BTC : SE.getMinusSCEV(BTC, SE.getOne(IdxTy));
+    Value *Last = Expander.expandCodeFor(LastS, IdxTy, PreTerm);
+    std::vector<Value *> Starts;
+    for (const Candidate &C : Cands) {
+      Value *Start = Expander.expandCodeFor(
+          C.AR->getStart(), C.AR->getStart()->getType(), PreTerm);
+      Starts.push_back(new BitCastInst(
+          Start, Type::getInt8PtrTy(M.getContext()), "swp.base", PreTerm));
+    }
+
+    // Prologue. If the loads might not run at all (BTC == 0 with the exit
+    // test first), guard it so we never touch an address they wouldn't.
+    BasicBlock *PrologueBB = Preheader;
+    Instruction *PrologueIP = PreTerm;
+    if (!BeforeExit) {
+      IRBuilder<> Builder(PreTerm);
+      Value *Runs = Builder.CreateICmpNE(
+          Expander.expandCodeFor(BTC, IdxTy, PreTerm),
+          ConstantInt::get(IdxTy, 0), "swp.runs");
+      PrologueIP = SplitBlockAndInsertIfThen(Runs, PreTerm, false, nullptr,
+                                             &DT, &LI);
+      PrologueBB = PrologueIP->getParent();
+      Preheader = L->getLoopPreheader();
+    }
+
+    IRBuilder<> Builder(PrologueIP);
+    std::vector<std::vector<Value *>> Prologue(Cands.size());
+    for (size_t c = 0; c < Cands.size(); ++c) {
+      const Candidate &C = Cands[c];
+      Builder.SetCurrentDebugLocation(C.Load->getDebugLoc());
+      for (unsigned j = 0; j < C.Distance; ++j) {
+        Value *Idx = umin(Builder, ConstantInt::get(IdxTy, j), Last);
+        LoadInst *P = Builder.CreateAlignedLoad(
+            C.Load->getType(), addressAt(Builder, C, Starts[c], Idx, SE),
+            C.Load->getAlign(), "swp.pro");
+        Prologue[c].push_back(P);
+      }
+    }
+
+    if (PrologueBB != Preheader) {
+      // Merge prologue values into the new preheader (undef when skipped)
+      Builder.SetInsertPoint(&Preheader->front());
+      for (auto &Vals : Prologue) {
+        for (Value *&V : Vals) {
+          PHINode *Phi = Builder.CreatePHI(V->getType(), 2, "swp.pro.merge");
+          Phi->addIncoming(V, PrologueBB);
+          for (BasicBlock *Pred : predecessors(Preheader))
+            if (Pred != PrologueBB)
+              Phi->addIncoming(UndefValue::get(V->getType()), Pred);
+          V = Phi;
+        }
+      }
+    }
+
+    // Iteration counter n: 0, 1, 2, ...
+    Builder.SetInsertPoint(&Header->front());
+    PHINode *Iter = Builder.CreatePHI(IdxTy, 2, "swp.iter");
+    Builder.SetInsertPoint(Latch->getTerminator());
+    Value *IterNext = Builder.CreateAdd(Iter, ConstantInt::get(IdxTy, 1),
+                                        "swp.iter.next");
+    Iter->addIncoming(ConstantInt::get(IdxTy, 0), Preheader);
+    Iter->addIncoming(IterNext, Latch);
+
+    for (size_t c = 0; c < Cands.size(); ++c) {
+      const Candidate &C = Cands[c];
+
+      // Rotating registers r[0..d-1]
+      Builder.SetInsertPoint(&Header->front());
+      std::vector<PHINode *> Regs;
+      for (unsigned j = 0; j < C.Distance; ++j) {
+        PHINode *R = Builder.CreatePHI(C.Load->getType(), 2, "swp.reg");
+        R->addIncoming(Prologue[c][j], Preheader);
+        Regs.push_back(R);
+      }
+
+      // Issue the load for iteration n+d ahead of this iteration's compute
+      Builder.SetInsertPoint(C.Load);
+      Value *AheadIdx = umin(
+          Builder,
+          Builder.CreateAdd(Iter, ConstantInt::get(IdxTy, C.Distance)), Last);
+      LoadInst *Ahead = Builder.CreateAlignedLoad(
+          C.Load->getType(), addressAt(Builder, C, Starts[c], AheadIdx, SE),
+          C.Load->getAlign(), "swp.ahead");
+
+      for (unsigned j = 0; j + 1 < C.Distance; ++j)
+        Regs[j]->addIncoming(Regs[j + 1], Latch);
+      Regs[C.Distance - 1]->addIncoming(Ahead, Latch);
+
+      ORE.emit([&]() {
+        return OptimizationRemark(DEBUG_TYPE, "Pipelined", C.Load)
+               << "load issued " << ore::NV("Distance", C.Distance)
+               << " iterations ahead";
+      });
+
+      C.Load->replaceAllUsesWith(Regs[0]);
+      C.Load->eraseFromParent();
+    }
+
+    SE.forgetLoop(L);
+    return true;
+  }
+
+  bool run(ModuleAnalysisManager &MAM) {
+    auto &FAM =
+        MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+    unsigned NumLoops = 0;
+    bool Changed = false;
+
+    for (Function &F : M) {
+      if (F.isDeclaration() || !hasHotLine(F))
+        continue;
+
+      if (promoteAllocasIfUseful(F, FAM, [&](Function &Copy) {
+            return hasCandidateLoop(Copy, FAM);
+          }))
+        Changed = true;
+
+      LoopInfo &LI = FAM.getResult<LoopAnalysis>(F);
+      ScalarEvolution &SE = FAM.getResult<ScalarEvolutionAnalysis>(F);
+      DominatorTree &DT = FAM.getResult<DominatorTreeAnalysis>(F);
+      AAResults &AA = FAM.getResult<AAManager>(F);
+      auto &ORE = FAM.getResult<OptimizationRemarkEmitterAnalysis>(F);
+
+      bool FChanged = false;
+      for (Loop *L : LI.getLoopsInPreorder()) {
+        if (!L->isInnermost())
+          continue;
+        if (pipelineLoop(L, SE, DT, LI, AA, ORE)) {
+          ++NumLoops;
+          FChanged = true;
+        }
+      }
+      if (FChanged) {
+        FAM.invalidate(F, PreservedAnalyses::none());
+        Changed = true;
+      }
+    }
+
+    errs() << "swp: pipelined " << NumLoops << " loops\n";
+    return Changed;
+  }
+};
+
+PreservedAnalyses SoftwarePipelinePass::run(Module &M,
+                                            ModuleAnalysisManager &MAM) {
+  if (CacheCGFile.empty()) {
+    errs() << "No file provided via -cache-cg-file\n";
+    return PreservedAnalyses::all();
+  }
+
+  const auto &Profile = MAM.getResult<CachegrindProfileAnalysis>(M);
+  if (!Profile.Loaded) {
+    errs() << "Failed to parse file: " << CacheCGFile << "\n";
+    return PreservedAnalyses::all();
+  }
+
+  SoftwarePipelineImpl Impl(M, Profile);
+  return Impl.run(MAM) ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
@@ -0,0 +1,38 @@
+#include "ParseCachegrindPass.h"
+#include "StrideProfile.h"
+
+#include <fstream>
+#include <sstream>
+
+/**
+ * Stride profiling: prefetch addresses the IR doesn't explain.
+ *
+ * computeFutureAddress() can only advance a GEP's non-constant index, so a
+ * load through `p++`, a cast or a pointer kept in memory (all of them at
+ * -O0) falls back to prefetching its own address. -cache-stride-instrument
+ * puts a cp_st_access(id, addr, "file:line") call before every load; the
+ * runtime (runtime/cp_stride.c) records the most frequent delta between
+ * consecutive addresses of each. Given that table, -cache-stride-profile
+ * prefetches such loads at addr + stride * distance when the stride is
+ * stable enough (-cache-stride-min-stable).
+ */
+
+bool parseStrideProfile(const std::string &Path,
+                        std::map<uint32_t, StrideSiteStats> &Sites) {
+  std::ifstream In(Path);
+  if (!In.is_open())
+    return false;
+
+  std::string Line;
+  while (std::getline(In, Line)) {
+    if (Line.empty() || Line[0] == '#')
+      continue;
+    std::istringstream SS(Line);
+    uint32_t ID;
+    StrideSiteStats S;
+    if (!(SS >> ID >> S.Loc >> S.Accesses >> S.Stride >> S.Hits))
+      continue;
+    Sites[ID] = S;
+  }
+  return true;
+}
@@ -0,0 +1,26 @@
+#ifndef STRIDE_PROFILE_H
+#define STRIDE_PROFILE_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+/// Dominant address delta of one load from the stride runtime
+/// (runtime/cp_stride.c), keyed by the load's prefetch site ID.
+struct StrideSiteStats {
+  std::string Loc;
+  uint64_t Accesses = 0;
+  int64_t Stride = 0; ///< bytes between consecutive addresses
+  uint64_t Hits = 0;  ///< deltas equal to Stride (a lower bound)
+
+  /// Fraction of deltas equal to Stride.
+  double stability() const {
+    return Accesses > 1 ? double(Hits) / (Accesses - 1) : 0.0;
+  }
+};
+
+/// Parse the table written by the stride runtime, keyed by site ID.
+bool parseStrideProfile(const std::string &Path,
+                        std::map<uint32_t, StrideSiteStats> &Sites);
+
+#endif // STRIDE_PROFILE_H
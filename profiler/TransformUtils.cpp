@@ -0,0 +1,80 @@
+#include "ParseCachegrindPass.h"
+
+#include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/PromoteMemToReg.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+#include <vector>
+
+using namespace llvm;
+
+/**
+ * Helpers shared by the loop transformations (cachegrind-swp,
+ * cachegrind-runahead, cachegrind-batch, cachegrind-coro).
+ *
+ * They all look for loops through SCEV or by following header phis, which
+ * -O0 IR hides in allocas, so a function has to be promoted to SSA before
+ * it can be searched. promoteAllocasIfUseful() searches a promoted copy
+ * instead, and only rewrites the function itself if that finds something,
+ * so functions the pass leaves alone come out unchanged.
+ */
+
+static std::vector<AllocaInst *> promotableAllocas(Function &F) {
+  std::vector<AllocaInst *> Allocas;
+  for (Instruction &I : F.getEntryBlock())
+    if (auto *AI = dyn_cast<AllocaInst>(&I))
+      if (isAllocaPromotable(AI))
+        Allocas.push_back(AI);
+  return Allocas;
+}
+
+bool promoteAllocas(Function &F, DominatorTree &DT, AssumptionCache &AC) {
+  std::vector<AllocaInst *> Allocas = promotableAllocas(F);
+  if (Allocas.empty())
+    return false;
+  PromoteMemToReg(Allocas, DT, &AC);
+  return true;
+}
+
+bool promoteAllocasIfUseful(Function &F, FunctionAnalysisManager &FAM,
+                            function_ref<bool(Function &)> Probe) {
+  if (promotableAllocas(F).empty())
+    return false;
+
+  ValueToValueMapTy VMap;
+  Function *Copy = CloneFunction(&F, VMap);
+  promoteAllocas(*Copy, FAM.getResult<DominatorTreeAnalysis>(*Copy),
+                 FAM.getResult<AssumptionAnalysis>(*Copy));
+  FAM.invalidate(*Copy, PreservedAnalyses::none());
+  bool Useful = Probe(*Copy);
+  FAM.clear(*Copy, Copy->getName());
+  Copy->eraseFromParent();
+  if (!Useful)
+    return false;
+
+  promoteAllocas(F, FAM.getResult<DominatorTreeAnalysis>(F),
+                 FAM.getResult<AssumptionAnalysis>(F));
+  PreservedAnalyses PA;
+  PA.preserveSet<CFGAnalyses>();
+  FAM.invalidate(F, PA);
+  return true;
+}
+
+bool isHarmlessCall(const Instruction &I) {
+  auto *II = dyn_cast<IntrinsicInst>(&I);
+  if (!II)
+    return false;
+  switch (II->getIntrinsicID()) {
+  case Intrinsic::prefetch:
+  case Intrinsic::lifetime_start:
+  case Intrinsic::lifetime_end:
+  case Intrinsic::assume:
+    return true;
+  default:
+    return isa<DbgInfoIntrinsic>(II);
+  }
+}
@@ -0,0 +1,215 @@
+; cachegrind-batch on a hash-join probe loop (-O0 style): probe() walks the
+; bucket chain of each s[j] through next[]; the hot head[] load (hj.c:42)
+; gets batched. 1001 probes, so the last batch is partial.
+;
+source_filename = "hj.c"
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-pc-linux-gnu"
+
+%struct.Tuple = type { i64, i64 }
+
+define internal i32 @hash_key(i64 %key, i32 %mask) !dbg !30 {
+entry:
+  %key.addr = alloca i64, align 8
+  %mask.addr = alloca i32, align 4
+  store i64 %key, i64* %key.addr, align 8, !dbg !31
+  store i32 %mask, i32* %mask.addr, align 4, !dbg !31
+  %0 = load i64, i64* %key.addr, align 8, !dbg !32
+  %sh = lshr i64 %0, 33, !dbg !32
+  %x = xor i64 %0, %sh, !dbg !32
+  %m = mul i64 %x, -49064778989728563, !dbg !33
+  %sh2 = lshr i64 %m, 33, !dbg !33
+  %x2 = xor i64 %m, %sh2, !dbg !33
+  store i64 %x2, i64* %key.addr, align 8, !dbg !33
+  %1 = load i64, i64* %key.addr, align 8, !dbg !34
+  %t = trunc i64 %1 to i32, !dbg !34
+  %2 = load i32, i32* %mask.addr, align 4, !dbg !34
+  %and = and i32 %t, %2, !dbg !34
+  ret i32 %and, !dbg !34
+}
+
+define i64 @probe(%struct.Tuple* %r, i32* %head, i32* %next, i64* %s, i64 %ns, i32 %mask, i64* %matches) !dbg !10 {
+entry:
+  %r.addr = alloca %struct.Tuple*, align 8
+  %head.addr = alloca i32*, align 8
+  %next.addr = alloca i32*, align 8
+  %s.addr = alloca i64*, align 8
+  %ns.addr = alloca i64, align 8
+  %mask.addr = alloca i32, align 4
+  %matches.addr = alloca i64*, align 8
+  %sum = alloca i64, align 8
+  %found = alloca i64, align 8
+  %j = alloca i64, align 8
+  %i = alloca i32, align 4
+  store %struct.Tuple* %r, %struct.Tuple** %r.addr, align 8
+  store i32* %head, i32** %head.addr, align 8
+  store i32* %next, i32** %next.addr, align 8
+  store i64* %s, i64** %s.addr, align 8
+  store i64 %ns, i64* %ns.addr, align 8
+  store i32 %mask, i32* %mask.addr, align 4
+  store i64* %matches, i64** %matches.addr, align 8
+  store i64 0, i64* %sum, align 8, !dbg !20
+  store i64 0, i64* %found, align 8, !dbg !20
+  store i64 0, i64* %j, align 8, !dbg !21
+  br label %for.cond, !dbg !21
+for.cond:
+  %0 = load i64, i64* %j, align 8, !dbg !21
+  %1 = load i64, i64* %ns.addr, align 8, !dbg !21
+  %cmp = icmp ult i64 %0, %1, !dbg !21
+  br i1 %cmp, label %for.body, label %for.end, !dbg !21
+for.body:
+  %2 = load i32*, i32** %head.addr, align 8, !dbg !22
+  %3 = load i64*, i64** %s.addr, align 8, !dbg !22
+  %4 = load i64, i64* %j, align 8, !dbg !22
+  %arrayidx = getelementptr inbounds i64, i64* %3, i64 %4, !dbg !22
+  %5 = load i64, i64* %arrayidx, align 8, !dbg !22
+  %6 = load i32, i32* %mask.addr, align 4, !dbg !22
+  %call = call i32 @hash_key(i64 %5, i32 %6), !dbg !22
+  %idxprom = zext i32 %call to i64, !dbg !22
+  %arrayidx2 = getelementptr inbounds i32, i32* %2, i64 %idxprom, !dbg !22
+  %7 = load i32, i32* %arrayidx2, align 4, !dbg !22
+  store i32 %7, i32* %i, align 4, !dbg !22
+  br label %for.cond3, !dbg !22
+for.cond3:
+  %8 = load i32, i32* %i, align 4, !dbg !22
+  %cmp4 = icmp ne i32 %8, -1, !dbg !22
+  br i1 %cmp4, label %for.body5, label %for.end6, !dbg !22
+for.body5:
+  %9 = load %struct.Tuple*, %struct.Tuple** %r.addr, align 8, !dbg !23
+  %10 = load i32, i32* %i, align 4, !dbg !23
+  %idx = zext i32 %10 to i64, !dbg !23
+  %keyp = getelementptr inbounds %struct.Tuple, %struct.Tuple* %9, i64 %idx, i32 0, !dbg !23
+  %11 = load i64, i64* %keyp, align 8, !dbg !23
+  %12 = load i64*, i64** %s.addr, align 8, !dbg !23
+  %13 = load i64, i64* %j, align 8, !dbg !23
+  %sj = getelementptr inbounds i64, i64* %12, i64 %13, !dbg !23
+  %14 = load i64, i64* %sj, align 8, !dbg !23
+  %eq = icmp eq i64 %11, %14, !dbg !23
+  br i1 %eq, label %if.then, label %for.inc, !dbg !23
+if.then:
+  %payp = getelementptr inbounds %struct.Tuple, %struct.Tuple* %9, i64 %idx, i32 1, !dbg !24
+  %15 = load i64, i64* %payp, align 8, !dbg !24
+  %16 = load i64, i64* %sum, align 8, !dbg !24
+  %add = add i64 %16, %15, !dbg !24
+  store i64 %add, i64* %sum, align 8, !dbg !24
+  %17 = load i64, i64* %found, align 8, !dbg !25
+  %inc = add i64 %17, 1, !dbg !25
+  store i64 %inc, i64* %found, align 8, !dbg !25
+  br label %for.inc, !dbg !25
+for.inc:
+  %18 = load i32*, i32** %next.addr, align 8, !dbg !22
+  %19 = load i32, i32* %i, align 4, !dbg !22
+  %nidx = zext i32 %19 to i64, !dbg !22
+  %np = getelementptr inbounds i32, i32* %18, i64 %nidx, !dbg !22
+  %20 = load i32, i32* %np, align 4, !dbg !22
+  store i32 %20, i32* %i, align 4, !dbg !22
+  br label %for.cond3, !dbg !22
+for.end6:
+  %21 = load i64, i64* %j, align 8, !dbg !21
+  %inc7 = add i64 %21, 1, !dbg !21
+  store i64 %inc7, i64* %j, align 8, !dbg !21
+  br label %for.cond, !dbg !21
+for.end:
+  %22 = load i64, i64* %found, align 8, !dbg !26
+  %23 = load i64*, i64** %matches.addr, align 8, !dbg !26
+  store i64 %22, i64* %23, align 8, !dbg !26
+  %24 = load i64, i64* %sum, align 8, !dbg !27
+  ret i64 %24, !dbg !27
+}
+
+
+@.fmt = private constant [9 x i8] c"%lu %lu\0A\00"
+
+declare i8* @malloc(i64)
+declare i32 @printf(i8*, ...)
+
+; 256 tuples in 256 buckets, 1001 probes: every odd one hits
+define i32 @main() {
+entry:
+  %m = alloca i64
+  %rm = call i8* @malloc(i64 4096)
+  %r = bitcast i8* %rm to %struct.Tuple*
+  %hm = call i8* @malloc(i64 1024)
+  %head = bitcast i8* %hm to i32*
+  %nm = call i8* @malloc(i64 1024)
+  %next = bitcast i8* %nm to i32*
+  %sm = call i8* @malloc(i64 8008)
+  %s = bitcast i8* %sm to i64*
+  br label %fill
+
+fill:
+  %i = phi i32 [ 0, %entry ], [ %i1, %fill ]
+  %i64 = zext i32 %i to i64
+  %km = mul i64 %i64, 2654435761
+  %key = xor i64 %km, 12345
+  %kp = getelementptr %struct.Tuple, %struct.Tuple* %r, i64 %i64, i32 0
+  store i64 %key, i64* %kp
+  %pp = getelementptr %struct.Tuple, %struct.Tuple* %r, i64 %i64, i32 1
+  store i64 %i64, i64* %pp
+  %hp = getelementptr i32, i32* %head, i64 %i64
+  store i32 -1, i32* %hp
+  %i1 = add i32 %i, 1
+  %fdone = icmp eq i32 %i1, 256
+  br i1 %fdone, label %link, label %fill
+
+link:
+  %l = phi i32 [ 0, %fill ], [ %l1, %link ]
+  %l64 = zext i32 %l to i64
+  %lkp = getelementptr %struct.Tuple, %struct.Tuple* %r, i64 %l64, i32 0
+  %lk = load i64, i64* %lkp
+  %b = call i32 @hash_key(i64 %lk, i32 255)
+  %b64 = zext i32 %b to i64
+  %bp = getelementptr i32, i32* %head, i64 %b64
+  %old = load i32, i32* %bp
+  %np = getelementptr i32, i32* %next, i64 %l64
+  store i32 %old, i32* %np
+  store i32 %l, i32* %bp
+  %l1 = add i32 %l, 1
+  %ldone = icmp eq i32 %l1, 256
+  br i1 %ldone, label %probes, label %link
+
+probes:
+  %j = phi i64 [ 0, %link ], [ %j1, %probes ]
+  %odd = and i64 %j, 1
+  %isodd = icmp ne i64 %odd, 0
+  %j7 = mul i64 %j, 7
+  %ri = urem i64 %j7, 256
+  %rkp = getelementptr %struct.Tuple, %struct.Tuple* %r, i64 %ri, i32 0
+  %rk = load i64, i64* %rkp
+  %miss = mul i64 %j, 1000003
+  %sv = select i1 %isodd, i64 %rk, i64 %miss
+  %sp = getelementptr i64, i64* %s, i64 %j
+  store i64 %sv, i64* %sp
+  %j1 = add i64 %j, 1
+  %pdone = icmp eq i64 %j1, 1001
+  br i1 %pdone, label %run, label %probes
+
+run:
+  %sum = call i64 @probe(%struct.Tuple* %r, i32* %head, i32* %next, i64* %s, i64 1001, i32 255, i64* %m)
+  %mv = load i64, i64* %m
+  %f = getelementptr [9 x i8], [9 x i8]* @.fmt, i64 0, i64 0
+  %pr = call i32 (i8*, ...) @printf(i8* %f, i64 %sum, i64 %mv)
+  ret i32 0
+}
+
+!llvm.dbg.cu = !{!2}
+!llvm.module.flags = !{!60, !61}
+!2 = distinct !DICompileUnit(language: DW_LANG_C99, file: !3, producer: "hand", isOptimized: false, runtimeVersion: 0, emissionKind: FullDebug)
+!3 = !DIFile(filename: "hj.c", directory: "/tmp/bp")
+!10 = distinct !DISubprogram(name: "probe", scope: !3, file: !3, line: 37, type: !11, spFlags: DISPFlagDefinition, unit: !2)
+!11 = !DISubroutineType(types: !{null})
+!20 = !DILocation(line: 40, scope: !10)
+!21 = !DILocation(line: 41, scope: !10)
+!22 = !DILocation(line: 42, scope: !10)
+!23 = !DILocation(line: 43, scope: !10)
+!24 = !DILocation(line: 44, scope: !10)
+!25 = !DILocation(line: 45, scope: !10)
+!26 = !DILocation(line: 49, scope: !10)
+!27 = !DILocation(line: 50, scope: !10)
+!30 = distinct !DISubprogram(name: "hash_key", scope: !3, file: !3, line: 20, type: !11, spFlags: DISPFlagDefinition, unit: !2)
+!31 = !DILocation(line: 20, scope: !30)
+!32 = !DILocation(line: 21, scope: !30)
+!33 = !DILocation(line: 22, scope: !30)
+!34 = !DILocation(line: 24, scope: !30)
+!60 = !{i32 2, !"Debug Info Version", i32 3}
+!61 = !{i32 7, !"Dwarf Version", i32 4}
@@ -0,0 +1,212 @@
+; cachegrind-coro on a -O0 tree lookup loop with a main of its own:
+; lookup_all() calls tree_find() once per query (tl.c:28); the calls are
+; interleaved as coroutines 8 at a time. 101 queries, so the last group is
+; partial; every odd one hits.
+;
+source_filename = "tl.c"
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-pc-linux-gnu"
+
+%struct.TNode = type { i64, i64, %struct.TNode*, %struct.TNode* }
+
+define %struct.TNode* @tree_find(%struct.TNode* %t, i64 %key) #0 !dbg !10 {
+entry:
+  %t.addr = alloca %struct.TNode*, align 8
+  %key.addr = alloca i64, align 8
+  store %struct.TNode* %t, %struct.TNode** %t.addr, align 8
+  store i64 %key, i64* %key.addr, align 8
+  br label %while.cond, !dbg !20
+while.cond:
+  %0 = load %struct.TNode*, %struct.TNode** %t.addr, align 8, !dbg !20
+  %tobool = icmp ne %struct.TNode* %0, null, !dbg !20
+  br i1 %tobool, label %land.rhs, label %while.end, !dbg !20
+land.rhs:
+  %1 = load %struct.TNode*, %struct.TNode** %t.addr, align 8, !dbg !20
+  %kp = getelementptr inbounds %struct.TNode, %struct.TNode* %1, i32 0, i32 0, !dbg !20
+  %2 = load i64, i64* %kp, align 8, !dbg !20
+  %3 = load i64, i64* %key.addr, align 8, !dbg !20
+  %cmp = icmp ne i64 %2, %3, !dbg !20
+  br i1 %cmp, label %while.body, label %while.end, !dbg !20
+while.body:
+  %4 = load i64, i64* %key.addr, align 8, !dbg !21
+  %5 = load %struct.TNode*, %struct.TNode** %t.addr, align 8, !dbg !21
+  %kp2 = getelementptr inbounds %struct.TNode, %struct.TNode* %5, i32 0, i32 0, !dbg !21
+  %6 = load i64, i64* %kp2, align 8, !dbg !21
+  %cmp3 = icmp ult i64 %4, %6, !dbg !21
+  br i1 %cmp3, label %cond.true, label %cond.false, !dbg !21
+cond.true:
+  %7 = load %struct.TNode*, %struct.TNode** %t.addr, align 8, !dbg !21
+  %lp = getelementptr inbounds %struct.TNode, %struct.TNode* %7, i32 0, i32 2, !dbg !21
+  %8 = load %struct.TNode*, %struct.TNode** %lp, align 8, !dbg !21
+  br label %cond.end, !dbg !21
+cond.false:
+  %9 = load %struct.TNode*, %struct.TNode** %t.addr, align 8, !dbg !21
+  %rp = getelementptr inbounds %struct.TNode, %struct.TNode* %9, i32 0, i32 3, !dbg !21
+  %10 = load %struct.TNode*, %struct.TNode** %rp, align 8, !dbg !21
+  br label %cond.end, !dbg !21
+cond.end:
+  %cond = phi %struct.TNode* [ %8, %cond.true ], [ %10, %cond.false ], !dbg !21
+  store %struct.TNode* %cond, %struct.TNode** %t.addr, align 8, !dbg !21
+  br label %while.cond, !dbg !20
+while.end:
+  %11 = load %struct.TNode*, %struct.TNode** %t.addr, align 8, !dbg !22
+  ret %struct.TNode* %11, !dbg !22
+}
+
+define i64 @lookup_all(%struct.TNode* %root, i64* %q, i64 %nq, i64* %found) #0 !dbg !30 {
+entry:
+  %root.addr = alloca %struct.TNode*, align 8
+  %q.addr = alloca i64*, align 8
+  %nq.addr = alloca i64, align 8
+  %found.addr = alloca i64*, align 8
+  %sum = alloca i64, align 8
+  %hits = alloca i64, align 8
+  %j = alloca i64, align 8
+  %t = alloca %struct.TNode*, align 8
+  store %struct.TNode* %root, %struct.TNode** %root.addr, align 8
+  store i64* %q, i64** %q.addr, align 8
+  store i64 %nq, i64* %nq.addr, align 8
+  store i64* %found, i64** %found.addr, align 8
+  store i64 0, i64* %sum, align 8, !dbg !31
+  store i64 0, i64* %hits, align 8, !dbg !31
+  store i64 0, i64* %j, align 8, !dbg !32
+  br label %for.cond, !dbg !32
+for.cond:
+  %0 = load i64, i64* %j, align 8, !dbg !32
+  %1 = load i64, i64* %nq.addr, align 8, !dbg !32
+  %cmp = icmp ult i64 %0, %1, !dbg !32
+  br i1 %cmp, label %for.body, label %for.end, !dbg !32
+for.body:
+  %2 = load %struct.TNode*, %struct.TNode** %root.addr, align 8, !dbg !33
+  %3 = load i64*, i64** %q.addr, align 8, !dbg !33
+  %4 = load i64, i64* %j, align 8, !dbg !33
+  %arrayidx = getelementptr inbounds i64, i64* %3, i64 %4, !dbg !33
+  %5 = load i64, i64* %arrayidx, align 8, !dbg !33
+  %call = call %struct.TNode* @tree_find(%struct.TNode* %2, i64 %5), !dbg !33
+  store %struct.TNode* %call, %struct.TNode** %t, align 8, !dbg !33
+  %6 = load %struct.TNode*, %struct.TNode** %t, align 8, !dbg !34
+  %tobool = icmp ne %struct.TNode* %6, null, !dbg !34
+  br i1 %tobool, label %if.then, label %for.inc, !dbg !34
+if.then:
+  %7 = load %struct.TNode*, %struct.TNode** %t, align 8, !dbg !35
+  %vp = getelementptr inbounds %struct.TNode, %struct.TNode* %7, i32 0, i32 1, !dbg !35
+  %8 = load i64, i64* %vp, align 8, !dbg !35
+  %9 = load i64, i64* %sum, align 8, !dbg !35
+  %add = add i64 %9, %8, !dbg !35
+  store i64 %add, i64* %sum, align 8, !dbg !35
+  %10 = load i64, i64* %hits, align 8, !dbg !35
+  %inc = add i64 %10, 1, !dbg !35
+  store i64 %inc, i64* %hits, align 8, !dbg !35
+  br label %for.inc, !dbg !35
+for.inc:
+  %11 = load i64, i64* %j, align 8, !dbg !32
+  %inc2 = add i64 %11, 1, !dbg !32
+  store i64 %inc2, i64* %j, align 8, !dbg !32
+  br label %for.cond, !dbg !32
+for.end:
+  %12 = load i64, i64* %hits, align 8, !dbg !36
+  %13 = load i64*, i64** %found.addr, align 8, !dbg !36
+  store i64 %12, i64* %13, align 8, !dbg !36
+  %14 = load i64, i64* %sum, align 8, !dbg !36
+  ret i64 %14, !dbg !36
+}
+
+
+@.fmt = private constant [9 x i8] c"%lu %lu\0A\00"
+
+declare i8* @calloc(i64, i64)
+declare i8* @malloc(i64)
+declare i32 @printf(i8*, ...)
+
+; A BST of the odd keys 1..509 inserted in a scrambled order, and 101
+; lookups of which every odd one hits
+define i32 @main() {
+entry:
+  %rootp = alloca %struct.TNode*
+  %found = alloca i64
+  store %struct.TNode* null, %struct.TNode** %rootp
+  %nm = call i8* @calloc(i64 255, i64 32)
+  %nodes = bitcast i8* %nm to %struct.TNode*
+  %qm = call i8* @malloc(i64 808)
+  %q = bitcast i8* %qm to i64*
+  br label %build
+
+build:
+  %i = phi i64 [ 0, %entry ], [ %i1, %place ]
+  %x = getelementptr %struct.TNode, %struct.TNode* %nodes, i64 %i
+  %pm = mul i64 %i, 37
+  %pr = urem i64 %pm, 255
+  %k2 = shl i64 %pr, 1
+  %key = or i64 %k2, 1
+  %xk = getelementptr %struct.TNode, %struct.TNode* %x, i32 0, i32 0
+  store i64 %key, i64* %xk
+  %xv = getelementptr %struct.TNode, %struct.TNode* %x, i32 0, i32 1
+  store i64 %i, i64* %xv
+  br label %walk
+
+walk:
+  %p = phi %struct.TNode** [ %rootp, %build ], [ %child, %descend ]
+  %cur = load %struct.TNode*, %struct.TNode** %p
+  %isnull = icmp eq %struct.TNode* %cur, null
+  br i1 %isnull, label %place, label %descend
+
+descend:
+  %ckp = getelementptr %struct.TNode, %struct.TNode* %cur, i32 0, i32 0
+  %ck = load i64, i64* %ckp
+  %lt = icmp ult i64 %key, %ck
+  %lp = getelementptr %struct.TNode, %struct.TNode* %cur, i32 0, i32 2
+  %rp = getelementptr %struct.TNode, %struct.TNode* %cur, i32 0, i32 3
+  %child = select i1 %lt, %struct.TNode** %lp, %struct.TNode** %rp
+  br label %walk
+
+place:
+  store %struct.TNode* %x, %struct.TNode** %p
+  %i1 = add i64 %i, 1
+  %bdone = icmp eq i64 %i1, 255
+  br i1 %bdone, label %queries, label %build
+
+queries:
+  %j = phi i64 [ 0, %place ], [ %j1, %queries ]
+  %odd = and i64 %j, 1
+  %isodd = icmp ne i64 %odd, 0
+  %jm = mul i64 %j, 11
+  %jr = urem i64 %jm, 255
+  %hk2 = shl i64 %jr, 1
+  %hit = or i64 %hk2, 1
+  %miss = shl i64 %j, 1
+  %qv = select i1 %isodd, i64 %hit, i64 %miss
+  %qp = getelementptr i64, i64* %q, i64 %j
+  store i64 %qv, i64* %qp
+  %j1 = add i64 %j, 1
+  %qdone = icmp eq i64 %j1, 101
+  br i1 %qdone, label %run, label %queries
+
+run:
+  %root = load %struct.TNode*, %struct.TNode** %rootp
+  %sum = call i64 @lookup_all(%struct.TNode* %root, i64* %q, i64 101, i64* %found)
+  %fv = load i64, i64* %found
+  %f = getelementptr [9 x i8], [9 x i8]* @.fmt, i64 0, i64 0
+  %pr2 = call i32 (i8*, ...) @printf(i8* %f, i64 %sum, i64 %fv)
+  ret i32 0
+}
+
+attributes #0 = { noinline nounwind optnone uwtable }
+
+!llvm.dbg.cu = !{!2}
+!llvm.module.flags = !{!60, !61}
+!2 = distinct !DICompileUnit(language: DW_LANG_C99, file: !3, producer: "hand", isOptimized: false, runtimeVersion: 0, emissionKind: FullDebug)
+!3 = !DIFile(filename: "tl.c", directory: "/tmp/co")
+!11 = !DISubroutineType(types: !{null})
+!10 = distinct !DISubprogram(name: "tree_find", scope: !3, file: !3, line: 19, type: !11, spFlags: DISPFlagDefinition, unit: !2)
+!20 = !DILocation(line: 20, scope: !10)
+!21 = !DILocation(line: 21, scope: !10)
+!22 = !DILocation(line: 22, scope: !10)
+!30 = distinct !DISubprogram(name: "lookup_all", scope: !3, file: !3, line: 25, type: !11, spFlags: DISPFlagDefinition, unit: !2)
+!31 = !DILocation(line: 26, scope: !30)
+!32 = !DILocation(line: 27, scope: !30)
+!33 = !DILocation(line: 28, scope: !30)
+!34 = !DILocation(line: 29, scope: !30)
+!35 = !DILocation(line: 30, scope: !30)
+!36 = !DILocation(line: 33, scope: !30)
+!60 = !{i32 2, !"Debug Info Version", i32 3}
+!61 = !{i32 7, !"Dwarf Version", i32 4}
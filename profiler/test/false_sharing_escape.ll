@@ -0,0 +1,62 @@
+; false-sharing-pad regression: both arrays have false sharing on their
+; elements, but &c[0] escapes into bump(), which indexes it with the old
+; 8-byte stride. Only d may be padded.
+;
+;   static long c[8], d[8];
+;   static void bump(long *p, long t) { p[t]++; }      // line 6
+;   void worker(long t) {
+;     bump(&c[0], t);                                   // line 10
+;     d[t]++;                                           // line 11
+;     c[t]++;                                           // line 12
+;   }
+;
+; false_sharing_escape.sharing.txt flags the accesses on lines 11 and 12.
+
+@c = internal global [8 x i64] zeroinitializer, align 16
+@d = internal global [8 x i64] zeroinitializer, align 16
+
+define internal void @bump(i64* %p, i64 %t) !dbg !6 {
+entry:
+  %e = getelementptr inbounds i64, i64* %p, i64 %t
+  %v = load i64, i64* %e, align 8, !dbg !9
+  %n = add i64 %v, 1
+  store i64 %n, i64* %e, align 8, !dbg !9
+  ret void
+}
+
+define void @worker(i64 %t) !dbg !10 {
+entry:
+  call void @bump(i64* getelementptr inbounds ([8 x i64], [8 x i64]* @c, i64 0, i64 0), i64 %t), !dbg !11
+  %e = getelementptr inbounds [8 x i64], [8 x i64]* @d, i64 0, i64 %t
+  %v = load i64, i64* %e, align 8, !dbg !12
+  %n = add i64 %v, 1
+  store i64 %n, i64* %e, align 8, !dbg !12
+  %f = getelementptr inbounds [8 x i64], [8 x i64]* @c, i64 0, i64 %t
+  %w = load i64, i64* %f, align 8, !dbg !13
+  %m = add i64 %w, 1
+  store i64 %m, i64* %f, align 8, !dbg !13
+  ret void
+}
+
+define i64 @total() {
+entry:
+  %a = load i64, i64* getelementptr inbounds ([8 x i64], [8 x i64]* @c, i64 0, i64 7), align 8
+  %b = load i64, i64* getelementptr inbounds ([8 x i64], [8 x i64]* @d, i64 0, i64 7), align 8
+  %s = add i64 %a, %b
+  ret i64 %s
+}
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3, !4}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "clang", isOptimized: false, runtimeVersion: 0, emissionKind: FullDebug)
+!1 = !DIFile(filename: "escape.c", directory: "/tmp")
+!2 = !DISubroutineType(types: !{})
+!3 = !{i32 2, !"Debug Info Version", i32 3}
+!4 = !{i32 7, !"Dwarf Version", i32 4}
+!6 = distinct !DISubprogram(name: "bump", scope: !1, file: !1, line: 5, type: !2, spFlags: DISPFlagDefinition, unit: !0)
+!9 = !DILocation(line: 6, scope: !6)
+!10 = distinct !DISubprogram(name: "worker", scope: !1, file: !1, line: 9, type: !2, spFlags: DISPFlagDefinition, unit: !0)
+!11 = !DILocation(line: 10, scope: !10)
+!12 = !DILocation(line: 11, scope: !10)
+!13 = !DILocation(line: 12, scope: !10)
@@ -0,0 +1,63 @@
+#!/usr/bin/env bash
+# Runs one of the plugin's passes on a test IR file and checks the result
+# Usage:
+#   ir_test.sh [-e regex] [-i regex] [-l library] [-n] \
+#              <opt> <lli> <plugin> <input.ll> <opt args>...
+#
+# The transformed IR must pass the verifier, and unless -n is given it must
+# print the same as <input.ll> under lli (-l: a shared library lli loads,
+# such as cp_runtime_shared). -e is a regex opt's stderr must match (may be
+# given more than once), -i one the transformed IR must match (grep -E).
+
+set -e
+
+ERR_RES=() IR_RE="" LIBS=() RUN=true
+while getopts ":e:i:l:n" opt; do
+  case $opt in
+    e) ERR_RES+=("$OPTARG") ;;
+    i) IR_RE="$OPTARG" ;;
+    l) LIBS=(-load="$OPTARG") ;;
+    n) RUN=false ;;
+    *) echo "ir_test: bad option -$OPTARG" >&2; exit 2 ;;
+  esac
+done
+shift $((OPTIND - 1))
+[ $# -ge 4 ] || { echo "ir_test: missing arguments" >&2; exit 2; }
+OPT="$1" LLI="$2" PLUGIN="$3" INPUT="$4"
+shift 4
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+status=0
+"$OPT" -load "$PLUGIN" -load-pass-plugin "$PLUGIN" "$@" "$INPUT" -S \
+  -o "$TMP/out.ll" 2> "$TMP/opt.err" || status=$?
+cat "$TMP/opt.err" >&2
+if [ $status -ne 0 ]; then
+  echo "ir_test: opt failed with status $status" >&2
+  exit 1
+fi
+
+for re in "${ERR_RES[@]}"; do
+  if ! grep -Eq "$re" "$TMP/opt.err"; then
+    echo "ir_test: opt's output doesn't match: $re" >&2
+    exit 1
+  fi
+done
+if [ -n "$IR_RE" ] && ! grep -Eq "$IR_RE" "$TMP/out.ll"; then
+  echo "ir_test: transformed IR doesn't match: $IR_RE" >&2
+  exit 1
+fi
+
+"$OPT" -passes=verify -disable-output "$TMP/out.ll"
+
+if $RUN; then
+  "$LLI" "${LIBS[@]}" "$INPUT" > "$TMP/orig.out"
+  "$LLI" "${LIBS[@]}" "$TMP/out.ll" > "$TMP/opt.out"
+  if ! cmp -s "$TMP/orig.out" "$TMP/opt.out"; then
+    echo "ir_test: transformed program prints something else:" >&2
+    diff "$TMP/orig.out" "$TMP/opt.out" >&2 || true
+    exit 1
+  fi
+fi
+echo "ir_test: $(basename "$INPUT") ok"
@@ -0,0 +1,91 @@
+; parse-cachegrind-function on clang -O0 output, where every function is
+; optnone: the hot a[i] load (sum.c:4) must still get a prefetch.
+;
+; double sum(double *a, int n) { double s = 0; for (int i = 0; i < n; i++) s += a[i]; return s; }
+
+@.fmt = private constant [4 x i8] c"%f\0A\00"
+
+define dso_local double @sum(double* %a, i32 %n) #0 !dbg !7 {
+entry:
+  %a.addr = alloca double*, align 8
+  %n.addr = alloca i32, align 4
+  %s = alloca double, align 8
+  %i = alloca i32, align 4
+  store double* %a, double** %a.addr, align 8
+  store i32 %n, i32* %n.addr, align 4
+  store double 0.000000e+00, double* %s, align 8, !dbg !10
+  store i32 0, i32* %i, align 4, !dbg !11
+  br label %for.cond, !dbg !11
+
+for.cond:
+  %0 = load i32, i32* %i, align 4, !dbg !11
+  %1 = load i32, i32* %n.addr, align 4, !dbg !11
+  %cmp = icmp slt i32 %0, %1, !dbg !11
+  br i1 %cmp, label %for.body, label %for.end, !dbg !11
+
+for.body:
+  %2 = load double*, double** %a.addr, align 8, !dbg !12
+  %3 = load i32, i32* %i, align 4, !dbg !12
+  %idxprom = sext i32 %3 to i64, !dbg !12
+  %arrayidx = getelementptr inbounds double, double* %2, i64 %idxprom, !dbg !12
+  %4 = load double, double* %arrayidx, align 8, !dbg !12
+  %5 = load double, double* %s, align 8, !dbg !12
+  %add = fadd double %5, %4, !dbg !12
+  store double %add, double* %s, align 8, !dbg !12
+  br label %for.inc, !dbg !12
+
+for.inc:
+  %6 = load i32, i32* %i, align 4, !dbg !11
+  %inc = add nsw i32 %6, 1, !dbg !11
+  store i32 %inc, i32* %i, align 4, !dbg !11
+  br label %for.cond, !dbg !11
+
+for.end:
+  %7 = load double, double* %s, align 8, !dbg !13
+  ret double %7, !dbg !13
+}
+
+declare dso_local i8* @malloc(i64)
+declare dso_local i32 @printf(i8*, ...)
+
+define dso_local i32 @main() #0 !dbg !14 {
+entry:
+  %mem = call i8* @malloc(i64 8000), !dbg !15
+  %a = bitcast i8* %mem to double*, !dbg !15
+  br label %fill
+
+fill:
+  %k = phi i64 [ 0, %entry ], [ %k1, %fill ]
+  %kd = sitofp i64 %k to double
+  %p = getelementptr inbounds double, double* %a, i64 %k
+  store double %kd, double* %p, align 8
+  %k1 = add nuw nsw i64 %k, 1
+  %more = icmp ult i64 %k1, 1000
+  br i1 %more, label %fill, label %run
+
+run:
+  %r = call double @sum(double* %a, i32 1000), !dbg !16
+  %f = getelementptr inbounds [4 x i8], [4 x i8]* @.fmt, i64 0, i64 0
+  %x = call i32 (i8*, ...) @printf(i8* %f, double %r), !dbg !16
+  ret i32 0, !dbg !16
+}
+
+attributes #0 = { noinline nounwind optnone uwtable }
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3, !4}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "clang", isOptimized: false, runtimeVersion: 0, emissionKind: FullDebug)
+!1 = !DIFile(filename: "sum.c", directory: "/tmp")
+!3 = !{i32 7, !"Dwarf Version", i32 5}
+!4 = !{i32 2, !"Debug Info Version", i32 3}
+!5 = !DISubroutineType(types: !6)
+!6 = !{null}
+!7 = distinct !DISubprogram(name: "sum", scope: !1, file: !1, line: 1, type: !5, scopeLine: 1, spFlags: DISPFlagDefinition, unit: !0)
+!10 = !DILocation(line: 2, column: 10, scope: !7)
+!11 = !DILocation(line: 3, column: 3, scope: !7)
+!12 = !DILocation(line: 4, column: 7, scope: !7)
+!13 = !DILocation(line: 5, column: 3, scope: !7)
+!14 = distinct !DISubprogram(name: "main", scope: !1, file: !1, line: 8, type: !5, scopeLine: 8, spFlags: DISPFlagDefinition, unit: !0)
+!15 = !DILocation(line: 9, column: 3, scope: !14)
+!16 = !DILocation(line: 12, column: 3, scope: !14)
@@ -0,0 +1,103 @@
+; -cache-prefetch-bounds=peel on SSA loops: sum() reads a[i] for i < n and
+; glob() the global A[64]; main calls them with short and full trip counts.
+;
+source_filename = "b.c"
+
+@fmt = constant [7 x i8] c"%d %f\0A\00"
+@A = global [64 x double] zeroinitializer
+
+define double @sum(double* %a, i32 %n) !dbg !4 {
+entry:
+  br label %for.cond
+
+for.cond:                                         ; preds = %for.body, %entry
+  %i = phi i32 [ 0, %entry ], [ %inc, %for.body ], !dbg !7
+  %s = phi double [ 0.000000e+00, %entry ], [ %add, %for.body ]
+  %cmp = icmp slt i32 %i, %n, !dbg !7
+  br i1 %cmp, label %for.body, label %for.end, !dbg !7
+
+for.body:                                         ; preds = %for.cond
+  %idxprom = sext i32 %i to i64, !dbg !8
+  %arrayidx = getelementptr inbounds double, double* %a, i64 %idxprom, !dbg !8
+  %v = load double, double* %arrayidx, align 8, !dbg !8
+  %add = fadd double %s, %v, !dbg !8
+  %inc = add nsw i32 %i, 1, !dbg !7
+  br label %for.cond, !dbg !7
+
+for.end:                                          ; preds = %for.cond
+  %s.lcssa = phi double [ %s, %for.cond ]
+  ret double %s.lcssa, !dbg !9
+}
+
+define double @glob(i32 %n) !dbg !10 {
+entry:
+  br label %for.cond
+
+for.cond:                                         ; preds = %for.body, %entry
+  %i = phi i32 [ 0, %entry ], [ %inc, %for.body ], !dbg !11
+  %s = phi double [ 0.000000e+00, %entry ], [ %add, %for.body ]
+  %cmp = icmp slt i32 %i, %n, !dbg !11
+  br i1 %cmp, label %for.body, label %for.end, !dbg !11
+
+for.body:                                         ; preds = %for.cond
+  %idxprom = sext i32 %i to i64, !dbg !12
+  %arrayidx = getelementptr inbounds [64 x double], [64 x double]* @A, i64 0, i64 %idxprom, !dbg !12
+  %v = load double, double* %arrayidx, align 8, !dbg !12
+  %add = fadd double %s, %v, !dbg !12
+  %inc = add nsw i32 %i, 1, !dbg !11
+  br label %for.cond, !dbg !11
+
+for.end:                                          ; preds = %for.cond
+  ret double %s, !dbg !13
+}
+
+declare i32 @printf(i8*, ...)
+
+define i32 @main() {
+entry:
+  br label %init
+
+init:                                             ; preds = %init, %entry
+  %k = phi i32 [ 0, %entry ], [ %k1, %init ]
+  %kd = sitofp i32 %k to double
+  %p = getelementptr [64 x double], [64 x double]* @A, i32 0, i32 %k
+  store double %kd, double* %p, align 8
+  %k1 = add i32 %k, 1
+  %c = icmp slt i32 %k1, 64
+  br i1 %c, label %init, label %run
+
+run:                                              ; preds = %init
+  %base = getelementptr [64 x double], [64 x double]* @A, i32 0, i32 0
+  %f = getelementptr [7 x i8], [7 x i8]* @fmt, i32 0, i32 0
+  %r0 = call double @sum(double* %base, i32 0)
+  %0 = call i32 (i8*, ...) @printf(i8* %f, i32 0, double %r0)
+  %r3 = call double @sum(double* %base, i32 3)
+  %1 = call i32 (i8*, ...) @printf(i8* %f, i32 3, double %r3)
+  %r64 = call double @sum(double* %base, i32 64)
+  %2 = call i32 (i8*, ...) @printf(i8* %f, i32 64, double %r64)
+  %g64 = call double @glob(i32 64)
+  %3 = call i32 (i8*, ...) @printf(i8* %f, i32 64, double %g64)
+  %g2 = call double @glob(i32 2)
+  %4 = call i32 (i8*, ...) @printf(i8* %f, i32 2, double %g2)
+  ret i32 0
+}
+
+
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!2, !3}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "x", isOptimized: false, runtimeVersion: 0, emissionKind: FullDebug)
+!1 = !DIFile(filename: "b.c", directory: "/tmp")
+!2 = !{i32 7, !"Dwarf Version", i32 4}
+!3 = !{i32 2, !"Debug Info Version", i32 3}
+!4 = distinct !DISubprogram(name: "sum", scope: !1, file: !1, line: 1, type: !5, scopeLine: 1, spFlags: DISPFlagDefinition, unit: !0)
+!5 = !DISubroutineType(types: !6)
+!6 = !{}
+!7 = !DILocation(line: 3, scope: !4)
+!8 = !DILocation(line: 4, scope: !4)
+!9 = !DILocation(line: 5, scope: !4)
+!10 = distinct !DISubprogram(name: "glob", scope: !1, file: !1, line: 10, type: !5, scopeLine: 10, spFlags: DISPFlagDefinition, unit: !0)
+!11 = !DILocation(line: 12, scope: !10)
+!12 = !DILocation(line: 13, scope: !10)
+!13 = !DILocation(line: 14, scope: !10)
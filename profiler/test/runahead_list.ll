@@ -0,0 +1,85 @@
+; cachegrind-runahead on a linked-list walk with a main of its own: walk()
+; sums the list (l.c:6) while loading p->next (l.c:7), so its next-pointer
+; slice runs ahead on the helper thread. Run with CP_RA_FORCE so the helper
+; starts even on one CPU.
+;
+source_filename = "l.c"
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-pc-linux-gnu"
+
+%struct.node = type { %struct.node*, i64, [48 x i8] }
+
+define i64 @walk(%struct.node* %head) !dbg !10 {
+entry:
+  br label %ph
+ph:
+  br label %hdr
+hdr:
+  %p = phi %struct.node* [ %head, %ph ], [ %n, %body ]
+  %s = phi i64 [ 0, %ph ], [ %s1, %body ]
+  %c = icmp eq %struct.node* %p, null, !dbg !13
+  br i1 %c, label %exit, label %body, !dbg !13
+body:
+  %vp = getelementptr inbounds %struct.node, %struct.node* %p, i32 0, i32 1, !dbg !14
+  %v = load i64, i64* %vp, align 8, !dbg !14
+  %s1 = add i64 %s, %v, !dbg !14
+  %np = getelementptr inbounds %struct.node, %struct.node* %p, i32 0, i32 0, !dbg !15
+  %n = load %struct.node*, %struct.node** %np, align 8, !dbg !15
+  br label %hdr, !dbg !15
+exit:
+  ret i64 %s, !dbg !16
+}
+
+declare i8* @malloc(i64)
+declare void @free(i8*)
+declare i32 @printf(i8*, ...)
+
+@fmt = private constant [5 x i8] c"%lu\0A\00"
+
+; Builds a 1000-node list (values i*i), walks it and frees it.
+define i32 @main() {
+entry:
+  br label %build
+build:
+  %i = phi i64 [ 0, %entry ], [ %i1, %build ]
+  %h = phi %struct.node* [ null, %entry ], [ %nn, %build ]
+  %m = call i8* @malloc(i64 64)
+  %nn = bitcast i8* %m to %struct.node*
+  %nx = getelementptr inbounds %struct.node, %struct.node* %nn, i32 0, i32 0
+  store %struct.node* %h, %struct.node** %nx, align 8
+  %vl = getelementptr inbounds %struct.node, %struct.node* %nn, i32 0, i32 1
+  %sq = mul i64 %i, %i
+  store i64 %sq, i64* %vl, align 8
+  %i1 = add i64 %i, 1
+  %done = icmp eq i64 %i1, 1000
+  br i1 %done, label %walked, label %build
+walked:
+  %sum = call i64 @walk(%struct.node* %nn)
+  %f = getelementptr inbounds [5 x i8], [5 x i8]* @fmt, i64 0, i64 0
+  call i32 (i8*, ...) @printf(i8* %f, i64 %sum)
+  br label %free
+free:
+  %p = phi %struct.node* [ %nn, %walked ], [ %next, %free ]
+  %np = getelementptr inbounds %struct.node, %struct.node* %p, i32 0, i32 0
+  %next = load %struct.node*, %struct.node** %np, align 8
+  %pb = bitcast %struct.node* %p to i8*
+  call void @free(i8* %pb)
+  %end = icmp eq %struct.node* %next, null
+  br i1 %end, label %out, label %free
+out:
+  ret i32 0
+}
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3, !4}
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "clang", isOptimized: false, runtimeVersion: 0, emissionKind: FullDebug)
+!1 = !DIFile(filename: "l.c", directory: "/tmp")
+!3 = !{i32 7, !"Dwarf Version", i32 5}
+!4 = !{i32 2, !"Debug Info Version", i32 3}
+!5 = !DISubroutineType(types: !6)
+!6 = !{null}
+!10 = distinct !DISubprogram(name: "walk", scope: !1, file: !1, line: 3, type: !5, scopeLine: 3, spFlags: DISPFlagDefinition, unit: !0)
+!13 = !DILocation(line: 5, column: 3, scope: !10)
+!14 = !DILocation(line: 6, column: 3, scope: !10)
+!15 = !DILocation(line: 7, column: 3, scope: !10)
+!16 = !DILocation(line: 9, column: 3, scope: !10)
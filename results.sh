@@ -0,0 +1,224 @@
+#!/usr/bin/env bash
+# Results database: one row per benchmark run, appended by run.sh
+# Usage:
+#   ./results.sh record <db> <column>=<value>...
+#   ./results.sh list [db]
+#   ./results.sh compare [-d db] <version_a> <version_b>
+#   ./results.sh sqlite <out.sqlite> [db]
+
+set -e
+
+DB="./results.tsv"
+
+# Column order of the database (a tab-separated file with a header row)
+COLUMNS=(
+  date commit version benchmark input config verified
+  runs base_mean base_sd base_samples opt_mean opt_sd opt_samples
+  base_Ir base_I1mr base_ILmr base_Dr base_D1mr base_DLmr base_Dw base_D1mw base_DLmw
+  opt_Ir opt_I1mr opt_ILmr opt_Dr opt_D1mr opt_DLmr opt_Dw opt_D1mw opt_DLmw
+  sites_planned sites_inserted
+)
+
+show_help() {
+  cat << EOF
+Usage:
+  $0 record <db> <column>=<value>...
+  $0 list [db]
+  $0 compare [-d db] <version_a> <version_b>
+  $0 sqlite <out.sqlite> [db]
+
+record appends one row to <db> (created with a header row if missing).
+Columns not given are recorded as "-". The columns are:
+$(printf '%s ' "${COLUMNS[@]}" | fold -s -w 70 | sed 's/^/  /')
+
+*_samples hold the individual wall-clock times (comma-separated),
+base_*/opt_* the PROGRAM TOTALS of the baseline/optimized Cachegrind runs.
+
+list shows the pass versions in <db> (default ${DB}) with their row counts.
+
+compare shows, per benchmark/input/config recorded under both versions
+(rows that failed output verification are ignored), the optimized
+runtime of each version over all their timing samples and its change.
+sig is a Welch t-test on those samples at the 5% level: "faster" or
+"slower" if the change is significant, "~" if not, "n/a" with fewer
+than two samples on a side. The baseline change shows how much the
+machine itself drifted between the runs. D1mr/DLmr are the optimized
+binary's Cachegrind totals (deterministic, so any change is real), and
+sites the inserted prefetches.
+
+sqlite loads <db> into table "results" of <out.sqlite> (replacing it),
+with "-" as NULL, for ad-hoc queries with the sqlite3 shell.
+EOF
+}
+
+record() {
+  local db="$1"
+  shift
+  declare -A values=()
+  local kv
+  for kv in "$@"; do
+    values[${kv%%=*}]="${kv#*=}"
+  done
+
+  if [ ! -s "$db" ]; then
+    (IFS=$'\t'; echo "${COLUMNS[*]}") > "$db"
+  fi
+  local row=() col value
+  for col in "${COLUMNS[@]}"; do
+    value="${values[$col]:--}"
+    row+=("${value//$'\t'/ }")
+  done
+  (IFS=$'\t'; echo "${row[*]}") >> "$db"
+}
+
+list() {
+  local db="${1:-$DB}"
+  awk -F'\t' '
+    NR == 1 { for (i = 1; i <= NF; ++i) col[$i] = i; next }
+    {
+      v = $col["version"]
+      if (!(v in rows)) order[++n] = v
+      ++rows[v]
+      last[v] = $col["date"]
+    }
+    END {
+      printf "%-12s %6s  %s\n", "version", "rows", "last run"
+      for (i = 1; i <= n; ++i)
+        printf "%-12s %6d  %s\n", order[i], rows[order[i]], last[order[i]]
+    }' "$db"
+}
+
+compare() {
+  local db="$DB" opt
+  OPTIND=1
+  while getopts ":d:" opt; do
+    case $opt in
+      d) db="$OPTARG" ;;
+      *) show_help; exit 2 ;;
+    esac
+  done
+  shift $((OPTIND - 1))
+  [ $# -eq 2 ] || { show_help; exit 2; }
+
+  awk -F'\t' -v va="$1" -v vb="$2" '
+    function mean(s, n,   i, x, t) {
+      n = split(s, x, ",")
+      for (i = 1; i <= n; ++i) t += x[i]
+      return n ? t / n : 0
+    }
+    function var(s, m,   i, n, x, t) {
+      n = split(s, x, ",")
+      for (i = 1; i <= n; ++i) t += (x[i] - m) ^ 2
+      return n > 1 ? t / (n - 1) : 0
+    }
+    function count(s,   x) { return s == "" ? 0 : split(s, x, ",") }
+    function pct(a, b) {
+      if (a == "-" || b == "-" || a + 0 == 0) return "-"
+      return sprintf("%+.1f%%", 100.0 * (b - a) / a)
+    }
+    # Two-sided 95% critical value of Student t with df degrees of freedom
+    function tcrit(df) {
+      if (df < 1) df = 1
+      if (df <= 30) return T[int(df)]
+      return df <= 60 ? 2.000 : (df <= 120 ? 1.980 : 1.960)
+    }
+    function append(s, t) {
+      if (t == "-" || t == "") return s
+      return s == "" ? t : s "," t
+    }
+    BEGIN {
+      split("12.706 4.303 3.182 2.776 2.571 2.447 2.365 2.306 2.262 2.228 " \
+            "2.201 2.179 2.160 2.145 2.131 2.120 2.110 2.101 2.093 2.086 " \
+            "2.080 2.074 2.069 2.064 2.060 2.056 2.052 2.048 2.045 2.042", T, " ")
+    }
+    NR == 1 { for (i = 1; i <= NF; ++i) col[$i] = i; next }
+    $col["verified"] == "no" { next }
+    $col["version"] == va || $col["version"] == vb {
+      v = $col["version"] == va ? "a" : "b"
+      key = $col["benchmark"] "\t" $col["input"] "\t" $col["config"]
+      if (!(key in seen)) { seen[key] = 1; order[++n] = key }
+      opt[key, v] = append(opt[key, v], $col["opt_samples"])
+      base[key, v] = append(base[key, v], $col["base_samples"])
+      # Counters and sites are deterministic: keep the latest row
+      d1[key, v] = $col["opt_D1mr"]
+      dl[key, v] = $col["opt_DLmr"]
+      sites[key, v] = $col["sites_inserted"]
+    }
+    END {
+      printf "%-24s %-12s %-28s %10s %10s %8s %-6s %8s %8s %8s %s\n",
+             "benchmark", "input", "config", va " (s)", vb " (s)",
+             "change", "sig", "base", "D1mr", "DLmr", "sites"
+      for (i = 1; i <= n; ++i) {
+        key = order[i]
+        if (!((key, "a") in opt) || !((key, "b") in opt)) continue
+        split(key, k, "\t")
+        na = count(opt[key, "a"]); nb = count(opt[key, "b"])
+        ma = mean(opt[key, "a"]); mb = mean(opt[key, "b"])
+        sig = "n/a"
+        if (na > 1 && nb > 1) {
+          sa = var(opt[key, "a"], ma) / na
+          sb = var(opt[key, "b"], mb) / nb
+          if (sa + sb == 0) {
+            sig = ma == mb ? "~" : (mb < ma ? "faster" : "slower")
+          } else {
+            t = (mb - ma) / sqrt(sa + sb)
+            df = (sa + sb) ^ 2 / (sa ^ 2 / (na - 1) + sb ^ 2 / (nb - 1))
+            sig = (t < 0 ? -t : t) > tcrit(df) ? (t < 0 ? "faster" : "slower") : "~"
+          }
+        }
+        printf "%-24s %-12s %-28s %10.4f %10.4f %8s %-6s %8s %8s %8s %s\n",
+               k[1], k[2], k[3], ma, mb, pct(ma, mb), sig,
+               pct(mean(base[key, "a"]), mean(base[key, "b"])),
+               pct(d1[key, "a"], d1[key, "b"]), pct(dl[key, "a"], dl[key, "b"]),
+               sites[key, "a"] "->" sites[key, "b"]
+      }
+    }' "$db"
+}
+
+to_sqlite() {
+  local out="$1" db="${2:-$DB}" col
+  command -v sqlite3 > /dev/null || { echo "results.sh: sqlite3 not found" >&2; exit 1; }
+  local cols=() nulls=()
+  for col in "${COLUMNS[@]}"; do
+    case $col in
+      date|commit|version|benchmark|input|config|verified|*_samples)
+        cols+=("\"$col\" TEXT") ;;
+      *_mean|*_sd) cols+=("\"$col\" REAL") ;;
+      *) cols+=("\"$col\" INTEGER") ;;
+    esac
+    nulls+=("\"$col\" = NULLIF(\"$col\", '-')")
+  done
+  sqlite3 "$out" << EOF
+DROP TABLE IF EXISTS results;
+CREATE TABLE results ($(IFS=,; echo "${cols[*]}"));
+.mode tabs
+.import --skip 1 "$db" results
+UPDATE results SET $(IFS=,; echo "${nulls[*]}");
+EOF
+}
+
+cmd="$1"
+shift || true
+case "$cmd" in
+  record)
+    [ $# -ge 1 ] || { show_help; exit 2; }
+    record "$@"
+    ;;
+  list)
+    list "$@"
+    ;;
+  compare)
+    compare "$@"
+    ;;
+  sqlite)
+    [ $# -ge 1 ] || { show_help; exit 2; }
+    to_sqlite "$@"
+    ;;
+  -h|--help)
+    show_help
+    ;;
+  *)
+    show_help
+    exit 2
+    ;;
+esac
@@ -11,8 +11,25 @@ set -e
 ###############################################
 
 PASS="./build/profiler/ParseCachegrindPass.so"
+RUNTIME="./build/runtime/libcp_runtime.a"
+VERIFY="./verify.sh"
+RESULTS_DB="./results.tsv"   # every run is appended here (see results.sh)
 CLEAN=true     # set to false if you want to keep IR/output files
 NUM_RUNS=5     # runs per benchmark for timing
+POOL_ALLOC=false
+ICACHE=false
+BLOCK_WEIGHTS=false
+SWP=false
+RUNAHEAD=false
+BATCH=false
+COROS=false
+ACCOUNTING=false
+REUSE=false
+STRIDES=false
+THREADS=false  # OpenMP/pthreads program: build with -fopenmp, profile sharing
+PAD=false      # pad globals with false sharing (needs -m)
+TOLERANCE=""   # relative tolerance for numbers in the verified output
+CACHE_TARGET="" # -cache-target preset or JSON file (default: the profile's)
 
 show_help() {
   cat << EOF
@@ -25,11 +42,19 @@ Runs entire workflow:
   2.5 Time baseline over ${NUM_RUNS} runs
   3. Run Cachegrind
   4. Run cg_annotate
+  4.5 Profile reuse distances per access (with -R)
+  4.6 Profile address strides per load (with -S)
+  4.7 Profile per-thread sharing and false sharing (with -m)
   5. Apply CacheOpt LLVM pass
   6. Build optimized binary
+  6.3 Verify the optimized binary's stdout, stderr, output files and
+      exit status against the baseline (failures are left out of the
+      summary)
   6.5 Time optimized over ${NUM_RUNS} runs
   7. Run Cachegrind again
-  8. Print cache stats
+  8. Print cache stats and append them, with the timings, pass version
+     and configuration, to ${RESULTS_DB} (compare versions with
+     ./results.sh compare <old> <new>)
 
 If <source_file.c> is a directory, runs the pipeline for every *.c
 file in that directory and prints the average % runtime change,
@@ -37,6 +62,41 @@ plus the best (most negative) and worst (most positive) % change.
 
 Options:
   -k      Keep intermediate files (no cleanup)
+  -p      Also pool-allocate hot linked-list nodes (links cp_runtime)
+  -i      Also apply I-cache layout (hot/cold sections, cold-region
+          outlining, linker function order) from Ir/I1mr/ILmr
+  -b      Also attach Ir-derived branch weights / entry counts, and build
+          both binaries at -O2 so block placement and inlining use them
+  -s      Also software-pipeline hot innermost loops (loads issued
+          several iterations ahead into rotating registers)
+  -H      Also run the next-pointer walk of hot linked-list loops ahead
+          on a helper thread that prefetches nodes (links cp_runtime;
+          needs a second CPU, see CP_RA_* in runtime/cp_runahead.c)
+  -g      Also strip-mine loops with hot indirect loads (hash probes)
+          into batches whose addresses are all prefetched first
+  -C      Also run batches of calls to hot pointer-chasing lookups as
+          coroutines interleaved round-robin (links cp_runtime)
+  -a      Also build an instrumented copy of the optimized binary and
+          print per-prefetch-site useful/late/early/redundant counts
+  -R      Also profile reuse distances with an instrumented binary, so
+          hot loads missing mostly on capacity or conflict are reported
+          (tile, interchange, pad) rather than prefetched
+  -S      Also profile each load's dominant address delta with an
+          instrumented binary, so loads whose addresses the IR can't
+          advance (p++, casts) are prefetched at addr + stride * distance
+  -m      Multithreaded program: build everything with -fopenmp (and
+          -pthread), profile per-thread coherence misses with an
+          instrumented binary, report false sharing and don't prefetch
+          lines other threads write. The -a/-R/-S runtimes are not
+          thread-safe and run with OMP_NUM_THREADS=1
+  -P      With -m, also pad and align the globals behind accesses with
+          false sharing so each thread's data gets its own cache lines
+  -t TOL  Let numbers in the verified output differ by relative TOL
+          (e.g. 1e-9 for floating-point output like FFT or basicmath)
+  -r DB   Append results to DB instead of ${RESULTS_DB}
+  -T TGT  Make prefetch decisions for cache target TGT (a preset such as
+          skylake-sp or neoverse-n1, or a JSON file) instead of the
+          cache geometry Cachegrind simulated
   -h      Show help
 
 Example:
@@ -46,31 +106,62 @@ EOF
 }
 
 ###############################################
-# HELPER: measure average runtime over N runs
+# HELPER: measure runtime over N runs
 ###############################################
-measure_avg_time() {
+# Prints the individual wall-clock times, comma-separated
+measure_times() {
   local runs="$1"
   shift
   local bin="$1"
   shift
 
-  local sum="0.0"
+  local times=()
+  local out
+  out=$(mktemp)
   for ((i=1; i<=runs; ++i)); do
-    # %e = real time in seconds (float)
-    local t
-    t=$(/usr/bin/time -f "%e" "$bin" "$@" 2>&1 >/dev/null)
-    sum=$(echo "$sum + $t" | bc -l)
+    # %e = real time in seconds (float), written to its own file so that
+    # nothing the program prints on stderr ends up in the sample
+    /usr/bin/time -o "$out" -f "%e" "$bin" "$@" >/dev/null 2>&1
+    times+=("$(tail -n 1 "$out")")
   done
+  rm -f "$out"
+  (IFS=,; echo "${times[*]}")
+}
 
-  echo "scale=6; $sum / $runs" | bc -l
+# mean / sample standard deviation of comma-separated times
+times_mean() {
+  awk -F, '{ for (i = 1; i <= NF; ++i) t += $i; printf "%.6f\n", t / NF }' <<< "$1"
+}
+times_sd() {
+  awk -F, '{
+    for (i = 1; i <= NF; ++i) t += $i
+    m = t / NF
+    for (i = 1; i <= NF; ++i) v += ($i - m) ^ 2
+    printf "%.6f\n", (NF > 1 ? sqrt(v / (NF - 1)) : 0)
+  }' <<< "$1"
 }
 
 ###############################################
 # PARSE FLAGS
 ###############################################
-while getopts ":kh" opt; do
+while getopts ":kpibsHgCaRSmPt:r:T:h" opt; do
     case $opt in
         k) CLEAN=false ;;
+        p) POOL_ALLOC=true ;;
+        i) ICACHE=true ;;
+        b) BLOCK_WEIGHTS=true ;;
+        s) SWP=true ;;
+        H) RUNAHEAD=true ;;
+        g) BATCH=true ;;
+        C) COROS=true ;;
+        a) ACCOUNTING=true ;;
+        R) REUSE=true ;;
+        S) STRIDES=true ;;
+        m) THREADS=true ;;
+        P) PAD=true ;;
+        t) TOLERANCE="$OPTARG" ;;
+        r) RESULTS_DB="$OPTARG" ;;
+        T) CACHE_TARGET="$OPTARG" ;;
         h) show_help; exit 0 ;;
         \?)
             echo "Invalid option: -$OPTARG" >&2
@@ -82,6 +173,53 @@ done
 
 shift $((OPTIND -1))
 
+PASSES="parse-cachegrind"
+if $POOL_ALLOC; then
+    PASSES="pool-alloc,$PASSES"
+fi
+if $ICACHE; then
+    PASSES="$PASSES,icache-layout"
+fi
+if $SWP; then
+    PASSES="$PASSES,cachegrind-swp"
+fi
+if $RUNAHEAD; then
+    PASSES="$PASSES,cachegrind-runahead"
+fi
+if $BATCH; then
+    PASSES="$PASSES,cachegrind-batch"
+fi
+if $COROS; then
+    PASSES="$PASSES,cachegrind-coro"
+fi
+
+# Branch weights only matter to the optimizer: build both versions at -O2,
+# and emit the IR unoptimized (but without optnone) so it consumes them.
+OPT_LEVEL="-O0"
+IR_FLAGS=("-O0")
+if $BLOCK_WEIGHTS; then
+    PASSES="cachegrind-block-weights,$PASSES"
+    OPT_LEVEL="-O2"
+    IR_FLAGS=("-O2" "-Xclang" "-disable-llvm-passes")
+fi
+
+# The sharing profile numbers the loads/stores of the unoptimized IR, so
+# padding runs before any pass that could add or move them
+if $PAD; then
+    if ! $THREADS; then
+        echo "-P needs a sharing profile: use it with -m" >&2
+        exit 1
+    fi
+    PASSES="false-sharing-pad,$PASSES"
+fi
+
+# Every compile and link of a multithreaded program needs the flags
+MT_FLAGS=()
+if $THREADS; then
+    MT_FLAGS=("-fopenmp" "-pthread")
+    IR_FLAGS+=("${MT_FLAGS[@]}")
+fi
+
 ###############################################
 # CHECK ARGUMENT
 ###############################################
@@ -122,7 +260,11 @@ run_one_benchmark() {
 
   local BASENAME NAME
   local IR_ORIG IR_OPT BIN_ORIG BIN_OPT
-  local CG_RAW CG_ANN CG_RAW_OPT CG_ANN_OPT
+  local CG_RAW CG_ANN CG_RAW_OPT CG_ANN_OPT ORDER_FILE
+  local BIN_PROF CG_RAW_PROF CG_ANN_PROF PROFILE_CG
+  local IR_PFSIM BIN_PFSIM PF_SITES IR_REUSE BIN_REUSE REUSE_SITES
+  local IR_STRIDE BIN_STRIDE STRIDE_SITES IR_SHARING BIN_SHARING SHARING_SITES
+  local SHARING_LINES
 
   BASENAME=$(basename "$SRC_FILE")
   NAME="./build/${BASENAME%.*}"
@@ -135,29 +277,56 @@ run_one_benchmark() {
   CG_ANN="$NAME.cgann"
   CG_RAW_OPT="$NAME.opt.cg"
   CG_ANN_OPT="$NAME.opt.cgann"
+  BIN_PROF="$NAME.prof"
+  CG_RAW_PROF="$NAME.prof.cg"
+  CG_ANN_PROF="$NAME.prof.cgann"
+  ORDER_FILE="$NAME.order"
+  IR_PFSIM="$NAME.pfsim.ll"
+  BIN_PFSIM="$NAME.pfsim"
+  PF_SITES="$NAME.pfsites"
+  IR_REUSE="$NAME.reuse.ll"
+  BIN_REUSE="$NAME.reuse"
+  REUSE_SITES="$NAME.reuse.txt"
+  IR_STRIDE="$NAME.stride.ll"
+  BIN_STRIDE="$NAME.stride"
+  STRIDE_SITES="$NAME.strides.txt"
+  IR_SHARING="$NAME.sharing.ll"
+  BIN_SHARING="$NAME.sharing"
+  SHARING_SITES="$NAME.sharing.txt"
+  SHARING_LINES="$NAME.sharing_lines.txt"
+  REMARKS="$NAME.remarks.yaml"
+  PASS_LOG="$NAME.pass.log"
+  VERIFY_DIR="$NAME.verify"
 
   # Clean old files for this benchmark (best-effort)
   rm -f "$IR_ORIG" "$IR_OPT" "$BIN_ORIG" "$BIN_OPT" \
-        "$CG_RAW" "$CG_ANN" "$CG_RAW_OPT" "$CG_ANN_OPT"
+        "$CG_RAW" "$CG_ANN" "$CG_RAW_OPT" "$CG_ANN_OPT" "$ORDER_FILE" \
+        "$BIN_PROF" "$CG_RAW_PROF" "$CG_ANN_PROF" \
+        "$IR_PFSIM" "$BIN_PFSIM" "$PF_SITES" "$REMARKS" "$PASS_LOG" \
+        "$IR_REUSE" "$BIN_REUSE" "$REUSE_SITES" \
+        "$IR_STRIDE" "$BIN_STRIDE" "$STRIDE_SITES" \
+        "$IR_SHARING" "$BIN_SHARING" "$SHARING_SITES" "$SHARING_LINES"
+  rm -rf "$VERIFY_DIR"
 
   ###############################################
   # STEP 1: Compile original program to LLVM IR
   ###############################################
   echo "[1] Compiling to LLVM IR…"
-  clang -O0 -g -emit-llvm -S "$SRC_FILE" -o "$IR_ORIG"
+  clang "${IR_FLAGS[@]}" -g -emit-llvm -S "$SRC_FILE" -o "$IR_ORIG"
 
   ###############################################
   # STEP 2: Build baseline binary
   ###############################################
   echo "[2] Building baseline binary…"
-  clang -O0 -g "$SRC_FILE" -o "$BIN_ORIG"
+  clang "$OPT_LEVEL" "${MT_FLAGS[@]}" -g "$SRC_FILE" -o "$BIN_ORIG" -lm
 
   ###############################################
   # STEP 2.5: Time baseline (real wall-clock)
   ###############################################
   echo "[2.5] Timing baseline (wall-clock, ${NUM_RUNS} runs)…"
-  local BASE_AVG
-  BASE_AVG=$(measure_avg_time "$NUM_RUNS" "$BIN_ORIG" "${PROG_ARGS[@]}")
+  local BASE_TIMES BASE_AVG
+  BASE_TIMES=$(measure_times "$NUM_RUNS" "$BIN_ORIG" "${PROG_ARGS[@]}")
+  BASE_AVG=$(times_mean "$BASE_TIMES")
   echo "  BASELINE average: ${BASE_AVG} s"
 
   ###############################################
@@ -175,28 +344,174 @@ run_one_benchmark() {
   echo "[4] Running cg_annotate…"
   cg_annotate --auto=yes --show-percs=no "$CG_RAW" > "$CG_ANN"
 
+  # With -b the baseline is built at -O2 from the source, which merges,
+  # moves and deletes lines of the IR the passes annotate, and a line the
+  # profile lacks would read as never executed. Profile a build of that
+  # exact IR instead; the -O2 profile stays the baseline for the summary.
+  PROFILE_CG="$CG_ANN"
+  if $BLOCK_WEIGHTS; then
+    echo "[4.2] Profiling the annotated IR itself…"
+    clang -O0 "${MT_FLAGS[@]}" -g "$IR_ORIG" -o "$BIN_PROF" -lm
+    valgrind --tool=cachegrind \
+      --cache-sim=yes --branch-sim=no \
+      --cachegrind-out-file="$CG_RAW_PROF" \
+      "$BIN_PROF" "${PROG_ARGS[@]}" > /dev/null
+    cg_annotate --auto=yes --show-percs=no "$CG_RAW_PROF" > "$CG_ANN_PROF"
+    PROFILE_CG="$CG_ANN_PROF"
+  fi
+
+  ###############################################
+  # STEP 4.5: Reuse-distance profile (optional)
+  ###############################################
+  local PROFILE_ARGS=()
+  if $REUSE; then
+    echo "[4.5] Running instrumented binary for per-access reuse distances…"
+    opt \
+      -load-pass-plugin "$PASS" \
+      -passes=parse-cachegrind \
+      -cache-reuse-instrument \
+      "$IR_ORIG" -o "$IR_REUSE"
+    clang "$OPT_LEVEL" "${MT_FLAGS[@]}" -g "$IR_REUSE" "$RUNTIME" -o "$BIN_REUSE" -lm
+    # Model the D1 of the cache target the pass will use (-T or the profile's)
+    local RD_KB RD_LINE RD_WAYS
+    read -r RD_KB RD_LINE RD_WAYS < <(
+      opt \
+        -load-pass-plugin "$PASS" \
+        -passes=parse-cachegrind \
+        -cache-cg-file="$PROFILE_CG" \
+        -cache-target="$CACHE_TARGET" \
+        -cache-dump-metrics \
+        "$IR_ORIG" -o /dev/null 2>&1 |
+        sed -n 's|^Cache target .*: D1 \([0-9]*\) KiB/\([0-9]*\) B/\([0-9]*\)-way.*|\1 \2 \3|p') || true
+    OMP_NUM_THREADS=1 CP_RD_OUT="$REUSE_SITES" \
+      CP_RD_CACHE_KB="$RD_KB" CP_RD_LINE="$RD_LINE" CP_RD_WAYS="$RD_WAYS" \
+      "$BIN_REUSE" "${PROG_ARGS[@]}" > /dev/null
+    PROFILE_ARGS+=(-cache-reuse-profile="$REUSE_SITES")
+  fi
+
+  ###############################################
+  # STEP 4.6: Stride profile (optional)
+  ###############################################
+  if $STRIDES; then
+    echo "[4.6] Running instrumented binary for per-load strides…"
+    opt \
+      -load-pass-plugin "$PASS" \
+      -passes=parse-cachegrind \
+      -cache-stride-instrument \
+      "$IR_ORIG" -o "$IR_STRIDE"
+    clang "$OPT_LEVEL" "${MT_FLAGS[@]}" -g "$IR_STRIDE" "$RUNTIME" -o "$BIN_STRIDE" -lm
+    OMP_NUM_THREADS=1 CP_ST_OUT="$STRIDE_SITES" "$BIN_STRIDE" "${PROG_ARGS[@]}" > /dev/null
+    PROFILE_ARGS+=(-cache-stride-profile="$STRIDE_SITES")
+  fi
+
+  ###############################################
+  # STEP 4.7: Sharing profile (multithreaded programs)
+  ###############################################
+  if $THREADS; then
+    echo "[4.7] Running instrumented binary for per-thread sharing…"
+    opt \
+      -load-pass-plugin "$PASS" \
+      -passes=parse-cachegrind \
+      -cache-sharing-instrument \
+      "$IR_ORIG" -o "$IR_SHARING"
+    clang "$OPT_LEVEL" "${MT_FLAGS[@]}" -g "$IR_SHARING" "$RUNTIME" -o "$BIN_SHARING" -lm
+    CP_SH_OUT="$SHARING_SITES" CP_SH_LINES_OUT="$SHARING_LINES" \
+      "$BIN_SHARING" "${PROG_ARGS[@]}" > /dev/null
+    # Per-site totals over the threads, false sharing first
+    awk '!/^#/ { acc[$2] += $4; coh[$2] += $6; fs[$2] += $7 }
+         END { for (l in acc) if (coh[l])
+                 printf "  %s: %d accesses, %d coherence misses, %d false sharing\n",
+                        l, acc[l], coh[l], fs[l] }' "$SHARING_SITES" |
+      sort -t, -k3 -rn | head -n 10
+    # Lines with the most false sharing and the bytes each thread wrote
+    awk '!/^#/ { printf "  line %s (%s): %d false sharing, thread:bytes %s\n",
+                        $1, $2, $3, $4 }' "$SHARING_LINES" | head -n 5
+    PROFILE_ARGS+=(-cache-sharing-profile="$SHARING_SITES")
+  fi
+
   ###############################################
   # STEP 5: Apply the LLVM optimization pass
   ###############################################
   echo "[5] Running CacheOpt LLVM pass…"
   opt \
     -load-pass-plugin "$PASS" \
-    -passes="parse-cachegrind" \
-    -cache-cg-file="$CG_ANN" \
-    "$IR_ORIG" -o "$IR_OPT"
+    -passes="$PASSES" \
+    -cache-cg-file="$PROFILE_CG" \
+    -cache-target="$CACHE_TARGET" \
+    "${PROFILE_ARGS[@]}" \
+    -icache-order-file="$ORDER_FILE" \
+    -pass-remarks-output="$REMARKS" \
+    "$IR_ORIG" -o "$IR_OPT" 2> "$PASS_LOG" || { cat "$PASS_LOG" >&2; exit 1; }
+  cat "$PASS_LOG" >&2
+  echo "  remarks for every considered access: $REMARKS"
 
   ###############################################
   # STEP 6: Build new binary
   ###############################################
   echo "[6] Building new binary…"
-  clang -O0 -g "$IR_OPT" -o "$BIN_OPT"
+  local LINK_ARGS=()
+  if $POOL_ALLOC; then
+    # free/realloc of pool nodes from code the pass didn't see (libraries)
+    LINK_ARGS+=("$RUNTIME" "-Wl,--wrap=free,--wrap=realloc")
+  fi
+  if $RUNAHEAD; then
+    LINK_ARGS+=("$RUNTIME" "-pthread")
+  fi
+  if $COROS; then
+    LINK_ARGS+=("$RUNTIME")
+  fi
+  # GNU ld already groups .text.hot/.text.unlikely; the order file needs lld
+  if $ICACHE && [ -s "$ORDER_FILE" ] && command -v ld.lld >/dev/null; then
+    LINK_ARGS+=("-fuse-ld=lld" "-Wl,--symbol-ordering-file=$ORDER_FILE")
+  fi
+  clang "$OPT_LEVEL" "${MT_FLAGS[@]}" -g "$IR_OPT" "${LINK_ARGS[@]}" -o "$BIN_OPT" -lm
+
+  ###############################################
+  # STEP 6.2: Prefetch accounting (optional)
+  ###############################################
+  if $ACCOUNTING; then
+    echo "[6.2] Running instrumented binary for per-site prefetch accounting…"
+    opt \
+      -load-pass-plugin "$PASS" \
+      -passes="$PASSES" \
+      -cache-cg-file="$PROFILE_CG" \
+      -cache-target="$CACHE_TARGET" \
+      "${PROFILE_ARGS[@]}" \
+      -cache-prefetch-instrument \
+      "$IR_ORIG" -o "$IR_PFSIM"
+    clang "$OPT_LEVEL" "${MT_FLAGS[@]}" -g "$IR_PFSIM" "$RUNTIME" -o "$BIN_PFSIM" -lm
+    OMP_NUM_THREADS=1 CP_PF_OUT="$PF_SITES" "$BIN_PFSIM" "${PROG_ARGS[@]}" > /dev/null
+    column -t "$PF_SITES" | sed 's/^/  /'
+  fi
+
+  ###############################################
+  # STEP 6.3: Verify output equivalence
+  ###############################################
+  echo "[6.3] Verifying optimized output against baseline…"
+  local VERIFY_ARGS=()
+  if [ -n "$TOLERANCE" ]; then
+    VERIFY_ARGS=(-r "$TOLERANCE")
+  fi
+  "$VERIFY" capture "$VERIFY_DIR/orig" "$BIN_ORIG" "${PROG_ARGS[@]}"
+  "$VERIFY" capture "$VERIFY_DIR/opt" "$BIN_OPT" "${PROG_ARGS[@]}"
+  LAST_VERIFIED=true
+  local verify_log
+  if verify_log=$("$VERIFY" compare "${VERIFY_ARGS[@]}" \
+                    "$VERIFY_DIR/orig" "$VERIFY_DIR/opt"); then
+    echo "  outputs match"
+  else
+    echo "$verify_log" | sed 's/^/  /'
+    echo "  VERIFICATION FAILED: $SRC_FILE is excluded from the summary"
+    LAST_VERIFIED=false
+  fi
 
   ###############################################
   # STEP 6.5: Time optimized (real wall-clock)
   ###############################################
   echo "[6.5] Timing optimized (wall-clock, ${NUM_RUNS} runs)…"
-  local OPT_AVG
-  OPT_AVG=$(measure_avg_time "$NUM_RUNS" "$BIN_OPT" "${PROG_ARGS[@]}")
+  local OPT_TIMES OPT_AVG
+  OPT_TIMES=$(measure_times "$NUM_RUNS" "$BIN_OPT" "${PROG_ARGS[@]}")
+  OPT_AVG=$(times_mean "$OPT_TIMES")
   echo "  OPTIMIZED average: ${OPT_AVG} s"
 
   ###############################################
@@ -245,6 +560,15 @@ run_one_benchmark() {
   totals_line=$(grep "PROGRAM TOTALS" "$CG_ANN_OPT")
   print_program_totals_line "$totals_line"
 
+  # I-cache read misses before/after (column 2 of PROGRAM TOTALS)
+  local I1MR_BASE I1MR_OPT
+  I1MR_BASE=$(grep "PROGRAM TOTALS" "$CG_ANN" | awk '{gsub(",", "", $2); print $2}')
+  I1MR_OPT=$(grep "PROGRAM TOTALS" "$CG_ANN_OPT" | awk '{gsub(",", "", $2); print $2}')
+  if [ -n "$I1MR_BASE" ] && [ "$I1MR_BASE" != "0" ]; then
+    echo
+    echo "  I1mr change: ${I1MR_BASE} -> ${I1MR_OPT} ($(echo "scale=2; 100.0 * ($I1MR_OPT - $I1MR_BASE) / $I1MR_BASE" | bc -l)%)"
+  fi
+
 
   # Percentage change in runtime
   local PERC
@@ -252,6 +576,33 @@ run_one_benchmark() {
   echo
   echo "  Runtime change for $SRC_FILE: ${PERC}%  (positive = slower, negative = speedup)"
 
+  # Append to the results database
+  local counters=(Ir I1mr ILmr Dr D1mr DLmr Dw D1mw DLmw) fields=() i
+  local base_totals opt_totals sites
+  read -ra base_totals <<< "$(grep "PROGRAM TOTALS" "$CG_ANN" | tr -d ,)"
+  read -ra opt_totals <<< "$(grep "PROGRAM TOTALS" "$CG_ANN_OPT" | tr -d ,)"
+  for i in "${!counters[@]}"; do
+    fields+=("base_${counters[$i]}=${base_totals[$i]}"
+             "opt_${counters[$i]}=${opt_totals[$i]}")
+  done
+  # "parse-cachegrind: inserted N of M planned prefetches"
+  read -ra sites <<< "$(sed -n 's/^parse-cachegrind: inserted \([0-9]*\) of \([0-9]*\) planned.*/\1 \2/p' "$PASS_LOG")"
+  ./results.sh record "$RESULTS_DB" \
+    date="$(date -u +%Y-%m-%dT%H:%M:%SZ)" \
+    commit="$(git describe --always --dirty 2>/dev/null || echo -)" \
+    version="$(cat ./build/profiler/pass_version 2>/dev/null || echo -)" \
+    benchmark="$SRC_FILE" input="${PROG_ARGS[*]}" \
+    config="$PASSES $OPT_LEVEL${CACHE_TARGET:+ target=$CACHE_TARGET}$($REUSE && echo " reuse")$($STRIDES && echo " strides")$($THREADS && echo " threads=${OMP_NUM_THREADS:-default}")" \
+    verified="$($LAST_VERIFIED && echo yes || echo no)" \
+    runs="$NUM_RUNS" \
+    base_mean="$BASE_AVG" base_sd="$(times_sd "$BASE_TIMES")" \
+    base_samples="$BASE_TIMES" \
+    opt_mean="$OPT_AVG" opt_sd="$(times_sd "$OPT_TIMES")" \
+    opt_samples="$OPT_TIMES" \
+    "${fields[@]}" \
+    sites_inserted="${sites[0]}" sites_planned="${sites[1]}"
+  echo "  recorded in $RESULTS_DB"
+
   # Export per-benchmark numbers back to caller via globals
   LAST_BASE_AVG="$BASE_AVG"
   LAST_OPT_AVG="$OPT_AVG"
@@ -261,7 +612,13 @@ run_one_benchmark() {
   # Cleanup per-benchmark intermediates if requested
   if $CLEAN; then
     rm -f "$IR_ORIG" "$IR_OPT" "$BIN_ORIG" "$BIN_OPT" \
-          "$CG_RAW" "$CG_ANN" "$CG_RAW_OPT" "$CG_ANN_OPT"
+          "$CG_RAW" "$CG_ANN" "$CG_RAW_OPT" "$CG_ANN_OPT" "$ORDER_FILE" \
+          "$BIN_PROF" "$CG_RAW_PROF" "$CG_ANN_PROF" \
+          "$IR_PFSIM" "$BIN_PFSIM" "$PF_SITES" "$REMARKS" "$PASS_LOG" \
+          "$IR_REUSE" "$BIN_REUSE" "$REUSE_SITES" \
+          "$IR_STRIDE" "$BIN_STRIDE" "$STRIDE_SITES" \
+          "$IR_SHARING" "$BIN_SHARING" "$SHARING_SITES" "$SHARING_LINES"
+    rm -rf "$VERIFY_DIR"
   fi
 }
 
@@ -270,6 +627,7 @@ run_one_benchmark() {
 ###############################################
 TOTAL_PERC="0.0"
 BENCH_COUNT=0
+FAILED_FILES=()   # optimized output differed from the baseline
 
 BEST_FILE=""
 BEST_BASE=""
@@ -297,6 +655,10 @@ if [ -d "$TARGET" ]; then
 
   for f in "${files[@]}"; do
     run_one_benchmark "$f"
+    if ! $LAST_VERIFIED; then
+      FAILED_FILES+=("$LAST_FILE")
+      continue
+    fi
     TOTAL_PERC=$(echo "$TOTAL_PERC + $LAST_PERC" | bc -l)
     BENCH_COUNT=$((BENCH_COUNT + 1))
 
@@ -354,11 +716,26 @@ if [ -d "$TARGET" ]; then
     echo "====================================================="
   fi
 
+  if [ ${#FAILED_FILES[@]} -gt 0 ]; then
+    echo
+    echo "Failed verification (not in the numbers above):"
+    printf '  %s\n' "${FAILED_FILES[@]}"
+  fi
+
 else
   # Single-file mode
   run_one_benchmark "$TARGET"
   echo
-  echo "Single benchmark % runtime change: ${LAST_PERC}%"
+  if $LAST_VERIFIED; then
+    echo "Single benchmark % runtime change: ${LAST_PERC}%"
+  else
+    echo "Single benchmark failed verification (measured change ${LAST_PERC}% not counted)"
+    FAILED_FILES+=("$LAST_FILE")
+  fi
 fi
 
+if [ ${#FAILED_FILES[@]} -gt 0 ]; then
+  echo -e "\nDone, ${#FAILED_FILES[@]} benchmark(s) FAILED verification ✘"
+  exit 1
+fi
 echo -e "\nDone ✔"
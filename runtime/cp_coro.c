@@ -0,0 +1,111 @@
+/*
+ * cp_coro.c - frames and statistics for interleaved lookup coroutines.
+ *
+ * The cachegrind-coro pass turns a pointer-chasing lookup into a coroutine
+ * and runs a batch of calls to it at a time, resuming each in turn after it
+ * prefetches its next node. Every lookup needs a frame for its state; a
+ * batch of lookups is started and finished every few dozen iterations, so
+ * frames come from per-thread free lists instead of malloc(). Sizes are
+ * rounded up to 64-byte classes, up to CP_CO_MAX_FRAME bytes; larger frames
+ * go to malloc(). At most CP_CO_POOL (default 64) free frames are kept per
+ * class.
+ *
+ * The scheduler reports each finished batch to cp_co_batch(). CP_CO_STATS
+ * prints lookups, batches and resumes per lookup to stderr at exit: a lookup
+ * is resumed once per node after the first, so this is about its depth.
+ */
+#include "cp_runtime.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CP_CO_CLASS 64
+#define CP_CO_MAX_FRAME 1024
+#define CP_CO_CLASSES (CP_CO_MAX_FRAME / CP_CO_CLASS)
+#define CP_CO_HEADER 16 /* keeps malloc's alignment for the frame */
+
+typedef struct cp_co_free_frame {
+  struct cp_co_free_frame *next;
+} cp_co_free_frame;
+
+typedef struct cp_co_class {
+  cp_co_free_frame *free;
+  size_t count;
+} cp_co_class;
+
+static __thread cp_co_class classes[CP_CO_CLASSES];
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static size_t pool_max;
+static int stats;
+
+/* Totals over all threads, for CP_CO_STATS */
+static uint64_t total_lookups;
+static uint64_t total_batches;
+static uint64_t total_resumes;
+
+static void cp_co_stats(void) {
+  uint64_t lookups = __atomic_load_n(&total_lookups, __ATOMIC_RELAXED);
+  uint64_t resumes = __atomic_load_n(&total_resumes, __ATOMIC_RELAXED);
+  fprintf(stderr,
+          "cp_runtime: coroutines: %llu lookups in %llu batches, "
+          "%.2f resumes per lookup\n",
+          (unsigned long long)lookups,
+          (unsigned long long)__atomic_load_n(&total_batches,
+                                              __ATOMIC_RELAXED),
+          lookups ? (double)resumes / (double)lookups : 0.0);
+}
+
+static void cp_co_init(void) {
+  const char *s = getenv("CP_CO_POOL");
+  pool_max = s && *s ? (size_t)strtoull(s, NULL, 10) : 64;
+  const char *st = getenv("CP_CO_STATS");
+  stats = st && *st;
+  if (stats)
+    atexit(cp_co_stats);
+}
+
+void *cp_co_alloc(uint64_t size) {
+  pthread_once(&init_once, cp_co_init);
+  size_t cls = (size_t)((size + CP_CO_HEADER + CP_CO_CLASS - 1) / CP_CO_CLASS);
+  char *block;
+  if (cls <= CP_CO_CLASSES && classes[cls - 1].free) {
+    cp_co_class *c = &classes[cls - 1];
+    block = (char *)c->free;
+    c->free = c->free->next;
+    c->count--;
+  } else {
+    block = malloc(cls * CP_CO_CLASS);
+    if (!block) {
+      fprintf(stderr, "cp_runtime: out of memory for a coroutine frame\n");
+      abort();
+    }
+  }
+  *(size_t *)block = cls;
+  return block + CP_CO_HEADER;
+}
+
+void cp_co_free(void *frame) {
+  if (!frame)
+    return;
+  char *block = (char *)frame - CP_CO_HEADER;
+  size_t cls = *(size_t *)block;
+  cp_co_class *c = cls <= CP_CO_CLASSES ? &classes[cls - 1] : NULL;
+  if (!c || c->count >= pool_max) {
+    free(block);
+    return;
+  }
+  cp_co_free_frame *f = (cp_co_free_frame *)block;
+  f->next = c->free;
+  c->free = f;
+  c->count++;
+}
+
+void cp_co_batch(uint64_t lookups, uint64_t resumes) {
+  if (!stats)
+    return;
+  __atomic_fetch_add(&total_lookups, lookups, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&total_batches, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&total_resumes, resumes, __ATOMIC_RELAXED);
+}
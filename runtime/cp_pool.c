@@ -0,0 +1,218 @@
+/*
+ * cp_pool.c - per-type bump arenas for pool-allocated linked structures.
+ *
+ * Slabs start small and double (up to CP_POOL_MAX_SLAB) so that a list of a
+ * million nodes lives in a couple dozen slabs. Every slab is recorded in a
+ * global table sorted by address, which lets free()/realloc() replacements
+ * tell pool memory from libc memory with one binary search.
+ *
+ * The pass only rewrites the free()/realloc() calls of the module it runs
+ * on. Linking with -Wl,--wrap=free,--wrap=realloc routes the calls of every
+ * other object in the link (prebuilt libraries, code compiled without the
+ * pass) through the same check; run.sh -p does so.
+ */
+#include "cp_runtime.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CP_POOL_MIN_SLAB (64u * 1024u)
+#define CP_POOL_MAX_SLAB (8u * 1024u * 1024u)
+
+typedef struct cp_pool {
+  size_t objsize;   /* node size rounded up to its alignment */
+  size_t align;
+  char *bump;       /* next free byte in the current slab */
+  char *limit;      /* end of the current slab */
+  size_t slab_size; /* size of the next slab to allocate */
+  void *freelist;   /* singly linked through the first word of each node */
+} cp_pool;
+
+typedef struct cp_slab {
+  char *begin;
+  char *end;
+  cp_pool *pool;
+} cp_slab;
+
+/* Set by the linker under --wrap; without it libc's own names are used */
+extern void __real_free(void *ptr) __attribute__((weak));
+extern void *__real_realloc(void *ptr, size_t size) __attribute__((weak));
+
+static void libc_free(void *ptr) {
+  if (__real_free)
+    __real_free(ptr);
+  else
+    free(ptr);
+}
+
+static void *libc_realloc(void *ptr, size_t size) {
+  return __real_realloc ? __real_realloc(ptr, size) : realloc(ptr, size);
+}
+
+static cp_slab *slabs;
+static size_t num_slabs;
+static size_t cap_slabs;
+
+static void cp_pool_oom(void) {
+  fprintf(stderr, "cp_runtime: out of memory in pool allocator\n");
+  abort();
+}
+
+static cp_slab *find_slab(const void *ptr) {
+  const char *p = (const char *)ptr;
+  size_t lo = 0, hi = num_slabs;
+
+  /* Last slab with begin <= p */
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (slabs[mid].begin <= p)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == 0)
+    return NULL;
+
+  cp_slab *s = &slabs[lo - 1];
+  return p < s->end ? s : NULL;
+}
+
+static void add_slab(cp_pool *pool, char *begin, size_t size) {
+  if (num_slabs == cap_slabs) {
+    size_t cap = cap_slabs ? cap_slabs * 2 : 16;
+    cp_slab *grown = (cp_slab *)libc_realloc(slabs, cap * sizeof(cp_slab));
+    if (!grown)
+      cp_pool_oom();
+    slabs = grown;
+    cap_slabs = cap;
+  }
+
+  /* Keep the table sorted by address */
+  size_t i = num_slabs;
+  while (i > 0 && slabs[i - 1].begin > begin) {
+    slabs[i] = slabs[i - 1];
+    --i;
+  }
+  slabs[i].begin = begin;
+  slabs[i].end = begin + size;
+  slabs[i].pool = pool;
+  ++num_slabs;
+}
+
+static cp_pool *create_pool(size_t size, size_t align) {
+  cp_pool *pool = (cp_pool *)calloc(1, sizeof(cp_pool));
+  if (!pool)
+    cp_pool_oom();
+
+  if (align & (align - 1)) {
+    fprintf(stderr, "cp_runtime: pool alignment %zu is not a power of two\n",
+            align);
+    abort();
+  }
+  if (align < sizeof(void *))
+    align = sizeof(void *);
+  if (size < sizeof(void *))
+    size = sizeof(void *);
+
+  pool->align = align;
+  pool->objsize = (size + align - 1) & ~(align - 1);
+  pool->slab_size = CP_POOL_MIN_SLAB;
+  return pool;
+}
+
+static void refill(cp_pool *pool) {
+  size_t size = pool->slab_size;
+  while (size < pool->objsize)
+    size *= 2;
+
+  /* Start the slab at an aligned address: malloc only guarantees the
+   * alignment of C scalar types, and node types may ask for more. Since
+   * objsize is a multiple of align, every node after the first is aligned
+   * too. Slabs are never freed, so the skipped bytes don't matter. */
+  char *raw = (char *)malloc(size + pool->align - 1);
+  if (!raw)
+    cp_pool_oom();
+  char *slab = (char *)(((uintptr_t)raw + pool->align - 1) &
+                        ~(uintptr_t)(pool->align - 1));
+
+  add_slab(pool, slab, size);
+  pool->bump = slab;
+  pool->limit = slab + size;
+
+  if (pool->slab_size < CP_POOL_MAX_SLAB)
+    pool->slab_size *= 2;
+}
+
+static void pool_release(cp_pool *pool, void *ptr) {
+  *(void **)ptr = pool->freelist;
+  pool->freelist = ptr;
+}
+
+void *cp_pool_alloc(void **handle, size_t size, size_t align) {
+  cp_pool *pool = (cp_pool *)*handle;
+  if (!pool) {
+    pool = create_pool(size, align);
+    *handle = pool;
+  }
+
+  /* Odd-sized request for this type (shouldn't happen); don't pool it. */
+  if (size > pool->objsize)
+    return malloc(size);
+
+  if (pool->freelist) {
+    void *node = pool->freelist;
+    pool->freelist = *(void **)node;
+    return node;
+  }
+
+  if ((size_t)(pool->limit - pool->bump) < pool->objsize)
+    refill(pool);
+
+  void *node = pool->bump;
+  pool->bump += pool->objsize;
+  return node;
+}
+
+void cp_pool_free(void **handle, void *ptr) {
+  (void)handle;
+  /* The node may have come from a different pool or from libc (e.g. an
+   * allocation site the pass didn't rewrite), so always look it up. */
+  cp_pool_free_any(ptr);
+}
+
+void cp_pool_free_any(void *ptr) {
+  if (!ptr)
+    return;
+
+  cp_slab *s = find_slab(ptr);
+  if (s)
+    pool_release(s->pool, ptr);
+  else
+    libc_free(ptr);
+}
+
+void *cp_pool_realloc_any(void *ptr, size_t size) {
+  if (!ptr)
+    return malloc(size);
+
+  cp_slab *s = find_slab(ptr);
+  if (!s)
+    return libc_realloc(ptr, size);
+
+  /* Move a pool node out to libc memory */
+  void *moved = malloc(size ? size : 1);
+  if (!moved)
+    return NULL;
+  memcpy(moved, ptr, size < s->pool->objsize ? size : s->pool->objsize);
+  pool_release(s->pool, ptr);
+  return moved;
+}
+
+/* Targets of -Wl,--wrap=free,--wrap=realloc */
+void __wrap_free(void *ptr) { cp_pool_free_any(ptr); }
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  return cp_pool_realloc_any(ptr, size);
+}
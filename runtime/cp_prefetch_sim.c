@@ -0,0 +1,228 @@
+/*
+ * cp_prefetch_sim.c - per-site prefetch effectiveness accounting.
+ *
+ * Binaries built with `-cache-prefetch-instrument` call cp_pf_access() before
+ * every load/store and cp_pf_prefetch() next to every inserted prefetch.
+ * Both feed a small set-associative LRU cache model (one level, the L1D by
+ * default). A prefetched line remembers the site that brought it in and the
+ * "time" (count of demand accesses) at which it would have arrived:
+ *
+ *   useful     first demand access after the line arrived
+ *   late       first demand access before the line arrived
+ *   early      evicted (or still unused at exit) without a demand access
+ *   redundant  the line was already in the cache when prefetched
+ *
+ * At exit the table is written to $CP_PF_OUT (default cp_prefetch_sites.txt),
+ * one row per site, which the pass reads back via -cache-prefetch-feedback.
+ *
+ * Environment: CP_PF_CACHE_KB (32), CP_PF_WAYS (8), CP_PF_LINE (64),
+ * CP_PF_LATENCY (demand accesses until a prefetch completes, 16).
+ *
+ * Not thread-safe.
+ */
+#include "cp_runtime.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CP_PF_NO_SITE UINT32_MAX
+
+typedef struct cp_pf_line {
+  uintptr_t tag;    /* line address + 1, 0 = empty */
+  uint64_t lru;     /* time of last touch */
+  uint64_t ready;   /* time the prefetch completes */
+  uint32_t site;    /* index into sites, CP_PF_NO_SITE if demand-filled or used */
+} cp_pf_line;
+
+typedef struct cp_pf_site {
+  uint32_t id;
+  const char *loc;
+  uint64_t issued;
+  uint64_t useful;
+  uint64_t late;
+  uint64_t early;
+  uint64_t redundant;
+} cp_pf_site;
+
+static cp_pf_line *lines;
+static size_t num_sets;
+static size_t num_ways;
+static unsigned line_shift;
+static uint64_t latency;
+static uint64_t now;
+
+static cp_pf_site *sites;
+static size_t num_sites;
+static size_t cap_sites;
+/* Open addressing on id: index into sites + 1, 0 = empty */
+static uint32_t *site_slots;
+static size_t cap_slots;
+
+static size_t env_size(const char *name, size_t def) {
+  const char *s = getenv(name);
+  if (!s || !*s)
+    return def;
+  size_t v = (size_t)strtoull(s, NULL, 10);
+  return v ? v : def;
+}
+
+static uint64_t mix(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  return x;
+}
+
+static void cp_pf_oom(void) {
+  fprintf(stderr, "cp_runtime: out of memory in prefetch simulator\n");
+  abort();
+}
+
+static void cp_pf_dump(void) {
+  const char *path = getenv("CP_PF_OUT");
+  if (!path || !*path)
+    path = "cp_prefetch_sites.txt";
+
+  /* Lines still holding an unused prefetch never paid off */
+  for (size_t i = 0; i < num_sets * num_ways; ++i)
+    if (lines[i].tag && lines[i].site != CP_PF_NO_SITE)
+      sites[lines[i].site].early++;
+
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    fprintf(stderr, "cp_runtime: can't write %s\n", path);
+    return;
+  }
+  fprintf(f, "# site file:line issued useful late early redundant\n");
+  for (size_t i = 0; i < num_sites; ++i) {
+    const cp_pf_site *s = &sites[i];
+    fprintf(f, "%u %s %llu %llu %llu %llu %llu\n", s->id, s->loc,
+            (unsigned long long)s->issued, (unsigned long long)s->useful,
+            (unsigned long long)s->late, (unsigned long long)s->early,
+            (unsigned long long)s->redundant);
+  }
+  fclose(f);
+}
+
+static void cp_pf_init(void) {
+  size_t line = env_size("CP_PF_LINE", 64);
+  size_t ways = env_size("CP_PF_WAYS", 8);
+  size_t kb = env_size("CP_PF_CACHE_KB", 32);
+
+  line_shift = 0;
+  while (((size_t)1 << (line_shift + 1)) <= line)
+    ++line_shift;
+  num_ways = ways;
+  num_sets = (kb * 1024) >> line_shift;
+  num_sets = num_sets / ways ? num_sets / ways : 1;
+  latency = env_size("CP_PF_LATENCY", 16);
+
+  lines = calloc(num_sets * num_ways, sizeof(cp_pf_line));
+  if (!lines)
+    cp_pf_oom();
+  atexit(cp_pf_dump);
+}
+
+/* Sites stay in issue order, so lines can keep their index */
+static uint32_t find_site(uint32_t id, const char *loc) {
+  if (2 * (num_sites + 1) > cap_slots) {
+    size_t cap = cap_slots ? 2 * cap_slots : 256;
+    uint32_t *slots = calloc(cap, sizeof(uint32_t));
+    if (!slots)
+      cp_pf_oom();
+    for (size_t k = 0; k < num_sites; ++k) {
+      size_t j = mix(sites[k].id) & (cap - 1);
+      while (slots[j])
+        j = (j + 1) & (cap - 1);
+      slots[j] = (uint32_t)k + 1;
+    }
+    free(site_slots);
+    site_slots = slots;
+    cap_slots = cap;
+  }
+
+  size_t i = mix(id) & (cap_slots - 1);
+  while (site_slots[i] && sites[site_slots[i] - 1].id != id)
+    i = (i + 1) & (cap_slots - 1);
+  if (site_slots[i])
+    return site_slots[i] - 1;
+
+  if (num_sites == cap_sites) {
+    cap_sites = cap_sites ? cap_sites * 2 : 64;
+    sites = realloc(sites, cap_sites * sizeof(cp_pf_site));
+    if (!sites)
+      cp_pf_oom();
+  }
+  memset(&sites[num_sites], 0, sizeof(cp_pf_site));
+  sites[num_sites].id = id;
+  sites[num_sites].loc = loc;
+  site_slots[i] = (uint32_t)num_sites + 1;
+  return (uint32_t)num_sites++;
+}
+
+/* Returns the way holding the line, or the LRU victim with *hit = 0 */
+static cp_pf_line *lookup(uintptr_t tag, int *hit) {
+  cp_pf_line *set = &lines[((tag - 1) % num_sets) * num_ways];
+  cp_pf_line *victim = set;
+  for (size_t w = 0; w < num_ways; ++w) {
+    if (set[w].tag == tag) {
+      *hit = 1;
+      return &set[w];
+    }
+    if (set[w].lru < victim->lru)
+      victim = &set[w];
+  }
+  *hit = 0;
+  return victim;
+}
+
+static void fill(cp_pf_line *l, uintptr_t tag, uint32_t site) {
+  if (l->tag && l->site != CP_PF_NO_SITE)
+    sites[l->site].early++;
+  l->tag = tag;
+  l->site = site;
+  l->lru = now;
+  l->ready = now + latency;
+}
+
+void cp_pf_access(const void *addr) {
+  if (!lines)
+    cp_pf_init();
+  ++now;
+
+  uintptr_t tag = ((uintptr_t)addr >> line_shift) + 1;
+  int hit;
+  cp_pf_line *l = lookup(tag, &hit);
+  if (!hit) {
+    fill(l, tag, CP_PF_NO_SITE);
+    return;
+  }
+
+  if (l->site != CP_PF_NO_SITE) {
+    if (now < l->ready)
+      sites[l->site].late++;
+    else
+      sites[l->site].useful++;
+    l->site = CP_PF_NO_SITE;
+  }
+  l->lru = now;
+}
+
+void cp_pf_prefetch(uint32_t site, const void *addr, const char *loc) {
+  if (!lines)
+    cp_pf_init();
+
+  uint32_t s = find_site(site, loc);
+  sites[s].issued++;
+
+  uintptr_t tag = ((uintptr_t)addr >> line_shift) + 1;
+  int hit;
+  cp_pf_line *l = lookup(tag, &hit);
+  if (hit) {
+    sites[s].redundant++;
+    return;
+  }
+  fill(l, tag, s);
+}
@@ -0,0 +1,391 @@
+/*
+ * cp_reuse.c - per-site reuse distances and 3C miss classification.
+ *
+ * Binaries built with `-cache-reuse-instrument` call cp_rd_access() before
+ * every load/store. Each access goes through two models:
+ *
+ *  - a set-associative LRU cache (CP_RD_CACHE_KB, CP_RD_WAYS, CP_RD_LINE;
+ *    32 KiB, 8 ways, 64 B by default), which decides hit or miss;
+ *  - Olken's algorithm for the reuse distance (distinct lines touched since
+ *    the previous access to the same line): every line sits in a splay tree
+ *    keyed by the time of its last access, so the distance is the number of
+ *    nodes after it.
+ *
+ * A miss is compulsory if the line was never touched before, capacity if
+ * its reuse distance is at least the cache's size in lines (a fully
+ * associative cache would miss too), and conflict otherwise.
+ *
+ * Sampling: with CP_RD_SAMPLE=N only lines whose address hashes to 0 mod N
+ * enter the tree (spatial sampling, as in SHARDS). Distances between
+ * sampled lines, and the counts they classify, are scaled by N. Accesses and
+ * misses are always exact.
+ *
+ * At exit the table is written to $CP_RD_OUT (default cp_reuse_sites.txt),
+ * one row per site, which the pass reads back via -cache-reuse-profile. The
+ * last column is a histogram of reuse distances: bucket 0 counts distance
+ * 0, bucket b distances in [2^(b-1), 2^b), the last one cold accesses.
+ *
+ * Not thread-safe.
+ */
+#include "cp_runtime.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CP_RD_BUCKETS 42 /* distances up to 2^40 lines, then cold */
+#define CP_RD_COLD (CP_RD_BUCKETS - 1)
+#define CP_RD_NODE_SLAB 4096
+
+typedef struct cp_rd_node {
+  struct cp_rd_node *left, *right, *parent;
+  uint64_t time;
+  uint64_t size; /* nodes in this subtree */
+} cp_rd_node;
+
+typedef struct cp_rd_entry {
+  uintptr_t tag; /* line address + 1, 0 = empty */
+  cp_rd_node *node;
+} cp_rd_entry;
+
+typedef struct cp_rd_site {
+  uint32_t id;
+  const char *loc; /* NULL = empty slot */
+  uint64_t accesses;
+  uint64_t misses;
+  uint64_t compulsory;
+  uint64_t capacity;
+  uint64_t conflict;
+  uint64_t hist[CP_RD_BUCKETS];
+} cp_rd_site;
+
+/* Cache model */
+static uintptr_t *cache_tags;
+static uint64_t *cache_lru;
+static size_t num_sets;
+static size_t num_ways;
+static unsigned line_shift;
+static uint64_t cache_lines;
+static uint64_t now;
+
+/* Olken tree over the sampled lines */
+static uint64_t sample_rate;
+static cp_rd_node *root;
+static uint64_t tree_time;
+static cp_rd_node *node_slab;
+static size_t node_slab_used = CP_RD_NODE_SLAB;
+
+static cp_rd_entry *entries;
+static size_t num_entries;
+static size_t cap_entries;
+
+static cp_rd_site *sites;
+static size_t num_sites;
+static size_t cap_sites;
+
+static size_t env_size(const char *name, size_t def) {
+  const char *s = getenv(name);
+  if (!s || !*s)
+    return def;
+  size_t v = (size_t)strtoull(s, NULL, 10);
+  return v ? v : def;
+}
+
+static void cp_rd_oom(void) {
+  fprintf(stderr, "cp_runtime: out of memory in reuse-distance profiler\n");
+  abort();
+}
+
+static uint64_t mix(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  return x;
+}
+
+/* --- splay tree ordered by time, with subtree sizes --- */
+
+static uint64_t size_of(const cp_rd_node *n) { return n ? n->size : 0; }
+
+static void update(cp_rd_node *n) {
+  n->size = 1 + size_of(n->left) + size_of(n->right);
+}
+
+static void rotate(cp_rd_node *x) {
+  cp_rd_node *p = x->parent, *g = p->parent;
+  if (p->left == x) {
+    p->left = x->right;
+    if (x->right)
+      x->right->parent = p;
+    x->right = p;
+  } else {
+    p->right = x->left;
+    if (x->left)
+      x->left->parent = p;
+    x->left = p;
+  }
+  p->parent = x;
+  x->parent = g;
+  if (g) {
+    if (g->left == p)
+      g->left = x;
+    else
+      g->right = x;
+  }
+  update(p);
+  update(x);
+}
+
+static void splay(cp_rd_node *x) {
+  while (x->parent) {
+    cp_rd_node *p = x->parent, *g = p->parent;
+    if (g)
+      rotate((g->left == p) == (p->left == x) ? p : x);
+    rotate(x);
+  }
+  root = x;
+}
+
+/* Unlink the root, joining its subtrees */
+static void remove_root(void) {
+  cp_rd_node *l = root->left, *r = root->right;
+  if (l)
+    l->parent = NULL;
+  if (r)
+    r->parent = NULL;
+  if (!l) {
+    root = r;
+    return;
+  }
+  cp_rd_node *max = l;
+  while (max->right)
+    max = max->right;
+  splay(max); /* root = max, which has no right child */
+  max->right = r;
+  if (r)
+    r->parent = max;
+  update(max);
+}
+
+/* Times only grow, so a new node is always the maximum: it becomes the
+ * root with the old tree as its left subtree. */
+static void insert_max(cp_rd_node *n) {
+  n->left = root;
+  n->right = NULL;
+  n->parent = NULL;
+  if (root)
+    root->parent = n;
+  root = n;
+  update(n);
+}
+
+static cp_rd_node *new_node(void) {
+  if (node_slab_used == CP_RD_NODE_SLAB) {
+    node_slab = malloc(CP_RD_NODE_SLAB * sizeof(cp_rd_node));
+    if (!node_slab)
+      cp_rd_oom();
+    node_slab_used = 0;
+  }
+  return &node_slab[node_slab_used++];
+}
+
+/* --- line -> tree node --- */
+
+static cp_rd_entry *find_entry(uintptr_t tag) {
+  if (2 * (num_entries + 1) > cap_entries) {
+    size_t old_cap = cap_entries;
+    cp_rd_entry *old = entries;
+    cap_entries = cap_entries ? 2 * cap_entries : 1024;
+    entries = calloc(cap_entries, sizeof(cp_rd_entry));
+    if (!entries)
+      cp_rd_oom();
+    for (size_t i = 0; i < old_cap; ++i) {
+      if (!old[i].tag)
+        continue;
+      size_t j = mix(old[i].tag) & (cap_entries - 1);
+      while (entries[j].tag)
+        j = (j + 1) & (cap_entries - 1);
+      entries[j] = old[i];
+    }
+    free(old);
+  }
+
+  size_t i = mix(tag) & (cap_entries - 1);
+  while (entries[i].tag && entries[i].tag != tag)
+    i = (i + 1) & (cap_entries - 1);
+  if (!entries[i].tag) {
+    entries[i].tag = tag;
+    ++num_entries;
+  }
+  return &entries[i];
+}
+
+/* Reuse distance of tag in sampled lines; UINT64_MAX if never seen */
+static uint64_t reuse_distance(uintptr_t tag) {
+  cp_rd_entry *e = find_entry(tag);
+  uint64_t dist = UINT64_MAX;
+  if (e->node) {
+    splay(e->node);
+    dist = size_of(e->node->right);
+    remove_root();
+  } else {
+    e->node = new_node();
+  }
+  e->node->time = ++tree_time;
+  insert_max(e->node);
+  return dist;
+}
+
+/* --- sites --- */
+
+static cp_rd_site *find_site(uint32_t id, const char *loc) {
+  if (2 * (num_sites + 1) > cap_sites) {
+    size_t old_cap = cap_sites;
+    cp_rd_site *old = sites;
+    cap_sites = cap_sites ? 2 * cap_sites : 256;
+    sites = calloc(cap_sites, sizeof(cp_rd_site));
+    if (!sites)
+      cp_rd_oom();
+    for (size_t i = 0; i < old_cap; ++i) {
+      if (!old[i].loc)
+        continue;
+      size_t j = mix(old[i].id) & (cap_sites - 1);
+      while (sites[j].loc)
+        j = (j + 1) & (cap_sites - 1);
+      sites[j] = old[i];
+    }
+    free(old);
+  }
+
+  size_t i = mix(id) & (cap_sites - 1);
+  while (sites[i].loc && sites[i].id != id)
+    i = (i + 1) & (cap_sites - 1);
+  if (!sites[i].loc) {
+    /* Copied: the module that owns loc may be unloaded before the dump
+       (dlclose, or lli freeing its JIT code at exit) */
+    size_t len = strlen(loc) + 1;
+    char *copy = malloc(len);
+    if (!copy)
+      cp_rd_oom();
+    sites[i].id = id;
+    sites[i].loc = memcpy(copy, loc, len);
+    ++num_sites;
+  }
+  return &sites[i];
+}
+
+static void cp_rd_dump(void) {
+  const char *path = getenv("CP_RD_OUT");
+  if (!path || !*path)
+    path = "cp_reuse_sites.txt";
+
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    fprintf(stderr, "cp_runtime: can't write %s\n", path);
+    return;
+  }
+  fprintf(f, "# cache %llu lines, sample 1/%llu\n",
+          (unsigned long long)cache_lines, (unsigned long long)sample_rate);
+  fprintf(f, "# site file:line accesses misses compulsory capacity conflict "
+             "histogram\n");
+  for (size_t i = 0; i < cap_sites; ++i) {
+    const cp_rd_site *s = &sites[i];
+    if (!s->loc)
+      continue;
+    fprintf(f, "%u %s %llu %llu %llu %llu %llu ", s->id, s->loc,
+            (unsigned long long)s->accesses, (unsigned long long)s->misses,
+            (unsigned long long)(s->compulsory * sample_rate),
+            (unsigned long long)(s->capacity * sample_rate),
+            (unsigned long long)(s->conflict * sample_rate));
+    /* Trailing empty buckets are left out */
+    int last = CP_RD_BUCKETS - 1;
+    while (last > 0 && !s->hist[last])
+      --last;
+    for (int b = 0; b <= last; ++b)
+      fprintf(f, "%s%llu", b ? "," : "",
+              (unsigned long long)(s->hist[b] * sample_rate));
+    fprintf(f, "\n");
+  }
+  fclose(f);
+}
+
+static void cp_rd_init(void) {
+  size_t line = env_size("CP_RD_LINE", 64);
+  size_t ways = env_size("CP_RD_WAYS", 8);
+  size_t kb = env_size("CP_RD_CACHE_KB", 32);
+  sample_rate = env_size("CP_RD_SAMPLE", 1);
+
+  line_shift = 0;
+  while (((size_t)1 << (line_shift + 1)) <= line)
+    ++line_shift;
+  cache_lines = (kb * 1024) >> line_shift;
+  num_ways = ways;
+  num_sets = cache_lines / ways ? cache_lines / ways : 1;
+
+  cache_tags = calloc(num_sets * num_ways, sizeof(uintptr_t));
+  cache_lru = calloc(num_sets * num_ways, sizeof(uint64_t));
+  if (!cache_tags || !cache_lru)
+    cp_rd_oom();
+  atexit(cp_rd_dump);
+}
+
+/* Set-associative LRU lookup; fills on a miss. Returns 1 on a hit. */
+static int cache_access(uintptr_t tag) {
+  size_t set = ((tag - 1) % num_sets) * num_ways;
+  size_t victim = set;
+  for (size_t w = set; w < set + num_ways; ++w) {
+    if (cache_tags[w] == tag) {
+      cache_lru[w] = now;
+      return 1;
+    }
+    if (cache_lru[w] < cache_lru[victim])
+      victim = w;
+  }
+  cache_tags[victim] = tag;
+  cache_lru[victim] = now;
+  return 0;
+}
+
+static unsigned bucket(uint64_t dist) {
+  if (dist == UINT64_MAX)
+    return CP_RD_COLD;
+  unsigned b = 0;
+  while (dist && b < CP_RD_COLD - 1) {
+    dist >>= 1;
+    ++b;
+  }
+  return b;
+}
+
+void cp_rd_access(uint32_t site, const void *addr, const char *loc) {
+  if (!cache_tags)
+    cp_rd_init();
+  ++now;
+
+  uintptr_t tag = ((uintptr_t)addr >> line_shift) + 1;
+  int hit = cache_access(tag);
+  cp_rd_site *s = loc ? find_site(site, loc) : NULL;
+  if (s) {
+    s->accesses++;
+    s->misses += !hit;
+  }
+
+  if (sample_rate > 1 && mix(tag) % sample_rate)
+    return;
+  uint64_t dist = reuse_distance(tag);
+  if (dist != UINT64_MAX)
+    dist *= sample_rate;
+  if (!s)
+    return;
+
+  s->hist[bucket(dist)]++;
+  if (hit)
+    return;
+  if (dist == UINT64_MAX)
+    s->compulsory++;
+  else if (dist >= cache_lines)
+    s->capacity++;
+  else
+    s->conflict++;
+}
@@ -0,0 +1,234 @@
+/*
+ * cp_runahead.c - helper-thread run-ahead for pointer-chasing loops.
+ *
+ * The cachegrind-runahead pass outlines the address slice of a hot list walk
+ * (`p = p->next`) into a helper function and brackets the loop with
+ * cp_ra_start() / cp_ra_stop(). A single helper thread, created on the first
+ * cp_ra_start(), runs that function from the loop's first node. It walks the
+ * list ahead of the main thread, touching each node so it is in the shared
+ * cache levels by the time the main thread gets there.
+ *
+ * Synchronization is one single-producer/single-consumer progress counter:
+ * the main thread counts its iterations in cp_ra_progress() and every
+ * CP_RA_PUBLISH (default 8, a power of two) iterations publishes the count
+ * and its current node with a release store. The helper counts its own steps
+ * in cp_ra_step() and:
+ *
+ *  - waits while it is more than `ahead` nodes in front (the throttle, set by
+ *    the pass or CP_RA_AHEAD, default 64), so its lines are not evicted
+ *    before use;
+ *  - jumps to the main thread's published node if it has fallen behind, as
+ *    touching nodes already visited is useless;
+ *  - gives up when cp_ra_stop() is called.
+ *
+ * Every field is on a cache line written by only one side, so the counter
+ * is the only line that moves between cores, once per publish.
+ *
+ * Run-ahead needs a second hardware thread: with fewer than 2 CPUs online,
+ * or CP_RA_DISABLE set, cp_ra_start() returns NULL and the other calls do
+ * nothing. CP_RA_FORCE enables it anyway. Only one loop runs ahead at a time;
+ * nested or concurrent starts get NULL too. CP_RA_STATS prints walks, helper
+ * steps, throttle waits and resyncs to stderr at exit.
+ */
+#include "cp_runtime.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define CP_RA_LINE __attribute__((aligned(64)))
+#define CP_RA_SPINS 64 /* pause this many times, then yield */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cp_ra_relax() __builtin_ia32_pause()
+#else
+#define cp_ra_relax() ((void)0)
+#endif
+
+typedef struct cp_ra_channel {
+  /* Main thread only */
+  CP_RA_LINE uint64_t steps;
+  uint64_t publish_mask;
+
+  /* Written by the main thread, read by the helper */
+  CP_RA_LINE uint64_t progress;
+  const void *pos;
+  int stop;
+
+  /* Helper only */
+  CP_RA_LINE uint64_t helper_steps;
+  uint64_t throttled;
+  uint64_t resyncs;
+
+  /* Handoff between walks, under lock */
+  CP_RA_LINE pthread_mutex_t lock;
+  pthread_cond_t cond;
+  cp_ra_slice fn;
+  void *start;
+  uint64_t ahead;
+  unsigned generation;
+  int busy;
+  char owned;
+} cp_ra_channel;
+
+static cp_ra_channel channel = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static int enabled;
+static uint64_t default_ahead;
+
+/* Totals over finished walks, for CP_RA_STATS */
+static uint64_t total_walks;
+static uint64_t total_steps;
+static uint64_t total_throttled;
+static uint64_t total_resyncs;
+
+static uint64_t env_u64(const char *name, uint64_t def) {
+  const char *s = getenv(name);
+  if (!s || !*s)
+    return def;
+  uint64_t v = strtoull(s, NULL, 10);
+  return v ? v : def;
+}
+
+static void cp_ra_stats(void) {
+  fprintf(stderr,
+          "cp_runtime: run-ahead: %llu walks, %llu helper steps, "
+          "%llu throttled, %llu resyncs\n",
+          (unsigned long long)total_walks, (unsigned long long)total_steps,
+          (unsigned long long)total_throttled,
+          (unsigned long long)total_resyncs);
+}
+
+static void *helper_main(void *arg) {
+  cp_ra_channel *ch = arg;
+  unsigned seen = 0;
+  pthread_mutex_lock(&ch->lock);
+  for (;;) {
+    while (ch->generation == seen)
+      pthread_cond_wait(&ch->cond, &ch->lock);
+    seen = ch->generation;
+    cp_ra_slice fn = ch->fn;
+    void *start = ch->start;
+    pthread_mutex_unlock(&ch->lock);
+
+    fn(start, ch);
+
+    pthread_mutex_lock(&ch->lock);
+    ch->busy = 0;
+    pthread_cond_broadcast(&ch->cond);
+  }
+  return NULL;
+}
+
+static void cp_ra_init(void) {
+  const char *disable = getenv("CP_RA_DISABLE");
+  const char *force = getenv("CP_RA_FORCE");
+  enabled = (force && *force) || sysconf(_SC_NPROCESSORS_ONLN) >= 2;
+  if (disable && *disable)
+    enabled = 0;
+  default_ahead = env_u64("CP_RA_AHEAD", 64);
+
+  uint64_t publish = env_u64("CP_RA_PUBLISH", 8);
+  uint64_t mask = 1;
+  while (mask < publish)
+    mask <<= 1;
+  channel.publish_mask = mask - 1;
+
+  const char *stats = getenv("CP_RA_STATS");
+  if (stats && *stats)
+    atexit(cp_ra_stats);
+
+  pthread_t helper;
+  if (enabled && pthread_create(&helper, NULL, helper_main, &channel) != 0) {
+    fprintf(stderr, "cp_runtime: can't start the run-ahead thread\n");
+    enabled = 0;
+  }
+  if (enabled)
+    pthread_detach(helper);
+}
+
+void *cp_ra_start(cp_ra_slice fn, void *start, uint32_t ahead) {
+  pthread_once(&init_once, cp_ra_init);
+  cp_ra_channel *ch = &channel;
+  if (!enabled || !start || __atomic_test_and_set(&ch->owned, __ATOMIC_ACQUIRE))
+    return NULL;
+
+  /* The helper is idle: nothing reads these until the handoff */
+  ch->steps = 0;
+  ch->progress = 0;
+  ch->pos = start;
+  ch->stop = 0;
+  ch->helper_steps = 0;
+  ch->throttled = 0;
+  ch->resyncs = 0;
+
+  pthread_mutex_lock(&ch->lock);
+  ch->fn = fn;
+  ch->start = start;
+  ch->ahead = ahead ? ahead : default_ahead;
+  ch->busy = 1;
+  ch->generation++;
+  pthread_cond_signal(&ch->cond);
+  pthread_mutex_unlock(&ch->lock);
+  return ch;
+}
+
+void cp_ra_progress(void *handle, const void *node) {
+  cp_ra_channel *ch = handle;
+  if (!ch)
+    return;
+  uint64_t n = ++ch->steps;
+  if (n & ch->publish_mask)
+    return;
+  __atomic_store_n(&ch->pos, node, __ATOMIC_RELAXED);
+  __atomic_store_n(&ch->progress, n, __ATOMIC_RELEASE);
+}
+
+void *cp_ra_step(void *handle, void *node) {
+  cp_ra_channel *ch = handle;
+  if (!node)
+    return NULL;
+  uint64_t n = ++ch->helper_steps;
+  for (unsigned spins = 0;; ++spins) {
+    if (__atomic_load_n(&ch->stop, __ATOMIC_ACQUIRE))
+      return NULL;
+    uint64_t main = __atomic_load_n(&ch->progress, __ATOMIC_ACQUIRE);
+    if (main >= n) {
+      /* Fallen behind: continue from the main thread's node */
+      ch->helper_steps = main;
+      ch->resyncs++;
+      return (void *)__atomic_load_n(&ch->pos, __ATOMIC_RELAXED);
+    }
+    if (n - main <= ch->ahead)
+      return node;
+    if (spins == 0)
+      ch->throttled++;
+    if (spins >= CP_RA_SPINS)
+      sched_yield();
+    else
+      cp_ra_relax();
+  }
+}
+
+void cp_ra_stop(void *handle) {
+  cp_ra_channel *ch = handle;
+  if (!ch)
+    return;
+  __atomic_store_n(&ch->stop, 1, __ATOMIC_RELEASE);
+  pthread_mutex_lock(&ch->lock);
+  while (ch->busy)
+    pthread_cond_wait(&ch->cond, &ch->lock);
+  pthread_mutex_unlock(&ch->lock);
+
+  total_walks++;
+  total_steps += ch->helper_steps;
+  total_throttled += ch->throttled;
+  total_resyncs += ch->resyncs;
+  __atomic_clear(&ch->owned, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,109 @@
+#ifndef CP_RUNTIME_H
+#define CP_RUNTIME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Pool allocation (see profiler/PoolAllocPass.cpp)
+ *
+ * Each pooled node type gets one `void *` handle, initialized to NULL by the
+ * pass. The pool is created lazily on the first allocation. Nodes are bumped
+ * out of large slabs so consecutive allocations are contiguous; freed nodes
+ * go on a per-pool freelist and are reused LIFO.
+ *
+ * Not thread-safe, like the single-threaded benchmarks it is used on.
+ */
+void *cp_pool_alloc(void **pool, size_t size, size_t align);
+void cp_pool_free(void **pool, void *ptr);
+
+/* free()/realloc() replacements for pointers that may or may not come from
+ * a pool. Non-pool pointers are forwarded to libc. Linking with
+ * -Wl,--wrap=free,--wrap=realloc sends every other free()/realloc() call in
+ * the program here as well. */
+void cp_pool_free_any(void *ptr);
+void *cp_pool_realloc_any(void *ptr, size_t size);
+
+/*
+ * Prefetch accounting (see runtime/cp_prefetch_sim.c)
+ *
+ * Inserted by -cache-prefetch-instrument: cp_pf_access() before every demand
+ * load/store, cp_pf_prefetch() next to every prefetch with the site's stable
+ * ID and "file:line". The per-site table is written at exit.
+ */
+void cp_pf_access(const void *addr);
+void cp_pf_prefetch(uint32_t site, const void *addr, const char *loc);
+
+/*
+ * Reuse-distance profiling (see runtime/cp_reuse.c)
+ *
+ * Inserted by -cache-reuse-instrument before every load/store, with the
+ * access's prefetch site ID and "file:line" (loc is NULL for accesses
+ * without a debug location, which only feed the cache model). Per-site
+ * compulsory/capacity/conflict misses and reuse-distance histograms are
+ * written at exit.
+ */
+void cp_rd_access(uint32_t site, const void *addr, const char *loc);
+
+/*
+ * Stride profiling (see runtime/cp_stride.c)
+ *
+ * Inserted by -cache-stride-instrument before every load with a debug
+ * location, with the load's prefetch site ID and "file:line". The most
+ * frequent delta between consecutive addresses of each site, and how many
+ * deltas had it, are written at exit.
+ */
+void cp_st_access(uint32_t site, const void *addr, const char *loc);
+
+/*
+ * Sharing profiling (see runtime/cp_sharing.c)
+ *
+ * Inserted by -cache-sharing-instrument before every load/store, with the
+ * access's prefetch site ID, its size, whether it writes and "file:line".
+ * Thread-safe: per-thread counts of accesses, coherence misses, false
+ * sharing and writes to lines other threads hold are written at exit, with
+ * the lines that had the most false sharing and the bytes each thread wrote.
+ */
+void cp_sh_access(uint32_t site, const void *addr, uint32_t size,
+                  uint32_t is_write, const char *loc);
+
+/*
+ * Helper-thread run-ahead (see runtime/cp_runahead.c)
+ *
+ * Inserted by the cachegrind-runahead pass around a hot pointer-chasing
+ * loop: cp_ra_start() before it hands the loop's first node to `fn`, the
+ * outlined `p = p->next` slice, on a helper thread and returns a handle
+ * (NULL if run-ahead is off or already in use); cp_ra_progress() at the top
+ * of each iteration publishes where the loop is; cp_ra_stop() on exit waits
+ * for the helper to leave the list. The slice calls cp_ra_step() before
+ * touching each node: it returns the node to touch, or NULL to stop, and
+ * keeps the helper at most `ahead` nodes (0 = $CP_RA_AHEAD) in front.
+ */
+typedef void (*cp_ra_slice)(void *start, void *handle);
+
+void *cp_ra_start(cp_ra_slice fn, void *start, uint32_t ahead);
+void cp_ra_progress(void *handle, const void *node);
+void *cp_ra_step(void *handle, void *node);
+void cp_ra_stop(void *handle);
+
+/*
+ * Interleaved lookups (see runtime/cp_coro.c)
+ *
+ * Called by lookup coroutines made by the cachegrind-coro pass:
+ * cp_co_alloc()/cp_co_free() give and take back a coroutine frame of `size`
+ * bytes from per-thread free lists. The pass's scheduler calls cp_co_batch()
+ * after each batch with its lookups and the resumes they took.
+ */
+void *cp_co_alloc(uint64_t size);
+void cp_co_free(void *frame);
+void cp_co_batch(uint64_t lookups, uint64_t resumes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CP_RUNTIME_H */
@@ -0,0 +1,340 @@
+/*
+ * cp_sharing.c - per-thread access counts and coherence misses.
+ *
+ * Binaries built with `-cache-sharing-instrument` call cp_sh_access() before
+ * every load/store, from any thread. Every cache line (CP_SH_LINE bytes, at
+ * most and by default 64) has a shadow entry in a direct-mapped table of
+ * 2^CP_SH_TABLE_LOG2 entries (default 20; a colliding line replaces the
+ * entry, forgetting its history) holding:
+ *
+ *  - which threads have a valid copy, as in an invalidation protocol: a read
+ *    adds the reader, a write leaves only the writer;
+ *  - the last writer and the bytes it has written since it took the line.
+ *
+ * An access by a thread without a valid copy of a line another thread wrote
+ * is a coherence miss. It is false sharing if none of the bytes it touches
+ * were written by that thread: only the line, not the data, was shared. A
+ * write that takes the line from other threads' copies is a shared write.
+ *
+ * Counts are kept per site and per thread, without locks, in tables owned
+ * by each thread (up to CP_SH_MAX_THREADS; later threads share the last
+ * slot, whose table is updated under a mutex). Shadow entries are updated
+ * under a per-entry spinlock. At exit the rows are written to $CP_SH_OUT
+ * (default cp_sharing_sites.txt), which the pass reads back via
+ * -cache-sharing-profile:
+ *
+ *   # site file:line thread accesses writes coherence false_sharing shared_writes
+ *
+ * Each line also remembers the bytes written by each of its first
+ * CP_SH_LINE_WRITERS writing threads, over the whole run, and the last access
+ * that missed on false sharing. The CP_SH_TOP_LINES (default 32) lines with
+ * the most false sharing go to $CP_SH_LINES_OUT (default
+ * cp_sharing_lines.txt), each with its writers' byte ranges:
+ *
+ *   # line file:line false_sharing writers (thread:byte ranges)
+ *   0x4c6040 counter_array.c:25 118264 0:0-15,1:16-31,2:32-47,3:48-63
+ */
+#include "cp_runtime.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CP_SH_MAX_THREADS 64
+#define CP_SH_LINE_WRITERS 4
+
+typedef struct cp_sh_line {
+  uintptr_t tag;   /* line address + 1, 0 = empty */
+  uint64_t valid;  /* threads with a copy */
+  uint64_t written; /* bytes written by writer since it took the line */
+  int writer;      /* -1 = none */
+  char lock;
+  uint8_t num_writers;
+  uint8_t writer_ids[CP_SH_LINE_WRITERS];
+  uint64_t writer_bytes[CP_SH_LINE_WRITERS]; /* over the whole run */
+  uint64_t false_sharing;
+  const char *false_sharing_loc; /* last access that missed on it */
+} cp_sh_line;
+
+typedef struct cp_sh_site {
+  uint32_t id;
+  const char *loc; /* NULL = empty slot */
+  uint64_t accesses;
+  uint64_t writes;
+  uint64_t coherence;
+  uint64_t false_sharing;
+  uint64_t shared_writes;
+} cp_sh_site;
+
+typedef struct cp_sh_thread {
+  int id;
+  cp_sh_site *sites;
+  size_t num_sites;
+  size_t cap_sites;
+} cp_sh_thread;
+
+static cp_sh_line *lines;
+static size_t table_mask;
+static unsigned line_shift;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static cp_sh_thread threads[CP_SH_MAX_THREADS];
+static int num_threads;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t overflow_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread cp_sh_thread *self;
+
+static size_t env_size(const char *name, size_t def) {
+  const char *s = getenv(name);
+  if (!s || !*s)
+    return def;
+  size_t v = (size_t)strtoull(s, NULL, 10);
+  return v ? v : def;
+}
+
+static void cp_sh_oom(void) {
+  fprintf(stderr, "cp_runtime: out of memory in sharing profiler\n");
+  abort();
+}
+
+static uint64_t mix(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  return x;
+}
+
+/* "0-7+16-23" style ranges of the set bits of a byte mask */
+static void print_ranges(FILE *f, uint64_t bytes) {
+  int first = 1;
+  for (int b = 0; b < 64;) {
+    if (!(bytes >> b & 1)) {
+      ++b;
+      continue;
+    }
+    int e = b;
+    while (e + 1 < 64 && (bytes >> (e + 1) & 1))
+      ++e;
+    fprintf(f, "%s%d-%d", first ? "" : "+", b, e);
+    first = 0;
+    b = e + 1;
+  }
+}
+
+static void cp_sh_dump_lines(void) {
+  const char *path = getenv("CP_SH_LINES_OUT");
+  if (!path || !*path)
+    path = "cp_sharing_lines.txt";
+  size_t top = env_size("CP_SH_TOP_LINES", 32);
+
+  /* Indices of the top lines, most false sharing first */
+  size_t *best = calloc(top, sizeof(size_t));
+  if (!best)
+    cp_sh_oom();
+  size_t num_best = 0;
+  for (size_t i = 0; i <= table_mask; ++i) {
+    if (!lines[i].false_sharing)
+      continue;
+    size_t pos = num_best < top ? num_best++ : top;
+    while (pos > 0 &&
+           lines[best[pos - 1]].false_sharing < lines[i].false_sharing) {
+      if (pos < top)
+        best[pos] = best[pos - 1];
+      --pos;
+    }
+    if (pos < top)
+      best[pos] = i;
+  }
+
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    fprintf(stderr, "cp_runtime: can't write %s\n", path);
+    free(best);
+    return;
+  }
+  fprintf(f, "# line file:line false_sharing writers\n");
+  for (size_t n = 0; n < num_best; ++n) {
+    const cp_sh_line *l = &lines[best[n]];
+    fprintf(f, "%#llx %s %llu ",
+            (unsigned long long)((l->tag - 1) << line_shift),
+            l->false_sharing_loc ? l->false_sharing_loc : "?",
+            (unsigned long long)l->false_sharing);
+    for (int w = 0; w < l->num_writers; ++w) {
+      fprintf(f, "%s%d:", w ? "," : "", l->writer_ids[w]);
+      print_ranges(f, l->writer_bytes[w]);
+    }
+    fprintf(f, "\n");
+  }
+  fclose(f);
+  free(best);
+}
+
+static void cp_sh_dump(void) {
+  cp_sh_dump_lines();
+
+  const char *path = getenv("CP_SH_OUT");
+  if (!path || !*path)
+    path = "cp_sharing_sites.txt";
+
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    fprintf(stderr, "cp_runtime: can't write %s\n", path);
+    return;
+  }
+  fprintf(f, "# site file:line thread accesses writes coherence "
+             "false_sharing shared_writes\n");
+  pthread_mutex_lock(&threads_lock);
+  for (int t = 0; t < num_threads; ++t) {
+    const cp_sh_thread *th = &threads[t];
+    for (size_t i = 0; i < th->cap_sites; ++i) {
+      const cp_sh_site *s = &th->sites[i];
+      if (!s->loc)
+        continue;
+      fprintf(f, "%u %s %d %llu %llu %llu %llu %llu\n", s->id, s->loc, t,
+              (unsigned long long)s->accesses, (unsigned long long)s->writes,
+              (unsigned long long)s->coherence,
+              (unsigned long long)s->false_sharing,
+              (unsigned long long)s->shared_writes);
+    }
+  }
+  pthread_mutex_unlock(&threads_lock);
+  fclose(f);
+}
+
+static void cp_sh_init(void) {
+  size_t line = env_size("CP_SH_LINE", 64);
+  if (line > 64)
+    line = 64; /* one bit per byte */
+  line_shift = 0;
+  while (((size_t)1 << (line_shift + 1)) <= line)
+    ++line_shift;
+  size_t log2 = env_size("CP_SH_TABLE_LOG2", 20);
+  table_mask = ((size_t)1 << log2) - 1;
+  lines = calloc(table_mask + 1, sizeof(cp_sh_line));
+  if (!lines)
+    cp_sh_oom();
+  atexit(cp_sh_dump);
+}
+
+static cp_sh_thread *this_thread(void) {
+  if (self)
+    return self;
+  pthread_once(&init_once, cp_sh_init);
+  pthread_mutex_lock(&threads_lock);
+  int id = CP_SH_MAX_THREADS - 1;
+  if (num_threads < CP_SH_MAX_THREADS) {
+    id = num_threads++;
+    threads[id].id = id; /* the last slot's threads only read it */
+  }
+  self = &threads[id];
+  pthread_mutex_unlock(&threads_lock);
+  return self;
+}
+
+/* Only the owning thread inserts (or overflow_lock's holder, for the last
+   slot); the dump runs at exit */
+static cp_sh_site *find_site(cp_sh_thread *th, uint32_t id, const char *loc) {
+  if (2 * (th->num_sites + 1) > th->cap_sites) {
+    size_t old_cap = th->cap_sites;
+    cp_sh_site *old = th->sites;
+    size_t cap = old_cap ? 2 * old_cap : 256;
+    cp_sh_site *sites = calloc(cap, sizeof(cp_sh_site));
+    if (!sites)
+      cp_sh_oom();
+    for (size_t i = 0; i < old_cap; ++i) {
+      if (!old[i].loc)
+        continue;
+      size_t j = mix(old[i].id) & (cap - 1);
+      while (sites[j].loc)
+        j = (j + 1) & (cap - 1);
+      sites[j] = old[i];
+    }
+    pthread_mutex_lock(&threads_lock);
+    th->sites = sites;
+    th->cap_sites = cap;
+    pthread_mutex_unlock(&threads_lock);
+    free(old);
+  }
+
+  size_t i = mix(id) & (th->cap_sites - 1);
+  while (th->sites[i].loc && th->sites[i].id != id)
+    i = (i + 1) & (th->cap_sites - 1);
+  if (!th->sites[i].loc) {
+    th->sites[i].id = id;
+    th->sites[i].loc = loc;
+    ++th->num_sites;
+  }
+  return &th->sites[i];
+}
+
+void cp_sh_access(uint32_t site, const void *addr, uint32_t size,
+                  uint32_t is_write, const char *loc) {
+  cp_sh_thread *th = this_thread();
+  int t = th->id;
+  uint64_t bit = 1ull << t;
+
+  uintptr_t a = (uintptr_t)addr;
+  uintptr_t tag = (a >> line_shift) + 1;
+  unsigned off = (unsigned)(a & (((uintptr_t)1 << line_shift) - 1));
+  unsigned end = off + (size ? size : 1);
+  if (end > (1u << line_shift))
+    end = 1u << line_shift; /* the rest is on the next line */
+  uint64_t bytes = (end - off == 64 ? ~0ull : ((1ull << (end - off)) - 1))
+                   << off;
+
+  cp_sh_line *l = &lines[mix(tag) & table_mask];
+  while (__atomic_test_and_set(&l->lock, __ATOMIC_ACQUIRE))
+    ;
+  if (l->tag != tag) {
+    l->tag = tag;
+    l->valid = 0;
+    l->written = 0;
+    l->writer = -1;
+    l->num_writers = 0;
+    l->false_sharing = 0;
+    l->false_sharing_loc = NULL;
+  }
+  int coherence = l->writer >= 0 && l->writer != t && !(l->valid & bit);
+  int false_sharing = coherence && !(l->written & bytes);
+  int shared_write = is_write && (l->valid & ~bit);
+  if (is_write) {
+    if (l->writer != t)
+      l->written = 0;
+    l->writer = t;
+    l->written |= bytes;
+    l->valid = bit;
+    int w = 0;
+    while (w < l->num_writers && l->writer_ids[w] != t)
+      ++w;
+    if (w == l->num_writers && w < CP_SH_LINE_WRITERS) {
+      l->writer_ids[w] = (uint8_t)t;
+      l->writer_bytes[w] = 0;
+      l->num_writers++;
+    }
+    if (w < l->num_writers)
+      l->writer_bytes[w] |= bytes;
+  } else {
+    l->valid |= bit;
+  }
+  if (false_sharing) {
+    l->false_sharing++;
+    if (loc)
+      l->false_sharing_loc = loc;
+  }
+  __atomic_clear(&l->lock, __ATOMIC_RELEASE);
+
+  if (!loc)
+    return;
+  int shared = t == CP_SH_MAX_THREADS - 1;
+  if (shared)
+    pthread_mutex_lock(&overflow_lock);
+  cp_sh_site *s = find_site(th, site, loc);
+  s->accesses++;
+  s->writes += is_write != 0;
+  s->coherence += coherence;
+  s->false_sharing += false_sharing;
+  s->shared_writes += shared_write != 0;
+  if (shared)
+    pthread_mutex_unlock(&overflow_lock);
+}
@@ -0,0 +1,155 @@
+/*
+ * cp_stride.c - per-load dominant address deltas.
+ *
+ * Binaries built with `-cache-stride-instrument` call cp_st_access() before
+ * every load. For each site the delta between consecutive addresses goes
+ * into a small space-saving summary (CP_ST_SLOTS candidates, as in Metwally
+ * et al.'s top-k counter): a delta already tracked is counted, a new one
+ * replaces the least counted candidate and inherits its count as an error
+ * bound. The candidate with the highest count is the site's stride, and its
+ * count minus its error bound is a lower bound on how many deltas had
+ * exactly that value.
+ *
+ * At exit the table is written to $CP_ST_OUT (default cp_stride_sites.txt),
+ * one row per site, which the pass reads back via -cache-stride-profile:
+ *
+ *   # site file:line accesses stride hits
+ *
+ * hits / (accesses - 1) is the fraction of deltas equal to the stride, so a
+ * pointer walk that restarts once per 100 elements has 99% stable deltas.
+ *
+ * Not thread-safe.
+ */
+#include "cp_runtime.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CP_ST_SLOTS 4
+
+typedef struct cp_st_slot {
+  int64_t delta;
+  uint64_t count; /* 0 = empty */
+  uint64_t error;
+} cp_st_slot;
+
+typedef struct cp_st_site {
+  uint32_t id;
+  const char *loc; /* NULL = empty slot */
+  uint64_t accesses;
+  uintptr_t last;
+  cp_st_slot slots[CP_ST_SLOTS];
+} cp_st_site;
+
+static cp_st_site *sites;
+static size_t num_sites;
+static size_t cap_sites;
+
+static uint64_t mix(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  return x;
+}
+
+static const cp_st_slot *dominant(const cp_st_site *s) {
+  const cp_st_slot *best = &s->slots[0];
+  for (int i = 1; i < CP_ST_SLOTS; ++i)
+    if (s->slots[i].count > best->count)
+      best = &s->slots[i];
+  return best;
+}
+
+static void cp_st_dump(void) {
+  const char *path = getenv("CP_ST_OUT");
+  if (!path || !*path)
+    path = "cp_stride_sites.txt";
+
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    fprintf(stderr, "cp_runtime: can't write %s\n", path);
+    return;
+  }
+  fprintf(f, "# site file:line accesses stride hits\n");
+  for (size_t i = 0; i < cap_sites; ++i) {
+    const cp_st_site *s = &sites[i];
+    if (!s->loc)
+      continue;
+    const cp_st_slot *d = dominant(s);
+    fprintf(f, "%u %s %llu %lld %llu\n", s->id, s->loc,
+            (unsigned long long)s->accesses, (long long)d->delta,
+            (unsigned long long)(d->count - d->error));
+  }
+  fclose(f);
+}
+
+static cp_st_site *find_site(uint32_t id, const char *loc) {
+  if (2 * (num_sites + 1) > cap_sites) {
+    size_t old_cap = cap_sites;
+    cp_st_site *old = sites;
+    cap_sites = cap_sites ? 2 * cap_sites : 256;
+    sites = calloc(cap_sites, sizeof(cp_st_site));
+    if (!sites) {
+      fprintf(stderr, "cp_runtime: out of memory in stride profiler\n");
+      abort();
+    }
+    for (size_t i = 0; i < old_cap; ++i) {
+      if (!old[i].loc)
+        continue;
+      size_t j = mix(old[i].id) & (cap_sites - 1);
+      while (sites[j].loc)
+        j = (j + 1) & (cap_sites - 1);
+      sites[j] = old[i];
+    }
+    if (!old)
+      atexit(cp_st_dump);
+    free(old);
+  }
+
+  size_t i = mix(id) & (cap_sites - 1);
+  while (sites[i].loc && sites[i].id != id)
+    i = (i + 1) & (cap_sites - 1);
+  if (!sites[i].loc) {
+    /* Copied, as in cp_reuse.c: loc's module may be gone by the dump */
+    size_t len = strlen(loc) + 1;
+    char *copy = malloc(len);
+    if (!copy) {
+      fprintf(stderr, "cp_runtime: out of memory in stride profiler\n");
+      abort();
+    }
+    sites[i].id = id;
+    sites[i].loc = memcpy(copy, loc, len);
+    ++num_sites;
+  }
+  return &sites[i];
+}
+
+void cp_st_access(uint32_t site, const void *addr, const char *loc) {
+  if (!loc)
+    return;
+  cp_st_site *s = find_site(site, loc);
+  uintptr_t a = (uintptr_t)addr;
+  if (s->accesses++ == 0) {
+    s->last = a;
+    return;
+  }
+  int64_t delta = (int64_t)(a - s->last);
+  s->last = a;
+
+  cp_st_slot *min = &s->slots[0];
+  for (int i = 0; i < CP_ST_SLOTS; ++i) {
+    cp_st_slot *slot = &s->slots[i];
+    if (slot->count && slot->delta == delta) {
+      slot->count++;
+      return;
+    }
+    if (slot->count < min->count)
+      min = slot;
+  }
+  /* Not tracked: take an empty slot or evict the least counted one */
+  min->error = min->count;
+  min->delta = delta;
+  min->count++;
+}
@@ -0,0 +1,151 @@
+#!/usr/bin/env bash
+# Output-equivalence check between a baseline and an optimized run
+# Usage:
+#   ./verify.sh capture <out_dir> <binary> [program args...]
+#   ./verify.sh compare [-r rel_tol] [-a abs_tol] [-x name]... <orig_dir> <opt_dir>
+
+set -e
+
+show_help() {
+  cat << EOF
+Usage:
+  $0 capture <out_dir> <binary> [program args...]
+  $0 compare [-r rel_tol] [-a abs_tol] [-x name]... <orig_dir> <opt_dir>
+
+capture runs <binary> inside a fresh <out_dir>, so files it writes by
+relative path land there, next to stdout, stderr and exit (its status).
+Arguments naming existing files are passed as absolute paths.
+
+compare checks that two directories hold the same files with the same
+contents. With -r/-a, text files may differ in numbers as long as
+|a - b| <= abs_tol + rel_tol * max(|a|, |b|) for every pair (for
+floating-point output such as FFT or basicmath); everything else must
+match exactly. -x skips files with that name. Exits 1 on any difference.
+EOF
+}
+
+capture() {
+  local out="$1" bin="$2"
+  shift 2
+
+  local args=() arg
+  for arg in "$@"; do
+    if [ -e "$arg" ]; then
+      args+=("$(realpath "$arg")")
+    else
+      args+=("$arg")
+    fi
+  done
+  bin=$(realpath "$bin")
+
+  rm -rf "$out"
+  mkdir -p "$out"
+  local status=0
+  (cd "$out" && "$bin" "${args[@]}" > stdout 2> stderr) || status=$?
+  echo "$status" > "$out/exit"
+}
+
+# Token-wise numeric comparison of two text files
+compare_numeric() {
+  awk -v rel="$REL_TOL" -v abs="$ABS_TOL" -v other="$2" '
+    function isnum(s) {
+      return s ~ /^[-+]?([0-9]+\.?[0-9]*|\.[0-9]+)([eE][-+]?[0-9]+)?$/
+    }
+    function mag(x) { return x < 0 ? -x : x }
+    {
+      if ((getline line < other) <= 0) {
+        print "  line " NR ": only in " FILENAME; bad = 1; exit
+      }
+      n = split($0, a, /[ \t,;:=()\[\]]+/)
+      m = split(line, b, /[ \t,;:=()\[\]]+/)
+      if (n != m) {
+        print "  line " NR ": " $0 " | " line; bad = 1; exit
+      }
+      for (i = 1; i <= n; ++i) {
+        if (a[i] "" == b[i] "")
+          continue
+        if (isnum(a[i]) && isnum(b[i])) {
+          x = a[i] + 0; y = b[i] + 0
+          big = mag(x) > mag(y) ? mag(x) : mag(y)
+          if (mag(x - y) <= abs + rel * big)
+            continue
+        }
+        print "  line " NR ": " a[i] " vs " b[i]; bad = 1; exit
+      }
+    }
+    END {
+      if (!bad && (getline line < other) > 0) {
+        print "  line " NR + 1 ": only in " other; bad = 1
+      }
+      exit bad
+    }' "$1"
+}
+
+compare() {
+  REL_TOL=0 ABS_TOL=0
+  local tolerant=false excludes=() opt
+  OPTIND=1
+  while getopts ":r:a:x:" opt; do
+    case $opt in
+      r) REL_TOL="$OPTARG"; tolerant=true ;;
+      a) ABS_TOL="$OPTARG"; tolerant=true ;;
+      x) excludes+=("$OPTARG") ;;
+      *) show_help; exit 2 ;;
+    esac
+  done
+  shift $((OPTIND - 1))
+  local orig="$1" opt_dir="$2"
+
+  list_files() {
+    (cd "$1" && find . \( -type f -o -type l \) | sort) | while read -r f; do
+      local name skip=false
+      name=$(basename "$f")
+      for x in "${excludes[@]}"; do
+        [ "$name" = "$x" ] && skip=true
+      done
+      $skip || echo "$f"
+    done
+  }
+
+  local bad=0 f
+  if ! diff <(list_files "$orig") <(list_files "$opt_dir") > /dev/null; then
+    echo "verify: different sets of files:"
+    diff <(list_files "$orig") <(list_files "$opt_dir") | grep '^[<>]' | sed 's/^/  /'
+    bad=1
+  fi
+
+  while read -r f; do
+    [ -e "$opt_dir/$f" ] || continue
+    cmp -s "$orig/$f" "$opt_dir/$f" && continue
+    if $tolerant && grep -Iq . "$orig/$f" && grep -Iq . "$opt_dir/$f" &&
+       compare_numeric "$orig/$f" "$opt_dir/$f" > /dev/null; then
+      continue
+    fi
+    echo "verify: ${f#./} differs"
+    if grep -Iq . "$orig/$f"; then
+      compare_numeric "$orig/$f" "$opt_dir/$f" || true
+    fi
+    bad=1
+  done < <(list_files "$orig")
+
+  return $bad
+}
+
+cmd="$1"
+shift || true
+case "$cmd" in
+  capture)
+    [ $# -ge 2 ] || { show_help; exit 2; }
+    capture "$@"
+    ;;
+  compare)
+    compare "$@"
+    ;;
+  -h|--help)
+    show_help
+    ;;
+  *)
+    show_help
+    exit 2
+    ;;
+esac